@@ -0,0 +1,102 @@
+// heap allocations of parsing one request. (every global operator new is counted)
+// usage : ./AllocBench [requests]
+
+#include "RequestParser.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <sys/time.h>
+
+static unsigned long g_allocations = 0;
+
+void* operator new(size_t size) throw (std::bad_alloc)
+{
+  void* p = malloc(size == 0 ? 1 : size);
+
+  if (p == NULL)
+    throw (std::bad_alloc());
+  g_allocations++;
+  return (p);
+}
+
+void operator delete(void* p) throw()
+{
+  free(p);
+}
+
+static const char* const REQUESTS[] = {
+  "GET /index.html HTTP/1.1\r\n"
+  "Host: localhost:8080\r\n"
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+  "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+  "Accept-Language: en-US,en;q=0.5\r\n"
+  "Accept-Encoding: gzip, deflate, br\r\n"
+  "Connection: keep-alive\r\n"
+  "Cookie: session_id=0123456789abcdef0123456789abcdef\r\n"
+  "Upgrade-Insecure-Requests: 1\r\n"
+  "Sec-Fetch-Dest: document\r\n"
+  "Sec-Fetch-Mode: navigate\r\n"
+  "\r\n",
+  "POST /cgi-bin/form.py?name=webserv&lang=c%2B%2B HTTP/1.1\r\n"
+  "Host: localhost:8080\r\n"
+  "User-Agent: curl/8.4.0\r\n"
+  "Accept: */*\r\n"
+  "Content-Type: application/x-www-form-urlencoded\r\n"
+  "Content-Length: 27\r\n"
+  "\r\n"
+  "field=value&other=something",
+};
+
+static double elapsedMicros(const struct timeval& begin)
+{
+  struct timeval end;
+
+  gettimeofday(&end, NULL);
+  return ((end.tv_sec - begin.tv_sec) * 1000000.0 + (end.tv_usec - begin.tv_usec));
+}
+
+// one keep-alive connection : the same arena for every request, reset in between.
+int main(int argc, char** argv)
+{
+  const long count = (argc > 1) ? atol(argv[1]) : 100000;
+  RequestParser parser;
+  Arena arena;
+
+  if (count <= 0)
+  {
+    std::cerr << "usage: " << argv[0] << " [requests]" << std::endl;
+    return (1);
+  }
+  for (size_t r = 0; r < sizeof(REQUESTS) / sizeof(REQUESTS[0]); ++r)
+  {
+    const size_t length = strlen(REQUESTS[r]);
+    size_t chunks = 0;
+    struct timeval begin;
+
+    g_allocations = 0;
+    gettimeofday(&begin, NULL);
+    for (long i = 0; i < count; ++i)
+    {
+      HTTPRequest* request = RequestParser::newRequest(&arena);
+      BufferSlice input(length); // (the read buffer of the connection)
+      memcpy(input.data(), REQUESTS[r], length);
+      input.fill(length);
+      parser.parse(request, input);
+      if (request->status != END)
+      {
+        std::cerr << "request " << r << " not parsed" << std::endl;
+        return (1);
+      }
+      chunks = std::max(chunks, arena.chunks());
+      delete (request);
+      arena.reset();
+    }
+    const double micros = elapsedMicros(begin);
+    std::cout << "request " << r << "\t" << length << " bytes"
+              << "\tallocations " << static_cast<double>(g_allocations) / count << " per request"
+              << "\t" << (micros * 1000.0 / count) << " ns per request"
+              << "\tarena chunks " << chunks << std::endl;
+  }
+  return (0);
+}
@@ -0,0 +1,271 @@
+// accepted connections handed to the workers, timed from outside : the server itself (ServerManager,
+// ThreadPool and the HandoffRing of each worker) runs in a child process, clients connect to it and
+// time each connection from accept to the first byte of the response. (from the established
+// connection, which waits in the accept queue, to the first byte received) at an accept rate, then
+// as fast as the clients can.
+// the rings only run with THREAD_MODE : this benchmark is built with it. (see the Makefile)
+// built without it, the numbers are those of one event loop which accepts and serves.
+// usage : ./HandoffBench [connections] [clients] [accepts per second]
+
+#include "ServerManager.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_PORT (4280)
+#define BENCH_START_WAIT (5) // seconds for the server to listen
+
+struct Client
+{
+    pthread_t thread;
+    long connections;
+    long begin;                // nanoseconds : first connect
+    long interval;             // nanoseconds between two connects (0 : back to back)
+    std::vector<long> latencies;
+    long failed;
+};
+
+static long nowNanos()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec * 1000000000L + now.tv_nsec);
+}
+
+static void sleepUntil(long nanos)
+{
+  struct timespec until;
+
+  until.tv_sec = nanos / 1000000000L;
+  until.tv_nsec = nanos % 1000000000L;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR)
+    ;
+}
+
+// one port, one static page.
+static std::string writeConfig(const std::string& dir)
+{
+  const std::string path = dir + "/bench.conf";
+  std::ofstream page((dir + "/index.html").c_str());
+  std::ofstream config(path.c_str());
+
+  page << "<html><body>handoff</body></html>\n";
+  config << "event_stat_interval : 0;\n"
+         << "server {\n"
+         << "\tserver_name : 127.0.0.1;\n"
+         << "\tlisten : 127.0.0.1:" << BENCH_PORT << ";\n"
+         << "\troot : " << dir << ";\n"
+         << "\tallow_methods : GET;\n"
+         << "\tindex : index.html;\n"
+         << "}\n";
+  return (path);
+}
+
+// the log of every connection goes to /dev/null.
+static pid_t startServer(const std::string& configPath, const char* binaryPath)
+{
+  const pid_t pid = fork();
+
+  if (pid != 0)
+    return (pid);
+  const FileDescriptor devNull = open("/dev/null", O_WRONLY);
+  dup2(devNull, STDOUT_FILENO);
+  dup2(devNull, STDERR_FILENO);
+  try
+  {
+    ServerManager server(configPath, binaryPath);
+    server.run();
+  }
+  catch (std::exception& e)
+  {
+    _exit(1);
+  }
+  _exit(0);
+}
+
+static FileDescriptor connectServer()
+{
+  struct sockaddr_in addr;
+  const FileDescriptor fd = socket(AF_INET, SOCK_STREAM, 0);
+
+  if (fd < 0)
+    return (FAILED);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(BENCH_PORT);
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0)
+  {
+    close(fd);
+    return (FAILED);
+  }
+  return (fd);
+}
+
+// closed with a reset : no TIME_WAIT left to run out of ports.
+static void resetConnection(FileDescriptor fd)
+{
+  struct linger optLinger = {1, 0};
+
+  setsockopt(fd, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
+  close(fd);
+}
+
+static bool waitServer()
+{
+  const long deadline = nowNanos() + BENCH_START_WAIT * 1000000000L;
+
+  while (nowNanos() < deadline)
+  {
+    const FileDescriptor fd = connectServer();
+    if (fd >= 0)
+    {
+      resetConnection(fd);
+      return (true);
+    }
+    usleep(10000);
+  }
+  return (false);
+}
+
+// one connection : established (in the accept queue) -> request -> first byte of the response.
+static long timeConnection()
+{
+  static const char REQUEST[] = "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+  const FileDescriptor fd = connectServer();
+  long latency = FAILED;
+  char byte;
+
+  if (fd < 0)
+    return (FAILED);
+  const long established = nowNanos();
+  if (send(fd, REQUEST, sizeof(REQUEST) - 1, MSG_NOSIGNAL) == static_cast<ssize_t>(sizeof(REQUEST) - 1)
+      && recv(fd, &byte, 1, 0) == 1)
+    latency = nowNanos() - established;
+  resetConnection(fd);
+  return (latency);
+}
+
+static void* runClient(void* arg)
+{
+  Client& client = *static_cast<Client*>(arg);
+
+  for (long i = 0; i < client.connections; ++i)
+  {
+    if (client.interval > 0)
+      sleepUntil(client.begin + i * client.interval);
+    const long latency = timeConnection();
+    if (latency < 0)
+      client.failed++;
+    else
+      client.latencies.push_back(latency);
+  }
+  return (NULL);
+}
+
+static double percentile(const std::vector<long>& sorted, double ratio)
+{
+  if (sorted.empty())
+    return (0);
+  return (sorted[static_cast<size_t>((sorted.size() - 1) * ratio)] / 1000.0);
+}
+
+// rate 0 : every client connects again as soon as it has its first byte.
+// the clients take turns at the rate : client i connects at i, i + clients, ... / rate.
+static void run(long connections, size_t clientCount, long rate)
+{
+  const long begin = nowNanos();
+  std::vector<Client*> clients;
+  std::vector<long> latencies;
+  long failed = 0;
+
+  for (size_t i = 0; i < clientCount; ++i)
+  {
+    Client* client = new Client();
+
+    client->connections = connections / clientCount + (i < connections % clientCount ? 1 : 0);
+    client->begin = (rate > 0) ? begin + static_cast<long>(i) * (1000000000L / rate) : 0;
+    client->interval = (rate > 0) ? static_cast<long>(clientCount) * (1000000000L / rate) : 0;
+    client->failed = 0;
+    clients.push_back(client);
+    pthread_create(&client->thread, NULL, runClient, client);
+  }
+  for (size_t i = 0; i < clients.size(); ++i)
+  {
+    pthread_join(clients[i]->thread, NULL);
+    latencies.insert(latencies.end(), clients[i]->latencies.begin(), clients[i]->latencies.end());
+    failed += clients[i]->failed;
+    delete (clients[i]);
+  }
+  const double seconds = (nowNanos() - begin) / 1000000000.0;
+  std::sort(latencies.begin(), latencies.end());
+  if (rate > 0)
+    std::cout << rate << "/s";
+  else
+    std::cout << "max";
+  std::cout << "\t" << latencies.size() / seconds << " connections/s"
+            << "\tp50 " << percentile(latencies, 0.5) << " us"
+            << "\tp99 " << percentile(latencies, 0.99) << " us"
+            << "\tp99.9 " << percentile(latencies, 0.999) << " us"
+            << "\tmax " << percentile(latencies, 1.0) << " us"
+            << "\tfailed " << failed << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  const long connections = (argc > 1) ? atol(argv[1]) : 20000;
+  const long clients = (argc > 2) ? atol(argv[2]) : 8;
+  const long rate = (argc > 3) ? atol(argv[3]) : 5000;
+  char dir[] = "/tmp/HandoffBench.XXXXXX";
+
+  if (connections <= 0 || clients <= 0 || rate <= 0)
+  {
+    std::cerr << "usage: " << argv[0] << " [connections] [clients] [accepts per second]" << std::endl;
+    return (1);
+  }
+  if (mkdtemp(dir) == NULL)
+  {
+    std::cerr << "mkdtemp failed" << std::endl;
+    return (1);
+  }
+  const std::string configPath = writeConfig(dir);
+  const pid_t server = startServer(configPath, argv[0]);
+  if (server > 0 && waitServer())
+  {
+    std::cout << connections << " connections, " << clients << " clients, ";
+    if (THREAD_MODE)
+      std::cout << "accepted by the main thread, served by " << THREAD_NO << " workers" << std::endl;
+    else
+      std::cout << "accepted and served by one event loop (THREAD_MODE is off)" << std::endl;
+    run(connections, static_cast<size_t>(clients), rate);
+    run(connections, static_cast<size_t>(clients), 0);
+  }
+  else
+  {
+    std::cerr << "the server did not start" << std::endl;
+  }
+  if (server > 0)
+  {
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+  }
+  unlink(configPath.c_str());
+  unlink((std::string(dir) + "/index.html").c_str());
+  rmdir(dir);
+  return (0);
+}
@@ -0,0 +1,169 @@
+// header lookups of one request : the names the server asks for, on the headers of a request head.
+// "map" : a std::map by exact name (made for each request), "list" : a case-insensitive walk
+// of the headers, "table" : HeaderTable slots (each header line looked up once).
+// usage : ./HeaderBench [rounds]
+
+#include "HeaderTable.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+static const char* const HEAD_NAMES[] = {"browser", "lowercase", "curl"};
+
+static const char* const HEADS[] = {
+  "Host: localhost:4242\r\n"
+  "Connection: keep-alive\r\n"
+  "Cache-Control: max-age=0\r\n"
+  "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+  "sec-ch-ua-mobile: ?0\r\n"
+  "sec-ch-ua-platform: \"Linux\"\r\n"
+  "Upgrade-Insecure-Requests: 1\r\n"
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+  "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+  "Sec-Fetch-Site: same-origin\r\n"
+  "Sec-Fetch-Mode: navigate\r\n"
+  "Sec-Fetch-User: ?1\r\n"
+  "Sec-Fetch-Dest: document\r\n"
+  "Referer: http://localhost:4242/www/html/content/\r\n"
+  "Accept-Encoding: gzip, deflate, br\r\n"
+  "Accept-Language: en-US,en;q=0.9,ko;q=0.8\r\n"
+  "Cookie: WEBSERV_ID=NjcNb0PxEgmic3D; theme=dark\r\n",
+  "host: localhost:4242\r\n"
+  "content-type: application/json\r\n"
+  "content-length: 17\r\n"
+  "accept: application/json\r\n"
+  "user-agent: okhttp/4.12.0\r\n"
+  "x-request-id: 5f0c6a8e-3b1d-4c2a-9f7e-8d6b5a4c3e2f\r\n"
+  "x-forwarded-for: 203.0.113.7\r\n"
+  "cookie: WEBSERV_ID=NjcNb0PxEgmic3D\r\n",
+  "Host: 127.0.0.1:4242\r\n"
+  "User-Agent: curl/8.4.0\r\n"
+  "Accept: */*\r\n",
+};
+
+// what a request asks for on its way : the parser, the server match (for each server block),
+// the processor, the session and the cgi.
+static const KnownHeader LOOKUPS[] = {
+  HD_CONTENT_LENGTH, HD_TRANSFER_ENCODING, HD_HOST, HD_HOST, HD_HOST,
+  HD_CONTENT_LENGTH, HD_COOKIE, HD_CONTENT_TYPE, HD_EXPECT
+};
+
+#define LOOKUP_COUNT (sizeof(LOOKUPS) / sizeof(LOOKUPS[0]))
+
+struct Field
+{
+    const char* name;
+    size_t nameLength;
+    const char* value;
+    size_t valueLength;
+};
+
+static double elapsedNanos(const struct timeval& begin)
+{
+  struct timeval end;
+
+  gettimeofday(&end, NULL);
+  return ((end.tv_sec - begin.tv_sec) * 1000000000.0 + (end.tv_usec - begin.tv_usec) * 1000.0);
+}
+
+static std::vector<Field> splitHead(const char* head)
+{
+  std::vector<Field> fields;
+
+  for (const char* line = head; *line != '\0'; line = strstr(line, "\r\n") + 2)
+  {
+    const char* colon = strchr(line, ':');
+    Field field;
+    field.name = line;
+    field.nameLength = colon - line;
+    field.value = colon + 2;
+    field.valueLength = strstr(line, "\r\n") - field.value;
+    fields.push_back(field);
+  }
+  return (fields);
+}
+
+static size_t byMap(const std::vector<Field>& fields)
+{
+  std::map<std::string, std::string> headers;
+  size_t found = 0;
+
+  for (size_t i = 0; i < fields.size(); ++i)
+    headers[std::string(fields[i].name, fields[i].nameLength)] = std::string(fields[i].value, fields[i].valueLength);
+  for (size_t i = 0; i < LOOKUP_COUNT; ++i)
+    found += headers.find(HeaderTable::name(LOOKUPS[i])) != headers.end();
+  return (found);
+}
+
+static size_t byList(const std::vector<Field>& fields)
+{
+  size_t found = 0;
+
+  for (size_t i = 0; i < LOOKUP_COUNT; ++i)
+  {
+    const char* name = HeaderTable::name(LOOKUPS[i]);
+    const size_t length = strlen(name);
+    for (size_t k = fields.size(); k > 0; --k)
+    {
+      if (fields[k - 1].nameLength == length && strncasecmp(fields[k - 1].name, name, length) == 0)
+      {
+        found++;
+        break;
+      }
+    }
+  }
+  return (found);
+}
+
+static size_t byTable(const std::vector<Field>& fields)
+{
+  const Field* known[HD_UNKNOWN] = {};
+  size_t found = 0;
+
+  for (size_t i = 0; i < fields.size(); ++i)
+  {
+    const KnownHeader name = HeaderTable::lookup(fields[i].name, fields[i].nameLength);
+    if (name != HD_UNKNOWN)
+      known[name] = &fields[i];
+  }
+  for (size_t i = 0; i < LOOKUP_COUNT; ++i)
+    found += known[LOOKUPS[i]] != NULL;
+  return (found);
+}
+
+int main(int argc, char** argv)
+{
+  typedef size_t (*Lookup)(const std::vector<Field>&);
+  static const char* const LOOKUP_NAMES[] = {"map", "list", "table"};
+  static const Lookup LOOKUP_FUNCTIONS[] = {byMap, byList, byTable};
+  const long rounds = (argc > 1) ? atol(argv[1]) : 200000;
+
+  if (rounds <= 0)
+  {
+    std::cerr << "usage: " << argv[0] << " [rounds]" << std::endl;
+    return (1);
+  }
+  std::cout << LOOKUP_COUNT << " lookups per request" << std::endl;
+  for (size_t h = 0; h < sizeof(HEADS) / sizeof(HEADS[0]); ++h)
+  {
+    const std::vector<Field> fields = splitHead(HEADS[h]);
+    for (size_t k = 0; k < sizeof(LOOKUP_FUNCTIONS) / sizeof(LOOKUP_FUNCTIONS[0]); ++k)
+    {
+      struct timeval begin;
+      size_t found = 0;
+
+      gettimeofday(&begin, NULL);
+      for (long i = 0; i < rounds; ++i)
+        found += LOOKUP_FUNCTIONS[k](fields);
+      const double nanos = elapsedNanos(begin) / rounds;
+      std::cout << HEAD_NAMES[h] << " (" << fields.size() << " headers)\t" << LOOKUP_NAMES[k]
+                << "\t" << nanos << " ns/request\tfound " << found / rounds << std::endl;
+    }
+  }
+  return (0);
+}
@@ -0,0 +1,107 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <string>
+#include <map>
+#include <new>
+#include "BufferPool.hpp"
+
+#define ARENA_CHUNK_SIZE (4 * 1024) // a chunk : the smallest buffer class (larger for a larger allocation)
+#define ARENA_ALIGN (sizeof(void*))
+
+/**
+ * *--------------------------------------------------------------*
+ * * [ Arena ]                                                    |
+ * 요청 하나를 파싱한 데이터(헤더, query, url ...)를 담습니다.           |
+ *  - chunk (BufferPool 의 버퍼) 에서 앞에서부터 잘라 줍니다. free 없음. |
+ *  - reset() : 요청이 끝나면 한 번에 버립니다. 첫 chunk 는 다음 요청   |
+ *    (keep-alive) 이 그대로 씁니다.                                 |
+ **---------------------------------------------------------------*/
+class Arena
+{
+public:
+    Arena();
+    ~Arena();
+    void* allocate(size_t size);
+    void reset();
+    size_t chunks() const;
+
+private:
+    IOBuffer* _chunks;  // newest first, linked by next
+    char* _cursor;      // free bytes of the newest chunk : [_cursor, _end)
+    char* _end;
+
+    Arena(const Arena& other);
+    Arena& operator=(const Arena& other);
+};
+
+// a standard allocator on an arena : deallocate does nothing, reset() frees everything.
+// no arena (default constructed) : plain new / delete.
+template <typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <typename U>
+    struct rebind
+    {
+        typedef ArenaAllocator<U> other;
+    };
+
+    Arena* arena;
+
+    ArenaAllocator() : arena(NULL) {}
+    explicit ArenaAllocator(Arena* _arena) : arena(_arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    pointer address(reference value) const { return (&value); }
+    const_pointer address(const_reference value) const { return (&value); }
+    size_type max_size() const { return (static_cast<size_type>(-1) / sizeof(T)); }
+    void construct(pointer p, const T& value) { new (p) T(value); }
+    void destroy(pointer p) { p->~T(); }
+
+    pointer allocate(size_type count, const void* = 0)
+    {
+      if (arena == NULL)
+        return (static_cast<pointer>(::operator new(count * sizeof(T))));
+      return (static_cast<pointer>(arena->allocate(count * sizeof(T))));
+    }
+    void deallocate(pointer p, size_type)
+    {
+      if (arena == NULL)
+        ::operator delete(p);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs)
+{
+  return (lhs.arena == rhs.arena);
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs)
+{
+  return (lhs.arena != rhs.arena);
+}
+
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char> > ArenaString;
+typedef std::map<ArenaString, ArenaString, std::less<ArenaString>,
+                 ArenaAllocator<std::pair<const ArenaString, ArenaString> > > ArenaStringMap;
+
+// a copy out of the arena. (for what outlives the request)
+inline std::string toStdString(const ArenaString& str)
+{
+  return (std::string(str.data(), str.size()));
+}
+
+#endif //ARENA_HPP
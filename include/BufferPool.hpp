@@ -0,0 +1,68 @@
+#ifndef BUFFERPOOL_HPP
+#define BUFFERPOOL_HPP
+
+#include <cstddef>
+#include "WebservDefines.hpp"
+
+#define BUFFER_CLASSES (4)
+#define BUFFER_CLASS_MIN (4 * 1024)          // 4K, 16K, 64K, 256K : each class 4 times the one before
+#define BUFFER_CACHE_BYTES (1024 * 1024)     // a thread keeps this much of each class at most
+#define BUFFER_POOL_BYTES (8 * 1024 * 1024)  // the pool keeps this much of each class at most, the rest is freed
+
+// one buffer. the bytes follow it.
+struct IOBuffer
+{
+    size_t capacity;
+    int sizeClass;      // -1 : larger than the largest class, not pooled
+    int refs;           // slices on it (atomic : a slice may move to another thread)
+    IOBuffer* next;     // free list
+
+    char* bytes() { return (reinterpret_cast<char*>(this + 1)); }
+};
+
+/**
+ * *--------------------------------------------------------------*
+ * * [ BufferPool ]                                               |
+ * 읽고 보내는 버퍼를 크기별(size class)로 돌려 씁니다.               |
+ *  - 스레드마다 class 별 cache 에서 꺼내고 돌려놓습니다. (lock 없음)   |
+ *    넘치면 pool 로, pool 도 넘치면 free.                           |
+ *  - 버퍼는 BufferSlice 가 참조합니다. 마지막 slice 가 놓으면 돌아옴.  |
+ **---------------------------------------------------------------*/
+class BufferPool
+{
+public:
+    static IOBuffer* acquire(size_t capacity); // at least capacity bytes, one reference
+    static void release(IOBuffer* buffer);     // drops one reference
+    static void releaseThreadCache();          // a thread ends : its buffers go back to the pool
+    static void report();
+};
+
+// a part of a buffer : the bytes [data(), data() + size()). copies share the buffer.
+// filled by a read, then handed to the writer which consumes it from the front. (no copy)
+class BufferSlice
+{
+public:
+    BufferSlice();
+    explicit BufferSlice(size_t capacity);     // empty, on a new buffer
+    BufferSlice(const BufferSlice& other);
+    BufferSlice& operator=(const BufferSlice& other);
+    ~BufferSlice();
+
+    char* data() const;
+    size_t size() const;
+    bool empty() const;
+    size_t room() const;                       // bytes free after the slice
+    void fill(size_t count);                   // count bytes were written at data() + size()
+    void consume(size_t count);                // count bytes of the front are done with
+    void resize(size_t count);                 // only the first count bytes (no more than size())
+    void assign(const char* bytes, size_t count); // a copy of bytes, on a new buffer
+    void append(const char* bytes, size_t count); // a copy of bytes after the slice
+    void clear();
+
+private:
+    IOBuffer* _buffer;
+    size_t _offset;
+    size_t _size;
+};
+
+#endif //BUFFERPOOL_HPP
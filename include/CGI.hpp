@@ -14,11 +14,11 @@ class CGI
   public:
     pid_t pid;
     size_t envCount;
-    FileDescriptor writeFD;
     FileDescriptor readFD;
     std::string writeFilePath;
     std::string readFilePath;
     int exitStatus;
+    bool timedOut;  // killed by cgi_timeout -> 504
     char** env;
     char** cmd;
     char* path;
@@ -33,17 +33,18 @@ class CGI
     void parseCGI(struct Context* context, std::string& message);
     void closeProcess();
     void setFilePath(); // fork, pipe init
-    void setCGIenv(Server server, HTTPRequest& req, struct Context* context);
-    void getPATH(Server server, HTTPRequest& req);
+    void setCGIenv(Server& server, HTTPRequest& req, struct Context* context);
+    void getPATH(Server& server, HTTPRequest& req);
     void setRequestEnv(HTTPRequest& req);
     void addEnv(std::string key, std::string val);
-    void attachFileWriteEvent(struct Context* context);
     void CGIChildEvent(struct Context* context);
     void CGIfork(struct Context* context);
     CGI();
     ~CGI();
 };
 
+bool CGIPrepare(struct Context* context); // cgi, its input file (the body goes there)
 void CGIProcess(struct Context* context); //processinit, kevent(fd), 
+void CGIStart(struct Context* context);
 bool isCGIRequest(Location* loc);//cgi 확인
 #endif
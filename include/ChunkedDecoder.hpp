@@ -0,0 +1,60 @@
+#ifndef CHUNKEDDECODER_HPP
+#define CHUNKEDDECODER_HPP
+
+#include <cstddef>
+
+#define CHUNK_SIZE_DIGITS (15)        // hex digits of a chunk size, at most
+#define CHUNK_LINE_MAX (4 * 1024)     // a chunk size line with its extensions, a trailer line : bytes at most
+#define CHUNK_TRAILER_MAX (16 * 1024) // all trailer lines : bytes at most
+
+/**
+ * *--------------------------------------------------------------*
+ * * [ ChunkedDecoder ]                                           |
+ * Transfer-Encoding: chunked 본문을 받은 만큼씩 풉니다.             |
+ *  - 상태를 들고 있어서 어디서 끊겨 들어와도 이어서 읽습니다.         |
+ *    (받은 바이트는 한 번씩만 봅니다)                               |
+ *  - chunk 데이터는 복사하지 않고 받은 버퍼 안의 범위로 돌려줍니다.    |
+ *  - extension, trailer 는 읽고 버립니다.                          |
+ *  - 크기 줄을 읽자마자 maxBodySize 를 넘는지 봅니다.                |
+ **---------------------------------------------------------------*/
+class ChunkedDecoder
+{
+public:
+    size_t maxBodySize; // decoded bytes at most : more throws std::length_error
+
+    ChunkedDecoder();
+
+    // consumes [data, data + size) up to the end of the next piece of chunk data, which is
+    // returned in *piece (*pieceSize bytes, in data). returns the bytes consumed.
+    // a malformed body throws std::logic_error.
+    size_t decode(const char* data, size_t size, const char** piece, size_t* pieceSize);
+    bool done() const;
+    size_t decoded() const;
+
+private:
+    enum State
+    {
+        CHUNK_SIZE,       // hex digits
+        CHUNK_EXTENSION,  // ";name=value" after the size, skipped
+        CHUNK_SIZE_LF,
+        CHUNK_DATA,
+        CHUNK_DATA_CR,
+        CHUNK_DATA_LF,
+        CHUNK_TRAILER,    // the start of a trailer line, or of the last CRLF
+        CHUNK_TRAILER_LINE,
+        CHUNK_TRAILER_LF,
+        CHUNK_END_LF,
+        CHUNK_DONE
+    };
+
+    State _state;
+    size_t _remaining;  // CHUNK_DATA : bytes left of the chunk. CHUNK_SIZE : the size so far
+    size_t _digits;
+    size_t _lineBytes;  // of the line being read (size line, trailer line)
+    size_t _trailerBytes;
+    size_t _decoded;
+
+    void step(char c);
+};
+
+#endif //CHUNKEDDECODER_HPP
@@ -0,0 +1,46 @@
+#ifndef CONFIGSNAPSHOT_HPP
+#define CONFIGSNAPSHOT_HPP
+
+#include <vector>
+#include <string>
+#include "Server.hpp"
+
+/**
+ * *--------------------------------------------------------------*
+ * * [ ConfigSnapshot ]                                           |
+ * 설정 파일 하나를 파싱한 결과입니다. (servers, locations, error pages,   |
+ * listen 주소) 한 번 게시되면 바뀌지 않습니다. (server 의 load 카운터와    |
+ * session 만 움직입니다) SIGHUP 은 새 snapshot 을 만들어 교체합니다.      |
+ *  - reference counted : manager 는 게시된 snapshot 을, 연결과        |
+ *    listening socket 은 각자 사용하는 snapshot 을 잡고 있습니다.        |
+ *    마지막 release 가 snapshot 을 지웁니다.                          |
+ **---------------------------------------------------------------*/
+class ConfigSnapshot
+{
+public:
+    const unsigned long GENERATION; // 1 : the configuration the server started with
+    std::vector<Server> _servers;
+
+    ConfigSnapshot(const std::vector<Server>& servers, unsigned long generation);
+    void retain();
+    static void release(ConfigSnapshot* snapshot);
+
+    // servers which own a listening socket. (the first server of each port, the others share it)
+    std::vector<Server*> getListenServers();
+    Server* findListenServer(const struct sockaddr_in& addr);
+    Server* findPortServer(in_port_t port); // NULL : no server listens on port
+    Server& getPortServer(in_port_t port);
+    Server& getMatchedServer(const HTTPRequest& req);
+    std::string getServerName(in_port_t port) const;
+    // keep the sessions of the servers which are still there. (same name and port)
+    void takeSessions(const ConfigSnapshot& other);
+
+private:
+    size_t _refCount;
+
+    ~ConfigSnapshot();
+    ConfigSnapshot(const ConfigSnapshot& other);
+    ConfigSnapshot& operator=(const ConfigSnapshot& other);
+};
+
+#endif //CONFIGSNAPSHOT_HPP
@@ -0,0 +1,123 @@
+#ifndef EPOLLBACKEND_HPP
+#define EPOLLBACKEND_HPP
+
+#include "EventBackend.hpp"
+
+#ifdef WEBSERV_HAS_EPOLL
+
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+
+// Linux backend.
+// - kqueue keeps read / write filters (and their udata, EV_CLEAR) apart for one fd.
+//   epoll has one registration per fd : both interests share it, with the union of their masks.
+//   a change of either is one EPOLL_CTL_MOD of that mask. it stays until detach() : a connection
+//   turns its read and write on and off without deleting and adding it again.
+// - the registration is edge-triggered (EPOLLET) when every interest in it asks for it (EVENT_CLEAR,
+//   as EV_CLEAR on kqueue) : socket writes and connection reads. a read handler which stops before
+//   EAGAIN (read budget, a complete request, a body its sink does not take yet) adds the read again :
+//   the MOD reports what is left. (see resumeRead)
+// - regular files can not be added to epoll (EPERM). they are kept in a separate
+//   list : always writable, readable until EOF. the bytes before EOF are taken when the
+//   read interest is added and counted down by readFile() : wait() makes no system call
+//   for them. (a file which grows after that is seen on its next EVENT_ADD)
+// - process exit is watched with pidfd (signalfd(SIGCHLD) on old kernels).
+// - timers are timerfd.
+// - changes update the interest table at once, epoll_ctl() is deferred to the next wait :
+//   once per fd, with the final state of its interests.
+class EpollBackend : public EventBackend
+{
+private:
+    struct Interest
+    {
+        bool active;
+        bool enabled;
+        bool clear;
+        bool oneshot;
+        unsigned long seq; // _sequence when added (see updateEntry)
+        void* udata;
+
+        Interest() : active(false), enabled(false), clear(false), oneshot(false), seq(0), udata(NULL) {}
+    };
+
+    struct FdEntry
+    {
+        Interest read;
+        Interest write;
+        bool inEpoll;
+        bool dirty;        // changed since the last flush
+        bool alwaysReady;  // regular file (not pollable)
+        off_t remain;      // regular file : bytes before EOF (FAILED : unknown, see readFile)
+        dev_t dev;
+        ino_t ino;
+
+        FdEntry() : inEpoll(false), dirty(false), alwaysReady(false), remain(0), dev(0), ino(0) {}
+    };
+
+    // pidfd / timerfd -> watched pid or timer id
+    struct Watch
+    {
+        EventFilter filter;
+        uintptr_t ident;
+        bool oneshot;
+        void* udata;
+    };
+
+    FileDescriptor _epoll;
+    FileDescriptor _signalFd;                  // SIGCHLD fallback when pidfd is unavailable
+    std::vector<FdEntry> _fdTable;             // index : fd
+    std::set<FileDescriptor> _readyFds;        // always ready regular files
+    std::vector<struct epoll_event> _epollEvents;
+    std::vector<struct Event> _collected;      // events of one wait
+    std::deque<struct Event> _pending;         // exited children which did not fit in the caller's list
+    std::vector<FileDescriptor> _changes;      // fds to submit at flush()
+    unsigned long _sequence;
+    unsigned long _flushedSequence;            // _sequence at the last flush
+    std::map<FileDescriptor, Watch> _watches;  // pidfd, timerfd
+    std::map<pid_t, Watch> _signalWatches;     // pid watched through signalfd
+    std::map<uintptr_t, FileDescriptor> _timers;
+    std::map<pid_t, FileDescriptor> _pidFds;
+
+    EpollBackend(const EpollBackend& other);
+    EpollBackend& operator=(const EpollBackend& other);
+
+    FdEntry& getEntry(FileDescriptor fd);
+    void resetEntry(FileDescriptor fd);
+    void queueChange(FileDescriptor fd);
+    static uint32_t getMask(const FdEntry& entry);
+    int updateEntry(FileDescriptor fd);
+    void rearm(const struct Event& event);
+    bool isStillInterested(const struct Event& event);
+    void consumeInterest(const struct Event& event);
+    int pushEvent(struct Event* events, int maxEvents, int count, const struct Event& event);
+    int attachIO(const struct Event& change);
+    int attachProc(const struct Event& change);
+    int attachTimer(const struct Event& change);
+    int watchFd(FileDescriptor fd, const Watch& watch);
+    void unwatchFd(FileDescriptor fd);
+    bool hasAlwaysReady();
+    off_t getFileRemain(FileDescriptor fd);
+    void collectEpollEvent(const struct epoll_event& ev);
+    void collectIO(FileDescriptor fd, EventFilter filter, bool eof);
+    void collectAlwaysReady();
+    void collectExitedChild();
+
+public:
+    EpollBackend();
+    virtual ~EpollBackend();
+    virtual int attach(const struct Event& change);
+    virtual int flush();
+    virtual void detach(FileDescriptor fd);
+    virtual int wait(struct Event* events, int maxEvents, int timeoutMs);
+    virtual ssize_t readFile(FileDescriptor fd, void* buf, size_t size);
+    virtual FileDescriptor getFd() const;
+    virtual const char* getName() const;
+};
+
+#endif //WEBSERV_HAS_EPOLL
+
+#endif //EPOLLBACKEND_HPP
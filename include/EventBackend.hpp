@@ -0,0 +1,100 @@
+#ifndef EVENTBACKEND_HPP
+#define EVENTBACKEND_HPP
+
+#include "WebservDefines.hpp"
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+
+#if defined(__linux__)
+# define WEBSERV_HAS_EPOLL (1)
+# include <linux/version.h>
+# if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 13, 0) // multishot poll
+#  define WEBSERV_HAS_IO_URING (1)
+# endif
+#endif
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+# define WEBSERV_HAS_KQUEUE (1)
+#endif
+
+/**
+ * *--------------------------------------------------------------*
+ * * [ EventBackend ]                                             |
+ * 이벤트 감지 구현체(epoll, kqueue)를 감추는 인터페이스입니다.             |
+ * 사용법 (EV_SET + kevent 와 동일한 형태) :                            |
+ *  struct Event event;                                           |
+ *  setEvent(&event, fd, EVENT_READ, EVENT_ADD, 0, context);      |
+ *  backend->attach(event);                                       |
+ * attach 된 변경사항은 모아두었다가 다음 wait 때 한번에 반영됩니다.          |
+ * (이벤트 등록 시스템 콜을 요청마다 여러 번 부르지 않기 위함)                  |
+ * 등록된 fd 를 close 하기 전에는 detach(fd) 를 호출해야 합니다.            |
+ **---------------------------------------------------------------*/
+typedef enum
+{
+    EVENT_READ = 0,
+    EVENT_WRITE = 1,
+    EVENT_PROC = 2,  // ident = pid, fired once when the child exits
+    EVENT_TIMER = 3  // ident = timer id, data = period (ms)
+} EventFilter;
+
+// change flags (same meaning as kqueue EV_ flags)
+#define EVENT_ADD     (0x0001)
+#define EVENT_DELETE  (0x0002)
+#define EVENT_ENABLE  (0x0004)
+#define EVENT_DISABLE (0x0008)
+#define EVENT_CLEAR   (0x0010) // edge-triggered
+#define EVENT_ONESHOT (0x0020)
+
+// returned flags
+#define EVENT_EOF     (0x0100)
+#define EVENT_ERROR   (0x0200)
+
+struct Event
+{
+    uintptr_t ident;
+    EventFilter filter;
+    unsigned short flags;
+    intptr_t data;
+    void* udata;
+};
+
+inline void setEvent(struct Event* event, uintptr_t ident, EventFilter filter,
+                     unsigned short flags, intptr_t data, void* udata)
+{
+  event->ident = ident;
+  event->filter = filter;
+  event->flags = flags;
+  event->data = data;
+  event->udata = udata;
+}
+
+class EventBackend
+{
+public:
+    virtual ~EventBackend() {}
+
+    // queue a change (register, modify or delete one interest).
+    // it is submitted with the next wait() or flush().
+    virtual int attach(const struct Event& change) = 0;
+    // submit queued changes now. returns FAILED if one of them failed.
+    virtual int flush() = 0;
+    // forget every interest and queued change of fd. call it right before close(fd).
+    virtual void detach(FileDescriptor fd) = 0;
+    // submit queued changes and wait until at least one event is ready.
+    // (timeoutMs < 0 : wait forever)
+    virtual int wait(struct Event* events, int maxEvents, int timeoutMs) = 0;
+    // read a regular file registered with EVENT_READ. use it instead of read() :
+    // completion based backends (io_uring) hand over the data they already read.
+    virtual ssize_t readFile(FileDescriptor fd, void* buf, size_t size);
+    // read a connected socket registered with EVENT_READ, the same way. (io_uring receives
+    // on the ring : EAGAIN until the next receive completed) may run on any reactor thread.
+    virtual ssize_t receive(FileDescriptor fd, void* buf, size_t size);
+    // pollable descriptor of this backend. (used by worker threads)
+    virtual FileDescriptor getFd() const = 0;
+    virtual const char* getName() const = 0;
+
+    // name : "epoll", "kqueue", "io_uring", or "auto" / empty string for the platform default.
+    static EventBackend* create(const std::string& name = "");
+};
+
+#endif //EVENTBACKEND_HPP
@@ -3,7 +3,14 @@
 
 #include <string>
 #include <map>
+#include <vector>
+#include <sys/time.h>
 #include "WebservDefines.hpp"
+#include "Slab.hpp"
+#include "Arena.hpp"
+#include "BufferPool.hpp"
+#include "ChunkedDecoder.hpp"
+#include "HeaderTable.hpp"
 
 typedef enum
 {
@@ -13,45 +20,84 @@ typedef enum
     ERROR
 } RequestStatus;
 
+// what the parser reads next.
 typedef enum
 {
-    CRLF,
     STARTLINE,
     HEADER,
     BODY
 } CheckLevel;
 
+// a part of the request head : [offset, offset + length) of HTTPRequest::head.
+struct HeadSlice
+{
+    size_t offset;
+    size_t length;
+};
+
+struct HeaderField
+{
+    HeadSlice name;
+    HeadSlice value;
+};
+
+typedef std::vector<HeaderField, ArenaAllocator<HeaderField> > HeaderFields;
+
+#define HEADER_FIELDS_RESERVED (8) // (the known ones are not in there)
+
+// the start line and the headers stay where they were read : the fields are slices of head,
+// copied out only when asked. the headers of HeaderTable have a slot each, the others are
+// in a list. what is made of them lives in the arena of the connection, which is reset when
+// the request is done. the body goes on to bodyFd as it is read : body holds what it did not take yet.
 class HTTPRequest
 {
 public:
-    std::string* message; // request Message ( all )
-    std::string* body;
+    Arena* arena;
+    BufferSlice head;     // start line and headers, as read (shares the read buffer of the connection)
+    std::string* body;    // read and not given to bodyFd yet (all of it, while there is none)
+    size_t received;      // body bytes read so far
+    FileDescriptor bodyFd; // where the body goes as it is read (-1 : none). closed with the request
+    std::string bodyPath;  // PUT, POST : the temporary file of bodyFd ("" : none). unlinked with the request
+    std::string bodyTarget; // the file it becomes once the body is complete (see commitBody)
+    bool bodyFailed;      // bodyFd could not be written : the rest of the body is not read, the answer is 500
+    bool accepted;        // the processor checked the head : the body goes on to bodyFd
     MethodType method;
-    std::map<std::string, std::string> query; // url?query
-    std::string url; // pure url
-    std::string version;
-    std::map<std::string, std::string> headers;
+    HeadSlice target;     // url?query, as sent
+    HeadSlice version;
+    HeaderField known[HD_UNKNOWN]; // by KnownHeader. (name.length 0 : none)
+    HeaderFields headers;          // the other ones, in order
+    ArenaString url;      // pure url, decoded : made once the head is complete (every handler needs it)
+    size_t contentLength;
     bool chunkedFlag;
+    ChunkedDecoder chunked; // the body as it arrives, when chunkedFlag
+    bool dispatched;      // END or ERROR went to the processor
     RequestStatus status;
+    StatusCode errorCode; // what ERROR is answered with
     CheckLevel checkLevel;
+    size_t lineStart;     // parser : the line being read, in the read buffer
+    size_t scanned;       // parser : bytes of the read buffer already looked at
     struct timeval baseTime;
 
-    HTTPRequest()
-    {
-      chunkedFlag = false;
-      method = UNDEFINED;
-      status = READING;
-      checkLevel = CRLF;
-      message = NULL;
-      body = NULL;
-    }
-    ~HTTPRequest()
-    {
-        if (message != NULL)
-            delete message;
-        if (body != NULL)
-            delete (body);
-    }
+    explicit HTTPRequest(Arena* _arena);
+    ~HTTPRequest();
+
+    // copies out of head.
+    std::string string(const HeadSlice& slice) const;
+    bool addHeader(const HeaderField& field);             // false : Content-Length again, with another value
+    const HeaderField* findHeader(KnownHeader name) const;
+    const HeaderField* findHeader(const char* name) const; // case-insensitive. the last one (NULL : none)
+    std::string header(KnownHeader name) const;            // "" : none
+    std::string header(const char* name) const;
+    const ArenaStringMap& getQuery();                       // url?query, made on the first call
+
+    SLAB_ALLOCATED(g_requestSlab)
+
+private:
+    ArenaStringMap _query;
+    bool _queryParsed;
+
+    HTTPRequest(const HTTPRequest& other);
+    HTTPRequest& operator=(const HTTPRequest& other);
 };
 
 #endif
@@ -2,7 +2,6 @@
 #define HTTP_RESPONSE_HPP
 
 #include <sys/socket.h>
-#include <sys/event.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
@@ -15,6 +14,9 @@
 #include <ctime>
 #include "WebservDefines.hpp"
 #include "Session.hpp"
+#include "Slab.hpp"
+
+#define SEND_COALESCE_MAX (16 * 1024) // bytes held back to be sent together, at most
 
 struct Context;
 /**
@@ -155,8 +157,9 @@ public: // * constructor & destuctor
     HTTPResponse(const int& statusCode, const std::string& statusMessage,
                  const std::string& serverName);
     ~HTTPResponse();
+    SLAB_ALLOCATED(g_responseSlab)
     FileDescriptor _readFD;
-    FileDescriptor _writeFD;
+    size_t _outputBufferSize;  // bytes of a body chunk (output_buffer_size of the server)
 
 public: // * setter functions
     void setFd(const FileDescriptor& fd);
@@ -167,9 +170,13 @@ public: // * getter functions
 
 public: // * interface functions
     void sendToClient(struct Context* context);
+    static void sendContinue(struct Context* context); // "100 Continue" : the body is awaited
 
 private: // * helper functions
     static void socketSendHandler(struct Context* context);
+    static void readBody(struct Context* context);
+    static bool isBodyLeft(struct Context* context);
+    static void completeResponse(struct Context* context);
     static void bodyFdReadHandler(struct Context* context);
     static std::string getClientIP(const struct sockaddr_in* addr);
 };
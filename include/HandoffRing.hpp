@@ -0,0 +1,60 @@
+#ifndef HANDOFFRING_HPP
+#define HANDOFFRING_HPP
+
+#include <cstddef>
+
+// bounded queue between exactly one producer thread and one consumer thread. (no lock)
+// SIZE must be a power of two.
+// - push() : producer only. false when full.
+// - pop()  : consumer only. false when empty.
+template <typename T, size_t SIZE>
+class HandoffRing
+{
+private:
+    // head and tail on their own cache lines : the two threads do not invalidate each other's.
+    size_t _head;  // next slot to pop (written by the consumer)
+    char _padHead[64 - sizeof(size_t)];
+    size_t _tail;  // next slot to push (written by the producer)
+    char _padTail[64 - sizeof(size_t)];
+    T _items[SIZE];
+
+    HandoffRing(const HandoffRing& other);
+    HandoffRing& operator=(const HandoffRing& other);
+
+public:
+    HandoffRing() : _head(0), _tail(0) {}
+
+    bool push(const T& item)
+    {
+      const size_t tail = __atomic_load_n(&_tail, __ATOMIC_RELAXED);
+
+      if (tail - __atomic_load_n(&_head, __ATOMIC_ACQUIRE) >= SIZE)
+        return (false);
+      _items[tail & (SIZE - 1)] = item;
+      __atomic_store_n(&_tail, tail + 1, __ATOMIC_RELEASE);
+      return (true);
+    }
+
+    bool pop(T* item)
+    {
+      const size_t head = __atomic_load_n(&_head, __ATOMIC_RELAXED);
+
+      if (head == __atomic_load_n(&_tail, __ATOMIC_ACQUIRE))
+        return (false);
+      *item = _items[head & (SIZE - 1)];
+      __atomic_store_n(&_head, head + 1, __ATOMIC_RELEASE);
+      return (true);
+    }
+
+    bool empty() const
+    {
+      return (__atomic_load_n(&_head, __ATOMIC_ACQUIRE) == __atomic_load_n(&_tail, __ATOMIC_ACQUIRE));
+    }
+
+    size_t size() const
+    {
+      return (__atomic_load_n(&_tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&_head, __ATOMIC_ACQUIRE));
+    }
+};
+
+#endif //HANDOFFRING_HPP
@@ -0,0 +1,80 @@
+#ifndef HEADERTABLE_HPP
+#define HEADERTABLE_HPP
+
+#include <cstddef>
+
+// the request headers the server knows by name. (the order of HeaderTable::NAMES)
+typedef enum
+{
+    HD_HOST,
+    HD_CONTENT_LENGTH,
+    HD_TRANSFER_ENCODING,
+    HD_CONTENT_TYPE,
+    HD_CONNECTION,
+    HD_COOKIE,
+    HD_EXPECT,
+    HD_ACCEPT,
+    HD_ACCEPT_ENCODING,
+    HD_ACCEPT_LANGUAGE,
+    HD_ACCEPT_CHARSET,
+    HD_USER_AGENT,
+    HD_REFERER,
+    HD_AUTHORIZATION,
+    HD_CACHE_CONTROL,
+    HD_PRAGMA,
+    HD_IF_MODIFIED_SINCE,
+    HD_IF_NONE_MATCH,
+    HD_IF_MATCH,
+    HD_IF_UNMODIFIED_SINCE,
+    HD_RANGE,
+    HD_IF_RANGE,
+    HD_ORIGIN,
+    HD_UPGRADE,
+    HD_KEEP_ALIVE,
+    HD_TE,
+    HD_DATE,
+    HD_VIA,
+    HD_FORWARDED,
+    HD_X_FORWARDED_FOR,
+    HD_X_REAL_IP,
+    HD_CONTENT_ENCODING,
+    HD_DNT,
+    HD_SEC_FETCH_MODE,
+    HD_SEC_FETCH_SITE,
+    HD_SEC_FETCH_DEST,
+    HD_SEC_FETCH_USER,
+    HD_UPGRADE_INSECURE_REQUESTS,
+    HD_UNKNOWN // any other name. (also the number of the known ones)
+} KnownHeader;
+
+#define HEADER_TABLE_SLOTS (128)
+
+/**
+ * *--------------------------------------------------------------*
+ * * [ HeaderTable ]                                              |
+ * 헤더 이름 -> KnownHeader. (대소문자 구분 없이)                      |
+ *  - 이름의 길이, 첫 글자, 끝에서 세 번째 글자로 슬롯을 바로 찾습니다. |
+ *    아는 이름들은 서로 다른 슬롯에 들어가도록 골라 둔 해시라서          |
+ *    (perfect hash) 이름 비교는 한 번뿐입니다.                      |
+ *  - 이름을 추가하면 SLOTS 를 다시 만들어야 합니다. (HeaderTable.cpp) |
+ **---------------------------------------------------------------*/
+class HeaderTable
+{
+public:
+    struct Name
+    {
+        const char* name;
+        size_t length;
+    };
+
+    static KnownHeader lookup(const char* name, size_t length);
+    static const char* name(KnownHeader header);
+
+private:
+    static const Name NAMES[HD_UNKNOWN];
+    static const unsigned char SLOTS[HEADER_TABLE_SLOTS];
+
+    static size_t hash(const char* name, size_t length);
+};
+
+#endif //HEADERTABLE_HPP
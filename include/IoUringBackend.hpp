@@ -0,0 +1,201 @@
+#ifndef IOURINGBACKEND_HPP
+#define IOURINGBACKEND_HPP
+
+#include "EventBackend.hpp"
+
+#ifdef WEBSERV_HAS_IO_URING
+
+#include <sys/types.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <deque>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+// Linux io_uring backend. (event_backend : io_uring;)
+// - every change and the wait itself go through one io_uring_enter() per loop.
+// - connection sockets, read with receive() : after their first read, received on the ring.
+//   (IORING_OP_RECV through the registered file table, into a buffer the kernel picks among the
+//   ones provided to it) EVENT_READ is reported once the data is in memory, and receive() copies
+//   it to the caller without another syscall. what follows it (a body) is read by the caller
+//   until the next receive is submitted.
+// - other sockets, pipes, and every write interest : poll requests on the ring. (level-triggered :
+//   one-shot poll armed again after each event, EVENT_CLEAR : multishot poll) accept and send
+//   are still the caller's own syscalls, once the poll reported the socket ready.
+// - regular files : read asynchronously into registered buffers. EVENT_READ is reported
+//   once the data is in memory, and readFile() hands it over the same way.
+// - process exit : pidfd, timers : timerfd. (polled on the ring)
+// - ready events are returned in the order they were registered, like kqueue does.
+// - receive() may run on another reactor (a stolen job) : the state is kept under _mutex,
+//   which the wait does not hold while it blocks.
+class IoUringBackend : public EventBackend
+{
+private:
+    struct Interest
+    {
+        bool active;
+        bool enabled;
+        bool clear;
+        bool oneshot;
+        bool dirty;        // changed since the last flush
+        uint64_t token;    // armed poll request (0 : none)
+        unsigned long seq;
+        void* udata;
+
+        Interest() : active(false), enabled(false), clear(false), oneshot(false), dirty(false), token(0), seq(0), udata(NULL) {}
+    };
+
+    typedef enum
+    {
+        TYPE_UNKNOWN = 0,
+        TYPE_POLL,         // socket, pipe, ...
+        TYPE_FILE,         // regular file
+        TYPE_SOCKET        // socket read with receive() : read side received on the ring
+    } FdType;
+
+    struct FdEntry
+    {
+        Interest read;
+        Interest write;
+        FdType type;
+        uint64_t readToken; // file read or receive in flight (0 : none)
+        int buffer;         // buffer holding read data (-1 : none. a socket : a provided buffer)
+        size_t bufferPos;
+        size_t bufferLen;
+        bool eof;
+        int error;          // failed receive (errno)
+        bool fixed;         // in the registered file table (slot : fd)
+
+        FdEntry() : type(TYPE_UNKNOWN), readToken(0), buffer(-1), bufferPos(0), bufferLen(0), eof(false), error(0), fixed(false) {}
+    };
+
+    typedef enum
+    {
+        OP_POLL,
+        OP_FILE_READ,
+        OP_RECEIVE,
+        OP_WATCH
+    } OpType;
+
+    // request in flight. (user_data -> request)
+    struct Op
+    {
+        OpType type;
+        FileDescriptor fd;
+        EventFilter filter;
+        int buffer;
+    };
+
+    // pidfd / timerfd -> watched pid or timer id
+    struct Watch
+    {
+        EventFilter filter;
+        uintptr_t ident;
+        bool oneshot;
+        unsigned long seq;
+        uint64_t token;
+        void* udata;
+    };
+
+    struct ReadyEvent
+    {
+        unsigned long seq;
+        struct Event event;
+
+        bool operator<(const ReadyEvent& other) const { return (seq < other.seq); }
+    };
+
+    FileDescriptor _ring;
+    struct io_uring_params _params;
+    void* _sqRingPtr;
+    size_t _sqRingSize;
+    void* _cqRingPtr;
+    size_t _cqRingSize;
+    struct io_uring_sqe* _sqes;
+    size_t _sqesSize;
+    unsigned* _sqHead;
+    unsigned* _sqTail;
+    unsigned* _sqMask;
+    unsigned* _sqArray;
+    unsigned* _cqHead;
+    unsigned* _cqTail;
+    unsigned* _cqMask;
+    struct io_uring_cqe* _cqes;
+
+    std::vector<char> _bufferMemory;           // registered buffers (IOURING_BUFFER_COUNT * IOURING_BUFFER_SIZE)
+    std::vector<int> _freeBuffers;
+    bool _fixedBuffers;                        // false : registration refused (RLIMIT_MEMLOCK)
+    std::vector<char> _receiveMemory;          // provided buffers (IOURING_RECEIVE_COUNT * IOURING_BUFFER_SIZE)
+    std::vector<int> _returnedBuffers;         // provided buffers taken back, given again at the next flush
+    bool _receiving;                           // false : buffers refused, every socket is polled
+    int _fixedFiles;                           // registered file table size (0 : none)
+    std::vector<FileDescriptor> _starved;      // files and sockets waiting for a free buffer
+
+    std::vector<FdEntry> _fdTable;             // index : fd
+    std::set<FileDescriptor> _buffered;        // regular files and received sockets (not polled)
+    std::map<uint64_t, Op> _ops;
+    uint64_t _nextToken;
+    std::vector<std::pair<FileDescriptor, EventFilter> > _changes; // interests to submit at flush()
+    std::vector<ReadyEvent> _collected;        // events of one wait, sorted by registration order
+    std::deque<struct Event> _pending;         // events which did not fit in the caller's list
+    unsigned long _sequence;
+    std::map<FileDescriptor, Watch> _watches;  // pidfd, timerfd
+    std::map<uintptr_t, FileDescriptor> _timers;
+    std::map<pid_t, FileDescriptor> _pidFds;
+    pthread_mutex_t _mutex;
+
+    IoUringBackend(const IoUringBackend& other);
+    IoUringBackend& operator=(const IoUringBackend& other);
+
+    void setupRing();
+    void setupBuffers();
+    void setupFiles();
+    bool updateFile(int slot, FileDescriptor fd);
+    void releaseRing();
+    struct io_uring_sqe* getSqe();
+    int enter(unsigned minComplete, int timeoutMs);
+    uint64_t addOp(OpType type, FileDescriptor fd, EventFilter filter, int buffer);
+    bool pollAdd(FileDescriptor fd, unsigned mask, bool multishot, uint64_t token);
+    void cancel(uint64_t token, bool poll);
+    FdEntry& getEntry(FileDescriptor fd);
+    void resetEntry(FileDescriptor fd);
+    void releaseBuffer(FdEntry& entry);
+    void queueChange(FileDescriptor fd, EventFilter filter);
+    void flushChanges();
+    void provideBuffers();
+    void updateInterest(FileDescriptor fd, EventFilter filter);
+    void submitFileRead(FileDescriptor fd);
+    void submitReceive(FileDescriptor fd);
+    ssize_t readBuffered(FileDescriptor fd, void* buf, size_t size);
+    int attachIO(const struct Event& change);
+    int attachProc(const struct Event& change);
+    int attachTimer(const struct Event& change);
+    int watchFd(FileDescriptor fd, Watch& watch);
+    void unwatchFd(FileDescriptor fd);
+    static bool isReceiveEnd(const FdEntry& entry);
+    bool hasReadyData();
+    bool isStillInterested(const struct Event& event);
+    void consumeInterest(const struct Event& event);
+    int pushEvent(struct Event* events, int maxEvents, int count, const struct Event& event);
+    void collect(unsigned long seq, const struct Event& event);
+    void collectCompletion(const struct io_uring_cqe& cqe);
+    void collectReadyData();
+
+public:
+    IoUringBackend();
+    virtual ~IoUringBackend();
+    virtual int attach(const struct Event& change);
+    virtual int flush();
+    virtual void detach(FileDescriptor fd);
+    virtual int wait(struct Event* events, int maxEvents, int timeoutMs);
+    virtual ssize_t readFile(FileDescriptor fd, void* buf, size_t size);
+    virtual ssize_t receive(FileDescriptor fd, void* buf, size_t size);
+    virtual FileDescriptor getFd() const;
+    virtual const char* getName() const;
+};
+
+#endif //WEBSERV_HAS_IO_URING
+
+#endif //IOURINGBACKEND_HPP
@@ -0,0 +1,45 @@
+#ifndef KQUEUEBACKEND_HPP
+#define KQUEUEBACKEND_HPP
+
+#include "EventBackend.hpp"
+
+#ifdef WEBSERV_HAS_KQUEUE
+
+#include <sys/event.h>
+#include <set>
+#include <utility>
+#include <vector>
+
+// BSD, macOS backend.
+// changes are kept in a changelist and passed to the kevent() call which waits.
+// an add followed by a delete of the same interest is dropped before submission.
+class KqueueBackend : public EventBackend
+{
+private:
+    typedef std::pair<uintptr_t, short> InterestKey; // (ident, filter)
+
+    FileDescriptor _kqueue;
+    std::vector<struct kevent> _changeList;
+    std::vector<struct kevent> _eventList;
+    std::set<InterestKey> _registered;  // interests submitted to the kernel
+
+    KqueueBackend(const KqueueBackend& other);
+    KqueueBackend& operator=(const KqueueBackend& other);
+
+    void dropQueuedChanges(uintptr_t ident, short filter);
+    void markSubmitted(const struct kevent* changes, int count);
+
+public:
+    KqueueBackend();
+    virtual ~KqueueBackend();
+    virtual int attach(const struct Event& change);
+    virtual int flush();
+    virtual void detach(FileDescriptor fd);
+    virtual int wait(struct Event* events, int maxEvents, int timeoutMs);
+    virtual FileDescriptor getFd() const;
+    virtual const char* getName() const;
+};
+
+#endif //WEBSERV_HAS_KQUEUE
+
+#endif //KQUEUEBACKEND_HPP
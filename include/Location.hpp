@@ -2,6 +2,32 @@
 #define LOCATION_HPP
 
 #include "WebservDefines.hpp"
+#include <ctime>
+
+#define DEFAULT_CLIENT_HEADER_TIMEOUT 60
+#define DEFAULT_CLIENT_BODY_TIMEOUT 60
+#define DEFAULT_KEEPALIVE_TIMEOUT 75
+#define DEFAULT_SEND_TIMEOUT 60
+#define DEFAULT_CGI_TIMEOUT 60
+
+// seconds (0 : no timeout). header and keepAlive are taken from the server of the port,
+// the others from the location of the request. (see ConnectionTimers)
+struct Timeouts
+{
+    time_t header;    // client_header_timeout : request line and headers -> 408
+    time_t body;      // client_body_timeout : between two reads of the body -> 408
+    time_t keepAlive; // keepalive_timeout : idle connection between requests -> close
+    time_t send;      // send_timeout : between two writes of the response -> close
+    time_t cgi;       // cgi_timeout : run time of the cgi process -> 504
+
+    Timeouts() :
+            header(DEFAULT_CLIENT_HEADER_TIMEOUT),
+            body(DEFAULT_CLIENT_BODY_TIMEOUT),
+            keepAlive(DEFAULT_KEEPALIVE_TIMEOUT),
+            send(DEFAULT_SEND_TIMEOUT),
+            cgi(DEFAULT_CGI_TIMEOUT)
+    {}
+};
 
 class Location
 {
@@ -14,6 +40,7 @@ public:
     std::vector<std::string> cgiInfo;      // ex. name: cgi_tester, arg: hello_world
     std::pair<StatusCode, std::string> _redirect;   // ex. 301 https://profile.intra.42.fr/
     bool _autoindex; // autoindex flag (on | off)
+    Timeouts timeouts;
 
 public:
     bool isMatchedLocation(const std::string& url) const;
@@ -0,0 +1,63 @@
+#ifndef MASTER_HPP
+#define MASTER_HPP
+
+#include "WebservDefines.hpp"
+#include <sys/types.h>
+#include <ctime>
+#include <vector>
+#include "Server.hpp"
+
+class ServerManager;
+
+#define RESPAWN_DELAY (1) // seconds : a worker which dies sooner than this after its start waits as long
+
+// one worker process. (master side)
+struct WorkerProcess
+{
+    pid_t pid;               // 0 : not running
+    time_t startedAt;
+    time_t respawnAt;        // not running : started again from then
+    unsigned long respawns;
+};
+
+// worker_processes : N; -> prefork.
+// - the master opens the listening sockets of the configuration and forks N workers. each worker
+//   runs its own event loop on those sockets : a crash takes down one worker, the master starts
+//   it again.
+// - worker_cpu_affinity pins each worker to its CPUs.
+// - every worker counts its load in a slot of memory shared with the master, and in one more slot
+//   for all of them, against the limits of the configuration. (max_connections, max_requests,
+//   max_cgi : for the whole server, not for each worker) the master reports them. (event_stat_interval)
+class Master
+{
+public:
+    ServerManager& _manager;
+    std::vector<WorkerProcess> _workers;
+    std::vector<pid_t> _retired;            // told to quit (reload), not started again
+    std::vector<FileDescriptor> _listenFds;
+    Load* _loads;                           // shared : one slot per worker, then the one of every worker
+    ssize_t _workerId;                      // -1 : master
+    time_t _lastReport;
+
+    Master(ServerManager& manager, size_t workerCount);
+    ~Master();
+    void openListeners(bool mustOpen);
+    void adoptListeners();
+    bool spawnWorkers();                    // true : returned in a new worker process
+    void reapWorkers();
+    void replaceWorkers();
+    void signalWorkers(int signo);
+    size_t runningWorkers() const;
+    Load* getWorkerLoad() const;
+    Load* getWorkersLoad() const;
+    void report(time_t interval);
+
+private:
+    Master(const Master& other);
+    Master& operator=(const Master& other);
+
+    void resetLoad(size_t id);
+    void pinWorker(size_t id);
+};
+
+#endif //MASTER_HPP
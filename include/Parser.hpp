@@ -8,6 +8,7 @@
 #include <string>
 #include <stack>
 #include <exception>
+#include <ctime>
 #include "Server.hpp"
 
 #define DEFAULT_CLIENT_MAX_BODY_SIZE 10000
@@ -17,6 +18,49 @@
 #define DEFAULT_ROOT "./"
 #define DEFAULT_SOCKET_LISTEN_ADDR "0.0.0.0:80"
 #define DEFAULT_ALLOW_METHODS UNDEFINED
+#define DEFAULT_EVENT_BATCH_SIZE 512
+#define DEFAULT_READ_BUDGET (256 * 1024)
+#define DEFAULT_EVENT_STAT_INTERVAL 0
+#define DEFAULT_EVENT_BACKEND "auto"
+#define DEFAULT_WORKER_THREADS 0
+#define DEFAULT_WORKER_PROCESSES 0
+#define DEFAULT_ACCEPT_BUDGET 64
+#define DEFAULT_RETRY_AFTER 1
+#define DEFAULT_SHUTDOWN_TIMEOUT 30
+#define DEFAULT_SLAB_HUGEPAGES false
+
+// directives outside of server blocks. (process wide)
+struct GlobalConfig
+{
+    size_t eventBatchSize;    // event_batch_size : events harvested per wait
+    size_t readBudget;        // read_budget : bytes read from one socket per wakeup
+    time_t eventStatInterval; // event_stat_interval : seconds between event stat logs (0 : off)
+    std::string eventBackend; // event_backend : epoll, kqueue, io_uring or auto
+    size_t workerThreads;     // worker_threads : event loops, one per thread (0 : main thread only, auto : cpu count)
+    size_t workerProcesses;   // worker_processes : prefork workers, each with one event loop (0 : off, auto : cpu count)
+    std::vector<std::string> workerCpuAffinity; // worker_cpu_affinity : auto, or one CPU bit mask per worker (empty : off)
+    size_t acceptBudget;      // accept_budget : connections accepted from one listening socket per wakeup
+    size_t maxLoad[LOAD_KINDS]; // max_connections, max_requests, max_cgi : whole process (0 : no limit)
+    time_t retryAfter;        // retry_after : Retry-After seconds of the 503 answered over a limit
+    time_t shutdownTimeout;   // shutdown_timeout : seconds given to the connections to finish on SIGTERM / SIGQUIT
+    bool slabHugePages;       // slab_hugepages : on -> connections, requests and responses carved from huge pages
+
+    GlobalConfig() :
+            eventBatchSize(DEFAULT_EVENT_BATCH_SIZE),
+            readBudget(DEFAULT_READ_BUDGET),
+            eventStatInterval(DEFAULT_EVENT_STAT_INTERVAL),
+            eventBackend(DEFAULT_EVENT_BACKEND),
+            workerThreads(DEFAULT_WORKER_THREADS),
+            workerProcesses(DEFAULT_WORKER_PROCESSES),
+            acceptBudget(DEFAULT_ACCEPT_BUDGET),
+            retryAfter(DEFAULT_RETRY_AFTER),
+            shutdownTimeout(DEFAULT_SHUTDOWN_TIMEOUT),
+            slabHugePages(DEFAULT_SLAB_HUGEPAGES)
+    {
+      for (int i = 0; i < LOAD_KINDS; ++i)
+        maxLoad[i] = 0;
+    }
+};
 
 struct ParserNode
 {
@@ -30,6 +74,7 @@ class CommonParser
 {
 protected:
     std::vector<ParserNode> _nodeVector;
+    std::map<std::string, std::vector<std::string> > _globalElem;
 public:
     bool isNodeElementEmpty(ParserNode node);
     ParserNode* getNextNode(ParserNode node);
@@ -48,6 +93,9 @@ private:
                          unsigned int serverIndex);
     void getServerAttr(Server& server, unsigned int serverIndex);
     void getRedirect(Server& server, unsigned int serverIndex);
+    void getTimeouts(Timeouts& timeouts, const std::string& category, unsigned int serverIndex);
+    void getLoadLimits(Load& load, unsigned int serverIndex);
+    void getBufferSizes(Server& server, unsigned int serverIndex);
     void getLocationAttr(Server& server, unsigned int serverIndex);
     void displayServer(Server& server);
     void getErrorPage(std::map<StatusCode, std::string>& _errorPage,
@@ -60,6 +108,7 @@ public:
     ParserNode* getNode(size_t server_index, const std::string& category);
     static bool isValidFile(const std::string& configFilePath);
     std::vector<Server> parseConfigFile(const std::string& configFilePath);
+    GlobalConfig getGlobalConfig() const;
 };
 
 #endif
@@ -0,0 +1,94 @@
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include "WebservDefines.hpp"
+#include <pthread.h>
+#include <ctime>
+#include <deque>
+#include <vector>
+#include "EventBackend.hpp"
+
+class ServerManager;
+struct Context;
+
+#define STEAL_MIN_DEPTH (2) // a reactor's run queue is stolen from once it holds this many items
+
+// Context::workState
+#define WORK_IDLE   (0)
+#define WORK_QUEUED (1) // in a run queue, or its job is running (maybe on another reactor)
+#define WORK_PARKED (2) // queued, and its read interest is disabled until the job is done
+
+// request processing step of one connection.
+struct WorkItem
+{
+    struct Context* context;
+    bool (*job)(struct Context* context);    // any reactor : no event registration, no close
+    void (*finish)(struct Context* context); // owner reactor, when job returned true
+    bool ready;                              // job result
+};
+
+// one event loop running on its own thread. (worker_threads : N;)
+// - owns its event backend and one SO_REUSEPORT listening socket per port :
+//   the kernel picks the reactor of a new connection, no thread wakes up the others.
+// - every connection accepted here lives and dies on this thread : only this reactor
+//   registers its events and closes its descriptors.
+// - the CPU part of request processing goes through a run queue. an idle reactor steals
+//   jobs from the back of a busy one's queue, and hands them back to finish here.
+class Reactor
+{
+public:
+    Reactor(ServerManager& manager, size_t id);
+    ~Reactor();
+    void openListeners();
+    void adoptListeners();
+    void getListenFds(std::vector<FileDescriptor>& fds);
+    void start();
+    void join();
+    void run();
+    void submit(struct Context* context, bool (*job)(struct Context*), void (*finish)(struct Context*));
+    void wakeUp();
+    size_t getId() const;
+    EventBackend* getBackend() const;
+
+private:
+    const size_t ID;
+    ServerManager& _manager;
+    EventBackend* _backend;
+    pthread_mutex_t _listenMutex;     // _listenContexts once started : changed here, read by the main thread (upgrade)
+    std::vector<struct Context*> _listenContexts;
+    pthread_t _thread;
+    bool _started;
+
+    pthread_mutex_t _queueMutex;
+    std::deque<WorkItem> _runQueue;   // front : this reactor, back : thieves
+    size_t _depth;                    // _runQueue.size(), read by thieves without the lock
+    pthread_mutex_t _doneMutex;
+    std::vector<WorkItem> _done;      // items stolen from here, to finish here
+    size_t _doneCount;
+    FileDescriptor _wakeFd[2];
+    int _idle;                        // 1 : about to wait, needs a wake up to see new work
+
+    // run queue counters (reset at each event_stat_interval report)
+    unsigned long _executed;          // jobs run here (own and stolen)
+    unsigned long _stolen;            // jobs this reactor stole
+    unsigned long _stolenFrom;        // jobs taken from this reactor's queue
+    size_t _maxDepth;
+    time_t _lastReport;
+    unsigned long _listenGeneration;  // configuration of _listenContexts (see ServerManager::reload)
+
+    Reactor(const Reactor& other);
+    Reactor& operator=(const Reactor& other);
+
+    static bool runJob(WorkItem& item);
+    void complete(WorkItem& item);
+    void runQueue();
+    void finishStolen();
+    bool steal();
+    bool hasWork();
+    void wakeThief();
+    void park(struct Context* context);
+    void reportQueue(time_t interval);
+    void updateListeners();
+};
+
+#endif //REACTOR_HPP
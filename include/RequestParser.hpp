@@ -6,22 +6,32 @@
 #include <map>
 #include <string>
 
+class ConfigSnapshot;
+class EventBackend;
+
+#define REQUEST_HEAD_MAX (64 * 1024) // start line and headers, at most
+#define PIPELINE_DEPTH (32)          // requests read ahead of the one being served, at most
+#define PIPELINE_ARENA_CHUNKS (16)   // arena chunks of the connection past which none is read ahead
+#define BODY_PENDING_BUFFERS (4)     // body read and not taken by its sink : read buffers at most
+
 class RequestParser
 {
 private:
-    void checkCRLF(HTTPRequest* request);
-    void getStartLine(HTTPRequest* request, size_t& end);
-    void getQuery(HTTPRequest* request);
-    void getHeader(HTTPRequest* request, size_t begin, size_t endPOS);
-    void checkBodyLength(HTTPRequest* request);
-    void parseChunked(HTTPRequest* request);
-    void parseBody(HTTPRequest* request);
-    void checkStartLineValid(HTTPRequest* request);
+    void parseStartLine(HTTPRequest* request, const char* data, size_t begin, size_t end);
+    void parseHeaderLine(HTTPRequest* request, const char* data, size_t begin, size_t end);
+    void completeHead(HTTPRequest* request, BufferSlice& input, size_t length);
+    void parseHead(HTTPRequest* request, BufferSlice& input);
+    void parseBody(HTTPRequest* request, BufferSlice& input);
     void checkHeaderValid(HTTPRequest* request);
-    void readRequest(FileDescriptor fd, HTTPRequest* request);
-    std::string::iterator getOneLine(std::string& str, \
-                        std::string::iterator it, std::string::iterator end);
+    void limitBody(HTTPRequest* request, ConfigSnapshot& snapshot);
+    void rejectRequest(HTTPRequest* request, const std::exception& error);
+    bool readRequest(EventBackend* backend, FileDescriptor fd, BufferSlice& input, HTTPRequest* request,
+                     ConfigSnapshot& snapshot, size_t readBudget, size_t bufferSize);
 public:
+    static HTTPRequest* newRequest(Arena* arena);
+    void parse(HTTPRequest* request, BufferSlice& input, ConfigSnapshot* snapshot = NULL);
+    bool receiveRequest(struct Context* context);
+    void queueRequests(struct Context* context);
     void parseRequest(struct Context* context);
     void displayAll(HTTPRequest* request);
 };
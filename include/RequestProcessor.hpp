@@ -6,6 +6,7 @@
 #include <map>
 
 class ServerManager;
+class Server;
 
 // Request Processor
 // HTTPRequest 를 바탕으로 해당 Request를 처리함
@@ -13,7 +14,9 @@ class ServerManager;
 class RequestProcessor
 {
 private:
-    StatusCode checkValidHeader(const HTTPRequest &req);
+    StatusCode checkValidHeader(Server &matchedServer, const HTTPRequest &req);
+    bool acceptRequest(struct Context *context, Server &server);
+    void updateTimer(struct Context *context);
 
 public:
     void processRequest(struct Context *context);
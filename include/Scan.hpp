@@ -0,0 +1,48 @@
+#ifndef SCAN_HPP
+#define SCAN_HPP
+
+#include <cstddef>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+# define SCAN_X86 (1) // sse2 always, avx2 when the cpu has it
+#else
+# define SCAN_X86 (0) // scalar only
+#endif
+
+/**
+ * *--------------------------------------------------------------*
+ * * [ Scan ]                                                     |
+ * 헤더를 파싱할 때 구분자('\n', ':', ' ' ...) 를 찾습니다.           |
+ *  - x86 : 16 (sse2), 32 (avx2) 바이트씩 한 번에 비교합니다.         |
+ *    avx2 는 시작할 때 cpu 를 보고 고릅니다. (runtime dispatch)     |
+ *  - 그 외 : 한 바이트씩. (scalar)                                 |
+ **---------------------------------------------------------------*/
+class Scan
+{
+public:
+    // the first byte of [begin, end) which is a or b. end : none.
+    typedef const char* (*Kernel)(const char* begin, const char* end, char a, char b);
+
+    static const char* any(const char* begin, const char* end, char a, char b)
+    {
+      return (_kernel(begin, end, a, b));
+    }
+    static const char* find(const char* begin, const char* end, char c)
+    {
+      return (_kernel(begin, end, c, c));
+    }
+
+    static const char* scalar(const char* begin, const char* end, char a, char b);
+#if SCAN_X86
+    static const char* sse2(const char* begin, const char* end, char a, char b);
+    static const char* avx2(const char* begin, const char* end, char a, char b);
+    static bool hasAvx2();
+#endif
+    static void use(Kernel kernel); // (benchmarks)
+    static const char* name();      // of the kernel in use
+
+private:
+    static Kernel _kernel;
+};
+
+#endif //SCAN_HPP
@@ -10,7 +10,6 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <iostream>
-#include <sys/event.h>
 #include <fcntl.h>
 #include <vector>
 #include <string>
@@ -18,6 +17,38 @@
 
 class HTTPResponse;
 
+// admission control : load kinds. (see ServerManager::admit)
+#define LOAD_CONNECTIONS (0) // accepted connections
+#define LOAD_REQUESTS    (1) // requests, from the complete request to the end of its response
+#define LOAD_CGI         (2) // running cgi processes
+#define LOAD_KINDS       (3)
+
+// bytes read from the socket at once / bytes of a response body chunk. (see BufferPool)
+#define DEFAULT_CLIENT_BUFFER_SIZE (16 * 1024)
+#define DEFAULT_OUTPUT_BUFFER_SIZE (16 * 1024)
+
+// binary upgrade : the previous process passes its listening sockets. (see ServerManager::upgrade)
+#define UPGRADE_FDS_ENV "WEBSERV_LISTEN_FDS" // "fd;fd;..."
+#define UPGRADE_PID_ENV "WEBSERV_PARENT_PID" // drains once the sockets are served here
+
+// in-flight counters against limits. (updated by every thread : atomics)
+struct Load
+{
+    size_t current[LOAD_KINDS];
+    size_t limit[LOAD_KINDS];           // max_connections, max_requests, max_cgi (0 : no limit)
+    unsigned long rejected[LOAD_KINDS]; // answered 503
+
+    Load()
+    {
+      for (int i = 0; i < LOAD_KINDS; ++i)
+      {
+        current[i] = 0;
+        limit[i] = 0;
+        rejected[i] = 0;
+      }
+    }
+};
+
 class Server
 {
 
@@ -33,11 +64,22 @@ public:
     int _serverPort;
     int _clientMaxBodySize;
     std::pair<StatusCode, std::string> _redirect;
+    Timeouts _timeouts;
+    size_t _clientBufferSize;  // client_buffer_size : request bytes read from the socket at once
+    size_t _outputBufferSize;  // output_buffer_size : response body bytes read from the file and sent at once
+    Load _load;
     Session _sessionStorage;
     Location* getMatchedLocation(const HTTPRequest& req);
     void processRequest(struct Context* context);
+    HTTPResponse* openBodySink(struct Context* context); // POST, PUT (NULL : the body has where to go)
     FileDescriptor getErrorPageFd(const StatusCode& stCode); // open and return ErrorPage file_descriptor.
     void openServer();
+    FileDescriptor openListenSocket(bool reusePort) const;
+    static bool isListenSocket(FileDescriptor fd, struct sockaddr_in* addr);
+    // startup only, before any thread : sockets of UPGRADE_FDS_ENV, taken by openListenSocket.
+    static void loadInheritedSockets();
+    static void inheritSocket(FileDescriptor fd);
+    static FileDescriptor takeLeftoverSocket(struct sockaddr_in* addr); // one no server took (-1 : none)
     /* if there is no cookie in request --> return -1.  
     else, if valid id --> return  1 | if not valid --> return 0 */
     int getSessionStatus(const HTTPRequest &req); // parse req's cookie data -> validate session_id
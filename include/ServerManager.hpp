@@ -8,10 +8,35 @@
 #include "RequestParser.hpp"
 #include "HTTPResponse.hpp"
 #include "ThreadPool.hpp"
+#include "Reactor.hpp"
+#include "Master.hpp"
 #include "CGI.hpp"
+#include "EventBackend.hpp"
+#include "TimingWheel.hpp"
+#include "ConfigSnapshot.hpp"
+#include "Slab.hpp"
+#include "BufferPool.hpp"
 #include <sys/stat.h>
 class ServerManager;
+struct AcceptStat;
 
+// Context::state : the connection is ... (first context)
+#define CONN_READ_HEADER (0)
+#define CONN_READ_BODY   (1)
+#define CONN_PROCESSING  (2) // file write, autoindex listing
+#define CONN_CGI_RUNNING (3)
+#define CONN_SEND_HEADER (4)
+#define CONN_SEND_BODY   (5)
+
+// contexts of one connection : connectContexts[stage]. (see getStage)
+#define STAGE_CONNECTION (0) // socket read : the connection itself
+#define STAGE_SEND       (1) // socket write
+#define STAGE_BODY       (2) // response body read (file, autoindex pipe, cgi output)
+#define STAGE_AUX        (3) // request body write (file, autoindex pipe, cgi input), cgi process, cgi output header
+#define CONN_STAGES      (4)
+
+// one connection : its first context owns the request, the response and the cgi of the
+// request being served. the other stages only borrow them, and are reused by every request.
 struct Context
 {
     int fd;
@@ -20,15 +45,24 @@ struct Context
     ServerManager* manager;
     CGI* cgi;
     HTTPRequest* req;
+    std::vector<HTTPRequest*> pipeline; // first context : requests read after req, served after it in order
     HTTPResponse* res; // -> for file FD, ContentLength... etc
-    char* ioBuffer;
-    size_t  bufferSize;
+    BufferSlice ioBuffer; // bytes left to write (socket, pipe). send : the responses before res may wait there
+    BufferSlice readBuffer; // first context : bytes read from the socket. the head of req is in it
+    Arena arena;        // first context : what is made of req, reset when it is released
     ssize_t  totalIOSize; // 보낼 때 마다 합산.
-    FileDescriptor threadKQ;
+    EventBackend* threadBackend;
+    Reactor* reactor;   // worker_threads : owner of this connection (NULL : main loop)
+    int workState;      // WORK_IDLE, WORK_QUEUED, WORK_PARKED (see Reactor)
+    int state;          // first context : CONN_
+    bool readPaused;    // first context : socket read disabled until the response is sent
+    bool readLeft;      // first context : the last read stopped before EAGAIN (no new edge for the rest)
+    AcceptStat* acceptStat; // listening sockets only
+    Server* loadServers[LOAD_KINDS]; // first context : server of each load slot the connection holds
+    ConfigSnapshot* snapshot; // first context and listening sockets : configuration in use (one reference)
     std::vector<struct Context*>* connectContexts;
     FileDescriptor pipeFD[2];
 
-    Context(){}
     Context(int _fd,
             struct sockaddr_in _addr,
             void (* _handler)(struct Context* obj),
@@ -40,37 +74,113 @@ struct Context
             cgi(NULL),
             req(NULL),
             res(NULL),
-            ioBuffer(NULL),
-            bufferSize(0),
             totalIOSize(0),
-            threadKQ(0),
+            threadBackend(NULL),
+            reactor(NULL),
+            workState(WORK_IDLE),
+            state(CONN_READ_HEADER),
+            readPaused(false),
+            readLeft(false),
+            acceptStat(NULL),
+            snapshot(NULL),
             connectContexts(NULL)
     {
       pipeFD[0] = -1;
       pipeFD[1] = -1;
+      for (int i = 0; i < LOAD_KINDS; ++i)
+        loadServers[i] = NULL;
     }
+    // the other stages of a connection are deleted first. (see clearContexts)
     ~Context()
     {
-      if (connectContexts)
-      {
-        for (
-              std::vector<struct Context*>::iterator it = connectContexts->begin();
-              it != connectContexts->end();
-              ++it
-              )
-        {
-          struct Context* context = *it;
-
-          if (context->ioBuffer != NULL)
-            delete (context->ioBuffer);
-          // 이렇게 안하면 재귀 호출됨...
-          if (context != this)
-            free(context);
-        }
-        // 중복되는 자료.
-        delete (this->connectContexts);
-      }
+      if (connectContexts != NULL && connectContexts->front() == this)
+        delete (connectContexts);
     }
+    SLAB_ALLOCATED(g_contextSlab)
+};
+
+#define EVENT_STAT_BUCKETS (12) // 1, 2, 4, ... 1024, more
+
+// events-per-wakeup counters. (used to tune event_batch_size)
+struct EventStat
+{
+    unsigned long wakeups;
+    unsigned long events;
+    unsigned long fullBatches; // wakeups which filled the whole batch
+    unsigned long histogram[EVENT_STAT_BUCKETS]; // [i] : 2^(i-1) < events <= 2^i
+    time_t lastReport;
+
+    EventStat();
+    void record(int eventCount, size_t batchSize);
+    void report(const std::string& name, time_t interval);
+};
+
+// ConnectionTimer kinds : the phase of the connection being timed.
+#define TIMEOUT_NONE      (0)
+#define TIMEOUT_HEADER    (1) // request line and headers -> 408
+#define TIMEOUT_BODY      (2) // between two reads of the body -> 408
+#define TIMEOUT_KEEPALIVE (3) // idle between requests -> close
+#define TIMEOUT_SEND      (4) // between two writes of the response -> close
+#define TIMEOUT_CGI       (5) // cgi process -> killed, 504
+#define TIMEOUT_ANY       (-1)
+
+struct ConnectionTimer
+{
+    TimerNode node;                                // node.kind : TIMEOUT_
+    std::vector<struct Context*>* connectContexts; // the connection on this fd (NULL : none)
+    const Timeouts* portTimeouts;                  // server of the port : header, keepalive
+    const Timeouts* timeouts;                      // location of the current request
+};
+
+// timeouts of the connections of one event loop, used by the thread of the loop only.
+// slots are indexed by socket fd and kept once allocated :
+// arming, moving and cancelling a timer only relinks its node in the wheel.
+class ConnectionTimers
+{
+private:
+    TimingWheel _wheel;
+    std::vector<ConnectionTimer*> _slots;
+    size_t _open; // connections
+
+    ConnectionTimers(const ConnectionTimers& other);
+    ConnectionTimers& operator=(const ConnectionTimers& other);
+    ConnectionTimer* getTimer(FileDescriptor fd) const;
+    static void timeoutHandler(TimerNode* node);
+    void closeConnections(bool force);
+public:
+    ConnectionTimers();
+    ~ConnectionTimers();
+    // the event loop of this thread : tick the wheel with an EVENT_TIMER on backend.
+    void bind(EventBackend* backend);
+    void open(FileDescriptor fd, std::vector<struct Context*>* connectContexts, const Timeouts* portTimeouts);
+    void close(FileDescriptor fd);
+    // (re)start the timer of fd as kind, if it is running as fromKind. (TIMEOUT_NONE : stop it)
+    void arm(FileDescriptor fd, int kind, int fromKind = TIMEOUT_ANY);
+    void setTimeouts(FileDescriptor fd, const Timeouts* timeouts);
+    // between two requests : the connection moved to the server of a new configuration.
+    void setPortTimeouts(FileDescriptor fd, const Timeouts* portTimeouts);
+    void advance();
+    size_t size() const;
+    size_t connections() const;
+    // stop : close the connections which are done. (all of them past deadline) true : none left.
+    bool drain(time_t deadline);
+    static ConnectionTimers* current(); // bound to this thread (NULL : none)
+};
+
+// accept counters of one listening socket. (used to tune accept_budget)
+struct AcceptStat
+{
+    unsigned long wakeups;
+    unsigned long accepted;
+    unsigned long maxAccepted;  // most connections accepted in one wakeup
+    unsigned long budgetHits;   // wakeups which stopped at accept_budget, connections left in the queue
+    unsigned long overflows;    // budget hits which found the accept queue full (new connections dropped)
+    unsigned long errors;       // accept failures other than an empty queue (EMFILE ...)
+    time_t lastReport;
+
+    AcceptStat();
+    void record(size_t acceptedCount, bool budgetHit, bool queueFull);
+    void report(const std::string& name, time_t interval);
 };
 
 class RequestParser;
@@ -78,33 +188,98 @@ class RequestParser;
 class ServerManager
 {
 private:
-    std::vector<Server> _serverList;
-    std::vector<struct Context*> _contexts;
-    FileDescriptor _kqueue;
+    std::string _configFilePath;
+    std::string _binaryPath;         // absolute path of argv[0] : started again on SIGUSR2 (see upgrade)
+    pid_t _upgradePid;               // process started by the last upgrade (0 : none)
+    ConfigSnapshot* _snapshot;       // published configuration (SIGHUP : reload)
+    unsigned long _generation;       // _snapshot->GENERATION, read without the lock
+    pthread_mutex_t _snapshotMutex;  // _snapshot and the reference taken from it
+    std::vector<struct Context*> _contexts; // listening sockets of the main thread
+    FileDescriptor _signalFd[2];     // written by the signal handler
+    GlobalConfig _config;
+    EventBackend* _eventBackend;
+    EventStat _eventStat;
     RequestProcessor _processor;
     RequestParser _requestParser;
     ThreadPool _threadPool;
+    std::vector<Reactor*> _reactors; // worker_threads > 0
+    Master* _master;                 // worker_processes > 0 (also kept by the workers)
+    ConnectionTimers _timers;
+    Load _processLoad;
+    Load* _load;                     // whole process (worker process : its slot shared with the master)
+    Load* _workersLoad;              // worker process : every worker against the limits, shared too (NULL : none)
+    std::string _unavailableResponse;
+    time_t _lastLoadReport;
+    int _stopping;                   // SIGTERM, SIGQUIT : draining, then every loop returns
+    time_t _stopDeadline;            // connections left then are closed (shutdown_timeout)
+    void runEventLoop();
+    void runReactors();
+    void runMaster();
+    void runWorker();
+    void handleSignals();
+    void takeOver();
+    std::vector<FileDescriptor> getListenFds() const;
 public:
-    explicit ServerManager(const std::string& configFilePath);
+    ServerManager(const std::string& configFilePath, const std::string& binaryPath);
     ~ServerManager();
     void run();
     void initServers();
-    void attachServerEvent(Server& server);
-    int attachNewEvent(struct Context* context, const struct kevent& event);
-    FileDescriptor getKqueue() const;
-    std::string getServerName(in_port_t port_num) const;
-    std::vector<Server>& getServerList();
+    void reload();
+    void upgrade();
+    void stop();
+    bool isStopping() const;
+    bool isWorkerProcess() const;
+    time_t getStopDeadline() const;
+    int attachNewEvent(struct Context* context, const struct Event& event);
+    void detachEvents(struct Context* context, FileDescriptor fd);
+    EventBackend* getContextBackend(struct Context* context) const;
+    EventBackend* getEventBackend() const;
+    const GlobalConfig& getConfig() const;
+    ConfigSnapshot* acquireSnapshot();
+    bool isCurrentSnapshot(const ConfigSnapshot* snapshot) const;
+    unsigned long getGeneration() const;
     RequestProcessor& getRequestProcessor();
     RequestParser& getRequestParser();
-    Server& getMatchedServer(const HTTPRequest& req);
+    ThreadPool& getThreadPool();
+    const std::vector<Reactor*>& getReactors() const;
+    bool admit(Server& server, int kind);
+    void release(Server& server, int kind);
+    void moveLoad(Server& from, Server& to, int kind);
+    const std::string& getUnavailableResponse() const;
+    void reportLoad(time_t interval);
 };
 
 void socketReceiveHandler(struct Context* context);
 void acceptHandler(struct Context* context);
-void handleEvent(struct kevent* event);
+void attachClient(const struct Handoff& handoff, EventBackend* backend, Reactor* reactor);
+void syncListeners(std::vector<struct Context*>& listeners, ServerManager* manager, EventBackend* backend, Reactor* reactor, bool mustOpen);
+void adoptListeners(std::vector<struct Context*>& listeners, ServerManager* manager, EventBackend* backend, Reactor* reactor);
+void closeListener(struct Context* context);
+void closeListeners(std::vector<struct Context*>& listeners);
+void printLoad(const std::string& name, Load& load);
+void dropLoad(Load& load, int kind, size_t count);
+ConfigSnapshot& getSnapshot(const struct Context* context);
+void handleEvent(struct Event* event, struct Event* batchRest = NULL, int batchRestCount = 0);
+void handleEvents(struct Event* events, int eventCount);
+bool writeBody(struct Context* context);
+bool commitBody(struct Context* context);
+void streamBody(struct Context* context);
+void resumeRead(struct Context* connection);
 void writeFileHandle(struct Context* context);
 void writePipeHandler(struct Context* context);
-void CGIWriteHandler(struct Context* context);
+struct Context* getStage(struct Context* context, int stage, void (*handler)(struct Context*));
+void setState(struct Context* context, int state);
+void completeRequest(struct Context* context);
+bool isNextRequestRead(struct Context* context);
+void cancelPipeline(struct Context* context);
 void clearContexts(struct Context* context);
+void closeConnection(struct Context* context);
+void connectionTimeoutHandler(struct Context* context, int kind);
+void armTimer(struct Context* context, int kind, int fromKind = TIMEOUT_ANY);
+void setTimerTimeouts(struct Context* context, const Timeouts* timeouts);
+bool acquireLoad(struct Context* context, Server& server, int kind);
+void releaseLoad(struct Context* context, int kind);
+void sendServiceUnavailable(struct Context* context);
+void sendServerError(struct Context* context);
 void CGIChildHandler(struct Context* context);
 #endif //SERVERMANAGER_HPP
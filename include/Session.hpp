@@ -42,7 +42,9 @@ public:
     bool isValid_ID(const std::string& clientID);
     // add session_id to the storage
     void add(const std::string& id, const WS::Time& expire_time);
-    // find given id in storage
+    // copy the sessions of other (locked)
+    void assign(const Session& other);
+    // find given id in storage (not locked : the iterator is only valid in one thread)
     std::map<std::string, WS::Time>::iterator find(const std::string& id);
     // generate random string
     static std::string gen_random_string(int len);
@@ -0,0 +1,85 @@
+#ifndef SLAB_HPP
+#define SLAB_HPP
+
+#include <cstddef>
+#include <pthread.h>
+#include "WebservDefines.hpp"
+
+#define SLAB_BYTES (64 * 1024)            // one slab
+#define SLAB_HUGE_BYTES (2 * 1024 * 1024) // one slab, slab_hugepages : on (one huge page)
+#define SLAB_ALIGN (16)
+#define SLAB_CACHE_BATCH (32)             // objects moved between a thread cache and its pool at once
+#define SLAB_MAX_POOLS (4)
+
+// the free objects one thread keeps of one pool.
+struct SlabCache
+{
+    void* head;             // free list, linked through the objects
+    size_t count;
+    unsigned long allocs;   // by this thread : written by it only
+    unsigned long frees;
+    SlabCache* next;        // caches of the pool
+};
+
+/**
+ * *--------------------------------------------------------------*
+ * * [ SlabPool ]                                                 |
+ * 같은 크기의 객체들을 slab 에서 잘라 씁니다. (Context, HTTPRequest,  |
+ * HTTPResponse : 연결, 요청마다 만들고 지우는 객체들)                  |
+ *  - 스레드마다 자기 cache 에서 꺼내고 돌려놓습니다. (lock 없음)         |
+ *    cache 가 비거나 넘치면 SLAB_CACHE_BATCH 개씩 pool 과 주고받습니다.  |
+ *  - slab 은 돌려주지 않습니다 : high-water mark 만큼 남아 있습니다.   |
+ *  - SLAB_ALLOCATOR (0) : 그냥 new / delete. (sanitizer build)       |
+ **---------------------------------------------------------------*/
+class SlabPool
+{
+public:
+    const char* const NAME;
+    const size_t OBJECT_SIZE;     // rounded up to SLAB_ALIGN
+
+    SlabPool(const char* name, size_t objectSize);
+    void* allocate(size_t size);
+    void deallocate(void* object, size_t size);
+    void report();
+
+    static void useHugePages(bool on);   // before any thread starts
+    static void releaseThreadCaches();   // a thread ends : its free objects go back to the pools
+    static void reportAll();
+
+private:
+    size_t _id;                   // slot of its caches in every thread
+    pthread_mutex_t _mutex;       // everything below
+    void* _free;                  // objects given back by the caches
+    size_t _freeCount;
+    size_t _slabs;
+    size_t _slabBytes;            // of all slabs
+    SlabCache* _caches;
+    unsigned long _retiredAllocs; // of the caches of the threads which ended
+    unsigned long _retiredFrees;
+    size_t _objects;              // carved from all slabs
+    size_t _outHighWater;         // objects out of the pool at most (in use or in a thread cache)
+
+    SlabPool(const SlabPool& other);
+    SlabPool& operator=(const SlabPool& other);
+
+    SlabCache* threadCache();
+    void refill(SlabCache* cache);
+    void spill(SlabCache* cache, size_t count);
+    void carve();
+    unsigned long countLive();
+};
+
+extern SlabPool g_contextSlab;
+extern SlabPool g_requestSlab;
+extern SlabPool g_responseSlab;
+
+#if SLAB_ALLOCATOR
+// new and delete of a class from pool.
+# define SLAB_ALLOCATED(pool) \
+    static void* operator new(size_t size) { return (pool.allocate(size)); } \
+    static void operator delete(void* object, size_t size) { pool.deallocate(object, size); }
+#else
+# define SLAB_ALLOCATED(pool)
+#endif
+
+#endif //SLAB_HPP
@@ -4,26 +4,67 @@
 #include "WebservDefines.hpp"
 #include <pthread.h>
 #include <vector>
-#include <map>
-#include <queue>
-#include <sys/event.h>
+#include <ctime>
+#include <netinet/in.h>
+#include "EventBackend.hpp"
+#include "HandoffRing.hpp"
 
+#define HANDOFF_RING_SIZE (1024) // accepted connections waiting for one worker
+
+class ServerManager;
+class ConfigSnapshot;
+class Server;
+
+// accepted connection, before it is registered on the event loop which serves it.
+// (THREAD_MODE : handed by the main thread to a worker)
+struct Handoff
+{
+    FileDescriptor fd;
+    struct sockaddr_in addr;
+    ServerManager* manager;
+    ConfigSnapshot* snapshot; // one reference, taken over by the connection
+    Server* server;           // server of the port : holds the connection's load slot
+};
+
+// THREAD_MODE : the main thread accepts, workers serve the connections.
+// - one lock-free ring per worker. (single producer : main thread, single consumer : worker)
+// - a worker is woken up (eventfd, pipe on other platforms) only when it went idle.
 class ThreadPool
 {
 public:
+    struct Worker
+    {
+        ThreadPool* pool;
+        size_t id;
+        pthread_t thread;
+        EventBackend* backend;
+        HandoffRing<Handoff, HANDOFF_RING_SIZE> ring;
+        FileDescriptor wakeFd[2]; // [0] : watched by the worker, [1] : written by the main thread
+        int idle;                 // 1 : about to wait, needs a wake up to see the ring
+        unsigned long wakeups;    // wake ups sent (main thread)
+    };
+
     const size_t NUM_THREADS;
     bool _stopAll;
-    pthread_mutex_t _jobQueueMutex;
-    std::vector<pthread_t> _workerThreads;
-    std::queue<struct kevent*> _eventQueue;
-    FileDescriptor _serverKQ;
+    time_t _stopDeadline;     // workers close the connections left then (see ConnectionTimers::drain)
+    std::vector<Worker*> _workers;
+    size_t _nextWorker;
+    std::string _backendName;
+    size_t _eventBatchSize;
+    time_t _eventStatInterval;
+    unsigned long _handoffs;
+    unsigned long _dropped;   // every ring was full
 
     explicit ThreadPool(size_t threadNumber);
     ~ThreadPool();
-    pthread_mutex_t* getMutex();
-    void attachNewEvent(struct kevent* event);
+    bool handOff(const struct Handoff& handoff);
     bool isStop() const;
+    void stop(time_t deadline);
     void createPool();
+
+private:
+    ThreadPool(const ThreadPool& other);
+    ThreadPool& operator=(const ThreadPool& other);
 };
 
 #endif //THREADPOOL_HPP
@@ -0,0 +1,65 @@
+#ifndef TIMINGWHEEL_HPP
+#define TIMINGWHEEL_HPP
+
+#include <cstddef>
+#include <ctime>
+
+#define TIMER_TICK_MS (500)     // resolution of the wheel (and period of the event loop timer)
+#define TIMER_WHEEL_BITS (6)
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS (4)  // 64 ticks, 64^2, 64^3, 64^4 (about 97 days at 500ms)
+#define TIMER_WHEEL_ID (1)      // EVENT_TIMER ident of the event loop timer
+
+// intrusive list node : the owner keeps it, the wheel never allocates.
+struct TimerNode
+{
+    TimerNode* prev;
+    TimerNode* next;     // NULL : not scheduled
+    unsigned long expire; // tick
+    int kind;
+    void* data;
+
+    TimerNode() : prev(NULL), next(NULL), expire(0), kind(0), data(NULL) {}
+};
+
+/**
+ * *--------------------------------------------------------------*
+ * * [ TimingWheel ]                                              |
+ * 이벤트 루프 하나가 가진 타이머 묶음입니다. (hierarchical timing wheel)  |
+ *  - schedule / cancel : O(1), 리스트 연결만 바꿉니다. (할당 없음)       |
+ *  - advance() : 이벤트 루프의 EVENT_TIMER 마다 호출. 지난 tick 의       |
+ *    타이머들을 handler 로 넘기고, 윗 단계 slot 은 때가 되면 내려옵니다.   |
+ * 한 스레드(이벤트 루프)에서만 사용합니다.                               |
+ **---------------------------------------------------------------*/
+class TimingWheel
+{
+public:
+    typedef void (*Handler)(TimerNode* node);
+
+private:
+    TimerNode _slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; // list heads
+    unsigned long _current;  // last tick processed
+    long _startMs;
+    size_t _count;
+    Handler _handler;
+
+    TimingWheel(const TimingWheel& other);
+    TimingWheel& operator=(const TimingWheel& other);
+
+    unsigned long getTick() const;
+    void insert(TimerNode* node);
+    void cascade(int level);
+
+public:
+    explicit TimingWheel(Handler handler);
+    // (re)arm node to fire after timeoutMs. also moves an already scheduled node.
+    void schedule(TimerNode* node, int kind, long timeoutMs);
+    void cancel(TimerNode* node);
+    // fire every timer which is due. the handler may schedule or cancel any node.
+    void advance();
+    size_t size() const;
+
+    static bool isScheduled(const TimerNode* node);
+};
+
+#endif //TIMINGWHEEL_HPP
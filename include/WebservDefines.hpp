@@ -3,13 +3,18 @@
 
 #include <string>
 #include <vector>
+#include <sys/types.h>
 
-#define BUFFER_SIZE (16 * 1024)
 #define LISTEN_QUEUE_SIZE 1024
 #define FAILED (-1)
 #define THREAD_NO 20
-#define THREAD_MODE (0)
+#ifndef THREAD_MODE
+# define THREAD_MODE (0) // 1 : the main thread accepts, THREAD_NO workers serve (see ThreadPool)
+#endif
 #define DEBUG_MODE (0)
+#ifndef SLAB_ALLOCATOR
+# define SLAB_ALLOCATOR (1) // 0 : connections, requests and responses from plain new / delete (sanitizers)
+#endif
 
 #define SESSION_ID_LENGH (15)
 #define SESSION_KEY ("WEBSERV_ID")
@@ -65,6 +70,7 @@ typedef enum
     ST_NOT_IMPLEMENTED = 501,
     ST_BAD_GATEWAY = 502,
     ST_SERVICE_UNAVAILABLE = 503,
+    ST_GATEWAY_TIMEOUT = 504,
     ST_ERROR = -1
 } StatusCode;
 
@@ -76,6 +82,12 @@ std::string ft_itos(ssize_t i);
 int ft_stoi(const std::string& str);
 std::string getStatusCodeMessage(StatusCode code);
 long FdGetFileSize(int fd);
+// wake up a thread blocked in its event backend. (eventfd, pipe on other platforms)
+// [0] : watched by the sleeping thread, [1] : written by the others
+void openWakeFd(FileDescriptor wakeFd[2]);
+void closeWakeFd(FileDescriptor wakeFd[2]);
+void sendWakeUp(FileDescriptor wakeFd);
+void clearWakeUp(FileDescriptor wakeFd);
 
 
 #endif
@@ -0,0 +1,60 @@
+#include "Arena.hpp"
+#include <algorithm>
+
+Arena::Arena() :
+  _chunks(NULL),
+  _cursor(NULL),
+  _end(NULL)
+{
+}
+
+Arena::~Arena()
+{
+  while (_chunks != NULL)
+  {
+    IOBuffer* chunk = _chunks;
+    _chunks = chunk->next;
+    BufferPool::release(chunk);
+  }
+}
+
+// the newest chunk, or a new one when it is too full. (what was left of it is lost until reset)
+void* Arena::allocate(size_t size)
+{
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  if (_cursor == NULL || static_cast<size_t>(_end - _cursor) < size)
+  {
+    IOBuffer* chunk = BufferPool::acquire(std::max(size, static_cast<size_t>(ARENA_CHUNK_SIZE)));
+    chunk->next = _chunks;
+    _chunks = chunk;
+    _cursor = chunk->bytes();
+    _end = _cursor + chunk->capacity;
+  }
+  void* p = _cursor;
+  _cursor += size;
+  return (p);
+}
+
+// the oldest chunk is kept for the next request.
+void Arena::reset()
+{
+  if (_chunks == NULL)
+    return ;
+  while (_chunks->next != NULL)
+  {
+    IOBuffer* chunk = _chunks;
+    _chunks = chunk->next;
+    BufferPool::release(chunk);
+  }
+  _cursor = _chunks->bytes();
+  _end = _cursor + _chunks->capacity;
+}
+
+size_t Arena::chunks() const
+{
+  size_t count = 0;
+
+  for (IOBuffer* chunk = _chunks; chunk != NULL; chunk = chunk->next)
+    count++;
+  return (count);
+}
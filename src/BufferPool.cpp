@@ -0,0 +1,271 @@
+#include "BufferPool.hpp"
+#include <pthread.h>
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <sstream>
+
+// free buffers of one class.
+struct BufferList
+{
+    IOBuffer* head;
+    size_t count;
+};
+
+static pthread_mutex_t g_poolMutex = PTHREAD_MUTEX_INITIALIZER;
+static BufferList g_pool[BUFFER_CLASSES];
+static size_t g_allocated[BUFFER_CLASSES];  // alive buffers, pooled or not (atomic)
+static size_t g_highWater[BUFFER_CLASSES];  // of g_allocated (atomic)
+static size_t g_unpooled;                   // alive buffers larger than the largest class (atomic)
+static __thread BufferList t_cache[BUFFER_CLASSES];
+
+static size_t classSize(int sizeClass)
+{
+  return (static_cast<size_t>(BUFFER_CLASS_MIN) << (2 * sizeClass));
+}
+
+static size_t classLimit(int sizeClass, size_t bytes)
+{
+  return (bytes / classSize(sizeClass));
+}
+
+static void push(BufferList& list, IOBuffer* buffer)
+{
+  buffer->next = list.head;
+  list.head = buffer;
+  list.count++;
+}
+
+static IOBuffer* pop(BufferList& list)
+{
+  IOBuffer* buffer = list.head;
+
+  if (buffer != NULL)
+  {
+    list.head = buffer->next;
+    list.count--;
+  }
+  return (buffer);
+}
+
+static IOBuffer* allocate(size_t capacity, int sizeClass)
+{
+  IOBuffer* buffer = static_cast<IOBuffer*>(::operator new(sizeof(IOBuffer) + capacity));
+
+  buffer->capacity = capacity;
+  buffer->sizeClass = sizeClass;
+  if (sizeClass < 0)
+  {
+    __atomic_add_fetch(&g_unpooled, 1, __ATOMIC_RELAXED);
+    return (buffer);
+  }
+  const size_t allocated = __atomic_add_fetch(&g_allocated[sizeClass], 1, __ATOMIC_RELAXED);
+  size_t highWater = __atomic_load_n(&g_highWater[sizeClass], __ATOMIC_RELAXED);
+  while (allocated > highWater
+         && !__atomic_compare_exchange_n(&g_highWater[sizeClass], &highWater, allocated, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+  return (buffer);
+}
+
+static void deallocate(IOBuffer* buffer)
+{
+  if (buffer->sizeClass < 0)
+    __atomic_sub_fetch(&g_unpooled, 1, __ATOMIC_RELAXED);
+  else
+    __atomic_sub_fetch(&g_allocated[buffer->sizeClass], 1, __ATOMIC_RELAXED);
+  ::operator delete(buffer);
+}
+
+// the cache of the thread, then the pool, then a new one.
+IOBuffer* BufferPool::acquire(size_t capacity)
+{
+  int sizeClass = 0;
+  IOBuffer* buffer;
+
+  while (sizeClass < BUFFER_CLASSES && classSize(sizeClass) < capacity)
+    sizeClass++;
+  if (sizeClass == BUFFER_CLASSES)
+    buffer = allocate(capacity, -1);
+  else if ((buffer = pop(t_cache[sizeClass])) == NULL)
+  {
+    pthread_mutex_lock(&g_poolMutex);
+    buffer = pop(g_pool[sizeClass]);
+    pthread_mutex_unlock(&g_poolMutex);
+    if (buffer == NULL)
+      buffer = allocate(classSize(sizeClass), sizeClass);
+  }
+  buffer->refs = 1;
+  return (buffer);
+}
+
+// the last reference : back to the cache of this thread, whichever took it.
+void BufferPool::release(IOBuffer* buffer)
+{
+  if (buffer == NULL || __atomic_sub_fetch(&buffer->refs, 1, __ATOMIC_ACQ_REL) > 0)
+    return ;
+  const int sizeClass = buffer->sizeClass;
+  if (sizeClass < 0)
+  {
+    deallocate(buffer);
+    return ;
+  }
+  if (t_cache[sizeClass].count < classLimit(sizeClass, BUFFER_CACHE_BYTES))
+  {
+    push(t_cache[sizeClass], buffer);
+    return ;
+  }
+  pthread_mutex_lock(&g_poolMutex);
+  if (g_pool[sizeClass].count < classLimit(sizeClass, BUFFER_POOL_BYTES))
+  {
+    push(g_pool[sizeClass], buffer);
+    buffer = NULL;
+  }
+  pthread_mutex_unlock(&g_poolMutex);
+  if (buffer != NULL)
+    deallocate(buffer);
+}
+
+void BufferPool::releaseThreadCache()
+{
+  for (int i = 0; i < BUFFER_CLASSES; ++i)
+  {
+    IOBuffer* buffer;
+    while ((buffer = pop(t_cache[i])) != NULL)
+    {
+      pthread_mutex_lock(&g_poolMutex);
+      if (g_pool[i].count < classLimit(i, BUFFER_POOL_BYTES))
+      {
+        push(g_pool[i], buffer);
+        buffer = NULL;
+      }
+      pthread_mutex_unlock(&g_poolMutex);
+      if (buffer != NULL)
+        deallocate(buffer);
+    }
+  }
+}
+
+// allocated : in use, in a thread cache or in the pool.
+void BufferPool::report()
+{
+  std::stringstream ss;
+
+  ss << "buffer";
+  pthread_mutex_lock(&g_poolMutex);
+  for (int i = 0; i < BUFFER_CLASSES; ++i)
+  {
+    ss << "\t" << (classSize(i) / 1024) << "K "
+       << __atomic_load_n(&g_allocated[i], __ATOMIC_RELAXED)
+       << " (high-water " << __atomic_load_n(&g_highWater[i], __ATOMIC_RELAXED)
+       << ", pool " << g_pool[i].count << ")";
+  }
+  pthread_mutex_unlock(&g_poolMutex);
+  ss << "\tlarger " << __atomic_load_n(&g_unpooled, __ATOMIC_RELAXED) << "\n";
+  printLog(ss.str(), PRINT_CYAN);
+}
+
+BufferSlice::BufferSlice() :
+  _buffer(NULL),
+  _offset(0),
+  _size(0)
+{
+}
+
+BufferSlice::BufferSlice(size_t capacity) :
+  _buffer(BufferPool::acquire(capacity)),
+  _offset(0),
+  _size(0)
+{
+}
+
+BufferSlice::BufferSlice(const BufferSlice& other) :
+  _buffer(other._buffer),
+  _offset(other._offset),
+  _size(other._size)
+{
+  if (_buffer != NULL)
+    __atomic_add_fetch(&_buffer->refs, 1, __ATOMIC_RELAXED);
+}
+
+BufferSlice& BufferSlice::operator=(const BufferSlice& other)
+{
+  if (other._buffer != NULL)
+    __atomic_add_fetch(&other._buffer->refs, 1, __ATOMIC_RELAXED);
+  BufferPool::release(_buffer);
+  _buffer = other._buffer;
+  _offset = other._offset;
+  _size = other._size;
+  return (*this);
+}
+
+BufferSlice::~BufferSlice()
+{
+  BufferPool::release(_buffer);
+}
+
+char* BufferSlice::data() const
+{
+  return (_buffer != NULL ? _buffer->bytes() + _offset : NULL);
+}
+
+size_t BufferSlice::size() const
+{
+  return (_size);
+}
+
+bool BufferSlice::empty() const
+{
+  return (_size == 0);
+}
+
+size_t BufferSlice::room() const
+{
+  return (_buffer != NULL ? _buffer->capacity - _offset - _size : 0);
+}
+
+void BufferSlice::fill(size_t count)
+{
+  _size += std::min(count, room());
+}
+
+void BufferSlice::consume(size_t count)
+{
+  count = std::min(count, _size);
+  _offset += count;
+  _size -= count;
+}
+
+void BufferSlice::resize(size_t count)
+{
+  _size = std::min(count, _size);
+}
+
+void BufferSlice::assign(const char* bytes, size_t count)
+{
+  *this = BufferSlice(count);
+  memcpy(data(), bytes, count);
+  _size = count;
+}
+
+// in the room of the buffer when no other slice is on it, else the slice moves to a new one.
+void BufferSlice::append(const char* bytes, size_t count)
+{
+  if (_buffer == NULL || room() < count || __atomic_load_n(&_buffer->refs, __ATOMIC_ACQUIRE) != 1)
+  {
+    BufferSlice fresh(_size + count);
+    if (_size > 0)
+      memcpy(fresh.data(), data(), _size);
+    fresh._size = _size;
+    *this = fresh;
+  }
+  memcpy(data() + _size, bytes, count);
+  _size += count;
+}
+
+void BufferSlice::clear()
+{
+  BufferPool::release(_buffer);
+  _buffer = NULL;
+  _offset = 0;
+  _size = 0;
+}
@@ -1,7 +1,10 @@
 #include "CGI.hpp"
 #include <cctype>
 #include "ServerManager.hpp"
+#include "Scan.hpp"
 #include <signal.h>
+#include <climits>
+#include <cstring>
 # define P_W	1
 # define P_R	0
 
@@ -16,7 +19,7 @@ CGI::CGI()
   cmd[2] = NULL;
   env = new char*[ENVCOUNT];
   pid = -1;
-  writeFD = -1;
+  timedOut = false;
   readFD = -1;
   exitStatus = -1;
 }
@@ -34,8 +37,8 @@ CGI::~CGI()
   delete []env;
   unlink(writeFilePath.c_str());
   unlink(readFilePath.c_str());
-  close (writeFD);
-  close (readFD);
+  if (readFD >= 0)
+    close (readFD);
 }
 
 void CGI::parseBody(HTTPResponse* res, size_t count)
@@ -43,50 +46,58 @@ void CGI::parseBody(HTTPResponse* res, size_t count)
   res->addHeader("Content-Length", ft_itos(FdGetFileSize(readFD) - count));
 }
 
-void CGI::parseHeader(HTTPResponse* res, std::string &message)
+// the '\r' of the first "\r\n" in [begin, end). end : none.
+static const char* findCRLF(const char* begin, const char* end)
 {
-  std::string key;
-  std::string buffer;
-  size_t endPOS;
-  std::string::iterator it = message.begin();
+  const char* newline = begin;
 
-  endPOS = message.find("\r\n\r\n") + 2;
-  if (endPOS == std::string::npos)
+  while ((newline = Scan::find(newline, end, '\n')) != end)
   {
-    throw(std::logic_error("cgi header syntax error"));
+    if (newline != begin && newline[-1] == '\r')
+    {
+      return (newline - 1);
+    }
+    newline++;
   }
-  for ( size_t i = 0; i != endPOS; ++i )
+  return (end);
+}
+
+// "key: value" lines, up to an empty one. (erased with it)
+void CGI::parseHeader(HTTPResponse* res, std::string &message)
+{
+  const char* const data = message.data();
+  const char* const end = data + message.size();
+  const char* line = data;
+
+  while (true)
   {
-    if (it[i] == '\r' && it[i + 1] == '\n')
+    const char* lineEnd = findCRLF(line, end);
+    if (lineEnd == end)
     {
-      if (!key.empty() && !buffer.empty())
-      {
-        res->addHeader(key, buffer);
-        buffer.clear();
-        key.clear();
-        i++;
-        continue;
-      }
-      else
-      {
-        throw (std::logic_error("header key, value error\n"));
-      }
+      throw(std::logic_error("cgi header syntax error"));
     }
-    if (it[i] == ':' && key.empty())
+    if (lineEnd == line)
     {
-      key = buffer;
-      buffer.clear();
-      if (it[i + 1] == ' ' || it[i + 1] == '\t')
-      {
-        i++;
-      }
+      break;
     }
-    else
+    const char* colon = Scan::find(line, lineEnd, ':');
+    if (colon == lineEnd || colon == line)
+    {
+      throw (std::logic_error("header key, value error\n"));
+    }
+    const char* value = colon + 1;
+    if (value != lineEnd && (*value == ' ' || *value == '\t'))
+    {
+      value++;
+    }
+    if (value == lineEnd)
     {
-      buffer += it[i];
+      throw (std::logic_error("header key, value error\n"));
     }
+    res->addHeader(std::string(line, colon), std::string(value, lineEnd));
+    line = lineEnd + 2;
   }
-  message.erase(0, endPOS + 2);
+  message.erase(0, line + 2 - data);
 }
 
 void CGI::parseStartLine(struct Context* context, std::string &message)
@@ -130,7 +141,7 @@ void CGI::parseStartLine(struct Context* context, std::string &message)
       buffer += *it;
     }
   }
-  context->res = new HTTPResponse(statuscode, statusmessage, context->manager->getServerName(context->addr.sin_port));
+  context->res = new HTTPResponse(statuscode, statusmessage, getSnapshot(context).getServerName(context->addr.sin_port));
   message.erase(0, end + 2);
 }
 
@@ -142,22 +153,7 @@ void CGI::parseCGI(struct Context* context, std::string& message)
   parseHeader(context->res, message);
   parseBody(context->res, count);
   context->res->setFd(context->cgi->readFD);
-}
-
-void CGI::attachFileWriteEvent(struct Context* context)
-{
-  context->cgi->writeFD = open(context->cgi->writeFilePath.c_str(),  O_WRONLY | O_CREAT | O_TRUNC, 0777);
-  struct Context* newContext = new struct Context(context->fd, context->addr, CGIWriteHandler, context->manager);
-  newContext->req = context->req;
-  newContext->cgi = context->cgi;
-  newContext->threadKQ = context->threadKQ;
-  newContext->connectContexts = context->connectContexts;
-  newContext->connectContexts->push_back(newContext);
-  newContext->pipeFD[0] = context->pipeFD[0];
-  newContext->pipeFD[1] = context->pipeFD[1];
-  struct kevent event;
-  EV_SET(&event, newContext->cgi->writeFD, EVFILT_WRITE, EV_ADD, 0, 0, newContext);
-  newContext->manager->attachNewEvent(newContext, event);
+  context->cgi->readFD = -1; // the response closes it from now on
 }
 
 void CGI::CGIfork(struct Context* context)
@@ -188,19 +184,12 @@ void CGI::CGIfork(struct Context* context)
 
 void CGI::CGIChildEvent(struct Context* context)
 {
-  struct Context* newContext = new struct Context(context->fd, context->addr, CGIChildHandler, context->manager);
-  struct kevent event;
-  newContext->cgi = context->cgi;
-  newContext->req = context->req;
-  newContext->threadKQ = context->threadKQ;
-  newContext->connectContexts = context->connectContexts;
-  newContext->connectContexts->push_back(newContext);
-  newContext->pipeFD[0] = context->pipeFD[0];
-  newContext->pipeFD[1] = context->pipeFD[1];
+  struct Context* newContext = getStage(context, STAGE_AUX, CGIChildHandler);
+  struct Event event;
   while (true)
   {
     newContext->cgi->CGIfork(newContext);
-    EV_SET(&event, newContext->cgi->pid, EVFILT_PROC, EV_ADD | EV_ENABLE, NOTE_EXIT | NOTE_EXITSTATUS, newContext->cgi->exitStatus, newContext);
+    setEvent(&event, newContext->cgi->pid, EVENT_PROC, EVENT_ADD | EVENT_ENABLE, 0, newContext);
     if (newContext->manager->attachNewEvent(newContext, event) < 0)
     {
       kill(newContext->cgi->pid, SIGKILL);
@@ -210,6 +199,7 @@ void CGI::CGIChildEvent(struct Context* context)
       break ;
     }
   }
+  armTimer(newContext, TIMEOUT_CGI);
 }
 
 void CGI::addEnv(std::string key, std::string val)
@@ -233,14 +223,15 @@ void CGI::addEnv(std::string key, std::string val)
 
 std::string CGI::getQueryFullPath(HTTPRequest& req)
 {
-  std::map<std::string, std::string>::iterator it;
+  const ArenaStringMap& query = req.getQuery();
+  ArenaStringMap::const_iterator it;
   std::string temp;
 
-  for (it = req.query.begin(); it != req.query.end(); ++it)
+  for (it = query.begin(); it != query.end(); ++it)
   {
-    temp.append(it->first);
+    temp.append(it->first.data(), it->first.size());
     temp.append("=");
-    temp.append(it->second);
+    temp.append(it->second.data(), it->second.size());
     temp.append("&");
   }
   return (temp);
@@ -258,7 +249,7 @@ std::string CGI::ft_getcwd()
   path.erase(path.find("/build"));
   return (path);
 }
-void CGI::getPATH(Server server, HTTPRequest& req)
+void CGI::getPATH(Server& server, HTTPRequest& req)
 {
   std::string requestpath;
   std::string requestcmd;
@@ -296,36 +287,46 @@ void CGI::getPATH(Server server, HTTPRequest& req)
   }
 }
 
-void CGI::setRequestEnv(HTTPRequest& req)
+// "Accept-Language" -> "HTTP_ACCEPT_LANGUAGE"
+static std::string envName(const char* name, size_t length)
 {
-  std::string schema = "HTTP_";
-  std::string key;
-  std::string val;
+  std::string key = "HTTP_";
   char c;
 
-  for (std::map<std::string, std::string>::const_iterator it = req.headers.begin();\
-        it != req.headers.end(); ++it)
+  for (size_t i = 0; i < length; ++i)
   {
-    key.assign(schema);
-    for (size_t i = 0; i < it->first.size(); ++i)
+    c = name[i];
+    if (islower(c))
     {
-      c = it->first[i];
-      if (islower(c))
-      {
-        c = toupper(c);
-      }
-      else if (c == '-')
-      {
-        c = '_';
-      }
-      key.append(&c, 1);
+      c = toupper(c);
+    }
+    else if (c == '-')
+    {
+      c = '_';
     }
-    val.assign(it->second);
-    addEnv(key, val);
+    key.append(&c, 1);
   }
+  return (key);
 }
 
-void CGI::setCGIenv(Server server, HTTPRequest& req, struct Context* context)
+void CGI::setRequestEnv(HTTPRequest& req)
+{
+  const char* head = req.head.data();
+
+  for (int name = 0; name < HD_UNKNOWN; ++name)
+  {
+    const HeaderField& field = req.known[name];
+    if (field.name.length != 0)
+      addEnv(envName(head + field.name.offset, field.name.length), req.string(field.value));
+  }
+  for (HeaderFields::const_iterator it = req.headers.begin();\
+        it != req.headers.end(); ++it)
+  {
+    addEnv(envName(head + it->name.offset, it->name.length), req.string(it->value));
+  }
+}
+
+void CGI::setCGIenv(Server& server, HTTPRequest& req, struct Context* context)
 {
   addEnv("SERVER_SOFTWARE", "webserv/1.1");
   addEnv("SERVER_PROTOCOL", "HTTP/1.1");
@@ -336,7 +337,7 @@ void CGI::setCGIenv(Server server, HTTPRequest& req, struct Context* context)
   addEnv("SCRIPT_NAME", "webserv/1.1");
   addEnv("QUERY_STRING", encodePercentEncoding(getQueryFullPath(req)));
   addEnv("REMOTE_ADDR", getClientIP(&context->addr));
-  addEnv("CONTENT_TYPE", req.headers.find("Content-Type")->second);
+  addEnv("CONTENT_TYPE", req.header(HD_CONTENT_TYPE));
   getPATH(server, req);
   setRequestEnv(req);
 }
@@ -345,31 +346,71 @@ void CGI::setFilePath()
 {
   std::string infilepath;
   std::string outfilepath;
-  static ssize_t fileCount;
+  static ssize_t nextFileCount;
+  // worker threads run CGI at the same time. (worker_threads)
+  const ssize_t fileCount = __sync_fetch_and_add(&nextFileCount, 1) % INT32_MAX;
 
-  if (fileCount == INT32_MAX)
-  {
-    fileCount = 0;
-  }
   infilepath.assign(ft_getcwd());
   infilepath.append("/tempfile/in");
   infilepath.append(ft_itos(fileCount));
   outfilepath.assign(ft_getcwd());
   outfilepath.append("/tempfile/out");
-  outfilepath.append(ft_itos(fileCount++));
+  outfilepath.append(ft_itos(fileCount));
   writeFilePath = infilepath;
   readFilePath = outfilepath;
 }
 
-void CGIProcess(struct Context* context)
+// the cgi of the request, before its body is read : the body goes to its input file as it arrives.
+// returns false when it is refused. (answered already)
+bool CGIPrepare(struct Context* context)
 {
-  context->cgi = new CGI();
   HTTPRequest& req = *context->req;
-  Server& server = context->manager->getMatchedServer(req);
+  Server& server = getSnapshot(context).getMatchedServer(req);
+
+  if (!acquireLoad(context, server, LOAD_CGI))
+  {
+    sendServiceUnavailable(context);
+    return (false);
+  }
+  context->cgi = new CGI();
 
   context->cgi->setCGIenv(server, req, context);
   context->cgi->setFilePath();
-  context->cgi->attachFileWriteEvent(context);
+  req.bodyFd = open(context->cgi->writeFilePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0777);
+  if (req.bodyFd < 0) // (the cgi would read an empty stdin)
+  {
+    printLog("error\t\t" + getClientIP(&context->addr) + "\t: cgi input file failed\n", PRINT_RED);
+    sendServerError(context);
+    return (false);
+  }
+  return (true);
+}
+
+// the body is read : the cgi starts once all of it is in its input file. (see writeFileHandle)
+void CGIProcess(struct Context* context)
+{
+  if (context->cgi == NULL && !CGIPrepare(context))
+    return ;
+  setState(context, CONN_CGI_RUNNING);
+  if (context->req->bodyFd >= 0 && !writeBody(context))
+    streamBody(context);
+  else if (context->req->bodyFailed)
+    sendServerError(context);
+  else
+    CGIStart(context);
+}
+
+// the input file is complete : the cgi reads it as its stdin.
+void CGIStart(struct Context* context)
+{
+  HTTPRequest& req = *context->req;
+
+  if (req.bodyFd >= 0)
+  {
+    close(req.bodyFd);
+    req.bodyFd = -1;
+  }
+  context->cgi->CGIChildEvent(context);
 }
 
 bool isCGIRequest(Location* loc)
@@ -0,0 +1,138 @@
+#include "ChunkedDecoder.hpp"
+#include <stdexcept>
+
+ChunkedDecoder::ChunkedDecoder() :
+  maxBodySize(static_cast<size_t>(-1)),
+  _state(CHUNK_SIZE),
+  _remaining(0),
+  _digits(0),
+  _lineBytes(0),
+  _trailerBytes(0),
+  _decoded(0)
+{
+
+}
+
+static int hexValue(char c)
+{
+  if (c >= '0' && c <= '9')
+    return (c - '0');
+  if (c >= 'a' && c <= 'f')
+    return (c - 'a' + 10);
+  if (c >= 'A' && c <= 'F')
+    return (c - 'A' + 10);
+  return (-1);
+}
+
+// one byte of the framing. (the chunk data is never walked through : see decode)
+void ChunkedDecoder::step(char c)
+{
+  switch (_state)
+  {
+    case CHUNK_SIZE:
+    {
+      const int value = hexValue(c);
+      if (value >= 0)
+      {
+        if (_digits == CHUNK_SIZE_DIGITS)
+          throw (std::logic_error("chunk size too long"));
+        _remaining = _remaining * 16 + value;
+        _digits++;
+        break;
+      }
+      if (_digits == 0)
+        throw (std::logic_error("chunk size error"));
+      if (c == ';' || c == ' ' || c == '\t')
+        _state = CHUNK_EXTENSION;
+      else if (c == '\r')
+        _state = CHUNK_SIZE_LF;
+      else
+        throw (std::logic_error("chunk size error"));
+      break;
+    }
+    case CHUNK_EXTENSION:
+      if (c == '\r')
+        _state = CHUNK_SIZE_LF;
+      else if (c == '\n')
+        throw (std::logic_error("chunk extension error"));
+      break;
+    case CHUNK_SIZE_LF:
+      if (c != '\n')
+        throw (std::logic_error("chunk size error"));
+      if (_remaining > maxBodySize - _decoded) // before any of it is read
+        throw (std::length_error("chunked body too large"));
+      _state = (_remaining == 0) ? CHUNK_TRAILER : CHUNK_DATA;
+      _lineBytes = 0;
+      break;
+    case CHUNK_DATA_CR:
+      if (c != '\r')
+        throw (std::logic_error("chunk data longer than its size"));
+      _state = CHUNK_DATA_LF;
+      break;
+    case CHUNK_DATA_LF:
+      if (c != '\n')
+        throw (std::logic_error("chunk data longer than its size"));
+      _state = CHUNK_SIZE;
+      _digits = 0;
+      _lineBytes = 0;
+      break;
+    case CHUNK_TRAILER:
+      _state = (c == '\r') ? CHUNK_END_LF : CHUNK_TRAILER_LINE;
+      break;
+    case CHUNK_TRAILER_LINE:
+      if (c == '\r')
+        _state = CHUNK_TRAILER_LF;
+      break;
+    case CHUNK_TRAILER_LF:
+      if (c != '\n')
+        throw (std::logic_error("trailer error"));
+      _state = CHUNK_TRAILER;
+      _lineBytes = 0;
+      break;
+    case CHUNK_END_LF:
+      if (c != '\n')
+        throw (std::logic_error("chunked end error"));
+      _state = CHUNK_DONE;
+      break;
+    default:
+      break;
+  }
+}
+
+size_t ChunkedDecoder::decode(const char* data, size_t size, const char** piece, size_t* pieceSize)
+{
+  size_t used = 0;
+
+  *piece = NULL;
+  *pieceSize = 0;
+  while (used < size && _state != CHUNK_DONE)
+  {
+    if (_state == CHUNK_DATA)
+    {
+      const size_t count = (_remaining < size - used) ? _remaining : size - used;
+      *piece = data + used;
+      *pieceSize = count;
+      _remaining -= count;
+      _decoded += count;
+      if (_remaining == 0)
+        _state = CHUNK_DATA_CR;
+      return (used + count);
+    }
+    if (_state >= CHUNK_TRAILER && ++_trailerBytes > CHUNK_TRAILER_MAX)
+      throw (std::logic_error("trailer too large"));
+    if (++_lineBytes > CHUNK_LINE_MAX)
+      throw (std::logic_error("chunk line too long"));
+    step(data[used++]);
+  }
+  return (used);
+}
+
+bool ChunkedDecoder::done() const
+{
+  return (_state == CHUNK_DONE);
+}
+
+size_t ChunkedDecoder::decoded() const
+{
+  return (_decoded);
+}
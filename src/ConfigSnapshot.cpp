@@ -0,0 +1,170 @@
+#include "ConfigSnapshot.hpp"
+#include "Parser.hpp"
+
+ConfigSnapshot::ConfigSnapshot(const std::vector<Server>& servers, unsigned long generation) :
+  GENERATION(generation),
+  _servers(servers),
+  _refCount(1)
+{
+}
+
+ConfigSnapshot::~ConfigSnapshot()
+{
+}
+
+// the caller already holds a reference. (ServerManager::acquireSnapshot otherwise)
+void ConfigSnapshot::retain()
+{
+  __atomic_add_fetch(&_refCount, 1, __ATOMIC_RELAXED);
+}
+
+void ConfigSnapshot::release(ConfigSnapshot* snapshot)
+{
+  if (snapshot == NULL)
+    return ;
+  if (__atomic_sub_fetch(&snapshot->_refCount, 1, __ATOMIC_ACQ_REL) == 0)
+    delete (snapshot);
+}
+
+std::vector<Server*> ConfigSnapshot::getListenServers()
+{
+  std::vector<Server*> servers;
+
+  for (
+          std::vector<Server>::iterator server = _servers.begin();
+          server != _servers.end();
+          ++server
+          )
+  {
+    bool isFirst = true;
+    for (
+        std::vector<Server>::iterator temp = _servers.begin();
+        temp != server;
+        ++temp
+        )
+    {
+      if ((*temp)._serverPort == (*server)._serverPort && (*temp)._serverName == (*server)._serverName)
+        throw (std::runtime_error("Same port and Same server\n"));
+      if ((*temp)._serverPort == (*server)._serverPort)
+        isFirst = false;
+    }
+    if (isFirst)
+      servers.push_back(&(*server));
+  }
+  return (servers);
+}
+
+Server* ConfigSnapshot::findListenServer(const struct sockaddr_in& addr)
+{
+  std::vector<Server*> servers = getListenServers();
+
+  for (size_t i = 0; i < servers.size(); ++i)
+  {
+    if (servers[i]->_socketAddr.sin_port == addr.sin_port
+        && servers[i]->_socketAddr.sin_addr.s_addr == addr.sin_addr.s_addr)
+      return (servers[i]);
+  }
+  return (NULL);
+}
+
+Server* ConfigSnapshot::findPortServer(in_port_t port)
+{
+  for (
+          std::vector<Server>::iterator it = _servers.begin();
+          it != _servers.end();
+          ++it
+          )
+  {
+    if (it->_socketAddr.sin_port == port)
+      return (&(*it));
+  }
+  return (NULL);
+}
+
+Server& ConfigSnapshot::getPortServer(in_port_t port)
+{
+  Server* server = findPortServer(port);
+
+  return ((server != NULL) ? *server : _servers[0]);
+}
+
+std::string ConfigSnapshot::getServerName(in_port_t port_num) const
+{
+  std::vector<Server>::const_iterator itr = this->_servers.begin();
+  while (itr != _servers.end())
+  {
+    if (itr->_socketAddr.sin_port == port_num) // if found target port
+    {
+      return (itr->_serverName);
+    }
+    itr++;
+  }
+  return (DEFAULT_SERVER_NAME);
+}
+
+Server& ConfigSnapshot::getMatchedServer(const HTTPRequest& req)
+{
+  const HeaderField* mit;
+  for (
+          std::vector<Server>::iterator it = _servers.begin();
+          it != _servers.end();
+          ++it
+          )
+  {
+    Server& server = *it;
+    std::string serverName = server._serverName + ':' + ft_itos(server._serverPort);
+    mit = req.findHeader(HD_HOST);
+    if (mit == NULL)
+    {
+      continue;
+    }
+    std::string host;
+    host.assign(req.string(mit->value));
+    if (host.find(':') == std::string::npos)
+    {
+      host += ":80";
+    }
+    if (host == serverName)
+    {
+      return (server);
+    }
+  }
+  // no matched host, then check port
+  for (
+          std::vector<Server>::iterator it = _servers.begin();
+          it != _servers.end();
+          ++it
+          )
+  {
+    Server& server = *it;
+    mit = req.findHeader(HD_HOST);
+    if (mit == NULL)
+    {
+      continue;
+    }
+    std::string host;
+    host.assign(req.string(mit->value));
+    std::string hostPort = host.substr(host.find(':') + 1);
+    if (server._serverPort == ft_stoi(hostPort))
+    {
+      return (server);
+    }
+  }
+  return (_servers[0]);
+}
+
+void ConfigSnapshot::takeSessions(const ConfigSnapshot& other)
+{
+  for (size_t i = 0; i < _servers.size(); ++i)
+  {
+    for (size_t j = 0; j < other._servers.size(); ++j)
+    {
+      if (_servers[i]._serverName == other._servers[j]._serverName
+          && _servers[i]._serverPort == other._servers[j]._serverPort)
+      {
+        _servers[i]._sessionStorage.assign(other._servers[j]._sessionStorage);
+        break ;
+      }
+    }
+  }
+}
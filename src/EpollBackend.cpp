@@ -0,0 +1,661 @@
+#include "EpollBackend.hpp"
+
+#ifdef WEBSERV_HAS_EPOLL
+
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <pthread.h>
+#include <stdexcept>
+#include <unistd.h>
+
+static FileDescriptor openPidFd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+  return (static_cast<FileDescriptor>(syscall(SYS_pidfd_open, pid, 0)));
+#else
+  (void)pid;
+  errno = ENOSYS;
+  return (FAILED);
+#endif
+}
+
+EpollBackend::EpollBackend() :
+        _signalFd(-1),
+        _sequence(0),
+        _flushedSequence(0)
+{
+  if ((_epoll = epoll_create1(EPOLL_CLOEXEC)) < 0)
+  {
+    throw (std::runtime_error("create epoll failed\n"));
+  }
+}
+
+EpollBackend::~EpollBackend()
+{
+  for (std::map<FileDescriptor, Watch>::iterator it = _watches.begin(); it != _watches.end(); ++it)
+  {
+    close(it->first);
+  }
+  if (_signalFd >= 0)
+    close(_signalFd);
+  close(_epoll);
+}
+
+FileDescriptor EpollBackend::getFd() const
+{
+  return (_epoll);
+}
+
+const char* EpollBackend::getName() const
+{
+  return ("epoll");
+}
+
+EpollBackend::FdEntry& EpollBackend::getEntry(FileDescriptor fd)
+{
+  if (_fdTable.size() <= static_cast<size_t>(fd))
+    _fdTable.resize(fd + 1);
+  return (_fdTable[fd]);
+}
+
+int EpollBackend::attach(const struct Event& change)
+{
+  switch (change.filter)
+  {
+    case EVENT_READ:
+    case EVENT_WRITE:
+      return (attachIO(change));
+    case EVENT_PROC:
+      return (attachProc(change));
+    case EVENT_TIMER:
+      return (attachTimer(change));
+  }
+  return (FAILED);
+}
+
+int EpollBackend::attachIO(const struct Event& change)
+{
+  const FileDescriptor fd = static_cast<FileDescriptor>(change.ident);
+
+  if (fd < 0 || fd == _epoll)
+    return (FAILED);
+  FdEntry& entry = getEntry(fd);
+  if ((change.flags & EVENT_ADD) && entry.alwaysReady)
+  {
+    // kqueue drops the registration on close(). check if the regular file was closed.
+    struct stat st;
+    if (fstat(fd, &st) == FAILED || st.st_dev != entry.dev || st.st_ino != entry.ino)
+      resetEntry(fd);
+    else if (change.filter == EVENT_READ)
+      entry.remain = getFileRemain(fd);
+  }
+  Interest& interest = (change.filter == EVENT_READ) ? entry.read : entry.write;
+  if (change.flags & EVENT_DELETE)
+  {
+    if (!interest.active)
+      return (FAILED);
+    interest.active = false;
+    queueChange(fd);
+    return (0);
+  }
+  if (change.flags & EVENT_ADD)
+  {
+    interest.active = true;
+    interest.enabled = true;
+    interest.clear = (change.flags & EVENT_CLEAR);
+    interest.oneshot = (change.flags & EVENT_ONESHOT);
+    interest.seq = ++_sequence;
+    interest.udata = change.udata;
+  }
+  else if (!interest.active)
+  {
+    return (FAILED);
+  }
+  if (change.flags & EVENT_ENABLE)
+    interest.enabled = true;
+  if (change.flags & EVENT_DISABLE)
+    interest.enabled = false;
+  queueChange(fd);
+  return (0);
+}
+
+// the interest table is updated at once. epoll_ctl() is called at flush(),
+// once per fd with the final state of both interests. (add + delete -> nothing)
+void EpollBackend::queueChange(FileDescriptor fd)
+{
+  FdEntry& entry = _fdTable[fd];
+
+  if (entry.dirty)
+    return ;
+  entry.dirty = true;
+  _changes.push_back(fd);
+}
+
+int EpollBackend::flush()
+{
+  int result = 0;
+
+  for (size_t i = 0; i < _changes.size(); ++i)
+  {
+    const FileDescriptor fd = _changes[i];
+
+    if (!_fdTable[fd].dirty) // detached
+      continue;
+    _fdTable[fd].dirty = false;
+    if (updateEntry(fd) == FAILED)
+      result = FAILED;
+  }
+  _changes.clear();
+  _flushedSequence = _sequence;
+  return (result);
+}
+
+// fd is closed right after this. delete its registrations now : a forked CGI child
+// may still hold a copy, and epoll keeps them until every copy is closed.
+void EpollBackend::detach(FileDescriptor fd)
+{
+  if (fd < 0 || _fdTable.size() <= static_cast<size_t>(fd))
+    return ;
+  resetEntry(fd);
+}
+
+void EpollBackend::resetEntry(FileDescriptor fd)
+{
+  FdEntry& entry = _fdTable[fd];
+
+  if (entry.inEpoll)
+    epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, NULL);
+  if (entry.alwaysReady)
+    _readyFds.erase(fd);
+  entry = FdEntry();
+}
+
+// the mask of the registration of fd. edge-triggered only if every interest in it is.
+uint32_t EpollBackend::getMask(const FdEntry& entry)
+{
+  uint32_t events = 0;
+  bool clear = true;
+
+  if (entry.read.active && entry.read.enabled)
+  {
+    events |= EPOLLIN | EPOLLRDHUP;
+    clear = clear && entry.read.clear;
+  }
+  if (entry.write.active && entry.write.enabled)
+  {
+    events |= EPOLLOUT;
+    clear = clear && entry.write.clear;
+  }
+  if (events != 0 && clear)
+    events |= EPOLLET;
+  return (events);
+}
+
+// apply both interests of fd to its registration : one epoll_ctl() with their combined mask.
+// the registration stays until detach(), disabled or deleted interests included : turning one on
+// or off again is a MOD. (an empty mask is edge-triggered : EPOLLHUP and EPOLLERR are reported anyway)
+int EpollBackend::updateEntry(FileDescriptor fd)
+{
+  FdEntry& entry = _fdTable[fd];
+  struct epoll_event ev;
+
+  if (!entry.read.active)
+    entry.read = Interest();
+  if (!entry.write.active)
+    entry.write = Interest();
+  if (!entry.read.active && !entry.write.active && !entry.inEpoll)
+  {
+    resetEntry(fd);
+    return (0);
+  }
+  if (entry.alwaysReady)
+    return (0);
+  memset(&ev, 0, sizeof(ev));
+  ev.data.fd = fd;
+  ev.events = getMask(entry);
+  if (entry.inEpoll)
+  {
+    if (ev.events == 0)
+      ev.events = EPOLLET;
+    if (epoll_ctl(_epoll, EPOLL_CTL_MOD, fd, &ev) == 0)
+      return (0);
+    // fd was closed (and maybe reused) since then. the kernel dropped its registration :
+    // an interest is stale unless it was added after the last flush.
+    entry.inEpoll = false;
+    if (entry.read.seq <= _flushedSequence)
+      entry.read = Interest();
+    if (entry.write.seq <= _flushedSequence)
+      entry.write = Interest();
+    if (!entry.read.active && !entry.write.active)
+    {
+      resetEntry(fd);
+      return (0);
+    }
+    ev.events = getMask(entry);
+  }
+  if (ev.events == 0) // added once an interest is enabled
+    return (0);
+  if (epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &ev) == 0
+      || (errno == EEXIST && epoll_ctl(_epoll, EPOLL_CTL_MOD, fd, &ev) == 0))
+  {
+    entry.inEpoll = true;
+    return (0);
+  }
+  if (errno == EPERM) // regular file : always writable, readable until EOF.
+  {
+    struct stat st;
+    if (fstat(fd, &st) == FAILED)
+      return (FAILED);
+    entry.alwaysReady = true;
+    entry.remain = getFileRemain(fd);
+    entry.dev = st.st_dev;
+    entry.ino = st.st_ino;
+    _readyFds.insert(fd);
+    return (0);
+  }
+  if (errno == EBADF) // closed before the change was submitted
+    resetEntry(fd);
+  return (FAILED);
+}
+
+int EpollBackend::watchFd(FileDescriptor fd, const Watch& watch)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  if (epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &ev) < 0)
+  {
+    close(fd);
+    return (FAILED);
+  }
+  _watches[fd] = watch;
+  return (0);
+}
+
+void EpollBackend::unwatchFd(FileDescriptor fd)
+{
+  epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, NULL);
+  _watches.erase(fd);
+  close(fd);
+}
+
+int EpollBackend::attachProc(const struct Event& change)
+{
+  const pid_t pid = static_cast<pid_t>(change.ident);
+  Watch watch;
+
+  watch.filter = EVENT_PROC;
+  watch.ident = change.ident;
+  watch.oneshot = true;
+  watch.udata = change.udata;
+  if (change.flags & EVENT_DELETE)
+  {
+    std::map<pid_t, FileDescriptor>::iterator it = _pidFds.find(pid);
+    if (it != _pidFds.end())
+    {
+      unwatchFd(it->second);
+      _pidFds.erase(it);
+      return (0);
+    }
+    return (_signalWatches.erase(pid) ? 0 : FAILED);
+  }
+  if (!(change.flags & EVENT_ADD))
+    return (0);
+  std::map<pid_t, FileDescriptor>::iterator it = _pidFds.find(pid);
+  if (it != _pidFds.end())
+  {
+    _watches[it->second] = watch;
+    return (0);
+  }
+  FileDescriptor pidFd = openPidFd(pid);
+  if (pidFd >= 0)
+  {
+    if (watchFd(pidFd, watch) < 0)
+      return (FAILED);
+    _pidFds[pid] = pidFd;
+    return (0);
+  }
+  if (errno != ENOSYS)
+    return (FAILED);
+  // kernel < 5.3 : SIGCHLD through signalfd. (only this thread blocks SIGCHLD)
+  if (_signalFd < 0)
+  {
+    sigset_t mask;
+    struct epoll_event ev;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    if ((_signalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+      return (FAILED);
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = _signalFd;
+    if (epoll_ctl(_epoll, EPOLL_CTL_ADD, _signalFd, &ev) < 0)
+      return (FAILED);
+  }
+  _signalWatches[pid] = watch;
+  // SIGCHLD may be delivered before the mask was set.
+  siginfo_t info;
+  memset(&info, 0, sizeof(info));
+  if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == pid)
+  {
+    struct Event event;
+    setEvent(&event, change.ident, EVENT_PROC, EVENT_EOF, 0, change.udata);
+    _pending.push_back(event);
+  }
+  return (0);
+}
+
+int EpollBackend::attachTimer(const struct Event& change)
+{
+  std::map<uintptr_t, FileDescriptor>::iterator it = _timers.find(change.ident);
+
+  if (change.flags & EVENT_DELETE)
+  {
+    if (it == _timers.end())
+      return (FAILED);
+    unwatchFd(it->second);
+    _timers.erase(it);
+    return (0);
+  }
+  if (!(change.flags & EVENT_ADD))
+    return (0);
+  FileDescriptor timerFd;
+  if (it != _timers.end())
+  {
+    timerFd = it->second;
+  }
+  else if ((timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+  {
+    return (FAILED);
+  }
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_sec = change.data / 1000;
+  spec.it_value.tv_nsec = (change.data % 1000) * 1000000;
+  if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+    spec.it_value.tv_nsec = 1; // zero disarms timerfd
+  if (!(change.flags & EVENT_ONESHOT))
+    spec.it_interval = spec.it_value;
+  if (timerfd_settime(timerFd, 0, &spec, NULL) < 0)
+  {
+    if (it == _timers.end())
+      close(timerFd);
+    return (FAILED);
+  }
+  Watch watch;
+  watch.filter = EVENT_TIMER;
+  watch.ident = change.ident;
+  watch.oneshot = (change.flags & EVENT_ONESHOT);
+  watch.udata = change.udata;
+  if (it != _timers.end())
+  {
+    _watches[timerFd] = watch;
+    return (0);
+  }
+  if (watchFd(timerFd, watch) < 0)
+    return (FAILED);
+  _timers[change.ident] = timerFd;
+  return (0);
+}
+
+bool EpollBackend::isStillInterested(const struct Event& event)
+{
+  if (event.filter == EVENT_PROC)
+  {
+    const pid_t pid = static_cast<pid_t>(event.ident);
+    std::map<pid_t, FileDescriptor>::iterator it = _pidFds.find(pid);
+    if (it != _pidFds.end())
+      return (_watches[it->second].udata == event.udata);
+    std::map<pid_t, Watch>::iterator sit = _signalWatches.find(pid);
+    return (sit != _signalWatches.end() && sit->second.udata == event.udata);
+  }
+  if (event.filter == EVENT_TIMER)
+  {
+    std::map<uintptr_t, FileDescriptor>::iterator it = _timers.find(event.ident);
+    return (it != _timers.end() && _watches[it->second].udata == event.udata);
+  }
+  const FileDescriptor fd = static_cast<FileDescriptor>(event.ident);
+  if (_fdTable.size() <= static_cast<size_t>(fd))
+    return (false);
+  const Interest& interest = (event.filter == EVENT_READ) ? _fdTable[fd].read : _fdTable[fd].write;
+  return (interest.active && interest.enabled && interest.udata == event.udata);
+}
+
+// remove one-shot registrations once they are handed to the caller.
+void EpollBackend::consumeInterest(const struct Event& event)
+{
+  if (event.filter == EVENT_PROC)
+  {
+    struct Event change;
+    setEvent(&change, event.ident, EVENT_PROC, EVENT_DELETE, 0, NULL);
+    attachProc(change);
+  }
+  else if (event.filter == EVENT_TIMER)
+  {
+    std::map<uintptr_t, FileDescriptor>::iterator it = _timers.find(event.ident);
+    if (it != _timers.end() && _watches[it->second].oneshot)
+    {
+      unwatchFd(it->second);
+      _timers.erase(it);
+    }
+  }
+  else
+  {
+    const FileDescriptor fd = static_cast<FileDescriptor>(event.ident);
+    Interest& interest = (event.filter == EVENT_READ) ? _fdTable[fd].read : _fdTable[fd].write;
+    if (interest.oneshot)
+    {
+      interest.active = false;
+      updateEntry(fd);
+    }
+  }
+}
+
+// edge-triggered event which did not fit in the caller's list.
+// MOD with the same mask makes epoll report it again on the next wait.
+void EpollBackend::rearm(const struct Event& event)
+{
+  const FileDescriptor fd = static_cast<FileDescriptor>(event.ident);
+  const FdEntry& entry = _fdTable[fd];
+
+  if (entry.inEpoll && (getMask(entry) & EPOLLET))
+    updateEntry(fd);
+}
+
+int EpollBackend::pushEvent(struct Event* events, int maxEvents, int count, const struct Event& event)
+{
+  if (count >= maxEvents)
+  {
+    if (event.filter == EVENT_PROC && _signalWatches.count(static_cast<pid_t>(event.ident)))
+      _pending.push_back(event);
+    else if (event.filter == EVENT_READ || event.filter == EVENT_WRITE)
+      rearm(event);
+    // pidfd is level-triggered, unread timerfd fires again.
+    return (count);
+  }
+  events[count] = event;
+  if (event.filter == EVENT_TIMER)
+  {
+    uint64_t expirations = 0;
+    if (read(_timers[event.ident], &expirations, sizeof(expirations)) < 0)
+      return (count);
+    events[count].data = static_cast<intptr_t>(expirations);
+  }
+  consumeInterest(event);
+  return (count + 1);
+}
+
+// one registration : the read and / or the write interest of fd.
+void EpollBackend::collectEpollEvent(const struct epoll_event& ev)
+{
+  const FileDescriptor fd = ev.data.fd;
+  struct Event event;
+
+  if (fd == _signalFd)
+  {
+    struct signalfd_siginfo info;
+    while (read(_signalFd, &info, sizeof(info)) > 0)
+      ;
+    collectExitedChild();
+    return ;
+  }
+  std::map<FileDescriptor, Watch>::iterator it = _watches.find(fd);
+  if (it != _watches.end())
+  {
+    const Watch& watch = it->second;
+    setEvent(&event, watch.ident, watch.filter, (watch.filter == EVENT_PROC) ? EVENT_EOF : 0, 0, watch.udata);
+    _collected.push_back(event);
+    return ;
+  }
+  if (ev.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+    collectIO(fd, EVENT_READ, ev.events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR));
+  if (ev.events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+    collectIO(fd, EVENT_WRITE, ev.events & (EPOLLHUP | EPOLLERR));
+}
+
+void EpollBackend::collectIO(FileDescriptor fd, EventFilter filter, bool eof)
+{
+  struct Event event;
+
+  if (fd < 0 || _fdTable.size() <= static_cast<size_t>(fd))
+    return ;
+  const Interest& interest = (filter == EVENT_READ) ? _fdTable[fd].read : _fdTable[fd].write;
+  if (!_fdTable[fd].inEpoll || !interest.active || !interest.enabled)
+    return ;
+  setEvent(&event, fd, filter, eof ? EVENT_EOF : 0, 0, interest.udata);
+  _collected.push_back(event);
+}
+
+bool EpollBackend::hasAlwaysReady()
+{
+  for (std::set<FileDescriptor>::iterator it = _readyFds.begin(); it != _readyFds.end(); ++it)
+  {
+    const FdEntry& entry = _fdTable[*it];
+    if (entry.write.active && entry.write.enabled)
+      return (true);
+    if (entry.read.active && entry.read.enabled && entry.remain != 0)
+      return (true);
+  }
+  return (false);
+}
+
+// kqueue reports a regular file readable while the offset is before EOF.
+// returns the remaining bytes, or FAILED if it can not be checked.
+off_t EpollBackend::getFileRemain(FileDescriptor fd)
+{
+  struct stat st;
+  off_t offset;
+
+  if (fstat(fd, &st) == FAILED || (offset = lseek(fd, 0, SEEK_CUR)) == FAILED)
+    return (FAILED);
+  return ((st.st_size > offset) ? st.st_size - offset : 0);
+}
+
+// the readiness of regular files is known without a system call. (see readFile)
+void EpollBackend::collectAlwaysReady()
+{
+  struct Event event;
+
+  for (std::set<FileDescriptor>::iterator it = _readyFds.begin(); it != _readyFds.end(); ++it)
+  {
+    const FdEntry& entry = _fdTable[*it];
+
+    if (entry.read.active && entry.read.enabled && entry.remain != 0)
+    {
+      setEvent(&event, *it, EVENT_READ, 0, (entry.remain > 0) ? static_cast<intptr_t>(entry.remain) : 0, entry.read.udata);
+      _collected.push_back(event);
+    }
+    if (entry.write.active && entry.write.enabled)
+    {
+      setEvent(&event, *it, EVENT_WRITE, 0, 0, entry.write.udata);
+      _collected.push_back(event);
+    }
+  }
+}
+
+// a regular file is read through here : what is left of it is counted down. (EOF : no more read event)
+ssize_t EpollBackend::readFile(FileDescriptor fd, void* buf, size_t size)
+{
+  const ssize_t readSize = read(fd, buf, size);
+
+  if (readSize < 0 || fd < 0 || _fdTable.size() <= static_cast<size_t>(fd) || !_fdTable[fd].alwaysReady)
+    return (readSize);
+  FdEntry& entry = _fdTable[fd];
+  if (readSize == 0 || (entry.remain > 0 && entry.remain <= readSize))
+    entry.remain = 0;
+  else if (entry.remain > 0)
+    entry.remain -= readSize;
+  return (readSize);
+}
+
+void EpollBackend::collectExitedChild()
+{
+  struct Event event;
+
+  for (std::map<pid_t, Watch>::iterator it = _signalWatches.begin(); it != _signalWatches.end(); ++it)
+  {
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    // WNOWAIT : the handler reaps the child with waitpid()
+    if (waitid(P_PID, it->first, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == it->first)
+    {
+      setEvent(&event, it->first, EVENT_PROC, EVENT_EOF, 0, it->second.udata);
+      _collected.push_back(event);
+    }
+  }
+}
+
+int EpollBackend::wait(struct Event* events, int maxEvents, int timeoutMs)
+{
+  int count = 0;
+
+  if (maxEvents <= 0)
+    return (FAILED);
+  flush();
+  // (1) events left by the previous call. the interest may be gone since then.
+  while (!_pending.empty() && count < maxEvents)
+  {
+    const struct Event event = _pending.front();
+    _pending.pop_front();
+    if (isStillInterested(event))
+    {
+      events[count++] = event;
+      consumeInterest(event);
+    }
+  }
+  if (count > 0)
+    return (count);
+  if (_epollEvents.size() < static_cast<size_t>(maxEvents))
+    _epollEvents.resize(maxEvents);
+  do
+  {
+    // (2) kernel events. do not block while a regular file is waiting.
+    int readyCount = epoll_wait(_epoll, &_epollEvents[0], maxEvents, hasAlwaysReady() ? 0 : timeoutMs);
+    if (readyCount < 0)
+      return ((errno == EINTR) ? 0 : FAILED);
+    _collected.clear();
+    for (int i = 0; i < readyCount; ++i)
+    {
+      collectEpollEvent(_epollEvents[i]);
+    }
+    // (3) regular files
+    collectAlwaysReady();
+    for (size_t i = 0; i < _collected.size(); ++i)
+    {
+      count = pushEvent(events, maxEvents, count, _collected[i]);
+    }
+  } while (count == 0 && timeoutMs < 0);
+  return (count);
+}
+
+#endif //WEBSERV_HAS_EPOLL
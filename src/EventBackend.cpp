@@ -0,0 +1,35 @@
+#include "EventBackend.hpp"
+#include "EpollBackend.hpp"
+#include "IoUringBackend.hpp"
+#include "KqueueBackend.hpp"
+#include <stdexcept>
+#include <unistd.h>
+
+ssize_t EventBackend::readFile(FileDescriptor fd, void* buf, size_t size)
+{
+  return (read(fd, buf, size));
+}
+
+ssize_t EventBackend::receive(FileDescriptor fd, void* buf, size_t size)
+{
+  return (read(fd, buf, size));
+}
+
+EventBackend* EventBackend::create(const std::string& name)
+{
+  const bool isDefault = (name.empty() || name == "auto");
+
+#ifdef WEBSERV_HAS_EPOLL
+  if (isDefault || name == "epoll")
+    return (new EpollBackend());
+#endif
+#ifdef WEBSERV_HAS_IO_URING
+  if (name == "io_uring")
+    return (new IoUringBackend());
+#endif
+#ifdef WEBSERV_HAS_KQUEUE
+  if (isDefault || name == "kqueue")
+    return (new KqueueBackend());
+#endif
+  throw (std::runtime_error("event backend not supported : " + name + "\n"));
+}
@@ -0,0 +1,150 @@
+#include "HTTPRequest.hpp"
+#include <cstring>
+#include <strings.h>
+#include <unistd.h>
+
+HTTPRequest::HTTPRequest(Arena* _arena) :
+  arena(_arena),
+  body(NULL),
+  received(0),
+  bodyFd(-1),
+  bodyFailed(false),
+  accepted(false),
+  method(UNDEFINED),
+  headers(ArenaAllocator<HeaderField>(_arena)),
+  url(ArenaAllocator<char>(_arena)),
+  contentLength(0),
+  chunkedFlag(false),
+  dispatched(false),
+  status(READING),
+  errorCode(ST_BAD_REQUEST),
+  checkLevel(STARTLINE),
+  lineStart(0),
+  scanned(0),
+  _query(std::less<ArenaString>(), ArenaAllocator<char>(_arena)),
+  _queryParsed(false)
+{
+  target.offset = 0;
+  target.length = 0;
+  version.offset = 0;
+  version.length = 0;
+  memset(known, 0, sizeof(known));
+  headers.reserve(HEADER_FIELDS_RESERVED);
+}
+
+HTTPRequest::~HTTPRequest()
+{
+  if (body != NULL)
+    delete (body);
+  if (bodyFd >= 0)
+    close(bodyFd);
+  if (!bodyPath.empty()) // the body did not complete : the target is left as it was
+    unlink(bodyPath.c_str());
+}
+
+std::string HTTPRequest::string(const HeadSlice& slice) const
+{
+  return (std::string(head.data() + slice.offset, slice.length));
+}
+
+// a known name goes to its slot (a repeated one replaces it), the others to the list.
+// two different Content-Length : the size of the body depends on which one is read, and a proxy in
+// front may have read the other one. (request smuggling) the same value twice is one.
+bool HTTPRequest::addHeader(const HeaderField& field)
+{
+  const KnownHeader name = HeaderTable::lookup(head.data() + field.name.offset, field.name.length);
+
+  if (name == HD_UNKNOWN)
+  {
+    headers.push_back(field);
+    return (true);
+  }
+  const HeaderField& previous = known[name];
+  if (name == HD_CONTENT_LENGTH && previous.name.length != 0
+      && (previous.value.length != field.value.length
+          || memcmp(head.data() + previous.value.offset, head.data() + field.value.offset, field.value.length) != 0))
+    return (false);
+  known[name] = field;
+  return (true);
+}
+
+const HeaderField* HTTPRequest::findHeader(KnownHeader name) const
+{
+  return (known[name].name.length != 0 ? &known[name] : NULL);
+}
+
+const HeaderField* HTTPRequest::findHeader(const char* name) const
+{
+  const size_t length = strlen(name);
+  const KnownHeader header = HeaderTable::lookup(name, length);
+
+  if (header != HD_UNKNOWN)
+    return (findHeader(header));
+  for (size_t i = headers.size(); i > 0; --i)
+  {
+    const HeaderField& field = headers[i - 1];
+    if (field.name.length == length && strncasecmp(head.data() + field.name.offset, name, length) == 0)
+      return (&field);
+  }
+  return (NULL);
+}
+
+std::string HTTPRequest::header(KnownHeader name) const
+{
+  const HeaderField* field = findHeader(name);
+
+  return (field != NULL ? string(field->value) : std::string());
+}
+
+std::string HTTPRequest::header(const char* name) const
+{
+  const HeaderField* field = findHeader(name);
+
+  return (field != NULL ? string(field->value) : std::string());
+}
+
+// map[key] = value, without a default constructed (heap) value.
+static void setField(ArenaStringMap& map, const ArenaString& key, const ArenaString& value)
+{
+  ArenaStringMap::iterator it = map.lower_bound(key);
+
+  if (it != map.end() && it->first == key)
+    it->second = value;
+  else
+    map.insert(it, ArenaStringMap::value_type(key, value));
+}
+
+const ArenaStringMap& HTTPRequest::getQuery()
+{
+  if (_queryParsed)
+    return (_query);
+  _queryParsed = true;
+  if (target.length == 0)
+    return (_query);
+  const char* sent = head.data() + target.offset;
+  const char* mark = static_cast<const char*>(memchr(sent, '?', target.length));
+  if (mark == NULL)
+    return (_query);
+  const std::string decoded = decodePercentEncoding(std::string(mark + 1, sent + target.length));
+  const ArenaAllocator<char> allocator(arena);
+  const char* word = decoded.data();
+  const char* end = decoded.data() + decoded.size();
+  ArenaString key(allocator);
+
+  for (const char* it = word; it != end; ++it)
+  {
+    if (*it == '&')
+    {
+      setField(_query, key, ArenaString(word, it, allocator));
+      key.clear();
+      word = it + 1;
+    }
+    else if (*it == '=' && key.size())
+    {
+      key.assign(word, it);
+      word = it + 1;
+    }
+  }
+  setField(_query, key, ArenaString(word, end, allocator));
+  return (_query);
+}
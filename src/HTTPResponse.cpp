@@ -1,5 +1,6 @@
 #include "HTTPResponse.hpp"
 #include "ServerManager.hpp"
+#include <cstring>
 
 /**----------------------
  * * HeaderType         |
@@ -80,7 +81,8 @@ std::string ft_itos_width(int num, int minimum_width)
 std::string HeaderType::getDate()
 {
   time_t curTime = time(NULL);          // get current time info
-  struct tm* pLocal = gmtime(&curTime); // convert to struct for easy use
+  struct tm tmBuf;
+  struct tm* pLocal = gmtime_r(&curTime, &tmBuf); // convert to struct for easy use
   if (pLocal == NULL)
   {
     return ("null");
@@ -95,7 +97,8 @@ std::string HeaderType::getDate()
 std::string HeaderType::getDateByYearOffset(int year_diff)
 {
   time_t curTime = time(NULL);          // get current time info
-  struct tm* pLocal = gmtime(&curTime); // convert to struct for easy use
+  struct tm tmBuf;
+  struct tm* pLocal = gmtime_r(&curTime, &tmBuf); // convert to struct for easy use
   if (pLocal == NULL)
   {
     return ("null");
@@ -110,7 +113,8 @@ std::string HeaderType::getDateByYearOffset(int year_diff)
 std::string HeaderType::getDateByHourOffset(int hour_diff)
 {
   time_t curTime = time(NULL);          // get current time info
-  struct tm* pLocal = gmtime(&curTime); // convert to struct for easy use
+  struct tm tmBuf;
+  struct tm* pLocal = gmtime_r(&curTime, &tmBuf); // convert to struct for easy use
   if (pLocal == NULL)
   {
     return ("null");
@@ -318,7 +322,7 @@ HTTPResponse::HTTPResponse(const int& statusCode, const std::string& statusMessa
         :
         HTTPResponseHeader("HTTP/1.1", statusCode, statusMessage, serverName),
         _readFD(-1),
-        _writeFD(-1)
+        _outputBufferSize(DEFAULT_OUTPUT_BUFFER_SIZE)
 {
 }
 
@@ -326,8 +330,6 @@ HTTPResponse::~HTTPResponse()
 {
   if (_readFD > 0)
     close(_readFD);
-  if (_writeFD > 0)
-    close(_writeFD);
 }
 
 void HTTPResponse::setFd(const FileDescriptor& fd)
@@ -351,9 +353,11 @@ void HTTPResponse::sendToClient(struct Context* context)
   // 인증된 세션의 경우 화면을 이동해도 로그인이 풀리지 않고 로그아웃하기 전까지 유지.
   if (this->getHeader().getStatusCode() >= 400)
     this->addHeader("Connection", "close");
+  else if (context->manager->isStopping()) // the connection is closed once this response is sent
+    this->addHeader("Connection", "close");
 
   // * (0) Handle Cookie
-  Server& server = context->manager->getMatchedServer(*context->req);
+  Server& server = getSnapshot(context).getMatchedServer(*context->req);
   server._sessionStorage.clearExpiredID(); // clear expired session.
   int sessionStatus = server.getSessionStatus(*context->req);
   if (sessionStatus == SESSION_UNSET) // create session_id and pass to client
@@ -376,47 +380,55 @@ void HTTPResponse::sendToClient(struct Context* context)
 
 
   // * (1) Send Header
-  struct Context* newSendContext = new struct Context(context->fd, context->addr, socketSendHandler, context->manager);
-  newSendContext->connectContexts = context->connectContexts;
-  newSendContext->connectContexts->push_back(newSendContext);
-  newSendContext->res = this;
-  newSendContext->pipeFD[0] = context->pipeFD[0];
-  newSendContext->pipeFD[1] = context->pipeFD[1];
+  setState(context, CONN_SEND_HEADER);
+  struct Context* newSendContext = getStage(context, STAGE_SEND, socketSendHandler);
 
   // add header content
   std::string header = this->getHeader().toString() + "\n";
-  newSendContext->ioBuffer = new char[header.size()];
-  memmove(newSendContext->ioBuffer, header.c_str(), header.size());
-  newSendContext->bufferSize = header.size();
-  newSendContext->threadKQ = context->threadKQ;
-  newSendContext->req = context->req;
-
-  struct kevent event;
-  EV_SET(&event, newSendContext->fd, EVFILT_WRITE, EV_ADD | EV_CLEAR, 0, 0, newSendContext);
-  context->manager->attachNewEvent(newSendContext, event);
+  newSendContext->ioBuffer.append(header.c_str(), header.size()); // (after the responses waiting, if any)
+  _outputBufferSize = server._outputBufferSize;
+
+  struct Event event;
   if (context->res->_status_code >= 400)
   {
-    EV_SET(&event, newSendContext->fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+    setEvent(&event, newSendContext->fd, EVENT_READ, EVENT_DELETE, 0, NULL);
     context->manager->attachNewEvent(newSendContext, event);
   }
-  // * (2) Send Body
-  if (this->getFd() >= 0 && this->getContentLength() > 0 && this->getStatusCode() != ST_NO_CONTENT)
+  // * (2) Send Body : the header waits for its first chunk, as socketSendHandler would have it wait.
+  // (the socket is asked for once there is something to send with it)
+  if (isBodyLeft(newSendContext) && newSendContext->ioBuffer.size() < SEND_COALESCE_MAX)
+  {
+    readBody(newSendContext);
+  }
+  else
   {
-    struct Context* newReadContext = new struct Context(context->fd, context->addr, bodyFdReadHandler, context->manager);
-    newReadContext->connectContexts = context->connectContexts;
-    newReadContext->connectContexts->push_back(newReadContext);
-    newReadContext->res = this;
-    newReadContext->req = context->req;
-    newReadContext->threadKQ = context->threadKQ;
-    newReadContext->pipeFD[0] = context->pipeFD[0];
-    newReadContext->pipeFD[1] = context->pipeFD[1];
-    this->_readFD = this->_fileFd;
-    struct kevent _event;
-    EV_SET(&_event, newReadContext->res->_fileFd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, newReadContext);
-    context->manager->attachNewEvent(newReadContext, _event);
+    setEvent(&event, newSendContext->fd, EVENT_WRITE, EVENT_ADD | EVENT_CLEAR, 0, newSendContext);
+    context->manager->attachNewEvent(newSendContext, event);
   }
   printLog(methodToString(context->req->method)  + "\t\t" + getClientIP(&context->addr) + '\t' + ft_itos(context->res->_status_code) + '\n', ((int)context->res->_status_code < 400) ? PRINT_BLUE : PRINT_MAGENTA);
-  context->req = NULL;
+  armTimer(context, TIMEOUT_SEND);
+}
+
+// the interim response of "Expect: 100-continue" : the client sends the body once it has it.
+// it goes out alone, before the response. (no response yet : see socketSendHandler)
+void HTTPResponse::sendContinue(struct Context* context)
+{
+  static const char CONTINUE[] = "HTTP/1.1 100 Continue\r\n\r\n";
+  struct Context* newSendContext = getStage(context, STAGE_SEND, socketSendHandler);
+
+  newSendContext->ioBuffer.append(CONTINUE, sizeof(CONTINUE) - 1);
+  struct Event event;
+  setEvent(&event, newSendContext->fd, EVENT_WRITE, EVENT_ADD | EVENT_CLEAR, 0, newSendContext);
+  context->manager->attachNewEvent(newSendContext, event);
+}
+
+// the body of the response is not read to the end yet. (context : the send stage)
+bool HTTPResponse::isBodyLeft(struct Context* context)
+{
+  const HTTPResponse* res = context->res;
+
+  return (res != NULL && res->_fileFd > 0 && res->getContentLength() > context->totalIOSize
+          && res->getStatusCode() != ST_NO_CONTENT);
 }
 
 void HTTPResponse::socketSendHandler(struct Context* context)
@@ -425,77 +437,104 @@ void HTTPResponse::socketSendHandler(struct Context* context)
   {
     printLog("sk send handler called\n", PRINT_CYAN);
   }
-  if (context->ioBuffer == NULL)
+  if (context->ioBuffer.data() == NULL) // sent already (same batch)
   {
     return ;
   }
+  HTTPResponse* res = context->res;
+  const bool bodyLeft = isBodyLeft(context);
+  // small pieces go out together (one send) : the header waits for the first chunk of the body,
+  // and the end of a response for the response of the next request when it is read already. (pipelining)
+  if (res != NULL && context->ioBuffer.size() < SEND_COALESCE_MAX)
+  {
+    if (bodyLeft && context->totalIOSize == 0)
+    {
+      if (context->connectContexts->front()->state != CONN_SEND_BODY) // (not asked yet)
+        readBody(context);
+      return ;
+    }
+    if (!bodyLeft && res->_status_code < 400 && !context->manager->isStopping() && isNextRequestRead(context))
+    {
+      completeResponse(context);
+      return ;
+    }
+  }
   // 이 콜백은 socekt send 가능한 시점에서 호출되기 때문에, 이대로만 사용하면 된다.
   ssize_t sendSize;
-  if ((sendSize = send(context->fd, context->ioBuffer, context->bufferSize, MSG_DONTWAIT)) < 0)
+  if ((sendSize = send(context->fd, context->ioBuffer.data(), context->ioBuffer.size(), MSG_DONTWAIT)) < 0)
   {
     if (DEBUG_MODE)
     {
       printLog(strerror(errno), PRINT_YELLOW);
-      std::cout << '\n' << context->bufferSize << "\n";
+      std::cout << '\n' << context->ioBuffer.size() << "\n";
       printLog("error: " + getClientIP(&context->addr) + " : send failed\n", PRINT_RED);
     }
     return;
   }
-  // partial send handle
-  if (sendSize < static_cast<ssize_t>(context->bufferSize))
+  armTimer(context, TIMEOUT_SEND, TIMEOUT_SEND); // progress
+  context->ioBuffer.consume(sendSize);
+  if (!context->ioBuffer.empty()) // partial send : the rest is sent from where it is.
   {
-    memmove(context->ioBuffer, &context->ioBuffer[sendSize], context->bufferSize - sendSize);
-    context->bufferSize = context->bufferSize - sendSize;
+    return ;
   }
+  // give back used buffer
+  context->ioBuffer.clear();
+  if (res == NULL) // responses done before, which waited for one that is not ready (see completeResponse)
+  {
+    struct Event ev[1];
+    setEvent(ev, context->fd, EVENT_WRITE, EVENT_DELETE, 0, NULL);
+    context->manager->attachNewEvent(context, ev[0]);
+    return ;
+  }
+  if (bodyLeft)
+    readBody(context);
   else
+    completeResponse(context);
+}
+
+// enable read event : the header or the last chunk is sent, read the next one.
+void HTTPResponse::readBody(struct Context* context)
+{
+  setState(context, CONN_SEND_BODY);
+  struct Context* newReadContext = getStage(context, STAGE_BODY, bodyFdReadHandler);
+  newReadContext->totalIOSize = context->totalIOSize;
+  newReadContext->res->_readFD = context->res->_fileFd;
+  struct Event _event;
+  setEvent(&_event, newReadContext->res->_fileFd, EVENT_READ, EVENT_ADD | EVENT_ENABLE, 0, newReadContext);
+  context->manager->attachNewEvent(newReadContext, _event);
+}
+
+// the whole response is sent, or waits in ioBuffer for the next one. (see socketSendHandler)
+void HTTPResponse::completeResponse(struct Context* context)
+{
+  const bool sent = context->ioBuffer.empty();
+
+  // if bad request, close connection
+  if (context->res->_status_code >= 400)
   {
-    // enable read event
-    if (context->res->_fileFd > 0 && context->res->getContentLength() >  context->totalIOSize)
-    {
-      struct Context* newReadContext = new struct Context(context->fd, context->addr, bodyFdReadHandler, context->manager);
-      newReadContext->res = context->res;
-      newReadContext->threadKQ = context->threadKQ;
-      newReadContext->totalIOSize = context->totalIOSize;
-      newReadContext->connectContexts = context->connectContexts;
-      newReadContext->pipeFD[0] = context->pipeFD[0];
-      newReadContext->pipeFD[1] = context->pipeFD[1];
-      newReadContext->connectContexts->push_back(newReadContext);
-      newReadContext->res->_readFD = context->res->_fileFd;
-      struct kevent _event;
-      EV_SET(&_event, newReadContext->res->_fileFd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, newReadContext);
-      context->manager->attachNewEvent(newReadContext, _event);
-    }
-    else
-    {
-      if (context->res->getContentLength() == 0 || context->res->getContentLength() >= context->totalIOSize)
-      {
-        if (context->res->_readFD > 0)
-        {
-          close(context->res->_readFD);
-          context->res->_readFD = -1;
-        }
-        if (context->res->_writeFD > 0)
-        {
-          close(context->res->_writeFD);
-          context->res->_writeFD = -1;
-        }
-      }
-      // if bad request, close connection
-      if (context->res->_status_code >= 400)
-      {
-        shutdown(context->fd, SHUT_RDWR);
-        struct kevent ev[1];
-        EV_SET(ev, context->fd, EVFILT_READ, EV_ADD, 0, 0, context);
-        context->manager->attachNewEvent(context, ev[0]);
-      }
-      // delete sk event
-      struct kevent ev[1];
-      EV_SET(ev, context->fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
-      context->manager->attachNewEvent(context, ev[0]);
-    }
-    // delete used buffer
-    delete[] (context->ioBuffer);
-    context->ioBuffer = NULL;
+    shutdown(context->fd, SHUT_RDWR);
+    struct Event ev[1];
+    setEvent(ev, context->fd, EVENT_READ, EVENT_ADD | EVENT_CLEAR, 0, context);
+    context->manager->attachNewEvent(context, ev[0]);
+  }
+  if (context->res->_status_code >= 400 || context->manager->isStopping()) // ("Connection: close")
+    cancelPipeline(context);
+  armTimer(context, TIMEOUT_KEEPALIVE, TIMEOUT_SEND);
+  releaseLoad(context, LOAD_REQUESTS);
+  if (sent) // delete sk event
+  {
+    struct Event ev[1];
+    setEvent(ev, context->fd, EVENT_WRITE, EVENT_DELETE, 0, NULL);
+    context->manager->attachNewEvent(context, ev[0]);
+  }
+  // the response fds are closed with it. (a file still being written is flushed first)
+  // the next request read is served from there.
+  completeRequest(context);
+  if (!sent && context->res == NULL) // the next response is not ready yet : the waiting ones go alone
+  {
+    struct Event ev[1];
+    setEvent(ev, context->fd, EVENT_WRITE, EVENT_ADD | EVENT_CLEAR, 0, context);
+    context->manager->attachNewEvent(context, ev[0]);
   }
 }
 
@@ -505,51 +544,43 @@ void HTTPResponse::bodyFdReadHandler(struct Context* context)
   {
     printLog("file read handler called\n", PRINT_CYAN);
   }
-  char* buffer = new char[BUFFER_SIZE];
+  if (context->res == NULL || context->res->_fileFd < 0) // read already (same batch)
+    return ;
+  BufferSlice buffer(context->res->_outputBufferSize);
 
-  ssize_t current_rd_size = read(context->res->_fileFd, buffer, BUFFER_SIZE);
+  ssize_t current_rd_size = context->manager->getContextBackend(context)->readFile(context->res->_fileFd, buffer.data(), context->res->_outputBufferSize);
   if (current_rd_size < 0)
   {
     if (DEBUG_MODE)
     {
       printLog("error: client: " + getClientIP(&context->addr) + " : read failed\n", PRINT_RED);
     }
-    delete[] (buffer);
-    buffer = NULL;
   }
   else // 데이터가 들어왔다면, 소켓에 버퍼에 있는 데이터를 전송하는 socket send event를 등록.
   {
     context->totalIOSize += current_rd_size; // 읽은 길이를 누적.
     // Content_length와 누적 읽은 길이가 같아지면 file_fd 닫고 file_fd에 -1대입.
-    bool is_read_finished = false;
-    if (context->totalIOSize >= context->res->getContentLength())
+    if (context->totalIOSize >= context->res->getContentLength() || current_rd_size == 0) // (0 : shorter than announced)
     {
       if (context->pipeFD[1] > 0)
         close(context->pipeFD[1]);
       context->res->_fileFd = -1;   // socketSendHandler가 file_fd가 -1이면 소켓을 종료.
-      is_read_finished = true; // 마지막에 context delete하기 위함.
     }
-    // ResponseContext를 만들어서 넘긴다.
-    struct kevent event;
-    struct Context* newSendContext = new struct Context(context->fd, context->addr, socketSendHandler, context->manager);
-    newSendContext->connectContexts = context->connectContexts;
-    newSendContext->connectContexts->push_back(newSendContext);
-    newSendContext->res = context->res;
-    newSendContext->ioBuffer = buffer;
-    newSendContext->threadKQ = context->threadKQ;
-    newSendContext->bufferSize = current_rd_size;
+    // send stage of the connection에 넘긴다.
+    struct Event event;
+    struct Context* newSendContext = getStage(context, STAGE_SEND, socketSendHandler);
+    buffer.fill(current_rd_size);
+    if (newSendContext->ioBuffer.empty())
+      newSendContext->ioBuffer = buffer; // read into, sent from : no copy
+    else // (the header, or the responses before, wait there)
+      newSendContext->ioBuffer.append(buffer.data(), buffer.size());
     newSendContext->totalIOSize = context->totalIOSize;
-    newSendContext->pipeFD[0] = context->pipeFD[0];
-    newSendContext->pipeFD[1] = context->pipeFD[1];
-    EV_SET(&event, context->fd, EVFILT_WRITE, EV_ADD | EV_CLEAR, 0, 0, newSendContext);
+    setEvent(&event, context->fd, EVENT_WRITE, EVENT_ADD | EVENT_CLEAR, 0, newSendContext);
     context->manager->attachNewEvent(newSendContext, event);
-    // read handler가 중복 호출 되는 것을 방지함
-    if (!is_read_finished)
-    {
-      struct kevent ev[1];
-      EV_SET(ev, context->res->_fileFd, EVFILT_READ, EV_DISABLE, 0, 0, context);
-      context->manager->attachNewEvent(context, ev[0]);
-    }
+    // read handler가 중복 호출 되는 것을 방지함 (socketSendHandler enables it again for the next chunk)
+    struct Event ev[1];
+    setEvent(ev, context->res->_readFD, EVENT_READ, EVENT_DISABLE, 0, context);
+    context->manager->attachNewEvent(context, ev[0]);
   }
 }
 
@@ -0,0 +1,104 @@
+#include "HeaderTable.hpp"
+#include <strings.h>
+
+const HeaderTable::Name HeaderTable::NAMES[HD_UNKNOWN] = {
+  {"Host",                       4},
+  {"Content-Length",             14},
+  {"Transfer-Encoding",          17},
+  {"Content-Type",               12},
+  {"Connection",                 10},
+  {"Cookie",                     6},
+  {"Expect",                     6},
+  {"Accept",                     6},
+  {"Accept-Encoding",            15},
+  {"Accept-Language",            15},
+  {"Accept-Charset",             14},
+  {"User-Agent",                 10},
+  {"Referer",                    7},
+  {"Authorization",              13},
+  {"Cache-Control",              13},
+  {"Pragma",                     6},
+  {"If-Modified-Since",          17},
+  {"If-None-Match",              13},
+  {"If-Match",                   8},
+  {"If-Unmodified-Since",        19},
+  {"Range",                      5},
+  {"If-Range",                   8},
+  {"Origin",                     6},
+  {"Upgrade",                    7},
+  {"Keep-Alive",                 10},
+  {"TE",                         2},
+  {"Date",                       4},
+  {"Via",                        3},
+  {"Forwarded",                  9},
+  {"X-Forwarded-For",            15},
+  {"X-Real-IP",                  9},
+  {"Content-Encoding",           16},
+  {"DNT",                        3},
+  {"Sec-Fetch-Mode",             14},
+  {"Sec-Fetch-Site",             14},
+  {"Sec-Fetch-Dest",             14},
+  {"Sec-Fetch-User",             14},
+  {"Upgrade-Insecure-Requests",  25}
+};
+
+// hash(name) -> the one known name which may be there. made by trying multipliers until
+// every name of NAMES had a slot of its own.
+const unsigned char HeaderTable::SLOTS[HEADER_TABLE_SLOTS] = {
+  HD_UNKNOWN,                   HD_CONTENT_ENCODING,          HD_UNKNOWN,                   HD_UNKNOWN,
+  HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,                   HD_COOKIE,
+  HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,                   HD_ORIGIN,
+  HD_UNKNOWN,                   HD_UNKNOWN,                   HD_PRAGMA,                    HD_SEC_FETCH_DEST,
+  HD_UPGRADE_INSECURE_REQUESTS, HD_USER_AGENT,                HD_UNKNOWN,                   HD_KEEP_ALIVE,
+  HD_UNKNOWN,                   HD_VIA,                       HD_UNKNOWN,                   HD_UNKNOWN,
+  HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,
+  HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,
+  HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,
+  HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,                   HD_X_FORWARDED_FOR,
+  HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,
+  HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,                   HD_SEC_FETCH_SITE,
+  HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,                   HD_IF_RANGE,
+  HD_HOST,                      HD_TRANSFER_ENCODING,         HD_UNKNOWN,                   HD_UNKNOWN,
+  HD_DATE,                      HD_UNKNOWN,                   HD_ACCEPT_LANGUAGE,           HD_UNKNOWN,
+  HD_IF_MODIFIED_SINCE,         HD_UNKNOWN,                   HD_IF_UNMODIFIED_SINCE,       HD_UNKNOWN,
+  HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,
+  HD_UNKNOWN,                   HD_UNKNOWN,                   HD_CACHE_CONTROL,             HD_UNKNOWN,
+  HD_UNKNOWN,                   HD_ACCEPT_CHARSET,            HD_UNKNOWN,                   HD_RANGE,
+  HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,                   HD_DNT,
+  HD_UNKNOWN,                   HD_ACCEPT,                    HD_UNKNOWN,                   HD_UNKNOWN,
+  HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,
+  HD_UNKNOWN,                   HD_X_REAL_IP,                 HD_UNKNOWN,                   HD_FORWARDED,
+  HD_UNKNOWN,                   HD_EXPECT,                    HD_UNKNOWN,                   HD_SEC_FETCH_MODE,
+  HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,                   HD_IF_MATCH,
+  HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,
+  HD_IF_NONE_MATCH,             HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,
+  HD_UNKNOWN,                   HD_REFERER,                   HD_UPGRADE,                   HD_CONTENT_LENGTH,
+  HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,
+  HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,                   HD_UNKNOWN,
+  HD_AUTHORIZATION,             HD_UNKNOWN,                   HD_ACCEPT_ENCODING,           HD_CONNECTION,
+  HD_UNKNOWN,                   HD_CONTENT_TYPE,              HD_TE,                        HD_SEC_FETCH_USER
+};
+
+// (| 0x20 : lowercase for the letters, the rest does not matter as the name is compared after)
+size_t HeaderTable::hash(const char* name, size_t length)
+{
+  const unsigned char first = name[0] | 0x20;
+  const unsigned char third = name[length >= 3 ? length - 3 : 0] | 0x20;
+
+  return ((length + first * 3 + third * 8) & (HEADER_TABLE_SLOTS - 1));
+}
+
+KnownHeader HeaderTable::lookup(const char* name, size_t length)
+{
+  if (length == 0)
+    return (HD_UNKNOWN);
+  const KnownHeader header = static_cast<KnownHeader>(SLOTS[hash(name, length)]);
+  if (header != HD_UNKNOWN && NAMES[header].length == length && strncasecmp(NAMES[header].name, name, length) == 0)
+    return (header);
+  return (HD_UNKNOWN);
+}
+
+const char* HeaderTable::name(KnownHeader header)
+{
+  return (header < HD_UNKNOWN ? NAMES[header].name : "");
+}
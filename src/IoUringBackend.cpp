@@ -0,0 +1,1104 @@
+#include "IoUringBackend.hpp"
+
+#ifdef WEBSERV_HAS_IO_URING
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <endian.h>
+#include <poll.h>
+#include <stdexcept>
+#include <unistd.h>
+
+#define IOURING_QUEUE_DEPTH  (1024)
+#define IOURING_BUFFER_COUNT (64)
+#define IOURING_BUFFER_SIZE  (16 * 1024)
+#define IOURING_RECEIVE_COUNT (128)  // provided buffers : taken by a receive once its data arrived
+#define IOURING_RECEIVE_GROUP (0)
+#define IOURING_FIXED_FILES  (4096) // registered file table, at most (RLIMIT_NOFILE)
+
+static FileDescriptor openPidFd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+  return (static_cast<FileDescriptor>(syscall(SYS_pidfd_open, pid, 0)));
+#else
+  (void)pid;
+  errno = ENOSYS;
+  return (FAILED);
+#endif
+}
+
+IoUringBackend::IoUringBackend() :
+        _ring(-1),
+        _sqRingPtr(MAP_FAILED),
+        _sqRingSize(0),
+        _cqRingPtr(MAP_FAILED),
+        _cqRingSize(0),
+        _sqes(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+        _sqesSize(0),
+        _fixedBuffers(false),
+        _receiving(false),
+        _fixedFiles(0),
+        _nextToken(1),
+        _sequence(0)
+{
+  setupRing();
+  setupBuffers();
+  setupFiles();
+  pthread_mutex_init(&_mutex, NULL);
+}
+
+IoUringBackend::~IoUringBackend()
+{
+  for (std::map<FileDescriptor, Watch>::iterator it = _watches.begin(); it != _watches.end(); ++it)
+  {
+    close(it->first);
+  }
+  releaseRing();
+  pthread_mutex_destroy(&_mutex);
+}
+
+void IoUringBackend::setupRing()
+{
+  const unsigned required = IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG | IORING_FEAT_RW_CUR_POS;
+
+  memset(&_params, 0, sizeof(_params));
+  _params.flags = IORING_SETUP_CQSIZE;
+  _params.cq_entries = IOURING_QUEUE_DEPTH * 4; // multishot polls post many completions
+  if ((_ring = static_cast<FileDescriptor>(syscall(__NR_io_uring_setup, IOURING_QUEUE_DEPTH, &_params))) < 0)
+  {
+    throw (std::runtime_error("create io_uring failed\n"));
+  }
+  if ((_params.features & required) != required)
+  {
+    releaseRing();
+    throw (std::runtime_error("io_uring : kernel too old\n"));
+  }
+  _sqRingSize = _params.sq_off.array + _params.sq_entries * sizeof(unsigned);
+  _cqRingSize = _params.cq_off.cqes + _params.cq_entries * sizeof(struct io_uring_cqe);
+  if (_params.features & IORING_FEAT_SINGLE_MMAP)
+    _sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+  _sqRingPtr = mmap(NULL, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQ_RING);
+  if (_sqRingPtr != MAP_FAILED && (_params.features & IORING_FEAT_SINGLE_MMAP))
+    _cqRingPtr = _sqRingPtr;
+  else if (_sqRingPtr != MAP_FAILED)
+    _cqRingPtr = mmap(NULL, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_CQ_RING);
+  _sqesSize = _params.sq_entries * sizeof(struct io_uring_sqe);
+  if (_cqRingPtr != MAP_FAILED)
+    _sqes = static_cast<struct io_uring_sqe*>(mmap(NULL, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQES));
+  if (_sqes == MAP_FAILED)
+  {
+    releaseRing();
+    throw (std::runtime_error("map io_uring failed\n"));
+  }
+  char* sq = static_cast<char*>(_sqRingPtr);
+  char* cq = static_cast<char*>(_cqRingPtr);
+  _sqHead = reinterpret_cast<unsigned*>(sq + _params.sq_off.head);
+  _sqTail = reinterpret_cast<unsigned*>(sq + _params.sq_off.tail);
+  _sqMask = reinterpret_cast<unsigned*>(sq + _params.sq_off.ring_mask);
+  _sqArray = reinterpret_cast<unsigned*>(sq + _params.sq_off.array);
+  _cqHead = reinterpret_cast<unsigned*>(cq + _params.cq_off.head);
+  _cqTail = reinterpret_cast<unsigned*>(cq + _params.cq_off.tail);
+  _cqMask = reinterpret_cast<unsigned*>(cq + _params.cq_off.ring_mask);
+  _cqes = reinterpret_cast<struct io_uring_cqe*>(cq + _params.cq_off.cqes);
+}
+
+// file reads land in buffers registered once, so the kernel does not map them per request.
+void IoUringBackend::setupBuffers()
+{
+  std::vector<struct iovec> iov(IOURING_BUFFER_COUNT);
+
+  _bufferMemory.resize(IOURING_BUFFER_COUNT * IOURING_BUFFER_SIZE);
+  for (int i = 0; i < IOURING_BUFFER_COUNT; ++i)
+  {
+    iov[i].iov_base = &_bufferMemory[i * IOURING_BUFFER_SIZE];
+    iov[i].iov_len = IOURING_BUFFER_SIZE;
+    _freeBuffers.push_back(IOURING_BUFFER_COUNT - 1 - i);
+  }
+  // refused when RLIMIT_MEMLOCK is too small : plain reads into the same buffers.
+  _fixedBuffers = (syscall(__NR_io_uring_register, _ring, IORING_REGISTER_BUFFERS, &iov[0], IOURING_BUFFER_COUNT) == 0);
+  // sockets are received into buffers given to the kernel up front : a receive takes one only
+  // once its data arrived, so an idle connection holds none.
+  _receiveMemory.resize(IOURING_RECEIVE_COUNT * IOURING_BUFFER_SIZE);
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+  sqe->fd = IOURING_RECEIVE_COUNT;
+  sqe->addr = reinterpret_cast<uintptr_t>(&_receiveMemory[0]);
+  sqe->len = IOURING_BUFFER_SIZE;
+  sqe->off = 0;
+  sqe->buf_group = IOURING_RECEIVE_GROUP;
+  if (enter(1, -1) == 1)
+  {
+    const unsigned head = *_cqHead;
+    if (head != __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE))
+    {
+      _receiving = (_cqes[head & *_cqMask].res >= 0);
+      __atomic_store_n(_cqHead, head + 1, __ATOMIC_RELEASE);
+    }
+  }
+}
+
+// sockets are received through a registered file table (slot : fd), so the kernel does not look
+// the descriptor up at each receive. refused : plain descriptors.
+void IoUringBackend::setupFiles()
+{
+  struct rlimit limit;
+  int count = IOURING_FIXED_FILES;
+
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < static_cast<rlim_t>(count))
+    count = static_cast<int>(limit.rlim_cur);
+  const std::vector<int> slots(count, -1);
+  if (count > 0 && syscall(__NR_io_uring_register, _ring, IORING_REGISTER_FILES, &slots[0], count) == 0)
+    _fixedFiles = count;
+}
+
+// fd -1 empties the slot : the table holds its own reference to the file until then.
+bool IoUringBackend::updateFile(int slot, FileDescriptor fd)
+{
+  struct io_uring_files_update update;
+
+  memset(&update, 0, sizeof(update));
+  update.offset = static_cast<uint32_t>(slot);
+  update.fds = reinterpret_cast<uintptr_t>(&fd);
+  return (syscall(__NR_io_uring_register, _ring, IORING_REGISTER_FILES_UPDATE, &update, 1) == 1);
+}
+
+void IoUringBackend::releaseRing()
+{
+  if (_sqes != MAP_FAILED)
+    munmap(_sqes, _sqesSize);
+  if (_cqRingPtr != MAP_FAILED && _cqRingPtr != _sqRingPtr)
+    munmap(_cqRingPtr, _cqRingSize);
+  if (_sqRingPtr != MAP_FAILED)
+    munmap(_sqRingPtr, _sqRingSize);
+  if (_ring >= 0)
+    close(_ring);
+}
+
+FileDescriptor IoUringBackend::getFd() const
+{
+  return (_ring);
+}
+
+const char* IoUringBackend::getName() const
+{
+  return ("io_uring");
+}
+
+// the kernel reads the submission queue only in io_uring_enter(), so a sqe is
+// published right away and filled by the caller.
+struct io_uring_sqe* IoUringBackend::getSqe()
+{
+  const unsigned tail = *_sqTail;
+
+  if (tail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) >= _params.sq_entries)
+  {
+    enter(0, 0);
+    if (tail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) >= _params.sq_entries)
+      return (NULL);
+  }
+  const unsigned index = tail & *_sqMask;
+  struct io_uring_sqe* sqe = &_sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  _sqArray[index] = index;
+  __atomic_store_n(_sqTail, tail + 1, __ATOMIC_RELEASE);
+  return (sqe);
+}
+
+// submit queued sqes and wait for minComplete completions. (timeoutMs < 0 : forever)
+int IoUringBackend::enter(unsigned minComplete, int timeoutMs)
+{
+  const unsigned toSubmit = *_sqTail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+  unsigned flags = 0;
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  void* argp = NULL;
+  size_t argSize = 0;
+
+  if (minComplete > 0)
+  {
+    flags |= IORING_ENTER_GETEVENTS;
+    if (timeoutMs >= 0)
+    {
+      memset(&arg, 0, sizeof(arg));
+      ts.tv_sec = timeoutMs / 1000;
+      ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+      arg.ts = reinterpret_cast<uintptr_t>(&ts);
+      arg.sigmask_sz = _NSIG / 8;
+      flags |= IORING_ENTER_EXT_ARG;
+      argp = &arg;
+      argSize = sizeof(arg);
+    }
+  }
+  if (toSubmit == 0 && minComplete == 0)
+    return (0);
+  return (static_cast<int>(syscall(__NR_io_uring_enter, _ring, toSubmit, minComplete, flags, argp, argSize)));
+}
+
+uint64_t IoUringBackend::addOp(OpType type, FileDescriptor fd, EventFilter filter, int buffer)
+{
+  const uint64_t token = _nextToken++;
+  Op op;
+
+  op.type = type;
+  op.fd = fd;
+  op.filter = filter;
+  op.buffer = buffer;
+  _ops[token] = op;
+  return (token);
+}
+
+bool IoUringBackend::pollAdd(FileDescriptor fd, unsigned mask, bool multishot, uint64_t token)
+{
+  struct io_uring_sqe* sqe = getSqe();
+
+  if (sqe == NULL)
+    return (false);
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+#if __BYTE_ORDER == __BIG_ENDIAN
+  mask = (mask << 16) | (mask >> 16);
+#endif
+  sqe->poll32_events = mask;
+  if (multishot)
+    sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = token;
+  return (true);
+}
+
+// completions of cancel requests (user_data 0) are ignored.
+// a cancelled poll is forgotten now, a cancelled read keeps its buffer until it completes.
+void IoUringBackend::cancel(uint64_t token, bool poll)
+{
+  struct io_uring_sqe* sqe = getSqe();
+
+  if (poll)
+    _ops.erase(token);
+  if (sqe == NULL)
+    return ;
+  sqe->opcode = poll ? IORING_OP_POLL_REMOVE : IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = token;
+  sqe->user_data = 0;
+}
+
+IoUringBackend::FdEntry& IoUringBackend::getEntry(FileDescriptor fd)
+{
+  if (_fdTable.size() <= static_cast<size_t>(fd))
+    _fdTable.resize(fd + 1);
+  return (_fdTable[fd]);
+}
+
+void IoUringBackend::resetEntry(FileDescriptor fd)
+{
+  FdEntry& entry = _fdTable[fd];
+
+  if (entry.read.token != 0)
+    cancel(entry.read.token, true);
+  if (entry.write.token != 0)
+    cancel(entry.write.token, true);
+  if (entry.readToken != 0)
+  {
+    _ops[entry.readToken].fd = -1; // the buffer is freed when the read completes
+    cancel(entry.readToken, false);
+  }
+  releaseBuffer(entry);
+  if (entry.fixed)
+    updateFile(fd, -1);
+  _buffered.erase(fd);
+  entry = FdEntry();
+}
+
+void IoUringBackend::releaseBuffer(FdEntry& entry)
+{
+  if (entry.buffer < 0)
+    return ;
+  if (entry.type == TYPE_SOCKET) // given back to the kernel at the next flush
+    _returnedBuffers.push_back(entry.buffer);
+  else
+    _freeBuffers.push_back(entry.buffer);
+  entry.buffer = -1;
+  entry.bufferPos = 0;
+  entry.bufferLen = 0;
+  // files and sockets which could not get a buffer try again at the next flush.
+  const std::vector<FileDescriptor> starved(_starved);
+  _starved.clear();
+  for (std::vector<FileDescriptor>::const_iterator it = starved.begin(); it != starved.end(); ++it)
+  {
+    queueChange(*it, EVENT_READ);
+  }
+}
+
+int IoUringBackend::attach(const struct Event& change)
+{
+  int result = FAILED;
+
+  pthread_mutex_lock(&_mutex);
+  switch (change.filter)
+  {
+    case EVENT_READ:
+    case EVENT_WRITE:
+      result = attachIO(change);
+      break;
+    case EVENT_PROC:
+      result = attachProc(change);
+      break;
+    case EVENT_TIMER:
+      result = attachTimer(change);
+      break;
+  }
+  pthread_mutex_unlock(&_mutex);
+  return (result);
+}
+
+int IoUringBackend::attachIO(const struct Event& change)
+{
+  const FileDescriptor fd = static_cast<FileDescriptor>(change.ident);
+
+  if (fd < 0 || fd == _ring)
+    return (FAILED);
+  FdEntry& entry = getEntry(fd);
+  if ((change.flags & EVENT_ADD) && entry.type == TYPE_UNKNOWN)
+  {
+    // regular files can not be polled (always ready) : they are read on the ring instead.
+    struct stat st;
+    if (fstat(fd, &st) == FAILED)
+      return (FAILED);
+    entry.type = S_ISREG(st.st_mode) ? TYPE_FILE : TYPE_POLL;
+    if (entry.type == TYPE_FILE)
+      _buffered.insert(fd);
+  }
+  Interest& interest = (change.filter == EVENT_READ) ? entry.read : entry.write;
+  if (change.flags & EVENT_DELETE)
+  {
+    if (!interest.active)
+      return (FAILED);
+    interest.active = false;
+    queueChange(fd, change.filter);
+    return (0);
+  }
+  if (change.flags & EVENT_ADD)
+  {
+    interest.active = true;
+    interest.enabled = true;
+    interest.clear = (change.flags & EVENT_CLEAR);
+    interest.oneshot = (change.flags & EVENT_ONESHOT);
+    interest.seq = ++_sequence;
+    interest.udata = change.udata;
+    if (change.filter == EVENT_READ && entry.type == TYPE_FILE)
+      entry.eof = false;
+  }
+  else if (!interest.active)
+  {
+    return (FAILED);
+  }
+  if ((change.flags & EVENT_ENABLE) && !interest.enabled)
+  {
+    interest.enabled = true;
+    interest.seq = ++_sequence;
+  }
+  if (change.flags & EVENT_DISABLE)
+    interest.enabled = false;
+  queueChange(fd, change.filter);
+  return (0);
+}
+
+void IoUringBackend::queueChange(FileDescriptor fd, EventFilter filter)
+{
+  Interest& interest = (filter == EVENT_READ) ? _fdTable[fd].read : _fdTable[fd].write;
+
+  if (interest.dirty)
+    return ;
+  interest.dirty = true;
+  _changes.push_back(std::make_pair(fd, filter));
+}
+
+int IoUringBackend::flush()
+{
+  pthread_mutex_lock(&_mutex);
+  flushChanges();
+  pthread_mutex_unlock(&_mutex);
+  return (0);
+}
+
+// queue the requests of every changed interest. they are submitted with the next wait.
+void IoUringBackend::flushChanges()
+{
+  provideBuffers();
+  const std::vector<std::pair<FileDescriptor, EventFilter> > changes(_changes);
+
+  _changes.clear();
+  for (size_t i = 0; i < changes.size(); ++i)
+  {
+    const FileDescriptor fd = changes[i].first;
+    const EventFilter filter = changes[i].second;
+    Interest& interest = (filter == EVENT_READ) ? _fdTable[fd].read : _fdTable[fd].write;
+
+    if (!interest.dirty) // detached
+      continue;
+    interest.dirty = false;
+    updateInterest(fd, filter);
+  }
+}
+
+// the buffers receive() emptied go back to the kernel, ahead of the receives queued after them.
+void IoUringBackend::provideBuffers()
+{
+  if (_returnedBuffers.empty())
+    return ;
+  while (!_returnedBuffers.empty())
+  {
+    struct io_uring_sqe* sqe = getSqe();
+    if (sqe == NULL)
+      break;
+    const int buffer = _returnedBuffers.back();
+    _returnedBuffers.pop_back();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = 1;
+    sqe->addr = reinterpret_cast<uintptr_t>(&_receiveMemory[buffer * IOURING_BUFFER_SIZE]);
+    sqe->len = IOURING_BUFFER_SIZE;
+    sqe->off = static_cast<uint64_t>(buffer);
+    sqe->buf_group = IOURING_RECEIVE_GROUP;
+  }
+  const std::vector<FileDescriptor> starved(_starved);
+  _starved.clear();
+  for (std::vector<FileDescriptor>::const_iterator it = starved.begin(); it != starved.end(); ++it)
+  {
+    queueChange(*it, EVENT_READ);
+  }
+}
+
+void IoUringBackend::updateInterest(FileDescriptor fd, EventFilter filter)
+{
+  FdEntry& entry = _fdTable[fd];
+  Interest& interest = (filter == EVENT_READ) ? entry.read : entry.write;
+  const bool wanted = interest.active && interest.enabled;
+
+  if (entry.type == TYPE_FILE || (entry.type == TYPE_SOCKET && filter == EVENT_READ))
+  { // a file is always writable. readable once a read (a receive) completed.
+    if (interest.token != 0) // the poll of the socket before it was received on the ring
+    {
+      cancel(interest.token, true);
+      interest.token = 0;
+    }
+    if (filter == EVENT_READ && wanted && entry.type == TYPE_SOCKET)
+      submitReceive(fd);
+    else if (filter == EVENT_READ && wanted)
+      submitFileRead(fd);
+    if (!interest.active)
+      interest = Interest();
+    return ;
+  }
+  // an armed poll is replaced : a new poll checks the current state (like EPOLL_CTL_MOD).
+  if (interest.token != 0)
+  {
+    cancel(interest.token, true);
+    interest.token = 0;
+  }
+  if (!wanted)
+  {
+    if (!interest.active)
+      interest = Interest();
+    return ;
+  }
+  const unsigned mask = (filter == EVENT_READ) ? (POLLIN | POLLRDHUP) : POLLOUT;
+  const uint64_t token = addOp(OP_POLL, fd, filter, -1);
+  if (!pollAdd(fd, mask, interest.clear, token))
+  {
+    _ops.erase(token);
+    queueChange(fd, filter); // submission queue full : try again at the next flush
+    return ;
+  }
+  interest.token = token;
+}
+
+void IoUringBackend::submitFileRead(FileDescriptor fd)
+{
+  FdEntry& entry = _fdTable[fd];
+
+  if (entry.readToken != 0 || entry.buffer >= 0 || entry.eof)
+    return ;
+  if (_freeBuffers.empty())
+  {
+    _starved.push_back(fd);
+    return ;
+  }
+  struct io_uring_sqe* sqe = getSqe();
+  if (sqe == NULL)
+  {
+    _starved.push_back(fd);
+    return ;
+  }
+  const int buffer = _freeBuffers.back();
+  _freeBuffers.pop_back();
+  const uint64_t token = addOp(OP_FILE_READ, fd, EVENT_READ, buffer);
+  sqe->opcode = _fixedBuffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uintptr_t>(&_bufferMemory[buffer * IOURING_BUFFER_SIZE]);
+  sqe->len = IOURING_BUFFER_SIZE;
+  sqe->off = static_cast<uint64_t>(-1); // current file position, like read()
+  if (_fixedBuffers)
+    sqe->buf_index = static_cast<uint16_t>(buffer);
+  sqe->user_data = token;
+  entry.readToken = token;
+}
+
+// the kernel picks the buffer once data arrived. (none left : ENOBUFS, see collectCompletion)
+void IoUringBackend::submitReceive(FileDescriptor fd)
+{
+  FdEntry& entry = _fdTable[fd];
+
+  if (entry.readToken != 0 || entry.buffer >= 0 || entry.eof || entry.error != 0)
+    return ;
+  if (!entry.fixed && fd < _fixedFiles)
+    entry.fixed = updateFile(fd, fd);
+  struct io_uring_sqe* sqe = getSqe();
+  if (sqe == NULL)
+  {
+    _starved.push_back(fd);
+    return ;
+  }
+  const uint64_t token = addOp(OP_RECEIVE, fd, EVENT_READ, -1);
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->flags = IOSQE_BUFFER_SELECT | (entry.fixed ? IOSQE_FIXED_FILE : 0);
+  sqe->len = IOURING_BUFFER_SIZE;
+  sqe->buf_group = IOURING_RECEIVE_GROUP;
+  sqe->user_data = token;
+  entry.readToken = token;
+}
+
+// fd is closed right after this. pending requests hold their own reference to the file,
+// so they are cancelled now.
+void IoUringBackend::detach(FileDescriptor fd)
+{
+  pthread_mutex_lock(&_mutex);
+  if (fd >= 0 && static_cast<size_t>(fd) < _fdTable.size())
+    resetEntry(fd);
+  pthread_mutex_unlock(&_mutex);
+}
+
+ssize_t IoUringBackend::readFile(FileDescriptor fd, void* buf, size_t size)
+{
+  pthread_mutex_lock(&_mutex);
+  const ssize_t result = readBuffered(fd, buf, size);
+  const int readErrno = errno;
+  pthread_mutex_unlock(&_mutex);
+  errno = readErrno;
+  return (result);
+}
+
+// the first read of a socket is the caller's own, then the socket is received on the ring.
+// (only sockets read here are : the others are read by their handlers)
+ssize_t IoUringBackend::receive(FileDescriptor fd, void* buf, size_t size)
+{
+  ssize_t result;
+
+  pthread_mutex_lock(&_mutex);
+  if (fd >= 0 && static_cast<size_t>(fd) < _fdTable.size() && _fdTable[fd].type == TYPE_POLL)
+  {
+    FdEntry& entry = _fdTable[fd];
+    result = read(fd, buf, size);
+    if ((result > 0 || (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))) && _receiving && entry.read.active)
+    { // (its poll is replaced at the next flush)
+      const int readErrno = errno;
+      entry.type = TYPE_SOCKET;
+      _buffered.insert(fd);
+      queueChange(fd, EVENT_READ);
+      errno = readErrno;
+    }
+  }
+  else
+  {
+    result = readBuffered(fd, buf, size);
+  }
+  const int readErrno = errno;
+  pthread_mutex_unlock(&_mutex);
+  errno = readErrno;
+  return (result);
+}
+
+// data already read from a regular file, or received, is copied out. the next read is queued
+// once the buffer is empty.
+ssize_t IoUringBackend::readBuffered(FileDescriptor fd, void* buf, size_t size)
+{
+  if (fd < 0 || _fdTable.size() <= static_cast<size_t>(fd)
+      || (_fdTable[fd].type != TYPE_FILE && _fdTable[fd].type != TYPE_SOCKET))
+    return (read(fd, buf, size));
+  FdEntry& entry = _fdTable[fd];
+  if (entry.buffer >= 0)
+  {
+    const char* data = (entry.type == TYPE_SOCKET) ? &_receiveMemory[0] : &_bufferMemory[0];
+    const size_t copySize = std::min(size, entry.bufferLen - entry.bufferPos);
+    memcpy(buf, data + entry.buffer * IOURING_BUFFER_SIZE + entry.bufferPos, copySize);
+    entry.bufferPos += copySize;
+    if (entry.bufferPos >= entry.bufferLen)
+    {
+      releaseBuffer(entry);
+      if (entry.read.active)
+        queueChange(fd, EVENT_READ);
+    }
+    return (static_cast<ssize_t>(copySize));
+  }
+  if (entry.type == TYPE_SOCKET)
+  {
+    if (entry.eof)
+      return (0);
+    if (entry.error != 0 || entry.readToken != 0) // (in flight : what it receives is reported)
+    {
+      errno = (entry.error != 0) ? entry.error : EAGAIN;
+      return (FAILED);
+    }
+    // the next receive is only queued : the rest (a body) is read now, straight into the caller's
+    // buffer. the receive is submitted at the next flush, once the caller stopped.
+    return (read(fd, buf, size));
+  }
+  if (entry.readToken != 0) // the file position belongs to the read in flight
+  {
+    errno = EAGAIN;
+    return (FAILED);
+  }
+  if (entry.eof)
+    return (0);
+  return (read(fd, buf, size));
+}
+
+int IoUringBackend::watchFd(FileDescriptor fd, Watch& watch)
+{
+  const uint64_t token = addOp(OP_WATCH, fd, watch.filter, -1);
+
+  if (!pollAdd(fd, POLLIN, false, token))
+  {
+    _ops.erase(token);
+    return (FAILED);
+  }
+  watch.token = token;
+  _watches[fd] = watch;
+  return (0);
+}
+
+void IoUringBackend::unwatchFd(FileDescriptor fd)
+{
+  std::map<FileDescriptor, Watch>::iterator it = _watches.find(fd);
+
+  if (it != _watches.end())
+  {
+    if (it->second.token != 0)
+      cancel(it->second.token, true);
+    _watches.erase(it);
+  }
+  close(fd);
+}
+
+int IoUringBackend::attachProc(const struct Event& change)
+{
+  const pid_t pid = static_cast<pid_t>(change.ident);
+  std::map<pid_t, FileDescriptor>::iterator it = _pidFds.find(pid);
+  Watch watch;
+
+  if (change.flags & EVENT_DELETE)
+  {
+    if (it == _pidFds.end())
+      return (FAILED);
+    unwatchFd(it->second);
+    _pidFds.erase(it);
+    return (0);
+  }
+  if (!(change.flags & EVENT_ADD))
+    return (0);
+  if (it != _pidFds.end())
+  {
+    _watches[it->second].udata = change.udata;
+    _watches[it->second].seq = ++_sequence;
+    return (0);
+  }
+  watch.filter = EVENT_PROC;
+  watch.ident = change.ident;
+  watch.oneshot = true;
+  watch.seq = ++_sequence;
+  watch.token = 0;
+  watch.udata = change.udata;
+  FileDescriptor pidFd = openPidFd(pid);
+  if (pidFd < 0) // ESRCH : already reaped, ENOSYS : kernel < 5.3 (io_uring needs newer anyway)
+    return (FAILED);
+  if (watchFd(pidFd, watch) < 0)
+  {
+    close(pidFd);
+    return (FAILED);
+  }
+  _pidFds[pid] = pidFd;
+  return (0);
+}
+
+int IoUringBackend::attachTimer(const struct Event& change)
+{
+  std::map<uintptr_t, FileDescriptor>::iterator it = _timers.find(change.ident);
+
+  if (change.flags & EVENT_DELETE)
+  {
+    if (it == _timers.end())
+      return (FAILED);
+    unwatchFd(it->second);
+    _timers.erase(it);
+    return (0);
+  }
+  if (!(change.flags & EVENT_ADD))
+    return (0);
+  FileDescriptor timerFd;
+  if (it != _timers.end())
+  {
+    timerFd = it->second;
+  }
+  else if ((timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+  {
+    return (FAILED);
+  }
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_sec = change.data / 1000;
+  spec.it_value.tv_nsec = (change.data % 1000) * 1000000;
+  if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+    spec.it_value.tv_nsec = 1; // zero disarms timerfd
+  if (!(change.flags & EVENT_ONESHOT))
+    spec.it_interval = spec.it_value;
+  if (timerfd_settime(timerFd, 0, &spec, NULL) < 0)
+  {
+    if (it == _timers.end())
+      close(timerFd);
+    return (FAILED);
+  }
+  if (it != _timers.end())
+  {
+    Watch& watch = _watches[timerFd];
+    watch.oneshot = (change.flags & EVENT_ONESHOT);
+    watch.seq = ++_sequence;
+    watch.udata = change.udata;
+    return (0);
+  }
+  Watch watch;
+  watch.filter = EVENT_TIMER;
+  watch.ident = change.ident;
+  watch.oneshot = (change.flags & EVENT_ONESHOT);
+  watch.seq = ++_sequence;
+  watch.token = 0;
+  watch.udata = change.udata;
+  if (watchFd(timerFd, watch) < 0)
+  {
+    close(timerFd);
+    return (FAILED);
+  }
+  _timers[change.ident] = timerFd;
+  return (0);
+}
+
+bool IoUringBackend::isStillInterested(const struct Event& event)
+{
+  if (event.filter == EVENT_PROC)
+  {
+    std::map<pid_t, FileDescriptor>::iterator it = _pidFds.find(static_cast<pid_t>(event.ident));
+    return (it != _pidFds.end() && _watches[it->second].udata == event.udata);
+  }
+  if (event.filter == EVENT_TIMER)
+  {
+    std::map<uintptr_t, FileDescriptor>::iterator it = _timers.find(event.ident);
+    return (it != _timers.end() && _watches[it->second].udata == event.udata);
+  }
+  const FileDescriptor fd = static_cast<FileDescriptor>(event.ident);
+  if (_fdTable.size() <= static_cast<size_t>(fd))
+    return (false);
+  const Interest& interest = (event.filter == EVENT_READ) ? _fdTable[fd].read : _fdTable[fd].write;
+  return (interest.active && interest.enabled && interest.udata == event.udata);
+}
+
+// after an event is handed to the caller :
+// one-shot interests are removed, level-triggered polls are armed again.
+void IoUringBackend::consumeInterest(const struct Event& event)
+{
+  if (event.filter == EVENT_PROC)
+  {
+    struct Event change;
+    setEvent(&change, event.ident, EVENT_PROC, EVENT_DELETE, 0, NULL);
+    attachProc(change);
+    return ;
+  }
+  if (event.filter == EVENT_TIMER)
+  {
+    std::map<uintptr_t, FileDescriptor>::iterator it = _timers.find(event.ident);
+    if (it == _timers.end())
+      return ;
+    Watch& watch = _watches[it->second];
+    if (watch.oneshot)
+    {
+      unwatchFd(it->second);
+      _timers.erase(it);
+    }
+    else if (watch.token == 0)
+    {
+      watchFd(it->second, watch);
+    }
+    return ;
+  }
+  const FileDescriptor fd = static_cast<FileDescriptor>(event.ident);
+  FdEntry& entry = _fdTable[fd];
+  Interest& interest = (event.filter == EVENT_READ) ? entry.read : entry.write;
+  if (interest.oneshot)
+  {
+    interest.active = false;
+    queueChange(fd, event.filter);
+  }
+  else if ((entry.type == TYPE_POLL || (entry.type == TYPE_SOCKET && event.filter == EVENT_WRITE))
+           && interest.token == 0)
+  {
+    queueChange(fd, event.filter);
+  }
+}
+
+int IoUringBackend::pushEvent(struct Event* events, int maxEvents, int count, const struct Event& event)
+{
+  if (count >= maxEvents)
+  {
+    _pending.push_back(event);
+    return (count);
+  }
+  events[count] = event;
+  if (event.filter == EVENT_TIMER)
+  {
+    uint64_t expirations = 0;
+    if (read(_timers[event.ident], &expirations, sizeof(expirations)) < 0)
+      return (count);
+    events[count].data = static_cast<intptr_t>(expirations);
+  }
+  consumeInterest(event);
+  return (count + 1);
+}
+
+void IoUringBackend::collect(unsigned long seq, const struct Event& event)
+{
+  ReadyEvent ready;
+
+  ready.seq = seq;
+  ready.event = event;
+  _collected.push_back(ready);
+}
+
+void IoUringBackend::collectCompletion(const struct io_uring_cqe& cqe)
+{
+  std::map<uint64_t, Op>::iterator it = _ops.find(cqe.user_data);
+  struct Event event;
+
+  if (cqe.user_data == 0 || it == _ops.end())
+    return ;
+  const Op op = it->second;
+  const bool more = (cqe.flags & IORING_CQE_F_MORE);
+  if (op.type == OP_FILE_READ)
+  {
+    _ops.erase(it);
+    if (op.fd < 0 || _fdTable[op.fd].readToken != cqe.user_data) // detached
+    {
+      _freeBuffers.push_back(op.buffer);
+      return ;
+    }
+    FdEntry& entry = _fdTable[op.fd];
+    entry.readToken = 0;
+    if (cqe.res > 0)
+    {
+      entry.buffer = op.buffer;
+      entry.bufferPos = 0;
+      entry.bufferLen = static_cast<size_t>(cqe.res);
+      return ; // reported by collectReadyData()
+    }
+    _freeBuffers.push_back(op.buffer);
+    entry.eof = true; // kqueue does not report a regular file at EOF
+    if (cqe.res < 0 && entry.read.active && entry.read.enabled)
+    { // let the handler see the error with its own read()
+      setEvent(&event, op.fd, EVENT_READ, EVENT_ERROR, -cqe.res, entry.read.udata);
+      collect(entry.read.seq, event);
+    }
+    return ;
+  }
+  if (op.type == OP_RECEIVE)
+  {
+    _ops.erase(it);
+    const int buffer = (cqe.flags & IORING_CQE_F_BUFFER) ? static_cast<int>(cqe.flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+    if (op.fd < 0 || _fdTable[op.fd].readToken != cqe.user_data) // detached
+    {
+      if (buffer >= 0)
+        _returnedBuffers.push_back(buffer);
+      return ;
+    }
+    FdEntry& entry = _fdTable[op.fd];
+    entry.readToken = 0;
+    if (cqe.res > 0 && buffer >= 0)
+    {
+      entry.buffer = buffer;
+      entry.bufferPos = 0;
+      entry.bufferLen = static_cast<size_t>(cqe.res);
+      return ; // reported by collectReadyData()
+    }
+    if (buffer >= 0)
+      _returnedBuffers.push_back(buffer);
+    if (cqe.res == -ENOBUFS) // every buffer holds data : once one is given back
+      _starved.push_back(op.fd);
+    else if (cqe.res == -EAGAIN || cqe.res == -EINTR || cqe.res == -ECANCELED)
+      queueChange(op.fd, EVENT_READ);
+    else if (cqe.res == 0)
+      entry.eof = true;
+    else
+      entry.error = -cqe.res;
+    return ; // eof, error : reported by collectReadyData()
+  }
+  if (!more)
+    _ops.erase(it);
+  if (op.type == OP_WATCH)
+  {
+    std::map<FileDescriptor, Watch>::iterator wit = _watches.find(op.fd);
+    if (wit == _watches.end() || wit->second.token != cqe.user_data)
+      return ;
+    Watch& watch = wit->second;
+    watch.token = 0;
+    setEvent(&event, watch.ident, watch.filter, (watch.filter == EVENT_PROC) ? EVENT_EOF : 0, 0, watch.udata);
+    collect(watch.seq, event);
+    return ;
+  }
+  if (_fdTable.size() <= static_cast<size_t>(op.fd))
+    return ;
+  Interest& interest = (op.filter == EVENT_READ) ? _fdTable[op.fd].read : _fdTable[op.fd].write;
+  if (interest.token != cqe.user_data) // replaced or removed
+    return ;
+  if (!more)
+    interest.token = 0;
+  if (cqe.res < 0)
+  { // ECANCELED, or the poll was dropped (multishot overflow) : arm it again
+    if (interest.active)
+      queueChange(op.fd, op.filter);
+    return ;
+  }
+  if (!interest.active || !interest.enabled)
+    return ;
+  const unsigned mask = static_cast<unsigned>(cqe.res);
+  const unsigned eofMask = (op.filter == EVENT_READ) ? (POLLHUP | POLLRDHUP | POLLERR) : (POLLHUP | POLLERR);
+  setEvent(&event, op.fd, op.filter, (mask & eofMask) ? EVENT_EOF : 0, 0, interest.udata);
+  collect(interest.seq, event);
+}
+
+// a received socket at its end : reported until it is detached, like a hung up poll.
+bool IoUringBackend::isReceiveEnd(const FdEntry& entry)
+{
+  return (entry.type == TYPE_SOCKET && entry.buffer < 0 && (entry.eof || entry.error != 0));
+}
+
+bool IoUringBackend::hasReadyData()
+{
+  for (std::set<FileDescriptor>::iterator it = _buffered.begin(); it != _buffered.end(); ++it)
+  {
+    const FdEntry& entry = _fdTable[*it];
+    if (entry.type == TYPE_FILE && entry.write.active && entry.write.enabled)
+      return (true);
+    if (entry.read.active && entry.read.enabled && (entry.buffer >= 0 || isReceiveEnd(entry)))
+      return (true);
+  }
+  return (false);
+}
+
+void IoUringBackend::collectReadyData()
+{
+  struct Event event;
+
+  for (std::set<FileDescriptor>::iterator it = _buffered.begin(); it != _buffered.end(); ++it)
+  {
+    const FdEntry& entry = _fdTable[*it];
+
+    if (entry.read.active && entry.read.enabled && entry.buffer >= 0)
+    {
+      setEvent(&event, *it, EVENT_READ, 0, static_cast<intptr_t>(entry.bufferLen - entry.bufferPos), entry.read.udata);
+      collect(entry.read.seq, event);
+    }
+    else if (entry.read.active && entry.read.enabled && isReceiveEnd(entry))
+    {
+      setEvent(&event, *it, EVENT_READ, EVENT_EOF, entry.error, entry.read.udata);
+      collect(entry.read.seq, event);
+    }
+    if (entry.type == TYPE_FILE && entry.write.active && entry.write.enabled)
+    {
+      setEvent(&event, *it, EVENT_WRITE, 0, 0, entry.write.udata);
+      collect(entry.write.seq, event);
+    }
+  }
+}
+
+int IoUringBackend::wait(struct Event* events, int maxEvents, int timeoutMs)
+{
+  int count = 0;
+
+  if (maxEvents <= 0)
+    return (FAILED);
+  pthread_mutex_lock(&_mutex);
+  // (1) events left by the previous call. the interest may be gone since then.
+  while (!_pending.empty() && count < maxEvents)
+  {
+    const struct Event event = _pending.front();
+    _pending.pop_front();
+    if (isStillInterested(event))
+    {
+      events[count++] = event;
+      consumeInterest(event);
+    }
+  }
+  if (count > 0)
+  {
+    pthread_mutex_unlock(&_mutex);
+    return (count);
+  }
+  do
+  {
+    // (2) submit changes and wait in one syscall. do not block while data is ready.
+    // (a receive() meanwhile only queues changes : they go with the next flush)
+    flushChanges();
+    const bool ready = hasReadyData();
+    bool interrupted = false;
+    pthread_mutex_unlock(&_mutex);
+    const int entered = enter(ready ? 0 : 1, timeoutMs);
+    const int enterErrno = errno;
+    pthread_mutex_lock(&_mutex);
+    if (entered < 0)
+    {
+      if (enterErrno != ETIME && enterErrno != EINTR && enterErrno != EBUSY)
+      {
+        pthread_mutex_unlock(&_mutex);
+        errno = enterErrno;
+        return (FAILED);
+      }
+      interrupted = (enterErrno == EINTR);
+    }
+    _collected.clear();
+    unsigned head = *_cqHead;
+    const unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail)
+    {
+      const struct io_uring_cqe cqe = _cqes[head & *_cqMask];
+      collectCompletion(cqe);
+      ++head;
+    }
+    __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+    // (3) regular files, received sockets
+    collectReadyData();
+    std::stable_sort(_collected.begin(), _collected.end());
+    for (std::vector<ReadyEvent>::iterator it = _collected.begin(); it != _collected.end(); ++it)
+    {
+      count = pushEvent(events, maxEvents, count, it->event);
+    }
+    if (interrupted)
+      break;
+  } while (count == 0 && timeoutMs < 0);
+  pthread_mutex_unlock(&_mutex);
+  return (count);
+}
+
+#endif //WEBSERV_HAS_IO_URING
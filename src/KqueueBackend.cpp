@@ -0,0 +1,221 @@
+#include "KqueueBackend.hpp"
+
+#ifdef WEBSERV_HAS_KQUEUE
+
+#include <sys/event.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <stdexcept>
+
+static short toKqueueFilter(EventFilter filter)
+{
+  switch (filter)
+  {
+    case EVENT_READ:
+      return (EVFILT_READ);
+    case EVENT_WRITE:
+      return (EVFILT_WRITE);
+    case EVENT_PROC:
+      return (EVFILT_PROC);
+    case EVENT_TIMER:
+      return (EVFILT_TIMER);
+  }
+  return (EVFILT_READ);
+}
+
+static EventFilter toEventFilter(short filter)
+{
+  switch (filter)
+  {
+    case EVFILT_WRITE:
+      return (EVENT_WRITE);
+    case EVFILT_PROC:
+      return (EVENT_PROC);
+    case EVFILT_TIMER:
+      return (EVENT_TIMER);
+    default:
+      return (EVENT_READ);
+  }
+}
+
+KqueueBackend::KqueueBackend()
+{
+  if ((_kqueue = kqueue()) < 0)
+  {
+    throw (std::runtime_error("create kqueue failed\n"));
+  }
+  fcntl(_kqueue, F_SETFD, FD_CLOEXEC);
+}
+
+KqueueBackend::~KqueueBackend()
+{
+  close(_kqueue);
+}
+
+int KqueueBackend::attach(const struct Event& change)
+{
+  struct kevent event;
+  unsigned short flags = 0;
+  unsigned int fflags = 0;
+  const short filter = toKqueueFilter(change.filter);
+
+  if (change.flags & EVENT_DELETE)
+  {
+    // earlier changes of this interest are useless now.
+    dropQueuedChanges(change.ident, filter);
+    if (_registered.find(InterestKey(change.ident, filter)) == _registered.end())
+      return (0); // added and deleted before submission
+  }
+  if (change.flags & EVENT_ADD)
+    flags |= EV_ADD;
+  if (change.flags & EVENT_DELETE)
+    flags |= EV_DELETE;
+  if (change.flags & EVENT_ENABLE)
+    flags |= EV_ENABLE;
+  if (change.flags & EVENT_DISABLE)
+    flags |= EV_DISABLE;
+  if (change.flags & EVENT_CLEAR)
+    flags |= EV_CLEAR;
+  if (change.flags & EVENT_ONESHOT)
+    flags |= EV_ONESHOT;
+  if (change.filter == EVENT_PROC)
+  {
+    fflags = NOTE_EXIT;
+#ifdef NOTE_EXITSTATUS
+    fflags |= NOTE_EXITSTATUS;
+#endif
+  }
+  EV_SET(&event, change.ident, filter, flags, fflags, change.data, change.udata);
+  if (change.filter == EVENT_PROC)
+  { // submitted at once : the caller forks again if the child is already gone. (ESRCH)
+    if (kevent(_kqueue, &event, 1, NULL, 0, NULL) < 0)
+      return (FAILED);
+    markSubmitted(&event, 1);
+    return (0);
+  }
+  _changeList.push_back(event);
+  return (0);
+}
+
+void KqueueBackend::dropQueuedChanges(uintptr_t ident, short filter)
+{
+  std::vector<struct kevent>::iterator it = _changeList.begin();
+
+  while (it != _changeList.end())
+  {
+    if (it->ident == ident && it->filter == filter)
+      it = _changeList.erase(it);
+    else
+      ++it;
+  }
+}
+
+void KqueueBackend::markSubmitted(const struct kevent* changes, int count)
+{
+  for (int i = 0; i < count; ++i)
+  {
+    if (changes[i].flags & EV_DELETE)
+      _registered.erase(InterestKey(changes[i].ident, changes[i].filter));
+    else if (changes[i].flags & EV_ADD)
+      _registered.insert(InterestKey(changes[i].ident, changes[i].filter));
+  }
+}
+
+int KqueueBackend::flush()
+{
+  const int count = static_cast<int>(_changeList.size());
+  const struct timespec zero = {0, 0};
+  int result = 0;
+
+  if (count == 0)
+    return (0);
+  // EV_RECEIPT : one result per change, pending events are not returned.
+  for (int i = 0; i < count; ++i)
+    _changeList[i].flags |= EV_RECEIPT;
+  std::vector<struct kevent> receipts(count);
+  int receiptCount = kevent(_kqueue, &_changeList[0], count, &receipts[0], count, &zero);
+  if (receiptCount < 0)
+    result = FAILED;
+  markSubmitted(&_changeList[0], count);
+  for (int i = 0; i < receiptCount; ++i)
+  {
+    if ((receipts[i].flags & EV_ERROR) && receipts[i].data != 0)
+    {
+      _registered.erase(InterestKey(receipts[i].ident, receipts[i].filter));
+      result = FAILED;
+    }
+  }
+  _changeList.clear();
+  return (result);
+}
+
+// the kernel drops the registrations on close(). only the queued changes are removed.
+void KqueueBackend::detach(FileDescriptor fd)
+{
+  const uintptr_t ident = static_cast<uintptr_t>(fd);
+
+  dropQueuedChanges(ident, EVFILT_READ);
+  dropQueuedChanges(ident, EVFILT_WRITE);
+  _registered.erase(InterestKey(ident, EVFILT_READ));
+  _registered.erase(InterestKey(ident, EVFILT_WRITE));
+}
+
+int KqueueBackend::wait(struct Event* events, int maxEvents, int timeoutMs)
+{
+  struct timespec timeout;
+  struct timespec* timeoutPtr = NULL;
+  int count = 0;
+
+  if (maxEvents <= 0)
+    return (FAILED);
+  if (timeoutMs >= 0)
+  {
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_nsec = (timeoutMs % 1000) * 1000000;
+    timeoutPtr = &timeout;
+  }
+  // a failed change takes one slot of the event list. (EV_ERROR)
+  // submit the overflow first, so that every failure has a slot.
+  if (_changeList.size() > static_cast<size_t>(maxEvents))
+    flush();
+  if (_eventList.size() < static_cast<size_t>(maxEvents))
+    _eventList.resize(maxEvents);
+  do
+  {
+    const int changeCount = static_cast<int>(_changeList.size());
+    int readyCount = kevent(_kqueue, changeCount ? &_changeList[0] : NULL, changeCount,
+                            &_eventList[0], maxEvents, timeoutPtr);
+    markSubmitted(changeCount ? &_changeList[0] : NULL, changeCount);
+    _changeList.clear();
+    if (readyCount < 0)
+      return ((errno == EINTR) ? 0 : FAILED);
+    for (int i = 0; i < readyCount; ++i)
+    {
+      unsigned short flags = 0;
+
+      if (_eventList[i].flags & EV_ERROR)
+      { // result of a failed change, not an event.
+        _registered.erase(InterestKey(_eventList[i].ident, _eventList[i].filter));
+        continue;
+      }
+      if (_eventList[i].flags & EV_EOF || _eventList[i].fflags & EV_EOF)
+        flags |= EVENT_EOF;
+      setEvent(&events[count++], _eventList[i].ident, toEventFilter(_eventList[i].filter),
+               flags, _eventList[i].data, _eventList[i].udata);
+    }
+  } while (count == 0 && timeoutMs < 0);
+  return (count);
+}
+
+FileDescriptor KqueueBackend::getFd() const
+{
+  return (_kqueue);
+}
+
+const char* KqueueBackend::getName() const
+{
+  return ("kqueue");
+}
+
+#endif //WEBSERV_HAS_KQUEUE
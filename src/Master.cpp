@@ -0,0 +1,296 @@
+#include "Master.hpp"
+#include "ServerManager.hpp"
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <csignal>
+#include <sstream>
+#if defined(__linux__)
+# include <sched.h>
+# include <sys/prctl.h>
+#endif
+
+Master::Master(ServerManager& manager, size_t workerCount) :
+  _manager(manager),
+  _loads(NULL),
+  _workerId(-1),
+  _lastReport(time(NULL))
+{
+  void* shared = mmap(NULL, sizeof(Load) * (workerCount + 1), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+
+  if (shared == MAP_FAILED)
+    throw (std::runtime_error("mmap() worker loads failed\n"));
+  _loads = static_cast<Load*>(shared);
+  _workers.resize(workerCount);
+  _loads[workerCount] = Load();
+  for (int kind = 0; kind < LOAD_KINDS; ++kind)
+    _loads[workerCount].limit[kind] = _manager.getConfig().maxLoad[kind];
+  for (size_t i = 0; i < workerCount; ++i)
+  {
+    _workers[i].pid = 0;
+    _workers[i].startedAt = 0;
+    _workers[i].respawnAt = 0;
+    _workers[i].respawns = 0;
+    resetLoad(i);
+  }
+}
+
+// a worker keeps the mapping : its ServerManager counts in it until the end.
+Master::~Master()
+{
+  for (size_t i = 0; i < _listenFds.size(); ++i)
+    close(_listenFds[i]);
+  munmap(_loads, sizeof(Load) * (_workers.size() + 1));
+}
+
+// master only. same as syncListeners, without event loop : the workers watch the sockets.
+void Master::openListeners(bool mustOpen)
+{
+  ConfigSnapshot* snapshot = _manager.acquireSnapshot();
+  std::vector<Server*> servers = snapshot->getListenServers();
+  std::vector<FileDescriptor> kept;
+  std::vector<struct sockaddr_in> keptAddrs;
+
+  for (size_t i = 0; i < _listenFds.size(); ++i)
+  {
+    struct sockaddr_in addr;
+    if (Server::isListenSocket(_listenFds[i], &addr) && snapshot->findListenServer(addr) != NULL)
+    {
+      kept.push_back(_listenFds[i]);
+      keptAddrs.push_back(addr);
+      continue;
+    }
+    printLog("listen closed\t" + getClientIP(&addr) + ":" + ft_itos(ntohs(addr.sin_port)) + "\n", PRINT_CYAN);
+    close(_listenFds[i]);
+  }
+  _listenFds.swap(kept);
+  for (size_t i = 0; i < servers.size(); ++i)
+  {
+    bool isOpen = false;
+    for (size_t j = 0; j < keptAddrs.size() && !isOpen; ++j)
+      isOpen = (keptAddrs[j].sin_port == servers[i]->_socketAddr.sin_port
+                && keptAddrs[j].sin_addr.s_addr == servers[i]->_socketAddr.sin_addr.s_addr);
+    if (isOpen)
+      continue;
+    try
+    {
+      _listenFds.push_back(servers[i]->openListenSocket(false));
+    }
+    catch (std::exception& e)
+    {
+      if (mustOpen)
+      {
+        ConfigSnapshot::release(snapshot);
+        throw ;
+      }
+      printLog("error: listen " + getClientIP(&servers[i]->_socketAddr) + ":" + ft_itos(servers[i]->_serverPort) + " : " + e.what(), PRINT_RED);
+      continue;
+    }
+    if (!mustOpen)
+      printLog("listen opened\t" + getClientIP(&servers[i]->_socketAddr) + ":" + ft_itos(servers[i]->_serverPort) + "\n", PRINT_CYAN);
+  }
+  ConfigSnapshot::release(snapshot);
+}
+
+// master only. binary upgrade : the sockets of the previous process no address took are passed on
+// to the workers too, which accept from them. (see adoptListeners)
+void Master::adoptListeners()
+{
+  ConfigSnapshot* snapshot = _manager.acquireSnapshot();
+  struct sockaddr_in addr;
+  FileDescriptor fd;
+
+  while ((fd = Server::takeLeftoverSocket(&addr)) >= 0)
+  {
+    if (snapshot->findListenServer(addr) != NULL)
+      _listenFds.push_back(fd);
+    else // gone from the configuration
+      close(fd);
+  }
+  ConfigSnapshot::release(snapshot);
+}
+
+// master only. fork the workers which are not running. (those which just died wait RESPAWN_DELAY)
+bool Master::spawnWorkers()
+{
+  const time_t now = time(NULL);
+
+  for (size_t i = 0; i < _workers.size(); ++i)
+  {
+    WorkerProcess& worker = _workers[i];
+    if (worker.pid > 0 || now < worker.respawnAt)
+      continue;
+    const pid_t pid = fork();
+    if (pid < 0)
+    {
+      printLog("error: worker " + ft_itos(i) + " : fork() failed\n", PRINT_RED);
+      worker.respawnAt = now + RESPAWN_DELAY;
+      continue;
+    }
+    if (pid == 0)
+    {
+#if defined(__linux__)
+      prctl(PR_SET_PDEATHSIG, SIGQUIT); // the master is gone : drain
+#endif
+      _workerId = static_cast<ssize_t>(i);
+      pinWorker(i);
+      // the event loop of this worker takes them. (see Server::openListenSocket)
+      for (size_t j = 0; j < _listenFds.size(); ++j)
+        Server::inheritSocket(_listenFds[j]);
+      _listenFds.clear();
+      return (true);
+    }
+    if (worker.startedAt != 0)
+      worker.respawns++;
+    worker.pid = pid;
+    worker.startedAt = now;
+    printLog("worker\t\t" + ft_itos(i) + " started\tpid " + ft_itos(pid) + "\n", PRINT_CYAN);
+  }
+  return (false);
+}
+
+// master only. a worker which exits is started again by the next spawnWorkers().
+void Master::reapWorkers()
+{
+  const time_t now = time(NULL);
+  pid_t pid;
+  int status;
+
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+  {
+    for (size_t i = 0; i < _retired.size(); ++i)
+    {
+      if (_retired[i] == pid)
+      {
+        _retired.erase(_retired.begin() + i);
+        break ;
+      }
+    }
+    for (size_t i = 0; i < _workers.size(); ++i)
+    {
+      WorkerProcess& worker = _workers[i];
+      if (worker.pid != pid)
+        continue;
+      if (WIFSIGNALED(status))
+        printLog("error: worker " + ft_itos(i) + " (pid " + ft_itos(pid) + ") killed by signal " + ft_itos(WTERMSIG(status)) + "\n", PRINT_RED);
+      else
+        printLog("worker\t\t" + ft_itos(i) + " exited\tpid " + ft_itos(pid) + "\tstatus " + ft_itos(WEXITSTATUS(status)) + "\n", PRINT_YELLOW);
+      worker.pid = 0;
+      worker.respawnAt = (now - worker.startedAt < RESPAWN_DELAY) ? now + RESPAWN_DELAY : now;
+      resetLoad(i); // its connections are gone
+    }
+  }
+}
+
+// master only. SIGHUP : the workers drain, new ones start from the published configuration.
+// a new worker counts in the slot of the one it replaces. (both slots move by whole connections)
+void Master::replaceWorkers()
+{
+  for (size_t i = 0; i < _workers.size(); ++i)
+  {
+    if (_workers[i].pid <= 0)
+      continue;
+    kill(_workers[i].pid, SIGQUIT);
+    _retired.push_back(_workers[i].pid);
+    _workers[i].pid = 0;
+    _workers[i].respawnAt = 0;
+  }
+}
+
+void Master::signalWorkers(int signo)
+{
+  for (size_t i = 0; i < _workers.size(); ++i)
+  {
+    if (_workers[i].pid > 0)
+      kill(_workers[i].pid, signo);
+  }
+  for (size_t i = 0; i < _retired.size(); ++i)
+    kill(_retired[i], signo);
+}
+
+size_t Master::runningWorkers() const
+{
+  size_t count = _retired.size();
+
+  for (size_t i = 0; i < _workers.size(); ++i)
+  {
+    if (_workers[i].pid > 0)
+      count++;
+  }
+  return (count);
+}
+
+// worker only.
+Load* Master::getWorkerLoad() const
+{
+  return (&_loads[_workerId]);
+}
+
+// every worker together : the limits of the configuration are checked here.
+Load* Master::getWorkersLoad() const
+{
+  return (&_loads[_workers.size()]);
+}
+
+// the slots of the worker are given back for it. (its own slot has no limit : counts only)
+void Master::resetLoad(size_t id)
+{
+  for (int kind = 0; kind < LOAD_KINDS; ++kind)
+    dropLoad(*getWorkersLoad(), kind, __atomic_load_n(&_loads[id].current[kind], __ATOMIC_RELAXED));
+  _loads[id] = Load();
+}
+
+// worker_cpu_affinity : auto -> worker i on CPU i, otherwise the masks in turn. (rightmost bit : CPU 0)
+void Master::pinWorker(size_t id)
+{
+  const std::vector<std::string>& affinity = _manager.getConfig().workerCpuAffinity;
+
+  if (affinity.empty())
+    return ;
+#if defined(__linux__)
+  const long cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  if (affinity[0] == "auto")
+    CPU_SET(id % static_cast<size_t>(cpuCount > 0 ? cpuCount : 1), &set);
+  else
+  {
+    const std::string& mask = affinity[id % affinity.size()];
+    for (size_t bit = 0; bit < mask.size() && bit < CPU_SETSIZE; ++bit)
+    {
+      if (mask[mask.size() - 1 - bit] == '1')
+        CPU_SET(bit, &set);
+    }
+  }
+  if (sched_setaffinity(0, sizeof(set), &set) < 0)
+    printLog("error: worker " + ft_itos(id) + " : sched_setaffinity() failed\n", PRINT_RED);
+#else
+  printLog("error: worker " + ft_itos(id) + " : worker_cpu_affinity is not supported here\n", PRINT_RED);
+#endif
+}
+
+// master only. the load of every worker, then of all of them against the limits, every interval
+// seconds. (interval 0 : off)
+void Master::report(time_t interval)
+{
+  const time_t now = time(NULL);
+  const Load& workers = *getWorkersLoad();
+  Load total;
+
+  if (interval <= 0 || now - _lastReport < interval)
+    return ;
+  for (size_t i = 0; i < _workers.size(); ++i)
+  {
+    for (int kind = 0; kind < LOAD_KINDS; ++kind)
+      total.rejected[kind] += __atomic_load_n(&_loads[i].rejected[kind], __ATOMIC_RELAXED);
+    printLog("worker\t\t" + ft_itos(i) + "\tpid " + ft_itos(_workers[i].pid) + "\trespawns " + ft_itos(_workers[i].respawns) + "\n", PRINT_CYAN);
+    printLoad("worker " + ft_itos(i), _loads[i]);
+  }
+  for (int kind = 0; kind < LOAD_KINDS; ++kind)
+  {
+    total.current[kind] = __atomic_load_n(&workers.current[kind], __ATOMIC_RELAXED);
+    total.limit[kind] = workers.limit[kind];
+  }
+  printLoad("workers", total);
+  _lastReport = now;
+}
@@ -4,6 +4,8 @@
 #include <cctype>
 #include <sstream>
 
+static const char* const LOAD_DIRECTIVES[LOAD_KINDS] = {"max_connections", "max_requests", "max_cgi"};
+
 bool CommonParser::isNodeElementEmpty(ParserNode node)
 {
   if (node.elem.empty())
@@ -92,7 +94,7 @@ bool ConfigParser::isValidFile(const std::string& configFilePath)
   std::filebuf fb;
   char getChar;
 
-  if (fb.open(configFilePath, std::ios::in) == NULL)
+  if (fb.open(configFilePath.c_str(), std::ios::in) == NULL)
   {
     return (false);
   }
@@ -230,6 +232,9 @@ void ConfigParser::parseOneNode(std::istream& is)
     }
     buffer.clear();
   }
+  // directives outside of server blocks
+  _globalElem.insert(rootNode.elem.begin(), rootNode.elem.end());
+  rootNode.elem.clear();
   if (rootNode.next)
   {
     _nodeVector.push_back(rootNode);
@@ -333,6 +338,8 @@ void ConfigParser::getLocationAttr(Server& server, unsigned int serverIndex) {
         else { // if no autoindex option.
           location._autoindex = false;
         }
+        location.timeouts = server._timeouts;
+        getTimeouts(location.timeouts, temp->category, serverIndex);
         setLocationDefault(server, location);
         server._locations.push_back(location);
         location.allowMethods.clear();
@@ -383,6 +390,10 @@ void ConfigParser::displayServer(Server& server)
     }
     std::cout << std::endl;
     std::cout << "_autoindex : " << (server._locations[i]._autoindex ? "on" : "off") << std::endl;
+    std::cout << "_timeouts : header " << server._locations[i].timeouts.header
+              << " body " << server._locations[i].timeouts.body
+              << " send " << server._locations[i].timeouts.send
+              << " cgi " << server._locations[i].timeouts.cgi << std::endl;
     std::cout << "_cgiInfo : ";
     for (
             unsigned int k = 0; k < server._locations[i].cgiInfo.size(); ++k
@@ -424,6 +435,53 @@ void ConfigParser::getRedirect(Server &server, unsigned int serverIndex)
   }
 }
 
+// directives missing in category keep the value they have. (location : the server's)
+void ConfigParser::getTimeouts(Timeouts& timeouts, const std::string& category, unsigned int serverIndex)
+{
+  const char* const KEYS[] = {"client_header_timeout", "client_body_timeout", "keepalive_timeout", "send_timeout", "cgi_timeout"};
+  time_t* const VALUES[] = {&timeouts.header, &timeouts.body, &timeouts.keepAlive, &timeouts.send, &timeouts.cgi};
+
+  for (
+          size_t i = 0; i < sizeof(KEYS) / sizeof(KEYS[0]); ++i
+          )
+  {
+    std::string value = *(GetNodeElem(serverIndex, category, KEYS[i]).begin());
+    if (value.empty())
+      continue;
+    if (ft_stoi(value) < 0)
+      throw (std::runtime_error("invalid config file : " + std::string(KEYS[i]) + "\n"));
+    *VALUES[i] = ft_stoi(value);
+  }
+}
+
+void ConfigParser::getBufferSizes(Server& server, unsigned int serverIndex)
+{
+  const char* const KEYS[] = {"client_buffer_size", "output_buffer_size"};
+  size_t* const VALUES[] = {&server._clientBufferSize, &server._outputBufferSize};
+
+  for (
+          size_t i = 0; i < sizeof(KEYS) / sizeof(KEYS[0]); ++i
+          )
+  {
+    std::string value = *(GetNodeElem(serverIndex, "server", KEYS[i]).begin());
+    if (value.empty())
+      continue;
+    if (ft_stoi(value) <= 0)
+      throw (std::runtime_error("invalid config file : " + std::string(KEYS[i]) + "\n"));
+    *VALUES[i] = ft_stoi(value);
+  }
+}
+
+void ConfigParser::getLoadLimits(Load& load, unsigned int serverIndex)
+{
+  for (int i = 0; i < LOAD_KINDS; ++i)
+  {
+    std::string value = *(GetNodeElem(serverIndex, "server", LOAD_DIRECTIVES[i]).begin());
+    if (!value.empty() && ft_stoi(value) >= 0)
+      load.limit[i] = ft_stoi(value);
+  }
+}
+
 //begin empty일때
 void ConfigParser::getServerAttr(Server& server, unsigned int serverIndex)
 {
@@ -485,6 +543,9 @@ void ConfigParser::getServerAttr(Server& server, unsigned int serverIndex)
     server._allowMethods.push_back(DEFAULT_ALLOW_METHODS);
   }
   getRedirect(server, serverIndex);
+  getTimeouts(server._timeouts, "server", serverIndex);
+  getBufferSizes(server, serverIndex);
+  getLoadLimits(server._load, serverIndex);
   getLocationAttr(server, serverIndex);
   getErrorPage(server._errorPage, serverIndex);
 
@@ -496,7 +557,7 @@ std::vector<Server> ConfigParser::parseConfigFile(const std::string& configFileP
   std::filebuf fb;
   std::vector<Server> _serverList;
 
-  if (fb.open(configFilePath, std::ios::in) == NULL)
+  if (fb.open(configFilePath.c_str(), std::ios::in) == NULL)
   {
     throw (std::runtime_error("open fail\n"));
   }
@@ -517,3 +578,93 @@ std::vector<Server> ConfigParser::parseConfigFile(const std::string& configFileP
   }
   return (_serverList);
 }
+
+GlobalConfig ConfigParser::getGlobalConfig() const
+{
+  GlobalConfig config;
+  std::map<std::string, std::vector<std::string> >::const_iterator it;
+
+  it = _globalElem.find("event_batch_size");
+  if (it != _globalElem.end() && !it->second.empty() && ft_stoi(it->second[0]) > 0)
+  {
+    config.eventBatchSize = ft_stoi(it->second[0]);
+  }
+  it = _globalElem.find("read_budget");
+  if (it != _globalElem.end() && !it->second.empty() && ft_stoi(it->second[0]) > 0)
+  {
+    config.readBudget = ft_stoi(it->second[0]);
+  }
+  it = _globalElem.find("event_stat_interval");
+  if (it != _globalElem.end() && !it->second.empty() && ft_stoi(it->second[0]) >= 0)
+  {
+    config.eventStatInterval = ft_stoi(it->second[0]);
+  }
+  it = _globalElem.find("event_backend");
+  if (it != _globalElem.end() && !it->second.empty())
+  {
+    config.eventBackend = it->second[0];
+  }
+  it = _globalElem.find("worker_threads");
+  if (it != _globalElem.end() && !it->second.empty())
+  {
+    if (it->second[0] == "auto")
+    {
+      const long cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+      config.workerThreads = (cpuCount > 0) ? static_cast<size_t>(cpuCount) : 1;
+    }
+    else if (ft_stoi(it->second[0]) >= 0)
+      config.workerThreads = ft_stoi(it->second[0]);
+  }
+  it = _globalElem.find("worker_processes");
+  if (it != _globalElem.end() && !it->second.empty())
+  {
+    if (it->second[0] == "auto")
+    {
+      const long cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+      config.workerProcesses = (cpuCount > 0) ? static_cast<size_t>(cpuCount) : 1;
+    }
+    else if (ft_stoi(it->second[0]) >= 0)
+      config.workerProcesses = ft_stoi(it->second[0]);
+  }
+  it = _globalElem.find("worker_cpu_affinity");
+  if (it != _globalElem.end() && !it->second.empty() && it->second[0] != "off")
+  {
+    if (it->second[0] == "auto")
+      config.workerCpuAffinity.push_back("auto");
+    else
+    {
+      for (size_t i = 0; i < it->second.size(); ++i)
+      {
+        if (it->second[i].find_first_not_of("01") == std::string::npos)
+          config.workerCpuAffinity.push_back(it->second[i]);
+      }
+    }
+  }
+  for (int i = 0; i < LOAD_KINDS; ++i)
+  {
+    it = _globalElem.find(LOAD_DIRECTIVES[i]);
+    if (it != _globalElem.end() && !it->second.empty() && ft_stoi(it->second[0]) >= 0)
+      config.maxLoad[i] = ft_stoi(it->second[0]);
+  }
+  it = _globalElem.find("retry_after");
+  if (it != _globalElem.end() && !it->second.empty() && ft_stoi(it->second[0]) >= 0)
+  {
+    config.retryAfter = ft_stoi(it->second[0]);
+  }
+  it = _globalElem.find("shutdown_timeout");
+  if (it != _globalElem.end() && !it->second.empty() && ft_stoi(it->second[0]) >= 0)
+  {
+    config.shutdownTimeout = ft_stoi(it->second[0]);
+  }
+  it = _globalElem.find("slab_hugepages");
+  if (it != _globalElem.end() && !it->second.empty())
+  {
+    config.slabHugePages = (it->second[0] == "on");
+  }
+  it = _globalElem.find("accept_budget");
+  if (it != _globalElem.end() && !it->second.empty() && ft_stoi(it->second[0]) > 0)
+  {
+    config.acceptBudget = ft_stoi(it->second[0]);
+  }
+  return (config);
+}
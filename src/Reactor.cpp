@@ -0,0 +1,399 @@
+#include "Reactor.hpp"
+#include "ServerManager.hpp"
+#include <sstream>
+
+static void* reactorHandler(void* _reactor)
+{
+  reinterpret_cast<Reactor*>(_reactor)->run();
+  return (NULL);
+}
+
+Reactor::Reactor(ServerManager& manager, size_t id) :
+  ID(id),
+  _manager(manager),
+  _backend(NULL),
+  _started(false),
+  _depth(0),
+  _doneCount(0),
+  _idle(0),
+  _executed(0),
+  _stolen(0),
+  _stolenFrom(0),
+  _maxDepth(0),
+  _lastReport(time(NULL)),
+  _listenGeneration(0)
+{
+  struct Event event;
+
+  pthread_mutex_init(&_queueMutex, NULL);
+  pthread_mutex_init(&_doneMutex, NULL);
+  pthread_mutex_init(&_listenMutex, NULL);
+  _backend = EventBackend::create(manager.getConfig().eventBackend);
+  openWakeFd(_wakeFd);
+  setEvent(&event, _wakeFd[0], EVENT_READ, EVENT_ADD, 0, this);
+  if (_backend->attach(event) < 0 || _backend->flush() < 0)
+    throw (std::runtime_error("Event attach wake up fd failed\n"));
+}
+
+Reactor::~Reactor()
+{
+  for (
+          std::vector<struct Context*>::iterator it = _listenContexts.begin();
+          it != _listenContexts.end();
+          ++it
+          )
+  {
+    closeListener(*it);
+  }
+  _backend->detach(_wakeFd[0]);
+  closeWakeFd(_wakeFd);
+  delete (_backend);
+  pthread_mutex_destroy(&_queueMutex);
+  pthread_mutex_destroy(&_doneMutex);
+  pthread_mutex_destroy(&_listenMutex);
+}
+
+// every reactor binds the ports itself. (called before any reactor starts, errors stop the server)
+void Reactor::openListeners()
+{
+  _listenGeneration = _manager.getGeneration();
+  syncListeners(_listenContexts, &_manager, _backend, this, true);
+}
+
+// binary upgrade : the sockets left once every reactor took its own. (before any reactor starts)
+void Reactor::adoptListeners()
+{
+  ::adoptListeners(_listenContexts, &_manager, _backend, this);
+}
+
+// the listening sockets of this reactor, added to fds. (any thread)
+void Reactor::getListenFds(std::vector<FileDescriptor>& fds)
+{
+  pthread_mutex_lock(&_listenMutex);
+  for (size_t i = 0; i < _listenContexts.size(); ++i)
+    fds.push_back(_listenContexts[i]->fd);
+  pthread_mutex_unlock(&_listenMutex);
+}
+
+// a configuration was reloaded : open and close the listening sockets of this reactor.
+void Reactor::updateListeners()
+{
+  const unsigned long generation = _manager.getGeneration();
+
+  if (generation == _listenGeneration || _manager.isStopping())
+    return ;
+  _listenGeneration = generation;
+  pthread_mutex_lock(&_listenMutex);
+  syncListeners(_listenContexts, &_manager, _backend, this, false);
+  pthread_mutex_unlock(&_listenMutex);
+}
+
+void Reactor::start()
+{
+  if (pthread_create(&_thread, NULL, reactorHandler, this) != 0)
+    throw (std::runtime_error("Create reactor thread failed\n"));
+  _started = true;
+}
+
+void Reactor::join()
+{
+  if (_started)
+    pthread_join(_thread, NULL);
+  _started = false;
+}
+
+// any thread : the loop looks at its work, the configuration and the stop request again.
+void Reactor::wakeUp()
+{
+  sendWakeUp(_wakeFd[1]);
+}
+
+size_t Reactor::getId() const
+{
+  return (ID);
+}
+
+EventBackend* Reactor::getBackend() const
+{
+  return (_backend);
+}
+
+// owner only. the connection is left alone until its item is completed here.
+void Reactor::submit(struct Context* context, bool (*job)(struct Context*), void (*finish)(struct Context*))
+{
+  WorkItem item;
+  size_t depth;
+
+  item.context = context;
+  item.job = job;
+  item.finish = finish;
+  item.ready = false;
+  context->workState = WORK_QUEUED;
+  pthread_mutex_lock(&_queueMutex);
+  _runQueue.push_back(item);
+  depth = _runQueue.size();
+  __atomic_store_n(&_depth, depth, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&_queueMutex);
+  if (depth > _maxDepth)
+    _maxDepth = depth;
+  if (depth >= STEAL_MIN_DEPTH)
+    wakeThief();
+}
+
+bool Reactor::runJob(WorkItem& item)
+{
+  try
+  {
+    item.ready = item.job(item.context);
+  }
+  catch (std::exception& e)
+  {
+    printLog(e.what(), PRINT_RED);
+    item.ready = false;
+  }
+  return (item.ready);
+}
+
+// owner only.
+void Reactor::complete(WorkItem& item)
+{
+  struct Context* context = item.context;
+
+  if (context->workState == WORK_PARKED)
+  {
+    struct Event event;
+    setEvent(&event, context->fd, EVENT_READ, EVENT_ENABLE, 0, context);
+    _manager.attachNewEvent(context, event);
+  }
+  context->workState = WORK_IDLE;
+  if (!item.ready)
+    return ;
+  try
+  {
+    item.finish(context);
+  }
+  catch (std::exception& e)
+  {
+    printLog(e.what(), PRINT_RED);
+  }
+}
+
+void Reactor::runQueue()
+{
+  WorkItem item;
+
+  while (true)
+  {
+    pthread_mutex_lock(&_queueMutex);
+    if (_runQueue.empty())
+    {
+      pthread_mutex_unlock(&_queueMutex);
+      return ;
+    }
+    item = _runQueue.front();
+    _runQueue.pop_front();
+    __atomic_store_n(&_depth, _runQueue.size(), __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&_queueMutex);
+    runJob(item);
+    _executed++;
+    complete(item);
+  }
+}
+
+void Reactor::finishStolen()
+{
+  std::vector<WorkItem> done;
+
+  if (__atomic_load_n(&_doneCount, __ATOMIC_SEQ_CST) == 0)
+    return ;
+  pthread_mutex_lock(&_doneMutex);
+  done.swap(_done);
+  __atomic_store_n(&_doneCount, 0, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&_doneMutex);
+  for (size_t i = 0; i < done.size(); ++i)
+    complete(done[i]);
+}
+
+// take one job from the back of the deepest queue, run it, and hand it back to its owner.
+bool Reactor::steal()
+{
+  const std::vector<Reactor*>& reactors = _manager.getReactors();
+  Reactor* victim = NULL;
+  size_t victimDepth = STEAL_MIN_DEPTH - 1;
+  WorkItem item;
+
+  for (size_t i = 1; i < reactors.size(); ++i)
+  {
+    Reactor* other = reactors[(ID + i) % reactors.size()];
+    const size_t depth = __atomic_load_n(&other->_depth, __ATOMIC_SEQ_CST);
+    if (depth > victimDepth)
+    {
+      victim = other;
+      victimDepth = depth;
+    }
+  }
+  if (victim == NULL)
+    return (false);
+  pthread_mutex_lock(&victim->_queueMutex);
+  if (victim->_runQueue.size() < STEAL_MIN_DEPTH)
+  {
+    pthread_mutex_unlock(&victim->_queueMutex);
+    return (false);
+  }
+  item = victim->_runQueue.back();
+  victim->_runQueue.pop_back();
+  __atomic_store_n(&victim->_depth, victim->_runQueue.size(), __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&victim->_stolenFrom, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&victim->_queueMutex);
+
+  runJob(item);
+  _executed++;
+  _stolen++;
+
+  pthread_mutex_lock(&victim->_doneMutex);
+  victim->_done.push_back(item);
+  __atomic_store_n(&victim->_doneCount, victim->_done.size(), __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&victim->_doneMutex);
+  // pairs with the idle store + hasWork() of the owner.
+  if (__atomic_exchange_n(&victim->_idle, 0, __ATOMIC_SEQ_CST) == 1)
+    sendWakeUp(victim->_wakeFd[1]);
+  return (true);
+}
+
+// checked after announcing the wait : work that showed up in between is seen here or sends a wake up.
+bool Reactor::hasWork()
+{
+  const std::vector<Reactor*>& reactors = _manager.getReactors();
+
+  if (__atomic_load_n(&_depth, __ATOMIC_SEQ_CST) > 0 || __atomic_load_n(&_doneCount, __ATOMIC_SEQ_CST) > 0)
+    return (true);
+  for (size_t i = 0; i < reactors.size(); ++i)
+  {
+    if (reactors[i] != this && __atomic_load_n(&reactors[i]->_depth, __ATOMIC_SEQ_CST) >= STEAL_MIN_DEPTH)
+      return (true);
+  }
+  return (false);
+}
+
+// wake up one idle reactor to steal from this one.
+void Reactor::wakeThief()
+{
+  const std::vector<Reactor*>& reactors = _manager.getReactors();
+
+  for (size_t i = 1; i < reactors.size(); ++i)
+  {
+    Reactor* other = reactors[(ID + i) % reactors.size()];
+    if (__atomic_exchange_n(&other->_idle, 0, __ATOMIC_SEQ_CST) == 1)
+    {
+      sendWakeUp(other->_wakeFd[1]);
+      return ;
+    }
+  }
+}
+
+// the connection is ready again while its job is out : stop watching it until complete().
+// (enabling it there reports what the job did not read)
+void Reactor::park(struct Context* context)
+{
+  struct Event event;
+
+  setEvent(&event, context->fd, EVENT_READ, EVENT_DISABLE, 0, context);
+  _manager.attachNewEvent(context, event);
+  context->workState = WORK_PARKED;
+}
+
+// print the run queue counters every interval seconds and start over. (interval 0 : off)
+void Reactor::reportQueue(time_t interval)
+{
+  const time_t now = time(NULL);
+
+  if (interval <= 0 || now - _lastReport < interval)
+    return ;
+  std::stringstream ss;
+  ss << "run queue\treactor " << ID
+     << "\tdepth " << __atomic_load_n(&_depth, __ATOMIC_SEQ_CST)
+     << "\tmax depth " << _maxDepth
+     << "\texecuted " << _executed
+     << "\tstolen " << _stolen
+     << "\tstolen from " << __atomic_exchange_n(&_stolenFrom, 0, __ATOMIC_RELAXED)
+     << "\n";
+  printLog(ss.str(), PRINT_CYAN);
+  _maxDepth = 0;
+  _executed = 0;
+  _stolen = 0;
+  _lastReport = now;
+}
+
+void Reactor::run()
+{
+  const GlobalConfig& config = _manager.getConfig();
+  std::vector<struct Event> events(config.eventBatchSize);
+  const std::string statName = "reactor " + ft_itos(ID);
+  EventStat eventStat;
+  ConnectionTimers timers;
+
+  timers.bind(_backend);
+  while (1)
+  {
+    updateListeners();
+    if (_manager.isStopping())
+    { // returns once every connection of this reactor is closed (none of them has an item out then)
+      pthread_mutex_lock(&_listenMutex);
+      closeListeners(_listenContexts);
+      pthread_mutex_unlock(&_listenMutex);
+      if (timers.drain(_manager.getStopDeadline()))
+      {
+        SlabPool::releaseThreadCaches();
+        BufferPool::releaseThreadCache();
+        return ;
+      }
+    }
+    finishStolen();
+    runQueue();
+    if (steal())
+      continue;
+    __atomic_store_n(&_idle, 1, __ATOMIC_SEQ_CST);
+    if (hasWork())
+    {
+      __atomic_store_n(&_idle, 0, __ATOMIC_SEQ_CST);
+      continue;
+    }
+    int newEventCount = _backend->wait(&events[0], static_cast<int>(events.size()), -1);
+    __atomic_store_n(&_idle, 0, __ATOMIC_SEQ_CST);
+
+    if (newEventCount == -1)
+    { // nothing happen
+      printLog("EV ERR (-1)\n", PRINT_RED);
+      continue;
+    }
+    else if (newEventCount == 0)
+    { // time limit expired -> never happen
+      continue;
+    }
+    eventStat.record(newEventCount, events.size());
+    eventStat.report(statName, config.eventStatInterval);
+    reportQueue(config.eventStatInterval);
+    if (ID == 0)
+      _manager.reportLoad(config.eventStatInterval);
+    for (int i = 0; i < newEventCount; ++i)
+    {
+      if (events[i].filter == EVENT_TIMER) // the wheel is advanced after the batch
+      {
+        events[i].udata = NULL;
+      }
+      else if (events[i].udata == this) // wake up : work is checked at the top of the loop
+      {
+        clearWakeUp(_wakeFd[0]);
+        events[i].udata = NULL;
+      }
+      else if (events[i].udata != NULL && static_cast<struct Context*>(events[i].udata)->workState != WORK_IDLE)
+      {
+        if (static_cast<struct Context*>(events[i].udata)->workState == WORK_QUEUED)
+          park(static_cast<struct Context*>(events[i].udata));
+        events[i].udata = NULL;
+      }
+    }
+    handleEvents(&events[0], newEventCount);
+    timers.advance();
+  }
+}
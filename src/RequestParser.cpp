@@ -1,401 +1,435 @@
 #include "RequestParser.hpp"
 #include "ServerManager.hpp"
+#include "Scan.hpp"
+#include "CGI.hpp"
 #include <sys/time.h>
 #include <cstdlib>
+#include <cerrno>
+#include <algorithm>
+#include <cstring>
+#include <strings.h>
+#include <cctype>
+#include <stdexcept>
 
-std::string::iterator RequestParser::getOneLine(\
-    std::string& str, std::string::iterator it, std::string::iterator end)
+// the body is taken out of input, into request->body until the processor gives it to its sink.
+// (chunked : decoded as it arrives, the framing is dropped)
+void RequestParser::parseBody(HTTPRequest* request, BufferSlice& input)
 {
-  while (it != end && it + 1 != end)
+  if (request->chunkedFlag)
   {
-    if (*it == '\r' && *(it + 1) == '\n')
+    while (!input.empty() && !request->chunked.done())
+    {
+      const char* piece;
+      size_t pieceSize;
+      const size_t used = request->chunked.decode(input.data(), input.size(), &piece, &pieceSize);
+      request->body->append(piece, pieceSize);
+      request->received += pieceSize;
+      input.consume(used);
+    }
+    if (request->chunked.done())
     {
-      return it + 2;
+      request->status = END;
     }
-    str += *it;
-    it++;
+    return;
+  }
+  const size_t count = std::min(input.size(), request->contentLength - request->received);
+  request->body->append(input.data(), count);
+  request->received += count;
+  input.consume(count);
+  if (request->received == request->contentLength)
+  {
+    request->status = END;
   }
-  return it;
 }
 
-void RequestParser::checkBodyLength(HTTPRequest* request)
+void RequestParser::checkHeaderValid(HTTPRequest* request)
 {
-  size_t length;
+  const HeaderField* length;
+  const HeaderField* chunked;
 
-  if (request->method == GET || request->method == HEAD)
+  request->checkLevel = BODY;
+  if (request->method == GET || request->method == HEAD || request->method == DELETE)
   {
-    request->body->clear();
     request->status = END;
     return;
   }
-  length = static_cast<size_t>\
-            (strtol(request->headers.find("Content-Length")->second.c_str(), NULL, 10));
-  if (request->body->size() > length)
+  length = request->findHeader(HD_CONTENT_LENGTH);
+  chunked = request->findHeader(HD_TRANSFER_ENCODING);
+  if (chunked != NULL && chunked->value.length == sizeof("chunked") - 1
+      && strncasecmp(request->head.data() + chunked->value.offset, "chunked", chunked->value.length) == 0)
   {
-    throw (std::logic_error("body length more long"));
+    request->chunkedFlag = true;
   }
-  else if (request->body->size() == length)
+  if (!request->chunkedFlag && length == NULL)
   {
-    request->status = END;
+    if (request->method == POST || request->method == PUT) // a body is expected, with no size
+      request->errorCode = ST_LENGTH_REQUIRED;
+    throw (std::logic_error("don't have Content-Length"));
   }
-}
-
-// 16진수 문자열을 long으로 변환
-long convertHexStrToLong(const std::string& hex)
-{
-  long result = 0;
-
-  static const std::string HEX_LOOKUP("0123456789abcdef");
-  for (std::string::const_iterator itr = hex.begin(); itr != hex.end(); itr++)
+  if (length != NULL)
   {
-    int i = 0;
-    while (i < 16)
+    const char* digits = request->head.data() + length->value.offset;
+    size_t i = 0;
+    for (; i < length->value.length && isdigit(digits[i]); ++i)
     {
-      if (HEX_LOOKUP[i] == *itr)
+      if (request->contentLength > (static_cast<size_t>(-1) - 9) / 10)
       {
-        result = (result + i) * 16;
-        break;
+        throw std::logic_error("content-length value error");
       }
-      i++;
+      request->contentLength = request->contentLength * 10 + (digits[i] - '0');
+    }
+    if (!request->chunkedFlag && i != length->value.length)
+    {
+     throw std::logic_error("content-length value error");
     }
   }
-  return (result / 16);
+  request->status = HEADEROK;
+  if (request->chunkedFlag)
+    request->status = READING;
 }
 
-void RequestParser::parseChunked(HTTPRequest* request)
+// "method target version" : [begin, end) of the read buffer.
+void RequestParser::parseStartLine(HTTPRequest* request, const char* data, size_t begin, size_t end)
 {
-  std::string endcheck;
-  std::string chunckedbody;
-  std::string::reverse_iterator rit;
-  std::string::iterator it;
-  std::string::iterator end;
-  long int length_int;
-  std::string length_str;
-  std::string val;
+  const char* const lineEnd = data + end;
+  const char* word = data + begin;
+  HeadSlice words[3];
+  size_t k = 0;
 
-  for (
-          rit = request->body->rbegin(); rit != request->body->rend(); ++rit
-          )
-  {
-    endcheck.insert(endcheck.begin(), *rit);
-    if (endcheck.size() == 5)
-    {
-      break;
-    }
-  }
-  if (endcheck != "0\r\n\r\n")
+  while (true)
   {
-    return;
-  }
-  end = request->body->end();
-  for (
-          it = request->body->begin(); it != end - 5;
-          )
-  {
-    it = getOneLine(length_str, it, end);
-    it = getOneLine(val, it, end);
-
-    // FIXME : chunked의 length 정보가 hex(16진수)로 들어온다 --> ex. 3e8
-    length_int = convertHexStrToLong(length_str);
-    if (length_int < 0)
+    const char* space = Scan::find(word, lineEnd, ' ');
+    if (k == 3)
     {
-      throw std::logic_error("chunked length value error");
+      throw (std::logic_error("startline ERROR"));
     }
-    if (val.size() != static_cast<size_t>(length_int))
+    words[k].offset = word - data;
+    words[k].length = space - word;
+    k++;
+    if (space == lineEnd)
     {
-      throw std::logic_error("chunked length value error");
+      break;
     }
-    chunckedbody += val;
-    val.clear();
-    length_str.clear();
+    word = space + 1;
   }
-  request->body->assign(chunckedbody.begin(), chunckedbody.end());
-  request->status = END;
-}
-
-void RequestParser::parseBody(HTTPRequest* request)
-{
-  size_t delim;
-  if (request->checkLevel != BODY)
+  if (k != 3 || !words[1].length || !words[2].length)
   {
-      return;
-  }
-  if (!request->body->size())
-  {
-    delim = request->message->find("\r\n\r\n");
-    request->body->assign(request->message->begin() + delim + 4, request->message->end());
+    throw (std::logic_error("_startline vaild check ERROR"));
   }
-  if (request->chunkedFlag)
+  request->method = getMethodType(std::string(data + words[0].offset, words[0].length));
+  if (request->method == UNDEFINED)
   {
-    parseChunked(request);
+    throw (std::logic_error("_startline vaild check ERROR"));
   }
-  else
-    checkBodyLength(request);
+  request->target = words[1];
+  request->version = words[2];
 }
 
-void RequestParser::checkHeaderValid(HTTPRequest* request)
+// "key:value" or "key: value" : [begin, end) of the read buffer.
+void RequestParser::parseHeaderLine(HTTPRequest* request, const char* data, size_t begin, size_t end)
 {
-  std::map<std::string, std::string>::iterator length;
-  std::map<std::string, std::string>::iterator chunked;
-  char* endptr;
-  long int length_val;
+  const char* colon = Scan::find(data + begin, data + end, ':');
+  HeaderField field;
 
-  if (request->checkLevel != HEADER)
+  if (colon == data + end || colon == data + begin)
   {
-    return;
+    throw (std::logic_error("header key, value error (req parser)\n"));
   }
-  if (request->method == GET || request->method == HEAD || request->method == DELETE)
+  size_t value = colon - data + 1;
+  if (value < end && (data[value] == ' ' || data[value] == '\t'))
   {
-    request->status = END;
-    return;
+    value++;
   }
-  length = request->headers.find("Content-Length");
-  chunked = request->headers.find("Transfer-Encoding");
-  if (chunked != request->headers.end() && chunked->second == "chunked")
+  if (value >= end)
   {
-    request->chunkedFlag = true;
+    throw (std::logic_error("header key, value error (req parser)\n"));
   }
-  if (!request->chunkedFlag && length == request->headers.end())
+  field.name.offset = begin;
+  field.name.length = colon - data - begin;
+  field.value.offset = value;
+  field.value.length = end - value;
+  if (!request->addHeader(field))
   {
-    throw (std::logic_error("don't have Content-Length"));
+    throw (std::logic_error("conflicting Content-Length (req parser)\n"));
   }
-  if (length != request->headers.end())
-  {
-    length_val = strtol(length->second.c_str(), &endptr, 10);
-    if ((!request->chunkedFlag && *endptr != '\0') || length_val < 0)
-    {
-     throw std::logic_error("content-length value error");
-    }
-  }
-  request->checkLevel = BODY;
-  request->status = HEADEROK;
-  if (request->chunkedFlag)
-    request->status = READING;
 }
 
-void RequestParser::checkStartLineValid(HTTPRequest* request)
+// the head is in the first length bytes of input : it is kept as it is, the fields point into it.
+void RequestParser::completeHead(HTTPRequest* request, BufferSlice& input, size_t length)
 {
-  if (request->checkLevel != STARTLINE)
+  request->head = input;
+  request->head.resize(length);
+  input.consume(length);
+  const char* sent = request->head.data() + request->target.offset;
+  const char* mark = static_cast<const char*>(memchr(sent, '?', request->target.length));
+  request->url.assign(sent, (mark != NULL) ? mark : sent + request->target.length);
+  if (request->url.find('%') != ArenaString::npos)
   {
-    return;
-  }
-  if (request->method == UNDEFINED || \
-            !request->url.size() || !request->version.size())
-  {
-    throw (std::logic_error("_startline vaild check ERROR"));
+    const std::string decoded = decodePercentEncoding(toStdString(request->url));
+    request->url.assign(decoded.data(), decoded.size());
   }
-  request->checkLevel = HEADER;
+  checkHeaderValid(request);
 }
 
-void RequestParser::getStartLine(HTTPRequest* request, size_t& end)
+// the head, one line at a time from where the last read stopped : each byte is looked at once.
+// the offsets are from the front of input, where the head starts. (head shares it meanwhile :
+// the fields read so far can be looked up even if the head is never complete)
+void RequestParser::parseHead(HTTPRequest* request, BufferSlice& input)
 {
-  std::string::iterator it;
-  std::string buffer;
+  const char* data = input.data();
 
-  end = request->message->find("\r\n");
-  if (end == std::string::npos)
-  {
-    throw (std::logic_error("startline ERROR"));
-  }
-  it = request->message->begin();
-  for (
-          size_t i = 0, k = 0; i <= end; ++i, ++it
-          )
+  request->head = input;
+
+  while (request->checkLevel != BODY)
   {
-    if (*it == ' ' || i == end)
+    const char* newline = Scan::find(data + request->scanned, data + input.size(), '\n');
+    if (newline == data + input.size())
     {
-      switch (k)
+      request->scanned = input.size();
+      if (input.size() >= REQUEST_HEAD_MAX)
       {
-        case 0:
-          request->method = getMethodType(buffer);
-          break;
-        case 1:
-          request->url = decodePercentEncoding(buffer);
-          break;
-        case 2:
-          request->version = buffer;
-          break;
-        default:
-          throw (std::logic_error("startline ERROR"));
+        throw (std::logic_error("request head too large"));
       }
-      k++;
-      buffer.clear();
+      return;
     }
-    else
+    const size_t lineEnd = newline - data;
+    request->scanned = lineEnd + 1;
+    if (lineEnd == request->lineStart || data[lineEnd - 1] != '\r') // a bare LF : part of the line
     {
-      buffer += *it;
+      continue;
     }
-  }
-}
-
-void RequestParser::getHeader(HTTPRequest* request, size_t begin, size_t endPOS)
-{
-  std::string key;
-  std::string buffer;
-  std::string::iterator it = request->message->begin();
-
-  for (
-          size_t i = begin; i != endPOS; ++i
-          )
-  {
-    if (it[i] == '\r' && it[i + 1] == '\n')
+    const size_t begin = request->lineStart;
+    const size_t end = lineEnd - 1;
+    request->lineStart = request->scanned;
+    if (request->checkLevel == STARTLINE)
     {
-      if (!key.empty() && !buffer.empty())
+      if (begin != end) // (empty lines before it are skipped)
       {
-        request->headers[key] = buffer;
-        buffer.clear();
-        key.clear();
-        i++;
-        continue;
-      }
-      else
-      {
-        throw (std::logic_error("header key, value error (req parser)\n"));
+        parseStartLine(request, data, begin, end);
+        request->checkLevel = HEADER;
       }
     }
-    if (it[i] == ':' && key.empty())
+    else if (begin != end)
     {
-      key = buffer;
-      buffer.clear();
-      if (it[i + 1] == ' ' || it[i + 1] == '\t')
-      {
-        i++;
-      }
+      parseHeaderLine(request, data, begin, end);
     }
     else
     {
-      buffer += it[i];
+      completeHead(request, input, request->scanned);
     }
   }
 }
 
-void RequestParser::getQuery(HTTPRequest* request)
+// a chunked body is refused as soon as a chunk would take it past client_max_body_size of the
+// location, or of the server at the root. (the processor checks a Content-Length before the body
+// is read. no limit for cgi : as there)
+void RequestParser::limitBody(HTTPRequest* request, ConfigSnapshot& snapshot)
 {
-    size_t queryPOS;
-    std::string querySTR;
-    std::string key;
-    std::string buffer;
+  Server& server = snapshot.getMatchedServer(*request);
+  Location* location = server.getMatchedLocation(*request);
+  const int maxBodySize = (location != NULL) ? location->clientMaxBodySize : server._clientMaxBodySize;
 
-    queryPOS = request->url.find("?");
-    if (queryPOS == std::string::npos)
-    {
-        return;
-    }
-    querySTR.assign(request->url.begin() + queryPOS + 1, request->url.end());
-    request->url.resize(queryPOS);
-    for (std::string::iterator it = querySTR.begin(); it != querySTR.end(); ++it)
+  if (!isCGIRequest(location) && maxBodySize >= 0)
+  {
+    request->chunked.maxBodySize = static_cast<size_t>(maxBodySize);
+  }
+}
+
+// what input holds and was not parsed yet. the head stays in it until the request is done,
+// the body is taken out. (snapshot : the config the body limits come from. NULL : none)
+void RequestParser::parse(HTTPRequest* request, BufferSlice& input, ConfigSnapshot* snapshot)
+{
+  if (request->checkLevel != BODY)
+  {
+    parseHead(request, input);
+    if (request->checkLevel == BODY && request->chunkedFlag && snapshot != NULL)
     {
-        if (*it == '&')
-        {
-            request->query[key] = buffer;
-            key.clear();
-            buffer.clear();
-        }
-        else if (*it == '=' && key.size())
-        {
-            key = buffer;
-            buffer.clear();
-        }
-        else
-        {
-            buffer += *it;
-        }
+      limitBody(request, *snapshot);
     }
-    request->query[key] = buffer;
+  }
+  if (request->checkLevel == BODY && request->status != END)
+  {
+    parseBody(request, input);
+  }
 }
 
-void RequestParser::checkCRLF(HTTPRequest* request)
+// the read buffer has no room left : what is not parsed yet moves to the front of a new one,
+// twice as large when a head does not fit. (the old one stays while a request head is in it)
+static void makeRoom(BufferSlice& input, size_t bufferSize)
 {
-  size_t endPOS = request->message->find("\r\n\r\n");
-  size_t nowPOS = 0;
+  BufferSlice fresh(std::max(bufferSize, input.size() * 2));
 
-  if (endPOS != std::string::npos)
+  if (!input.empty())
   {
-    request->checkLevel = STARTLINE;
-    getStartLine(request, nowPOS);
-    getQuery(request);
-    getHeader(request, nowPOS + 2, endPOS + 2);
+    memcpy(fresh.data(), input.data(), input.size());
+    fresh.fill(input.size());
   }
+  input = fresh;
 }
 
-void RequestParser::readRequest(FileDescriptor fd, HTTPRequest* request)
+// the body is not read on yet : the head is not checked (the processor refuses it, or opens the sink
+// of the body, before more of it is read), the sink is slow, or it failed. (no sink : the body stays
+// in memory)
+static bool isBodyWaiting(const HTTPRequest* request, size_t bufferSize)
 {
-  char buffer[BUFFER_SIZE] = {0};
+  if (request->checkLevel != BODY)
+    return (false);
+  if (!request->accepted || request->bodyFailed)
+    return (true);
+  return (request->bodyFd >= 0 && request->body->size() >= BODY_PENDING_BUFFERS * bufferSize);
+}
 
-  if (read(fd, buffer, sizeof(buffer) - 1) < 0)
-  {
-    throw (std::runtime_error("receive failed\n"));
-  }
-  if (!request->body->size())
-  {
-    (*request->message) += buffer;
-  }
-  else
+// drain the socket until EAGAIN, but read at most readBudget bytes per wakeup, into the room of input.
+// (through the backend : see EventBackend::receive) returns true when it stopped before EAGAIN :
+// the read is edge-triggered, the rest is asked for again. (see resumeRead)
+bool RequestParser::readRequest(EventBackend* backend, FileDescriptor fd, BufferSlice& input, HTTPRequest* request,
+                                ConfigSnapshot& snapshot, size_t readBudget, size_t bufferSize)
+{
+  size_t totalReadSize = 0;
+  ssize_t readSize;
+
+  while (totalReadSize < readBudget && request->status != END && !isBodyWaiting(request, bufferSize))
   {
-    *request->body += buffer;
+    if (input.room() == 0 || (input.empty() && input.room() < bufferSize / 2))
+    {
+      makeRoom(input, bufferSize);
+    }
+    if ((readSize = backend->receive(fd, input.data() + input.size(), std::min(input.room(), readBudget - totalReadSize))) < 0)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) // (nothing at all : read already after an earlier event)
+        return (false);
+      throw (std::runtime_error("receive failed\n"));
+    }
+    if (readSize == 0) // closed by peer. EOF event follows.
+      return (false);
+    totalReadSize += readSize;
+    input.fill(readSize);
+    parse(request, input, &snapshot);
   }
-  switch (request->checkLevel)
+  return (true);
+}
+
+// a new request of the connection : what is made of it goes to the arena of the connection.
+HTTPRequest* RequestParser::newRequest(Arena* arena)
+{
+  HTTPRequest* request = new HTTPRequest(arena);
+
+  request->body = new std::string("");
+  return (request);
+}
+
+// a request which can not be read on : answered with its errorCode, then the connection is closed.
+void RequestParser::rejectRequest(HTTPRequest* request, const std::exception& error)
+{
+  printLog(std::string(error.what()) + '\n', PRINT_YELLOW);
+  if (dynamic_cast<const std::length_error*>(&error) != NULL)
+    request->errorCode = ST_PAYLOAD_TOO_LARGE;
+  request->status = ERROR;
+}
+
+// pipelining : the requests sent after the last one read, which came along with it, are parsed
+// from what is left in the read buffer and queued in order. the last one may be incomplete :
+// it is read on once it is served. (PIPELINE_DEPTH at most : the rest waits in the buffer)
+// the arena is reset only once no request is left in it : past PIPELINE_ARENA_CHUNKS the rest waits
+// too, so that a client always sending ahead lets the pipeline drain. (see completeRequest)
+void RequestParser::queueRequests(struct Context* context)
+{
+  BufferSlice& input = context->readBuffer;
+  HTTPRequest* last = context->pipeline.empty() ? context->req : context->pipeline.back();
+
+  while ((last == NULL || last->status == END) && context->pipeline.size() < PIPELINE_DEPTH
+         && context->arena.chunks() < PIPELINE_ARENA_CHUNKS)
   {
-    case CRLF:
-      checkCRLF(request);
-    case STARTLINE:
-      checkStartLineValid(request);
-    case HEADER:
-      checkHeaderValid(request);
-    case BODY:
-      parseBody(request);
+    while (!input.empty() && (input.data()[0] == '\r' || input.data()[0] == '\n')) // (after a body)
+    {
+      input.consume(1);
+    }
+    if (input.empty())
+    {
+      return;
+    }
+    last = newRequest(&context->arena);
+    gettimeofday(&last->baseTime, NULL);
+    context->pipeline.push_back(last);
+    try
+    {
+      parse(last, input, &getSnapshot(context));
+    }
+    catch (const std::exception& Error)
+    {
+      rejectRequest(last, Error);
+    }
   }
 }
 
-void RequestParser::parseRequest(struct Context* context)
+// read and parse what arrived on the socket. returns true when the request is ready to be processed.
+// it only touches context->req, context->pipeline and context->readBuffer (no event registration) :
+// a worker_threads reactor may run it for another one. (see Reactor)
+bool RequestParser::receiveRequest(struct Context* context)
 {
   if (!context->req)
   {
     printLog("New request\t" + getClientIP(&context->addr) + "\n" , PRINT_CYAN);
-    context->req = new HTTPRequest;
-    context->req->message = new std::string("");
-    context->req->body = new std::string("");
+    context->req = newRequest(&context->arena);
     gettimeofday(&context->req->baseTime, NULL);
   }
   if (context->req->status != END && context->req->status != ERROR)
   {
     try
     {
-      readRequest(context->fd, context->req);
+      const Server* portServer = context->loadServers[LOAD_CONNECTIONS];
+      context->readLeft = readRequest(context->manager->getContextBackend(context), context->fd,
+                                      context->readBuffer, context->req, getSnapshot(context),
+                                      context->manager->getConfig().readBudget,
+                                      portServer != NULL ? portServer->_clientBufferSize : DEFAULT_CLIENT_BUFFER_SIZE);
     }
     catch (const std::exception& Error)
     {
-      printLog(std::string(Error.what()) + '\n', PRINT_YELLOW);
-      context->req->status = ERROR;
+      rejectRequest(context->req, Error);
+    }
+    if (context->req->status == END && !context->readBuffer.empty())
+    {
+      queueRequests(context);
     }
   }
   if (context->req->status == ERROR || context->req->status == END)
   {
-    if (context->req->message == NULL)
-      return ;
-    delete (context->req->message);
-    context->req->message = NULL;
+    if (context->req->dispatched)
+      return (false);
+    context->req->dispatched = true;
   }
-  context->manager->getRequestProcessor().processRequest(context);
+  return (true);
+}
+
+void RequestParser::parseRequest(struct Context* context)
+{
+  if (receiveRequest(context))
+    context->manager->getRequestProcessor().processRequest(context);
 }
 
 void RequestParser::displayAll(HTTPRequest* request)
 {
   std::cout << "method : " << request->method << std::endl;
   std::cout << "url : " << request->url << std::endl;
-  std::cout << "version : " << request->version << std::endl;
+  std::cout << "version : " << request->string(request->version) << std::endl;
+  for (int name = 0; name < HD_UNKNOWN; ++name)
+  {
+    if (request->known[name].name.length != 0)
+      std::cout << request->string(request->known[name].name) << " : " << request->string(request->known[name].value) << std::endl;
+  }
   for (
-          std::map<std::string, std::string>::iterator it = request->headers.begin(); \
+          HeaderFields::const_iterator it = request->headers.begin(); \
             it != request->headers.end(); it++
           )
   {
-    std::cout << it->first << " : " << it->second << std::endl;
+    std::cout << request->string(it->name) << " : " << request->string(it->value) << std::endl;
   }
   std::cout << "body : " << request->body << std::endl;
   std::cout << "query key, value" << std::endl;
+  const ArenaStringMap& query = request->getQuery();
   for (
-          std::map<std::string, std::string>::iterator it = request->query.begin(); \
-            it != request->query.end(); it++
+          ArenaStringMap::const_iterator it = query.begin(); \
+            it != query.end(); it++
           )
   {
     std::cout << it->first << " : " << it->second << std::endl;
@@ -4,6 +4,7 @@
 #include "ServerManager.hpp"
 #include "WebservDefines.hpp"
 #include "CGI.hpp"
+#include <strings.h>
 
 static bool isAllowedMethod(std::vector<MethodType>& allowMethods, MethodType method)
 {
@@ -21,8 +22,6 @@ static bool isAllowedMethod(std::vector<MethodType>& allowMethods, MethodType me
   return (false);
 }
 
-// ASSUMPTION : request contain complete header...
-
 // WARN: Test code!
 StatusCode checkValidUrl_recur(const Server& matchedServer, const std::string& subUrl)
 {
@@ -44,90 +43,61 @@ StatusCode checkValidUrl_recur(const Server& matchedServer, const std::string& s
 }
 
 
-StatusCode RequestProcessor::checkValidHeader(const HTTPRequest& req)
+// the head is checked before any of the body is read : the route, its methods and the size of
+// the body. (a chunked one is checked as it arrives : see RequestParser::limitBody. none for cgi)
+StatusCode RequestProcessor::checkValidHeader(Server& matchedServer, const HTTPRequest& req)
 {
-  Server& matchedServer = _serverManager.getMatchedServer(req);
-
   // find _location
   Location* loc = matchedServer.getMatchedLocation(req);
-  // check _location
-  if (loc == NULL) // _root case
+  std::vector<MethodType>& allowMethods = (loc == NULL) ? matchedServer._allowMethods : loc->allowMethods;
+  const int maxBodySize = (loc == NULL) ? matchedServer._clientMaxBodySize : loc->clientMaxBodySize;
+
+  if (!isAllowedMethod(allowMethods, req.method))
   {
-    if (!isAllowedMethod(matchedServer._allowMethods, req.method))
-    {
-      return (ST_METHOD_NOT_ALLOWED);
-    }
-    if (req.chunkedFlag)
-    {
-      return (ST_OK);
-    }
-    try
-    {
-      std::map<std::string, std::string>::const_iterator it = req.headers.find("Content-Length");
-      if (it == req.headers.end())
-        throw (std::logic_error(""));
-      if (it->second.empty())
-      {
-        return (ST_LENGTH_REQUIRED);
-      }
-      int contentLength = ft_stoi(it->second);
-      if (loc->clientMaxBodySize < contentLength)
-      {
-        return (ST_PAYLOAD_TOO_LARGE);
-      }
-    }
-    catch (std::exception& e)
-    {
-      if (req.method != GET && req.method != HEAD && req.method != DELETE)
-      {
-        return (ST_LENGTH_REQUIRED);
-      }
-    }
+    return (ST_METHOD_NOT_ALLOWED);
   }
-  else
+  if (isCGIRequest(loc) || req.chunkedFlag)
   {
-    if (!isAllowedMethod(loc->allowMethods, req.method))
-    {
-      return (ST_METHOD_NOT_ALLOWED);
-    }
-    if (isCGIRequest(loc))
-    {
-      return (ST_OK);
-    }
-    if (req.chunkedFlag == true && req.body->size() <= static_cast<size_t>(loc->clientMaxBodySize))
-    {
-      return (ST_OK);
-    }
-    if (static_cast<size_t>(loc->clientMaxBodySize) < req.body->size())
-    {
-      return (ST_PAYLOAD_TOO_LARGE);
-    }
-    try
-    {
-      std::map<std::string, std::string>::const_iterator it = req.headers.find("Content-Length");
-      if (it == req.headers.end())
-        throw (std::logic_error(""));
-      if (it->second.empty())
-      {
-        return (ST_LENGTH_REQUIRED);
-      }
-      int contentLength = ft_stoi(it->second);
-      if (loc->clientMaxBodySize < contentLength)
-      {
-        return (ST_PAYLOAD_TOO_LARGE);
-      }
-    }
-    catch (std::exception& e)
-    {
-      if (req.method != GET && req.method != HEAD && req.method != DELETE)
-      {
-        return (ST_LENGTH_REQUIRED);
-      }
-    }
+    return (ST_OK);
+  }
+  if (maxBodySize >= 0 && req.contentLength > static_cast<size_t>(maxBodySize))
+  {
+    return (ST_PAYLOAD_TOO_LARGE);
   }
   return (ST_OK);
 }
 
+// "Expect: 100-continue" : the client waits for the head to be accepted before it sends the body.
+// (ignored from a HTTP/1.0 client)
+static bool isContinueExpected(const HTTPRequest& req)
+{
+  const HeaderField* expect = req.findHeader(HD_EXPECT);
+
+  if (expect == NULL || req.string(req.version) != "HTTP/1.1")
+    return (false);
+  return (expect->value.length == sizeof("100-continue") - 1
+          && strncasecmp(req.head.data() + expect->value.offset, "100-continue", expect->value.length) == 0);
+}
+
+// the status line of a request the parser could not read on. (see RequestParser::rejectRequest)
+static std::string getErrorMessage(StatusCode errorCode)
+{
+  if (errorCode == ST_PAYLOAD_TOO_LARGE)
+    return ("payload too large");
+  if (errorCode == ST_LENGTH_REQUIRED)
+    return ("length required");
+  return ("bad request");
+}
+
+// the response is sent as it is. (an error page : with its size)
+static void sendResponse(struct Context* context, HTTPResponse* response)
+{
+  context->res = response;
+  if (response->getFd() > 0)
+    response->addHeader(HTTPResponseHeader::CONTENT_LENGTH(FdGetFileSize(response->getFd())));
+  response->sendToClient(context);
+}
+
 void RequestProcessor::processRequest(struct Context* context)
 {
   // check context http request
@@ -137,80 +107,107 @@ void RequestProcessor::processRequest(struct Context* context)
   }
   // check request status
   HTTPRequest& req = *context->req;
+  updateTimer(context);
+  if (req.status == HEADEROK || (req.status == READING && req.checkLevel == BODY))
+    setState(context, CONN_READ_BODY);
   if (req.status == ERROR)
   {
     if (DEBUG_MODE)
-      printLog(*req.message, PRINT_RED);
-    HTTPResponse* response = new HTTPResponse(ST_BAD_REQUEST, "bad request", context->manager->getServerName(context->addr.sin_port));
-    Server& server = _serverManager.getMatchedServer(req);
+      printLog(std::string(context->readBuffer.data(), context->readBuffer.size()), PRINT_RED);
+    HTTPResponse* response = new HTTPResponse(req.errorCode, getErrorMessage(req.errorCode),
+                                              getSnapshot(context).getServerName(context->addr.sin_port));
+    Server& server = getSnapshot(context).getMatchedServer(req);
 
-    context->res = response;
     response->addHeader(HTTPResponseHeader::CONTENT_LENGTH(0));
-    response->setFd(server.getErrorPageFd(ST_BAD_REQUEST));
-    if (response->getFd() > 0)
-      response->addHeader(HTTPResponseHeader::CONTENT_LENGTH(FdGetFileSize(response->getFd())));
-    response->sendToClient(context);
+    response->setFd(server.getErrorPageFd(req.errorCode));
+    sendResponse(context, response);
     return;
   }
 
-  Server& server = _serverManager.getMatchedServer(req);
-  if (req.status == HEADEROK || req.status == END)
+  if (req.status != END) // the rest is read now. (a complete request : once it is answered)
+    resumeRead(context);
+  if (req.checkLevel != BODY) // the head is not complete
   {
-    StatusCode status = checkValidHeader(req);
-
-    if (status != ST_OK)
-    {
-      HTTPResponse* response = new HTTPResponse(status, "No", context->manager->getServerName(context->addr.sin_port));
-      context->res = response;
-
-      response->addHeader(HTTPResponseHeader::CONTENT_LENGTH(0));
-      response->setFd(server.getErrorPageFd(status));
-      if (response->getFd() > 0)
-        response->addHeader(HTTPResponseHeader::CONTENT_LENGTH(FdGetFileSize(response->getFd())));
-      response->sendToClient(context);
-      if (req.status == HEADEROK)
-      {
-        delete (req.message);
-        req.message = NULL;
-      }
-      return;
-    }
-    // * if redirection.
-    std::pair<StatusCode, std::string> redirect_data;
-    if (server.isRedirect(req.url, &redirect_data))
-    {
-      HTTPResponse* response = new HTTPResponse(redirect_data.first, "redirect", context->manager->getServerName(context->addr.sin_port));
-      context->res = response;
-      // set location header.
-      response->addHeader(HTTPResponse::LOCATION(redirect_data.second));
-      response->addHeader(HTTPResponseHeader::CONTENT_LENGTH(0));
-      response->setFd(-1);
-      response->sendToClient(context);
-      return ;
-    }
-    if (req.method == GET || req.method == HEAD) // not consider body
-    {
-      server.processRequest(context);
-      return;
-    }
-    else if (req.status == HEADEROK) // need to read body
-    {
-        return;
-     }
-    else
-    {
-      server.processRequest(context);
-      return;
-    }
+    return ;
+  }
+  Server& server = getSnapshot(context).getMatchedServer(req);
+  if (!req.accepted && !acceptRequest(context, server))
+  {
+    req.dispatched = true;
+    return ;
   }
-  else if (req.status == READING) // ignore request
+  if (req.status != END) // the body goes on to its sink as it is read
   {
+    streamBody(context);
     return ;
   }
-  else
+  setState(context, CONN_PROCESSING);
+  server.processRequest(context);
+}
+
+// the head is complete : it is checked once, before any of the body is taken, then the body has
+// where to go. (see openBodySink) returns false when the request is answered already.
+bool RequestProcessor::acceptRequest(struct Context* context, Server& server)
+{
+  HTTPRequest& req = *context->req;
+  StatusCode status = checkValidHeader(server, req);
+
+  if (status != ST_OK)
+  {
+    HTTPResponse* response = new HTTPResponse(status, "No", getSnapshot(context).getServerName(context->addr.sin_port));
+
+    response->addHeader(HTTPResponseHeader::CONTENT_LENGTH(0));
+    response->setFd(server.getErrorPageFd(status));
+    sendResponse(context, response);
+    return (false);
+  }
+  // * if redirection.
+  std::pair<StatusCode, std::string> redirect_data;
+  if (server.isRedirect(toStdString(req.url), &redirect_data))
+  {
+    HTTPResponse* response = new HTTPResponse(redirect_data.first, "redirect", getSnapshot(context).getServerName(context->addr.sin_port));
+    // set location header.
+    response->addHeader(HTTPResponse::LOCATION(redirect_data.second));
+    response->addHeader(HTTPResponseHeader::CONTENT_LENGTH(0));
+    response->setFd(-1);
+    sendResponse(context, response);
+    return (false);
+  }
+  if (!acquireLoad(context, server, LOAD_REQUESTS))
   {
+    sendServiceUnavailable(context);
+    return (false);
+  }
+  req.accepted = true;
+  if (req.method == POST || req.method == PUT) // the body goes to its file, or to the cgi
+  {
+    HTTPResponse* response = server.openBodySink(context);
+    if (response != NULL)
+      sendResponse(context, response);
+    if (context->res != NULL)
+      return (false);
+  }
+  if (req.status != END && isContinueExpected(req)) // (answered above when the body would be refused)
+    HTTPResponse::sendContinue(context);
+  return (true);
+}
 
+// the location of the request gives the timeouts from the body on. (see ConnectionTimers)
+// a complete request stops the timer : the response or the cgi starts the next one.
+void RequestProcessor::updateTimer(struct Context* context)
+{
+  HTTPRequest& req = *context->req;
+
+  if (req.status != READING || req.checkLevel == BODY) // headers are parsed
+  {
+    Server& server = getSnapshot(context).getMatchedServer(req);
+    Location* location = server.getMatchedLocation(req);
+    setTimerTimeouts(context, (location != NULL) ? &location->timeouts : &server._timeouts);
   }
+  if (req.status == END || req.status == ERROR)
+    armTimer(context, TIMEOUT_NONE);
+  else if (req.checkLevel == BODY)
+    armTimer(context, TIMEOUT_BODY);
 }
 
 RequestProcessor::RequestProcessor(ServerManager& svm) :
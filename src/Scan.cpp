@@ -0,0 +1,87 @@
+#include "Scan.hpp"
+#if SCAN_X86
+# include <immintrin.h>
+#endif
+
+const char* Scan::scalar(const char* begin, const char* end, char a, char b)
+{
+  for (; begin != end; ++begin)
+  {
+    if (*begin == a || *begin == b)
+      return (begin);
+  }
+  return (end);
+}
+
+#if SCAN_X86
+// 16 bytes compared at once : the lowest bit of the mask is the first match.
+const char* Scan::sse2(const char* begin, const char* end, char a, char b)
+{
+  const __m128i first = _mm_set1_epi8(a);
+  const __m128i second = _mm_set1_epi8(b);
+
+  for (; end - begin >= 16; begin += 16)
+  {
+    const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, first), _mm_cmpeq_epi8(bytes, second)));
+    if (mask != 0)
+      return (begin + __builtin_ctz(mask));
+  }
+  return (scalar(begin, end, a, b));
+}
+
+// 32 bytes at once. only called when the cpu has avx2 (the rest of the server is built without it)
+__attribute__((target("avx2")))
+const char* Scan::avx2(const char* begin, const char* end, char a, char b)
+{
+  const __m256i first = _mm256_set1_epi8(a);
+  const __m256i second = _mm256_set1_epi8(b);
+
+  for (; end - begin >= 32; begin += 32)
+  {
+    const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    const unsigned int mask = static_cast<unsigned int>(
+            _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, first), _mm256_cmpeq_epi8(bytes, second))));
+    if (mask != 0)
+    {
+      _mm256_zeroupper();
+      return (begin + __builtin_ctz(mask));
+    }
+  }
+  _mm256_zeroupper(); // or the sse code after it pays for the dirty upper halves (added by the compiler only when optimizing)
+  return (sse2(begin, end, a, b));
+}
+
+bool Scan::hasAvx2()
+{
+  __builtin_cpu_init(); // (called before main)
+  return (__builtin_cpu_supports("avx2"));
+}
+#endif
+
+static Scan::Kernel chooseKernel()
+{
+#if SCAN_X86
+  return (Scan::hasAvx2() ? Scan::avx2 : Scan::sse2);
+#else
+  return (Scan::scalar);
+#endif
+}
+
+Scan::Kernel Scan::_kernel = chooseKernel();
+
+void Scan::use(Kernel kernel)
+{
+  _kernel = kernel;
+}
+
+const char* Scan::name()
+{
+#if SCAN_X86
+  if (_kernel == avx2)
+    return ("avx2");
+  if (_kernel == sse2)
+    return ("sse2");
+#endif
+  return ("scalar");
+}
@@ -5,16 +5,18 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <cstring>
+#include <cstdlib>
 
 // if there is no cookie in request --> return -1
 // else, if valid id --> return  1
 // else, if not valid --> return 0
 int Server::getSessionStatus(const HTTPRequest& req)
 {
-  std::map<std::string, std::string>::const_iterator headerString_itr = req.headers.find("Cookie");
-  if (headerString_itr != req.headers.end()) // if header has Cookie.
+  const HeaderField* cookie = req.findHeader(HD_COOKIE);
+  if (cookie != NULL) // if header has Cookie.
   {
-    const std::string cookies = headerString_itr->second;
+    const std::string cookies = req.string(cookie->value);
     const size_t id_loc = cookies.find(SESSION_KEY);
     if (id_loc != std::string::npos) // if session id exists,
     {
@@ -39,7 +41,7 @@ std::string Server::getRealFilePath(const HTTPRequest& req)
     // check request file exists on root
     if (req.url.rfind('/') == 0) // root case
     {
-      filePath = req.url;
+      filePath = toStdString(req.url);
       if (filePath.length() == 1)
       {
         if (req.method == GET)
@@ -57,44 +59,151 @@ std::string Server::getRealFilePath(const HTTPRequest& req)
   }
   else
   {
-    filePath = (loc->convertURLToLocationPath(req.url));
+    filePath = (loc->convertURLToLocationPath(toStdString(req.url)));
   }
   return (filePath);
 }
 
-Server::Server()
+Server::Server() :
+        _serverFD(-1),
+        _clientBufferSize(DEFAULT_CLIENT_BUFFER_SIZE),
+        _outputBufferSize(DEFAULT_OUTPUT_BUFFER_SIZE)
 {
 }
 
 Server::~Server()
 {
-  shutdown(_serverFD, SHUT_RDWR);
+  // copies of Server share the listen socket. (shutdown() stops listening on linux)
+}
+
+// binary upgrade : listening sockets of the previous process, by address.
+// written at startup only, read by openListenSocket. (no lock)
+static std::vector<std::pair<FileDescriptor, struct sockaddr_in> > g_inheritedSockets;
+
+// a bound, listening TCP socket of this process. (addr : its address)
+bool Server::isListenSocket(FileDescriptor fd, struct sockaddr_in* addr)
+{
+  int listening = 0;
+  socklen_t len = sizeof(listening);
+
+  if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) < 0 || !listening)
+    return (false);
+  len = sizeof(*addr);
+  if (getsockname(fd, reinterpret_cast<sockaddr*>(addr), &len) < 0 || addr->sin_family != AF_INET)
+    return (false);
+  return (true);
+}
+
+void Server::loadInheritedSockets()
+{
+  const char* fds = getenv(UPGRADE_FDS_ENV);
+  std::string list((fds != NULL) ? fds : "");
+  size_t begin = 0;
+
+  while (begin < list.size())
+  {
+    size_t end = list.find(';', begin);
+    if (end == std::string::npos)
+      end = list.size();
+    FileDescriptor fd = ft_stoi(list.substr(begin, end - begin));
+    if (fd > STDERR_FILENO && fcntl(fd, F_SETFD, FD_CLOEXEC) == 0) // (passed on without it)
+      inheritSocket(fd);
+    begin = end + 1;
+  }
+  unsetenv(UPGRADE_FDS_ENV); // not for the CGI processes
+}
+
+// also the sockets of the master, in a new worker process.
+void Server::inheritSocket(FileDescriptor fd)
+{
+  struct sockaddr_in addr;
+
+  if (isListenSocket(fd, &addr))
+    g_inheritedSockets.push_back(std::make_pair(fd, addr));
+}
+
+// the previous process had more sockets per address than the servers took. (see adoptListeners)
+FileDescriptor Server::takeLeftoverSocket(struct sockaddr_in* addr)
+{
+  if (g_inheritedSockets.empty())
+    return (-1);
+  const FileDescriptor fd = g_inheritedSockets.back().first;
+  *addr = g_inheritedSockets.back().second;
+  g_inheritedSockets.pop_back();
+  return (fd);
+}
+
+// the socket the previous process listened with on addr. (-1 : none left)
+static FileDescriptor takeInheritedSocket(const struct sockaddr_in& addr)
+{
+  for (size_t i = 0; i < g_inheritedSockets.size(); ++i)
+  {
+    if (g_inheritedSockets[i].second.sin_port == addr.sin_port
+        && g_inheritedSockets[i].second.sin_addr.s_addr == addr.sin_addr.s_addr)
+    {
+      FileDescriptor fd = g_inheritedSockets[i].first;
+      g_inheritedSockets.erase(g_inheritedSockets.begin() + i);
+      return (fd);
+    }
+  }
+  return (-1);
 }
 
 void Server::openServer()
 {
+  this->_serverFD = openListenSocket(false);
+}
+
+// reusePort : every worker thread binds its own socket to the same port. (SO_REUSEPORT)
+// the kernel spreads new connections over those sockets.
+FileDescriptor Server::openListenSocket(bool reusePort) const
+{
+  FileDescriptor fd;
   int opt = 1;
 
-  if ((this->_serverFD = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+  // binary upgrade : the accept queue of the previous process is kept. (options are already set)
+  if ((fd = takeInheritedSocket(this->_socketAddr)) >= 0)
+  {
+    return (fd);
+  }
+  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
   {
     throw (std::runtime_error("Create Socket failed\n"));
   }
-  if (setsockopt(this->_serverFD, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
   {
     throw (std::runtime_error("Socket set option failed\n"));
   }
-  if (fcntl(this->_serverFD, F_SETFL, O_NONBLOCK) < 0)
+#if defined(SO_REUSEPORT_LB) // FreeBSD : SO_REUSEPORT alone does not balance
+  if (reusePort && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT_LB, &opt, sizeof(opt)) < 0)
+#elif defined(SO_REUSEPORT)
+  if (reusePort && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+#else
+  if (reusePort)
+#endif
+  {
+    throw (std::runtime_error("Socket set option SO_REUSEPORT failed\n"));
+  }
+  if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) // (upgrade : passed on explicitly)
   {
     throw (std::runtime_error("fcntl non-block failed\n"));
   }
-  if (bind(this->_serverFD, reinterpret_cast<const sockaddr*>(&this->_socketAddr), sizeof(this->_socketAddr)) < 0)
+  // template of the accepted sockets : they inherit the socket options of the listening socket.
+  // (no setsockopt per connection)
+  struct linger optLinger = {1, 0};
+  if (setsockopt(fd, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger)) < 0)
+  {
+    throw (std::runtime_error("Socket set option SO_LINGER failed\n"));
+  }
+  if (bind(fd, reinterpret_cast<const sockaddr*>(&this->_socketAddr), sizeof(this->_socketAddr)) < 0)
   {
     throw (std::runtime_error("Bind Socket failed\n"));
   }
-  if (listen(this->_serverFD, LISTEN_QUEUE_SIZE) < 0)
+  if (listen(fd, LISTEN_QUEUE_SIZE) < 0)
   {
     throw (std::runtime_error("Listen Socket failed\n"));
   }
+  return (fd);
 }
 
 FileDescriptor Server::getErrorPageFd(const StatusCode& stCode)
@@ -104,7 +213,7 @@ FileDescriptor Server::getErrorPageFd(const StatusCode& stCode)
   if (itr == _errorPage.end()) // if no suitable errPage
     return (-1);
   else
-    return (open(itr->second.c_str(), O_RDONLY)); // will return -1 or regular FD
+    return (open(itr->second.c_str(), O_RDONLY | O_CLOEXEC)); // will return -1 or regular FD
 }
 
 #define READ  (0)
@@ -113,14 +222,14 @@ FileDescriptor Server::getErrorPageFd(const StatusCode& stCode)
 static FileDescriptor createIndexPage(struct Context* context, const std::string& filePath, Location& location)
 {
   std::string content = "";
-  struct Context* newContext = new struct Context;
-  *newContext = *context;
   FileDescriptor* pipe_fd = context->pipeFD;
 
   if (pipe(pipe_fd) < 0)
   {
     throw(std::runtime_error("createIndexPage : pipe() returned -1"));
   }
+  fcntl(pipe_fd[READ], F_SETFD, FD_CLOEXEC);
+  fcntl(pipe_fd[WRITE], F_SETFD, FD_CLOEXEC);
   // write html to pipe_fd[WRITE]
   const std::string html_start = "<!DOCTYPE html><html lang=\"en\"><head><meta charset=\"UTF-8\"><title>autoindex</title></head><body>\n";
   content += html_start;
@@ -163,20 +272,10 @@ static FileDescriptor createIndexPage(struct Context* context, const std::string
   const std::string html_end = "</body></html>";
   content += html_end;
   // attach write pipe event
-  const size_t CONTENT_SIZE = content.size();
-  struct kevent ev;
-  newContext->req = context->req;
-  newContext->res = context->res;
-  newContext->fd = context->fd;
-  newContext->handler = writePipeHandler;
-  newContext->connectContexts->push_back(newContext);
-  newContext->ioBuffer = new char[CONTENT_SIZE];
-  newContext->totalIOSize = CONTENT_SIZE;
-  newContext->pipeFD[0] = context->pipeFD[0];
-  newContext->pipeFD[1] = context->pipeFD[1];
-  context->req = NULL;
-  memcpy(newContext->ioBuffer, content.c_str(), CONTENT_SIZE);
-  EV_SET(&ev, pipe_fd[WRITE], EVFILT_WRITE, EV_ADD, 0, 0, newContext);
+  struct Event ev;
+  struct Context* newContext = getStage(context, STAGE_AUX, writePipeHandler);
+  newContext->ioBuffer.assign(content.c_str(), content.size());
+  setEvent(&ev, pipe_fd[WRITE], EVENT_WRITE, EVENT_ADD, 0, newContext);
   context->manager->attachNewEvent(newContext, ev);
   return (pipe_fd[READ]);
 }
@@ -191,7 +290,7 @@ HTTPResponse* Server::processGETRequest(struct Context* context)
   if (filePath == "FAILED")
   {
     const StatusCode RETURN_STATUS = ST_NOT_FOUND;
-    HTTPResponse* response = new HTTPResponse(RETURN_STATUS, std::string("not found"), context->manager->getServerName(context->addr.sin_port));
+    HTTPResponse* response = new HTTPResponse(RETURN_STATUS, std::string("not found"), getSnapshot(context).getServerName(context->addr.sin_port));
     response->setFd(getErrorPageFd(RETURN_STATUS));
     return (response);
   }
@@ -205,13 +304,13 @@ HTTPResponse* Server::processGETRequest(struct Context* context)
     if (DEBUG_MODE)
       printLog(filePath + " NOT FOUND\n", PRINT_RED);
     const StatusCode RETURN_STATUS = ST_NOT_FOUND;
-    HTTPResponse* response = new HTTPResponse(RETURN_STATUS, std::string("not found"), context->manager->getServerName(context->addr.sin_port));
+    HTTPResponse* response = new HTTPResponse(RETURN_STATUS, std::string("not found"), getSnapshot(context).getServerName(context->addr.sin_port));
     response->setFd(getErrorPageFd(RETURN_STATUS));
     return (response);
   }
   else
   {
-    HTTPResponse* response = new HTTPResponse(ST_OK, std::string("OK"), context->manager->getServerName(context->addr.sin_port));
+    HTTPResponse* response = new HTTPResponse(ST_OK, std::string("OK"), getSnapshot(context).getServerName(context->addr.sin_port));
     Location* loc = getMatchedLocation(req);
     if (loc && loc->_autoindex == true) // if autoindex : on
     {
@@ -221,16 +320,29 @@ HTTPResponse* Server::processGETRequest(struct Context* context)
     }
     else // if autoindex : off
     {
-      response->setFd(open(filePath.c_str(), O_RDONLY));
+      response->setFd(open(filePath.c_str(), O_RDONLY | O_CLOEXEC));
     }
     return (response);
   }
 }
 
-// Process POST reqeust
-// Test on bash : curl -X POST http://127.0.0.1:4242/repository/test -d "Hello, World"
-// 참고 내용 : http://blog.storyg.co/rest-api-response-body-best-pratics
-HTTPResponse* Server::processPOSTRequest(struct Context* context)
+// the temporary file the body of filePath is written to : next to it, so that it can be renamed over
+// it. (see commitBody)
+static std::string getTemporaryPath(const std::string& filePath)
+{
+  static unsigned long nextFileCount;
+  // worker threads and worker processes write bodies at the same time. (worker_threads, worker_processes)
+  const unsigned long fileCount = __sync_fetch_and_add(&nextFileCount, 1);
+  const size_t nameStart = filePath.rfind('/') + 1; // (npos + 1 : 0)
+
+  return (filePath.substr(0, nameStart) + "." + filePath.substr(nameStart) + "."
+          + ft_itos(getpid()) + "." + ft_itos(fileCount) + ".part");
+}
+
+// POST, PUT : where the body goes as it is read, once the head is checked. (see streamBody)
+// a temporary file : the target is not touched before the body is complete.
+// returns the answer when it can go nowhere, NULL when it is open.
+HTTPResponse* Server::openBodySink(struct Context* context)
 {
   HTTPRequest& req = *context->req;
 
@@ -240,95 +352,85 @@ HTTPResponse* Server::processPOSTRequest(struct Context* context)
   if (filePath == "FAILED")
   {
     const StatusCode RETURN_STATUS = ST_NOT_FOUND;
-    HTTPResponse* response = new HTTPResponse(RETURN_STATUS, std::string("not found"), context->manager->getServerName(context->addr.sin_port));
+    HTTPResponse* response = new HTTPResponse(RETURN_STATUS, std::string("not found"), getSnapshot(context).getServerName(context->addr.sin_port));
     response->setFd(getErrorPageFd(RETURN_STATUS));
     return (response);
   }
-  else if (isCGIRequest(getMatchedLocation(req)))
+  if (req.method == POST && isCGIRequest(getMatchedLocation(req))) // the input file of the cgi
   {
-    CGIProcess(context);
+    CGIPrepare(context);
     return (NULL);
   }
-  else
+  req.bodyTarget = filePath;
+  req.bodyPath = getTemporaryPath(filePath);
+  req.bodyFd = open(req.bodyPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NONBLOCK | O_CLOEXEC, 0777);
+  if (req.bodyFd <= -1)
+    req.bodyPath.clear();
+  if (req.method == POST)
   {
-    HTTPResponse* response = NULL;
-    FileDescriptor writeFileFD = open(filePath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_NONBLOCK, 0777);
-    if (writeFileFD <= -1 || access(filePath.c_str(), R_OK | W_OK) == FAILED)
+    if (req.bodyFd <= -1 || (access(filePath.c_str(), F_OK) == 0 && access(filePath.c_str(), R_OK | W_OK) == FAILED))
     {
       const StatusCode RETURN_STATUS = ST_NOT_FOUND;
-      response = new HTTPResponse(RETURN_STATUS, std::string("File is not available"), context->manager->getServerName(context->addr.sin_port));
+      HTTPResponse* response = new HTTPResponse(RETURN_STATUS, std::string("File is not available"), getSnapshot(context).getServerName(context->addr.sin_port));
       response->setFd(getErrorPageFd(RETURN_STATUS));
       return (response);
     }
-    response = new HTTPResponse(ST_ACCEPTED, std::string("ACCEPTED"), context->manager->getServerName(context->addr.sin_port));
-    response->addHeader("Content-Location", filePath);
-    response->setFd(-1);
-    // prepare event context
-    struct Context* newContext = new struct Context(writeFileFD, context->addr, writeFileHandle, context->manager);
-    newContext->res = response;
-    newContext->req = context->req;
-    newContext->threadKQ = context->threadKQ;
-    newContext->connectContexts = context->connectContexts;
-    newContext->connectContexts->push_back(newContext);
-    newContext->totalIOSize = 0;
-    newContext->pipeFD[0] = context->pipeFD[0];
-    newContext->pipeFD[1] = context->pipeFD[1];
-    response->_writeFD = writeFileFD;
-    // attach event
-    struct kevent event;
-    EV_SET(&event, writeFileFD, EVFILT_WRITE, EV_ADD | EV_CLEAR, 0, 0, newContext);
-    context->manager->attachNewEvent(newContext, event);
-    return (response);
-  }
-}
-
-// Test on bash : curl -X PUT http://127.0.0.1:4242/repository/test -d "Hello, World"
-HTTPResponse* Server::processPUTRequest(struct Context* context)
-{
-  HTTPRequest& req = *context->req;
-
-  // check matched location
-  std::string filePath = getRealFilePath(req);
-
-  if (filePath == "FAILED")
-  {
-    const StatusCode RETURN_STATUS = ST_NOT_FOUND;
-    HTTPResponse* response = new HTTPResponse(RETURN_STATUS, std::string("not found"), context->manager->getServerName(context->addr.sin_port));
-    response->setFd(getErrorPageFd(RETURN_STATUS));
-    return (response);
   }
   else
   {
-    HTTPResponse* response = NULL;
-
-    FileDescriptor writeFileFD = open(filePath.c_str(), O_WRONLY |O_CREAT | O_TRUNC | O_NONBLOCK, 0777);
-    if (writeFileFD <= -1)
+    if (req.bodyFd <= -1)
     {
       const StatusCode RETURN_STATUS = ST_BAD_REQUEST;
-      response = new HTTPResponse(RETURN_STATUS, std::string("File is not available"), context->manager->getServerName(context->addr.sin_port));
+      HTTPResponse* response = new HTTPResponse(RETURN_STATUS, std::string("File is not available"), getSnapshot(context).getServerName(context->addr.sin_port));
       response->setFd(getErrorPageFd(RETURN_STATUS));
       return (response);
     }
-    response = new HTTPResponse(ST_ACCEPTED, std::string("Accepted"), context->manager->getServerName(context->addr.sin_port));
-    response->addHeader("Content-Location", filePath);
-    response->setFd(-1);
-    // prepare event context
-    struct Context* newContext = new struct Context(writeFileFD, context->addr, writeFileHandle, context->manager);
-    newContext->res = response;
-    newContext->req = context->req;
-    newContext->threadKQ = context->threadKQ;
-    newContext->totalIOSize = 0;
-    newContext->connectContexts = context->connectContexts;
-    newContext->connectContexts->push_back(newContext);
-    newContext->pipeFD[0] = context->pipeFD[0];
-    newContext->pipeFD[1] = context->pipeFD[1];
-    response->_writeFD = writeFileFD;
-    // attach event
-    struct kevent event;
-    EV_SET(&event, writeFileFD, EVFILT_WRITE, EV_ADD , 0, 0, newContext);
-    context->manager->attachNewEvent(newContext, event);
+  }
+  return (NULL);
+}
+
+// the answer to a body written to its file : sent once the rest of the body is written.
+// (a file which takes no more now : see writeFileHandle)
+static HTTPResponse* answerBody(struct Context* context, HTTPResponse* response)
+{
+  if (context->req->bodyFd < 0 || writeBody(context))
+  {
+    if (!commitBody(context))
+      response->setStatus(ST_INTERNAL_SERVER_ERROR, "Server Error");
     return (response);
   }
+  context->res = response;
+  streamBody(context);
+  return (NULL);
+}
+
+// Process POST reqeust : the body went to the file as it arrived. (see openBodySink)
+// Test on bash : curl -X POST http://127.0.0.1:4242/repository/test -d "Hello, World"
+// 참고 내용 : http://blog.storyg.co/rest-api-response-body-best-pratics
+HTTPResponse* Server::processPOSTRequest(struct Context* context)
+{
+  HTTPRequest& req = *context->req;
+
+  if (isCGIRequest(getMatchedLocation(req)))
+  {
+    CGIProcess(context);
+    return (NULL);
+  }
+  HTTPResponse* response = new HTTPResponse(ST_ACCEPTED, std::string("ACCEPTED"), getSnapshot(context).getServerName(context->addr.sin_port));
+  response->addHeader("Content-Location", getRealFilePath(req));
+  response->setFd(-1);
+  return (answerBody(context, response));
+}
+
+// Test on bash : curl -X PUT http://127.0.0.1:4242/repository/test -d "Hello, World"
+HTTPResponse* Server::processPUTRequest(struct Context* context)
+{
+  HTTPRequest& req = *context->req;
+
+  HTTPResponse* response = new HTTPResponse(ST_ACCEPTED, std::string("Accepted"), getSnapshot(context).getServerName(context->addr.sin_port));
+  response->addHeader("Content-Location", getRealFilePath(req));
+  response->setFd(-1);
+  return (answerBody(context, response));
 }
 
 HTTPResponse* Server::processHEADRequest(const struct Context* context)
@@ -340,20 +442,20 @@ HTTPResponse* Server::processHEADRequest(const struct Context* context)
 
   if (filePath == "FAILED")
   {
-    HTTPResponse* response = new HTTPResponse(ST_NOT_FOUND, std::string("not found"), context->manager->getServerName(context->addr.sin_port));
+    HTTPResponse* response = new HTTPResponse(ST_NOT_FOUND, std::string("not found"), getSnapshot(context).getServerName(context->addr.sin_port));
     response->setFd(-1);
     return (response);
   }
   // check is valid file
   if (access(filePath.c_str(), R_OK) == FAILED)
   {
-    HTTPResponse* response = new HTTPResponse(ST_NOT_FOUND, std::string("not found"), context->manager->getServerName(context->addr.sin_port));
+    HTTPResponse* response = new HTTPResponse(ST_NOT_FOUND, std::string("not found"), getSnapshot(context).getServerName(context->addr.sin_port));
     response->setFd(-1);
     return (response);
   }
   else
   {
-    HTTPResponse* response = new HTTPResponse(ST_OK, std::string("OK"), context->manager->getServerName(context->addr.sin_port));
+    HTTPResponse* response = new HTTPResponse(ST_OK, std::string("OK"), getSnapshot(context).getServerName(context->addr.sin_port));
     response->setFd(-1);
     return (response);
   }
@@ -369,7 +471,7 @@ HTTPResponse* Server::processDELETERequest(const struct Context* context)
   if (filePath == "FAILED")
   {
     const StatusCode RETURN_STATUS = ST_NOT_FOUND;
-    HTTPResponse* response = new HTTPResponse(RETURN_STATUS, std::string("not found"), context->manager->getServerName(context->addr.sin_port));
+    HTTPResponse* response = new HTTPResponse(RETURN_STATUS, std::string("not found"), getSnapshot(context).getServerName(context->addr.sin_port));
     response->setFd(getErrorPageFd(RETURN_STATUS));
     return (response);
   }
@@ -377,13 +479,13 @@ HTTPResponse* Server::processDELETERequest(const struct Context* context)
   if (access(filePath.c_str(), R_OK | W_OK) == FAILED)
   {
     const StatusCode RETURN_STATUS = ST_NOT_FOUND;
-    HTTPResponse* response = new HTTPResponse(RETURN_STATUS, std::string("not found"), context->manager->getServerName(context->addr.sin_port));
+    HTTPResponse* response = new HTTPResponse(RETURN_STATUS, std::string("not found"), getSnapshot(context).getServerName(context->addr.sin_port));
     response->setFd(getErrorPageFd(RETURN_STATUS));
     return (response);
   }
   else
   {
-    HTTPResponse* response = new HTTPResponse(ST_ACCEPTED, std::string("Delete file requested"), context->manager->getServerName(context->addr.sin_port));
+    HTTPResponse* response = new HTTPResponse(ST_ACCEPTED, std::string("Delete file requested"), getSnapshot(context).getServerName(context->addr.sin_port));
     if (unlink(filePath.c_str()) == FAILED)
       response->setStatus(ST_INTERNAL_SERVER_ERROR, "Server Error");
     response->setFd(-1);
@@ -488,7 +590,7 @@ Location* Server::getMatchedLocation(const HTTPRequest& req)
     }
   }
   // location matching algorithm.
-  return (const_cast<Location *>(getClosestMatchedLocation_recur(*this, req.url)));
+  return (const_cast<Location *>(getClosestMatchedLocation_recur(*this, toStdString(req.url))));
 }
 
 // 만약 redirection이 맞다면, 두번째 인자*buf에 데이터를 넣어줌 + true 반환.
@@ -1,47 +1,191 @@
 #include "ServerManager.hpp"
 #include "ThreadPool.hpp"
 #include <cstring>
+#include <sstream>
+#include <csignal>
+#include <cerrno>
+#include <poll.h>
+#include <sys/wait.h>
+#include <cstdlib>
+#include <unistd.h>
+#include <climits>
+#include <fcntl.h>
 
-ServerManager::ServerManager(const std::string& configFilePath) :
+extern char** environ;
+
+// the handler only records the signal and wakes up the main thread. (see handleSignals)
+static int g_reloadRequested = 0;
+static int g_stopRequested = 0;
+static int g_upgradeRequested = 0;
+static FileDescriptor g_signalWakeFd = -1;
+
+static void signalHandler(int signo)
+{
+  const int savedErrno = errno;
+
+  if (signo == SIGHUP)
+    __atomic_store_n(&g_reloadRequested, 1, __ATOMIC_SEQ_CST);
+  else if (signo == SIGTERM || signo == SIGQUIT)
+    __atomic_store_n(&g_stopRequested, 1, __ATOMIC_SEQ_CST);
+  else if (signo == SIGUSR2)
+    __atomic_store_n(&g_upgradeRequested, 1, __ATOMIC_SEQ_CST);
+  sendWakeUp(g_signalWakeFd);
+  errno = savedErrno;
+}
+
+// master : SIGCHLD wakes it up too. (a worker died) others keep the default.
+static void installSignalHandlers(FileDescriptor wakeFd, bool master)
+{
+  struct sigaction action;
+  struct sigaction childAction;
+
+  g_signalWakeFd = wakeFd;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = signalHandler;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  if (sigaction(SIGHUP, &action, NULL) < 0
+      || sigaction(SIGTERM, &action, NULL) < 0
+      || sigaction(SIGQUIT, &action, NULL) < 0
+      || sigaction(SIGUSR2, &action, NULL) < 0)
+    throw (std::runtime_error("sigaction() failed\n"));
+  memset(&childAction, 0, sizeof(childAction));
+  childAction.sa_handler = master ? signalHandler : SIG_DFL;
+  sigemptyset(&childAction.sa_mask);
+  childAction.sa_flags = SA_RESTART;
+  if (sigaction(SIGCHLD, &childAction, NULL) < 0)
+    throw (std::runtime_error("sigaction() failed\n"));
+}
+
+// the binary upgrade() starts again : its absolute path, found at startup. argv[0] may be a name
+// looked up in PATH (execve does not), and a new build installed there replaces the file.
+// (/proc/self/exe : "... (deleted)" then)
+static std::string getBinaryPath(const std::string& argv0)
+{
+  char path[PATH_MAX];
+
+#if defined(__linux__)
+  const ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+  if (length > 0)
+    return (std::string(path, length));
+#endif
+  if (argv0.find('/') != std::string::npos)
+    return ((realpath(argv0.c_str(), path) != NULL) ? std::string(path) : argv0);
+  const char* searchPath = getenv("PATH");
+  std::istringstream dirs((searchPath != NULL) ? searchPath : "");
+  std::string dir;
+  while (std::getline(dirs, dir, ':'))
+  {
+    const std::string candidate = (dir.empty() ? "." : dir) + "/" + argv0;
+    if (access(candidate.c_str(), X_OK) == 0 && realpath(candidate.c_str(), path) != NULL)
+      return (std::string(path));
+  }
+  return (argv0);
+}
+
+ServerManager::ServerManager(const std::string& configFilePath, const std::string& binaryPath) :
+        _configFilePath(configFilePath),
+        _binaryPath(getBinaryPath(binaryPath)),
+        _upgradePid(0),
+        _snapshot(NULL),
+        _generation(1),
+        _eventBackend(NULL),
         _processor(*this),
-        _threadPool(THREAD_NO)
+        _threadPool(THREAD_NO),
+        _master(NULL),
+        _load(&_processLoad),
+        _workersLoad(NULL)
 {
   ConfigParser parser;
-  _serverList = parser.parseConfigFile(configFilePath);
+  _snapshot = new ConfigSnapshot(parser.parseConfigFile(configFilePath), _generation);
+  _snapshot->getListenServers(); // same port and same server : stop here
+  _config = parser.getGlobalConfig();
+  SlabPool::useHugePages(_config.slabHugePages);
+  pthread_mutex_init(&_snapshotMutex, NULL);
+  _signalFd[0] = -1;
+  _signalFd[1] = -1;
+  for (int i = 0; i < LOAD_KINDS; ++i)
+    _processLoad.limit[i] = _config.maxLoad[i];
+  // answered right after accept(), before anything is allocated for the connection.
+  _unavailableResponse = "HTTP/1.1 503 Service Unavailable\r\n"
+                         "Retry-After: " + ft_itos(_config.retryAfter) + "\r\n"
+                         "Content-Length: 0\r\n"
+                         "Connection: close\r\n\r\n";
+  _lastLoadReport = time(NULL);
+  _stopping = 0;
+  _stopDeadline = 0;
 }
 
 ServerManager::~ServerManager()
 {
   for (
           std::vector<struct Context*>::iterator it = _contexts.begin();
-          it != _contexts.begin();
+          it != _contexts.end();
           ++it
           )
   {
-    delete (*it);
+    closeListener(*it);
     *it = NULL;
   }
+  for (size_t i = 0; i < _reactors.size(); ++i)
+    delete (_reactors[i]);
+  delete (_eventBackend);
+  if (_signalFd[0] >= 0)
+    closeWakeFd(_signalFd);
+  ConfigSnapshot::release(_snapshot);
+  pthread_mutex_destroy(&_snapshotMutex);
+  delete (_master);
 }
 
 void ServerManager::run()
 {
-  struct kevent event;
+  openWakeFd(_signalFd);
+  installSignalHandlers(_signalFd[1], _config.workerProcesses > 0);
+  Server::loadInheritedSockets();
+  if (_config.workerProcesses > 0)
+    runMaster();
+  else if (_config.workerThreads > 0 && !THREAD_MODE)
+    runReactors();
+  else
+    runEventLoop();
+}
+
+// worker_threads : 0; (and every worker process) -> one event loop on this thread.
+void ServerManager::runEventLoop()
+{
+  std::vector<struct Event> events(_config.eventBatchSize);
 
-  if ((_kqueue = kqueue()) < 0)
+  try
   {
-    printLog("error: server: create kqueue failed\n", PRINT_RED);
+    _eventBackend = EventBackend::create(_config.eventBackend);
+  }
+  catch (std::exception& e)
+  {
+    printLog("error: server: create event backend failed : " + std::string(e.what()), PRINT_RED);
     exit(1);
   }
+  printLog("event backend\t" + std::string(_eventBackend->getName()) + "\n", PRINT_CYAN);
   initServers(); // 여러 서버 세팅들을 모두 연다. (nginx config 참조)
+  adoptListeners(_contexts, this, _eventBackend, NULL);
+  struct Event signalEvent;
+  setEvent(&signalEvent, _signalFd[0], EVENT_READ, EVENT_ADD, 0, this);
+  if (_eventBackend->attach(signalEvent) < 0 || _eventBackend->flush() < 0)
+    throw (std::runtime_error("Event attach signal fd failed\n"));
   if (THREAD_MODE)
   {
-    _threadPool._serverKQ = _kqueue;
+    _threadPool._backendName = _eventBackend->getName();
+    _threadPool._eventBatchSize = _config.eventBatchSize;
+    _threadPool._eventStatInterval = _config.eventStatInterval;
     _threadPool.createPool();
   }
+  else
+    _timers.bind(_eventBackend); // THREAD_MODE : the workers time the connections
+  takeOver();
   while (1)
   {
-    // 서버 시작. 새 이벤트(Req)가 발생할 때 까지 무한루프. (감지하는 kevent)
-    int newEventCount = kevent(_kqueue, NULL, 0, &event, 1, NULL);
+    // 서버 시작. 새 이벤트(Req)가 발생할 때 까지 무한루프. (감지하는 event backend)
+    // 한 번 깨어날 때 준비된 이벤트를 최대 event_batch_size 개 까지 받아온다.
+    int newEventCount = _eventBackend->wait(&events[0], static_cast<int>(events.size()), -1);
 
     if (newEventCount == -1)
     { // nothing happen
@@ -51,83 +195,334 @@ void ServerManager::run()
     else if (newEventCount == 0)
     { // time limit expired -> never happen
       printLog("time limit expired\n", PRINT_BLUE);
+      continue;
     }
-    else if (event.filter == EVFILT_READ \
-            || event.filter == EVFILT_WRITE \
-            || event.filter == EVFILT_PROC)
+    _eventStat.record(newEventCount, events.size());
+    _eventStat.report("main", _config.eventStatInterval);
+    reportLoad(_config.eventStatInterval);
+    for (int i = 0; i < newEventCount; ++i)
     {
-      if (THREAD_MODE)
+      if (events[i].udata == this) // signal : handled after the batch
       {
-        _threadPool.attachNewEvent(&event);
+        clearWakeUp(_signalFd[0]);
+        events[i].udata = NULL;
       }
-      else
-        handleEvent(&event);
+    }
+    // THREAD_MODE : only listening sockets are here. (accepted connections go to the workers)
+    handleEvents(&events[0], newEventCount);
+    _timers.advance();
+    handleSignals();
+    if (isStopping())
+    {
+      closeListeners(_contexts);
+      if (THREAD_MODE) // returns once every worker is done
+      {
+        _threadPool.stop(getStopDeadline());
+        break ;
+      }
+      if (_timers.drain(getStopDeadline()))
+        break ;
     }
   }
+  printLog("shutdown\t\tdone\n", PRINT_CYAN);
 }
 
-FileDescriptor ServerManager::getKqueue() const
+// worker_threads : N; -> N event loops, each with its own listening sockets. (see Reactor)
+void ServerManager::runReactors()
 {
-  return _kqueue;
+  try
+  {
+    for (size_t i = 0; i < _config.workerThreads; ++i)
+    {
+      _reactors.push_back(new Reactor(*this, i));
+      _reactors.back()->openListeners();
+    }
+    _reactors[0]->adoptListeners();
+  }
+  catch (std::exception& e)
+  {
+    printLog("error: server: create reactor failed : " + std::string(e.what()), PRINT_RED);
+    exit(1);
+  }
+  printLog("event backend\t" + std::string(_reactors[0]->getBackend()->getName()) + "\n", PRINT_CYAN);
+  printLog("worker threads\t" + ft_itos(_reactors.size()) + "\n", PRINT_CYAN);
+  for (size_t i = 0; i < _reactors.size(); ++i)
+    _reactors[i]->start();
+  takeOver();
+  // the reactors serve every connection : this thread only waits for signals.
+  while (!isStopping())
+  {
+    struct pollfd signalPoll;
+    signalPoll.fd = _signalFd[0];
+    signalPoll.events = POLLIN;
+    signalPoll.revents = 0;
+    if (poll(&signalPoll, 1, -1) > 0)
+      clearWakeUp(_signalFd[0]);
+    handleSignals();
+  }
+  for (size_t i = 0; i < _reactors.size(); ++i) // each one returns once its connections are closed
+    _reactors[i]->join();
+  printLog("shutdown\t\tdone\n", PRINT_CYAN);
 }
 
-void ServerManager::initServers()
+// worker_processes : N; -> this process only holds the listening sockets and looks after the
+// workers. (see Master) worker_threads is not used : the workers share the sockets.
+void ServerManager::runMaster()
 {
-  for (
-          std::vector<Server>::iterator server = _serverList.begin();
-          server != _serverList.end();
-          ++server
-          )
+  bool tookOver = false;
+
+  _master = new Master(*this, _config.workerProcesses);
+  _master->openListeners(true);
+  _master->adoptListeners();
+  printLog("worker processes\t" + ft_itos(_config.workerProcesses) + "\n", PRINT_CYAN);
+  while (true)
   {
-    server->openServer();
-    for (
-        std::vector<Server>::iterator temp = _serverList.begin();
-        temp != server;
-        ++temp
-        )
+    if (!isStopping() && _master->spawnWorkers())
+    {
+      runWorker();
+      return ;
+    }
+    if (!tookOver)
     {
-      if ((*temp)._serverPort == (*server)._serverPort && (*temp)._serverName == (*server)._serverName)
-        throw (std::runtime_error("Same port and Same server\n"));
-      if ((*temp)._serverPort == (*server)._serverPort)
-        return ;
+      takeOver();
+      tookOver = true;
     }
-    attachServerEvent(*server);
+    if (isStopping() && _master->runningWorkers() == 0)
+      break ;
+    if (isStopping() && time(NULL) > getStopDeadline() + 1) // drained or not
+      _master->signalWorkers(SIGKILL);
+    struct pollfd signalPoll;
+    signalPoll.fd = _signalFd[0];
+    signalPoll.events = POLLIN;
+    signalPoll.revents = 0;
+    if (poll(&signalPoll, 1, TIMER_TICK_MS) > 0)
+      clearWakeUp(_signalFd[0]);
+    handleSignals();
+    _master->reapWorkers();
+    _master->report(_config.eventStatInterval);
   }
+  printLog("shutdown\t\tdone\n", PRINT_CYAN);
+}
+
+// a new worker process : the event loop of one worker, on the sockets of the master.
+void ServerManager::runWorker()
+{
+  closeWakeFd(_signalFd);
+  openWakeFd(_signalFd);
+  installSignalHandlers(_signalFd[1], false);
+  _load = _master->getWorkerLoad();
+  _workersLoad = _master->getWorkersLoad();
+  runEventLoop();
+}
+
+bool ServerManager::isWorkerProcess() const
+{
+  return (_master != NULL && _master->_workerId >= 0);
+}
+
+// main thread.
+void ServerManager::handleSignals()
+{
+  if (__atomic_exchange_n(&g_stopRequested, 0, __ATOMIC_SEQ_CST))
+    stop();
+  if (isWorkerProcess()) // the master reloads and upgrades
+    return ;
+  if (__atomic_exchange_n(&g_reloadRequested, 0, __ATOMIC_SEQ_CST) && !isStopping())
+    reload();
+  if (__atomic_exchange_n(&g_upgradeRequested, 0, __ATOMIC_SEQ_CST) && !isStopping())
+    upgrade();
+}
+
+// every listening socket of this process : of the main thread, of the reactors, or of the master.
+std::vector<FileDescriptor> ServerManager::getListenFds() const
+{
+  std::vector<FileDescriptor> fds;
+
+  for (size_t i = 0; i < _contexts.size(); ++i)
+    fds.push_back(_contexts[i]->fd);
+  for (size_t i = 0; i < _reactors.size(); ++i)
+    _reactors[i]->getListenFds(fds);
+  if (_master != NULL)
+    fds.insert(fds.end(), _master->_listenFds.begin(), _master->_listenFds.end());
+  return (fds);
 }
 
-std::string ServerManager::getServerName(in_port_t port_num) const
+// SIGUSR2 : start the binary this process was started from again (a new build can be installed
+// there) and pass it every listening socket of this process. it adopts them instead of socket /
+// bind / listen : the accept queues stay open through the swap and no connection is refused.
+// the new process sends SIGQUIT here once it serves them, and this one drains. (see stop)
+// if it fails to start, this process keeps running.
+// every other descriptor of the server is close-on-exec : the new process does not get them.
+void ServerManager::upgrade()
 {
-  std::vector<Server>::const_iterator itr = this->_serverList.begin();
-  while (itr != _serverList.end())
+  if (_upgradePid > 0 && waitpid(_upgradePid, NULL, WNOHANG) == 0)
   {
-    if (itr->_socketAddr.sin_port == port_num) // if found target port
-    {
-      return (itr->_serverName);
-    }
-    itr++;
+    printLog("error: upgrade: process " + ft_itos(_upgradePid) + " is still starting\n", PRINT_RED);
+    return ;
+  }
+  const std::vector<FileDescriptor> listenFds = getListenFds();
+  std::string fdList;
+  for (size_t i = 0; i < listenFds.size(); ++i)
+    fdList += (fdList.empty() ? "" : ";") + ft_itos(listenFds[i]);
+  // built before fork() : the child only calls fcntl() and execve().
+  std::vector<std::string> envStrings;
+  for (char** env = environ; *env != NULL; ++env)
+  {
+    const std::string var(*env);
+    if (var.compare(0, strlen(UPGRADE_FDS_ENV) + 1, UPGRADE_FDS_ENV "=") != 0
+        && var.compare(0, strlen(UPGRADE_PID_ENV) + 1, UPGRADE_PID_ENV "=") != 0)
+      envStrings.push_back(var);
+  }
+  envStrings.push_back(UPGRADE_FDS_ENV "=" + fdList);
+  envStrings.push_back(UPGRADE_PID_ENV "=" + ft_itos(getpid()));
+  std::vector<char*> envp;
+  for (size_t i = 0; i < envStrings.size(); ++i)
+    envp.push_back(const_cast<char*>(envStrings[i].c_str()));
+  envp.push_back(NULL);
+  char* argv[] = {const_cast<char*>(_binaryPath.c_str()), const_cast<char*>(_configFilePath.c_str()), NULL};
+
+  const pid_t pid = fork();
+  if (pid < 0)
+  {
+    printLog("error: upgrade: fork() failed\n", PRINT_RED);
+    return ;
+  }
+  if (pid == 0)
+  {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+    // connections, event backends, wake up pipes ... stay here. (close-on-exec)
+    for (size_t i = 0; i < listenFds.size(); ++i)
+      fcntl(listenFds[i], F_SETFD, 0);
+    execve(argv[0], argv, &envp[0]);
+    _exit(127);
   }
-  return (DEFAULT_SERVER_NAME);
+  _upgradePid = pid;
+  printLog("upgrade\t\tstarted process " + ft_itos(pid) + " with " + ft_itos(listenFds.size()) + " listening sockets\n", PRINT_CYAN);
+}
+
+// started by upgrade() : every listening socket is served here now, the previous process drains.
+void ServerManager::takeOver()
+{
+  const char* parent = getenv(UPGRADE_PID_ENV);
+  const pid_t parentPid = (parent != NULL) ? ft_stoi(parent) : 0;
+
+  unsetenv(UPGRADE_PID_ENV);
+  if (parentPid <= 0 || parentPid != getppid()) // not started by a running server
+    return ;
+  kill(parentPid, SIGQUIT);
+  printLog("upgrade\t\ttook over from process " + ft_itos(parentPid) + "\n", PRINT_CYAN);
+}
+
+// SIGTERM, SIGQUIT : graceful shutdown.
+// every event loop closes its listening sockets and the connections which wait for a request.
+// a request in flight (CGI included) gets its response with Connection: close, then the connection
+// is closed. what is left after shutdown_timeout seconds is closed. (CGI processes killed)
+void ServerManager::stop()
+{
+  if (isStopping())
+    return ;
+  _stopDeadline = time(NULL) + _config.shutdownTimeout;
+  __atomic_store_n(&_stopping, 1, __ATOMIC_SEQ_CST);
+  printLog("shutdown\t\tdraining connections, " + ft_itos(_config.shutdownTimeout) + "s at most\n", PRINT_CYAN);
+  for (size_t i = 0; i < _reactors.size(); ++i)
+    _reactors[i]->wakeUp();
+  if (_master != NULL && !isWorkerProcess()) // each worker drains by itself
+    _master->signalWorkers(SIGQUIT);
 }
 
-void ServerManager::attachServerEvent(Server& server)
+bool ServerManager::isStopping() const
 {
-  struct kevent events[1];
-  struct Context* context = new struct Context(server._serverFD, server._socketAddr, acceptHandler, this);
-  context->threadKQ = _kqueue;
+  return (__atomic_load_n(&_stopping, __ATOMIC_SEQ_CST) != 0);
+}
+
+// read after isStopping() returned true.
+time_t ServerManager::getStopDeadline() const
+{
+  return (_stopDeadline);
+}
+
+// SIGHUP : parse the configuration file again and publish it as a new snapshot.
+// requests in flight finish with the snapshot they started with, the next ones use the new one.
+// listening sockets are opened and closed by address : the others keep their accept queue.
+// process directives (event_backend, worker_threads, global limits ...) stay as the server started.
+void ServerManager::reload()
+{
+  ConfigSnapshot* snapshot = NULL;
+
+  printLog("reload\t\t" + _configFilePath + "\n", PRINT_CYAN);
+  try
+  {
+    ConfigParser parser;
+    snapshot = new ConfigSnapshot(parser.parseConfigFile(_configFilePath), _generation + 1);
+    if (snapshot->_servers.empty())
+      throw (std::runtime_error("no server\n"));
+    snapshot->getListenServers();
+  }
+  catch (std::exception& e)
+  {
+    ConfigSnapshot::release(snapshot);
+    printLog("error: reload failed, configuration " + ft_itos(_generation) + " kept : " + e.what(), PRINT_RED);
+    return ;
+  }
+  snapshot->takeSessions(*_snapshot);
+
+  ConfigSnapshot* old = _snapshot;
+  pthread_mutex_lock(&_snapshotMutex);
+  __atomic_store_n(&_snapshot, snapshot, __ATOMIC_RELEASE);
+  __atomic_store_n(&_generation, snapshot->GENERATION, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&_snapshotMutex);
+  ConfigSnapshot::release(old);
 
-  EV_SET(&events[0], server._serverFD, EVFILT_READ, EV_ADD, 0, 0, context);
-  // 등록하는 kevent
-  if (kevent(_kqueue, events, 1, NULL, 0, NULL) < 0)
+  if (_master != NULL) // new workers start with the new configuration
   {
-    printLog("error: server: event attachServerEvent failed\n", PRINT_RED);
-    throw (std::runtime_error("Event attachServerEvent failed\n"));
+    _master->openListeners(false);
+    _master->replaceWorkers();
   }
-  _contexts.push_back(context);
+  else if (_reactors.empty())
+    syncListeners(_contexts, this, _eventBackend, NULL, false);
+  for (size_t i = 0; i < _reactors.size(); ++i) // each reactor updates its own listening sockets
+    _reactors[i]->wakeUp();
+  printLog("reload\t\tconfiguration " + ft_itos(snapshot->GENERATION) + "\n", PRINT_CYAN);
+}
+
+// a reference to the published snapshot. (ConfigSnapshot::release when done)
+ConfigSnapshot* ServerManager::acquireSnapshot()
+{
+  ConfigSnapshot* snapshot;
+
+  pthread_mutex_lock(&_snapshotMutex);
+  snapshot = _snapshot;
+  snapshot->retain();
+  pthread_mutex_unlock(&_snapshotMutex);
+  return (snapshot);
+}
+
+// snapshot is held by the caller : it cannot be freed and reused for a newer one.
+bool ServerManager::isCurrentSnapshot(const ConfigSnapshot* snapshot) const
+{
+  return (__atomic_load_n(&_snapshot, __ATOMIC_ACQUIRE) == snapshot);
+}
+
+unsigned long ServerManager::getGeneration() const
+{
+  return (__atomic_load_n(&_generation, __ATOMIC_ACQUIRE));
+}
+
+EventBackend* ServerManager::getEventBackend() const
+{
+  return _eventBackend;
+}
+
+const GlobalConfig& ServerManager::getConfig() const
+{
+  return (_config);
 }
 
-std::vector<Server>& ServerManager::getServerList()
+void ServerManager::initServers()
 {
-  return (_serverList);
+  syncListeners(_contexts, this, _eventBackend, NULL, true);
 }
 
 RequestProcessor& ServerManager::getRequestProcessor()
@@ -139,76 +534,430 @@ RequestParser& ServerManager::getRequestParser()
   return (_requestParser);
 }
 
-Server& ServerManager::getMatchedServer(const HTTPRequest& req)
+ThreadPool& ServerManager::getThreadPool()
 {
-  std::map<std::string,std::string>::const_iterator mit;
-  for (
-          std::vector<Server>::iterator it = _serverList.begin();
-          it != _serverList.end();
-          ++it
-          )
+  return (_threadPool);
+}
+
+const std::vector<Reactor*>& ServerManager::getReactors() const
+{
+  return (_reactors);
+}
+
+EventBackend* ServerManager::getContextBackend(struct Context* context) const
+{
+  if (THREAD_MODE || context->threadBackend != NULL)
+    return (context->threadBackend);
+  return (_eventBackend);
+}
+
+// 등록된 fd 를 close 하기 전에 호출. (아직 반영되지 않은 변경사항도 버린다)
+void ServerManager::detachEvents(struct Context* context, FileDescriptor fd)
+{
+  if (fd < 0)
+    return ;
+  getContextBackend(context)->detach(fd);
+}
+
+int ServerManager::attachNewEvent(struct Context* context, const struct Event& event)
+{
+  EventBackend* backend = getContextBackend(context);
+
+  if (backend->attach(event) < 0)
   {
-    Server& server = *it;
-    std::string serverName = server._serverName + ':' + ft_itos(server._serverPort);
-    mit = req.headers.find("Host");
-    if (mit == req.headers.end())
-    {
-      continue;
-    }
-    std::string host;
-    host.assign(mit->second);
-    if (host.find(':') == std::string::npos)
-    {
-      host += ":80";
-    }
-    if (host == serverName)
+    if (DEBUG_MODE)
     {
-      return (server);
+      printLog("event attach failed\n", PRINT_YELLOW);
+      std::cout << backend->getFd() << " (attach) \n";
+      std::cout << event.ident << "(ident) (attach) \n";
+      std::cout << strerror(errno) << " (attach) \n";
     }
+    return (FAILED);
   }
-  // no matched host, then check port
-  for (
-          std::vector<Server>::iterator it = _serverList.begin();
-          it != _serverList.end();
-          ++it
-          )
+  return (0);
+}
+
+EventStat::EventStat() :
+        wakeups(0),
+        events(0),
+        fullBatches(0),
+        lastReport(time(NULL))
+{
+  memset(histogram, 0, sizeof(histogram));
+}
+
+void EventStat::record(int eventCount, size_t batchSize)
+{
+  int bucket = 0;
+
+  wakeups++;
+  events += eventCount;
+  if (static_cast<size_t>(eventCount) >= batchSize)
+    fullBatches++;
+  while (bucket < EVENT_STAT_BUCKETS - 1 && (1 << bucket) < eventCount)
+    bucket++;
+  histogram[bucket]++;
+}
+
+// print the counters every interval seconds and start over. (interval 0 : off)
+void EventStat::report(const std::string& name, time_t interval)
+{
+  const time_t now = time(NULL);
+
+  if (interval <= 0 || now - lastReport < interval || wakeups == 0)
+    return ;
+  std::stringstream ss;
+  ss << "event stat\t" << name
+     << "\twakeups " << wakeups
+     << "\tevents " << events
+     << "\tavg " << (events / wakeups)
+     << "\tfull batch " << fullBatches
+     << "\t[";
+  for (int i = 0; i < EVENT_STAT_BUCKETS; ++i)
   {
-    Server& server = *it;
-    mit = req.headers.find("Host");
-    if (mit == req.headers.end())
-    {
+    if (i == EVENT_STAT_BUCKETS - 1)
+      ss << ">" << (1 << (i - 1)) << ":" << histogram[i];
+    else
+      ss << "<=" << (1 << i) << ":" << histogram[i] << " ";
+  }
+  ss << "]\n";
+  printLog(ss.str(), PRINT_CYAN);
+  *this = EventStat();
+}
+
+// take one slot of kind from load. false : its limit is reached. (counted as rejected in counter)
+static bool acquireSlot(Load& load, int kind, Load& counter)
+{
+  const size_t current = __atomic_add_fetch(&load.current[kind], 1, __ATOMIC_RELAXED);
+
+  if (load.limit[kind] == 0 || current <= load.limit[kind])
+    return (true);
+  __atomic_sub_fetch(&load.current[kind], 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&counter.rejected[kind], 1, __ATOMIC_RELAXED);
+  return (false);
+}
+
+// a slot of the process, of every worker together (worker_processes), and of server.
+bool ServerManager::admit(Server& server, int kind)
+{
+  if (!acquireSlot(*_load, kind, *_load))
+    return (false);
+  if (_workersLoad != NULL && !acquireSlot(*_workersLoad, kind, *_load))
+  {
+    dropLoad(*_load, kind, 1);
+    return (false);
+  }
+  if (!acquireSlot(server._load, kind, server._load))
+  {
+    dropLoad(*_load, kind, 1);
+    if (_workersLoad != NULL)
+      dropLoad(*_workersLoad, kind, 1);
+    return (false);
+  }
+  return (true);
+}
+
+void ServerManager::release(Server& server, int kind)
+{
+  dropLoad(*_load, kind, 1);
+  if (_workersLoad != NULL)
+    dropLoad(*_workersLoad, kind, 1);
+  __atomic_sub_fetch(&server._load.current[kind], 1, __ATOMIC_RELAXED);
+}
+
+// count slots of kind are given back. (never below 0 : the master takes those of a dead worker
+// out of the workers' load, which a draining one sharing its slot still gives back. see Master)
+void dropLoad(Load& load, int kind, size_t count)
+{
+  size_t current = __atomic_load_n(&load.current[kind], __ATOMIC_RELAXED);
+
+  while (!__atomic_compare_exchange_n(&load.current[kind], &current, (current > count) ? current - count : 0,
+                                      true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+// a slot goes to the server of a newer configuration. (no limit check : it is already in)
+void ServerManager::moveLoad(Server& from, Server& to, int kind)
+{
+  __atomic_sub_fetch(&from._load.current[kind], 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&to._load.current[kind], 1, __ATOMIC_RELAXED);
+}
+
+const std::string& ServerManager::getUnavailableResponse() const
+{
+  return (_unavailableResponse);
+}
+
+void printLoad(const std::string& name, Load& load)
+{
+  const char* const KINDS[LOAD_KINDS] = {"connections", "requests", "cgi"};
+  std::stringstream ss;
+
+  ss << "load\t" << name;
+  for (int i = 0; i < LOAD_KINDS; ++i)
+  {
+    ss << "\t" << KINDS[i] << " " << __atomic_load_n(&load.current[i], __ATOMIC_RELAXED);
+    if (load.limit[i] > 0)
+      ss << "/" << load.limit[i];
+    ss << " (rejected " << __atomic_exchange_n(&load.rejected[i], 0, __ATOMIC_RELAXED) << ")";
+  }
+  ss << "\n";
+  printLog(ss.str(), PRINT_CYAN);
+}
+
+// print the in-flight counters and limits, then the slab and buffer pools, every interval seconds. (interval 0 : off)
+// rejected counts start over at each report.
+void ServerManager::reportLoad(time_t interval)
+{
+  const time_t now = time(NULL);
+
+  if (interval <= 0 || now - _lastLoadReport < interval)
+    return ;
+  ConfigSnapshot* snapshot = acquireSnapshot();
+  std::vector<Server>& servers = snapshot->_servers;
+
+  printLoad("all", *_load);
+  for (size_t i = 0; i < servers.size(); ++i)
+    printLoad(servers[i]._serverName + ":" + ft_itos(servers[i]._serverPort), servers[i]._load);
+  ConfigSnapshot::release(snapshot);
+  SlabPool::reportAll();
+  BufferPool::report();
+  _lastLoadReport = now;
+}
+
+AcceptStat::AcceptStat() :
+        wakeups(0),
+        accepted(0),
+        maxAccepted(0),
+        budgetHits(0),
+        overflows(0),
+        errors(0),
+        lastReport(time(NULL))
+{
+}
+
+void AcceptStat::record(size_t acceptedCount, bool budgetHit, bool queueFull)
+{
+  wakeups++;
+  accepted += acceptedCount;
+  if (acceptedCount > maxAccepted)
+    maxAccepted = acceptedCount;
+  if (budgetHit)
+    budgetHits++;
+  if (queueFull)
+    overflows++;
+}
+
+// print the counters every interval seconds and start over. (interval 0 : off)
+void AcceptStat::report(const std::string& name, time_t interval)
+{
+  const time_t now = time(NULL);
+
+  if (interval <= 0 || now - lastReport < interval || wakeups == 0)
+    return ;
+  std::stringstream ss;
+  ss << "accept stat\t" << name
+     << "\twakeups " << wakeups
+     << "\taccepted " << accepted
+     << "\tavg " << (accepted / wakeups)
+     << "\tmax " << maxAccepted
+     << "\tbudget hit " << budgetHits
+     << "\toverflow " << overflows
+     << "\terrors " << errors
+     << "\n";
+  printLog(ss.str(), PRINT_CYAN);
+  *this = AcceptStat();
+}
+
+static __thread ConnectionTimers* g_currentTimers = NULL;
+
+ConnectionTimers::ConnectionTimers() :
+        _wheel(timeoutHandler),
+        _open(0)
+{
+}
+
+ConnectionTimers::~ConnectionTimers()
+{
+  if (g_currentTimers == this)
+    g_currentTimers = NULL;
+  for (size_t i = 0; i < _slots.size(); ++i)
+    delete (_slots[i]);
+}
+
+ConnectionTimers* ConnectionTimers::current()
+{
+  return (g_currentTimers);
+}
+
+void ConnectionTimers::bind(EventBackend* backend)
+{
+  struct Event event;
+
+  setEvent(&event, TIMER_WHEEL_ID, EVENT_TIMER, EVENT_ADD, TIMER_TICK_MS, this);
+  if (backend->attach(event) < 0 || backend->flush() < 0)
+    throw (std::runtime_error("Event attach timer failed\n"));
+  g_currentTimers = this;
+}
+
+ConnectionTimer* ConnectionTimers::getTimer(FileDescriptor fd) const
+{
+  if (fd < 0 || static_cast<size_t>(fd) >= _slots.size() || _slots[fd] == NULL)
+    return (NULL);
+  if (_slots[fd]->connectContexts == NULL)
+    return (NULL);
+  return (_slots[fd]);
+}
+
+// a new connection : the header timeout starts.
+void ConnectionTimers::open(FileDescriptor fd, std::vector<struct Context*>* connectContexts, const Timeouts* portTimeouts)
+{
+  if (fd < 0)
+    return ;
+  if (static_cast<size_t>(fd) >= _slots.size())
+    _slots.resize(fd + 1, NULL);
+  if (_slots[fd] == NULL)
+    _slots[fd] = new ConnectionTimer();
+  ConnectionTimer* timer = _slots[fd];
+  if (timer->connectContexts == NULL)
+    _open++;
+  _wheel.cancel(&timer->node);
+  timer->node.data = timer;
+  timer->connectContexts = connectContexts;
+  timer->portTimeouts = portTimeouts;
+  timer->timeouts = portTimeouts;
+  arm(fd, TIMEOUT_HEADER);
+}
+
+void ConnectionTimers::close(FileDescriptor fd)
+{
+  ConnectionTimer* timer = getTimer(fd);
+
+  if (timer == NULL)
+    return ;
+  _wheel.cancel(&timer->node);
+  timer->connectContexts = NULL;
+  _open--;
+}
+
+void ConnectionTimers::arm(FileDescriptor fd, int kind, int fromKind)
+{
+  ConnectionTimer* timer = getTimer(fd);
+  time_t seconds = 0;
+
+  if (timer == NULL)
+    return ;
+  if (fromKind != TIMEOUT_ANY && (!TimingWheel::isScheduled(&timer->node) || timer->node.kind != fromKind))
+    return ;
+  if (kind == TIMEOUT_KEEPALIVE) // the next request starts over from the server of the port
+    timer->timeouts = timer->portTimeouts;
+  switch (kind)
+  {
+    case TIMEOUT_HEADER:
+      seconds = timer->portTimeouts->header;
+      break;
+    case TIMEOUT_KEEPALIVE:
+      seconds = timer->portTimeouts->keepAlive;
+      break;
+    case TIMEOUT_BODY:
+      seconds = timer->timeouts->body;
+      break;
+    case TIMEOUT_SEND:
+      seconds = timer->timeouts->send;
+      break;
+    case TIMEOUT_CGI:
+      seconds = timer->timeouts->cgi;
+      break;
+  }
+  if (seconds <= 0)
+    _wheel.cancel(&timer->node);
+  else
+    _wheel.schedule(&timer->node, kind, seconds * 1000);
+}
+
+void ConnectionTimers::setTimeouts(FileDescriptor fd, const Timeouts* timeouts)
+{
+  ConnectionTimer* timer = getTimer(fd);
+
+  if (timer != NULL)
+    timer->timeouts = timeouts;
+}
+
+void ConnectionTimers::setPortTimeouts(FileDescriptor fd, const Timeouts* portTimeouts)
+{
+  ConnectionTimer* timer = getTimer(fd);
+
+  if (timer == NULL)
+    return ;
+  timer->portTimeouts = portTimeouts;
+  timer->timeouts = portTimeouts;
+}
+
+void ConnectionTimers::advance()
+{
+  _wheel.advance();
+}
+
+size_t ConnectionTimers::size() const
+{
+  return (_wheel.size());
+}
+
+size_t ConnectionTimers::connections() const
+{
+  return (_open);
+}
+
+// close the keep-alive connections waiting for their next request.
+// force : every connection, with its CGI process. a connection with a job out is left for later.
+void ConnectionTimers::closeConnections(bool force)
+{
+  size_t closed = 0;
+
+  for (size_t fd = 0; fd < _slots.size(); ++fd)
+  {
+    ConnectionTimer* timer = getTimer(static_cast<FileDescriptor>(fd));
+    if (timer == NULL)
       continue;
-    }
-    std::string host;
-    host.assign(mit->second);
-    std::string hostPort = host.substr(host.find(':') + 1);
-    if (server._serverPort == ft_stoi(hostPort))
+    std::vector<struct Context*>& contexts = *timer->connectContexts;
+    bool busy = false;
+    for (size_t i = 0; i < contexts.size(); ++i)
     {
-      return (server);
+      if (contexts[i]->workState != WORK_IDLE)
+        busy = true;
     }
+    // a new connection is still served : its request may be on the way.
+    const bool waiting = TimingWheel::isScheduled(&timer->node) && timer->node.kind == TIMEOUT_KEEPALIVE;
+    if (busy || (!force && !waiting))
+      continue;
+    closeConnection(contexts.front()); // its cgi process is killed (see clearContexts)
+    closed++;
   }
-  return (_serverList[0]);
+  if (force && closed > 0)
+    printLog("shutdown\t\tclosed " + ft_itos(closed) + " connections left\n", PRINT_YELLOW);
 }
 
-int ServerManager::attachNewEvent(struct Context* context, const struct kevent& event)
+// called by an event loop after each batch once the server is stopping.
+// true : no connection left, the loop can return.
+bool ConnectionTimers::drain(time_t deadline)
 {
-  FileDescriptor kq;
+  closeConnections(time(NULL) >= deadline);
+  return (_open == 0);
+}
 
-  if (THREAD_MODE)
-    kq = context->threadKQ;
-  else
-    kq = _kqueue;
-  if (kevent(kq, &event, 1, NULL, 0, NULL) < 0)
+void ConnectionTimers::timeoutHandler(TimerNode* node)
+{
+  ConnectionTimer* timer = static_cast<ConnectionTimer*>(node->data);
+  std::vector<struct Context*>& contexts = *timer->connectContexts;
+
+  // worker_threads : a job of the connection is out. look again on the next tick.
+  for (size_t i = 0; i < contexts.size(); ++i)
   {
-    if (DEBUG_MODE)
+    if (contexts[i]->workState != WORK_IDLE)
     {
-      printLog("event attach failed\n", PRINT_YELLOW);
-      std::cout << kq << " (attach) \n";
-      std::cout << event.ident << "(ident) (attach) \n";
-      std::cout << strerror(errno) << " (attach) \n";
-      std::cout << context->threadKQ << " (attach) \n";
+      current()->_wheel.schedule(node, node->kind, TIMER_TICK_MS);
+      return ;
     }
-    return (FAILED);
   }
-  return (0);
+  connectionTimeoutHandler(contexts.front(), node->kind);
 }
@@ -3,7 +3,18 @@
 #include "HTTPResponse.hpp"
 #include "CGI.hpp"
 #include <sstream>
+#include <iomanip>
+#include <sys/wait.h>
+#include <csignal>
+#include <sys/ioctl.h>
 #include <set>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <netinet/tcp.h>
+#if defined(__linux__)
+# include <sys/eventfd.h>
+#endif
 
 void printLog(const std::string& log, const std::string& color = PRINT_RESET)
 {
@@ -49,13 +60,18 @@ std::string getClientIP(struct sockaddr_in* addr)
 
 void CGIParseHandler(struct Context* context)
 {
-  char buffer[BUFFER_SIZE];
   std::string message;
   size_t bodyPOS;
-  size_t readCount;
+  ssize_t readCount;
 
-  readCount = read(context->cgi->readFD, buffer, BUFFER_SIZE);
-  message.assign(buffer, readCount);
+  if (context->cgi == NULL) // the request is over (same batch)
+    return;
+  const size_t bufferSize = getSnapshot(context).getMatchedServer(*context->req)._outputBufferSize;
+  BufferSlice buffer(bufferSize);
+  readCount = context->manager->getContextBackend(context)->readFile(context->cgi->readFD, buffer.data(), bufferSize);
+  if (readCount < 0)
+    return;
+  message.assign(buffer.data(), readCount);
   bodyPOS = message.find("\r\n\r\n");
   if (bodyPOS == std::string::npos)
   {
@@ -65,8 +81,9 @@ void CGIParseHandler(struct Context* context)
   {
     message.resize(bodyPOS + 4);
     struct Context* origin = (*(context->connectContexts))[0];
+    origin->manager->detachEvents(origin, origin->cgi->readFD);
     close(origin->cgi->readFD);
-    origin->cgi->readFD = open(origin->cgi->readFilePath.c_str(), O_RDONLY);
+    origin->cgi->readFD = open(origin->cgi->readFilePath.c_str(), O_RDONLY | O_CLOEXEC);
     lseek(origin->cgi->readFD, message.size() ,SEEK_SET);
     origin->cgi->parseCGI(origin, message);
     origin->cgi->pid = -1;
@@ -77,52 +94,68 @@ void CGIParseHandler(struct Context* context)
 void CGIChildHandler(struct Context* context)
 {   
   waitpid(context->cgi->pid, &context->cgi->exitStatus, 0);
+  armTimer(context, TIMEOUT_NONE); // the pid is reaped : nothing to kill anymore
+  releaseLoad(context, LOAD_CGI);
   if (context->cgi->exitStatus)
   {
     struct Context* origin = (*(context->connectContexts))[0];
-    HTTPResponse* response = new HTTPResponse(ST_BAD_GATEWAY, "gateway broken", context->manager->getServerName(context->addr.sin_port));
+    HTTPResponse* response;
+    if (context->cgi->timedOut)
+      response = new HTTPResponse(ST_GATEWAY_TIMEOUT, "gateway timeout", getSnapshot(context).getServerName(context->addr.sin_port));
+    else
+      response = new HTTPResponse(ST_BAD_GATEWAY, "gateway broken", getSnapshot(context).getServerName(context->addr.sin_port));
     response->setFd(-1);
     response->addHeader(HTTPResponseHeader::CONTENT_LENGTH(0));
-    delete context->cgi;
-    context->cgi = NULL;
+    // the cgi is shared with the other contexts of the connection : clearContexts() frees it.
+    context->cgi->pid = -1;
     origin->res = response;
     origin->res->sendToClient(origin);
   }
   else
   {
-    context->cgi->readFD = open(context->cgi->readFilePath.c_str(), O_RDONLY);
-    struct Context* newContext = new struct Context(context->fd, context->addr, CGIParseHandler, context->manager);
-    newContext->req = context->req;
-    newContext->cgi = context->cgi;
-    newContext->threadKQ = context->threadKQ;
-    newContext->connectContexts = context->connectContexts;
-    newContext->connectContexts->push_back(newContext);
-    newContext->pipeFD[0] = context->pipeFD[0];
-    newContext->pipeFD[1] = context->pipeFD[1];
-    struct kevent event;
-    EV_SET(&event, newContext->cgi->readFD, EVFILT_READ, EV_ADD, 0, 0, newContext);
+    context->cgi->readFD = open(context->cgi->readFilePath.c_str(), O_RDONLY | O_CLOEXEC);
+    struct Context* newContext = getStage(context, STAGE_AUX, CGIParseHandler);
+    struct Event event;
+    setEvent(&event, newContext->cgi->readFD, EVENT_READ, EVENT_ADD, 0, newContext);
     newContext->manager->attachNewEvent(newContext, event);
   }
 }
 
-void CGIWriteHandler(struct Context* context)
+static bool receiveRequestJob(struct Context* context)
 {
-  HTTPRequest& req = *context->req;
+  return (context->manager->getRequestParser().receiveRequest(context));
+}
 
-  ssize_t writeSize = 0;
+static void processRequestJob(struct Context* context)
+{
+  context->manager->getRequestProcessor().processRequest(context);
+}
 
-  if ((writeSize = write(context->cgi->writeFD, &req.body->c_str()[context->totalIOSize], req.body->size() - context->totalIOSize)) < 0)
-  {
-    printLog("error\t\t" + getClientIP(&context->addr) + "\t: write failed\n", PRINT_RED);
-  }
-  context->totalIOSize += writeSize; // get total write size
-  if (context->totalIOSize >= static_cast<ssize_t>(req.body->size())) // If write finished
+// between two requests : the next request uses the configuration published last. (SIGHUP)
+// a connection of a port the new configuration dropped keeps its own.
+static void refreshSnapshot(struct Context* context)
+{
+  ServerManager* manager = context->manager;
+  Server* portServer = context->loadServers[LOAD_CONNECTIONS];
+
+  if (manager->isCurrentSnapshot(context->snapshot) || portServer == NULL)
+    return ;
+  // the response or the cgi of the previous request is still out (its load slot is held)
+  if (context->loadServers[LOAD_REQUESTS] != NULL || context->loadServers[LOAD_CGI] != NULL)
+    return ;
+  ConfigSnapshot* snapshot = manager->acquireSnapshot();
+  Server* server = snapshot->findPortServer(portServer->_socketAddr.sin_port);
+  if (server == NULL)
   {
-    delete (req.body);
-    req.body = NULL;
-    close(context->cgi->writeFD);
-    context->cgi->CGIChildEvent(context);
+    ConfigSnapshot::release(snapshot);
+    return ;
   }
+  manager->moveLoad(*portServer, *server, LOAD_CONNECTIONS);
+  context->loadServers[LOAD_CONNECTIONS] = server;
+  if (ConnectionTimers::current() != NULL)
+    ConnectionTimers::current()->setPortTimeouts(context->fd, &server->_timeouts);
+  ConfigSnapshot::release(context->snapshot);
+  context->snapshot = snapshot;
 }
 
 void socketReceiveHandler(struct Context* context)
@@ -131,87 +164,359 @@ void socketReceiveHandler(struct Context* context)
 		printLog("sk recv handler called\n", PRINT_CYAN);
   if (!context)
     throw (std::runtime_error("NULL context"));
+  if (context->state >= CONN_PROCESSING)
+  {
+    // the next request waits for the response of this one : completeRequest() reads it.
+    struct Event event;
+    setEvent(&event, context->fd, EVENT_READ, EVENT_DISABLE, 0, context);
+    context->manager->attachNewEvent(context, event);
+    context->readPaused = true;
+    return ;
+  }
+  if (context->req == NULL) // first bytes of the next request
+  {
+    refreshSnapshot(context);
+    armTimer(context, TIMEOUT_HEADER, TIMEOUT_KEEPALIVE);
+  }
+  // worker_threads : reading and parsing may be stolen by an idle reactor.
+  // (no response is in flight : nothing else of the connection runs meanwhile)
+  if (context->reactor != NULL)
+  {
+    context->reactor->submit(context, receiveRequestJob, processRequestJob);
+    return ;
+  }
   context->manager->getRequestParser().parseRequest(context);
 }
 
+// accept4 : the new socket is non-blocking from the start. (linux does not inherit O_NONBLOCK)
+// BSD : accepted sockets inherit O_NONBLOCK of the listening socket.
+// close-on-exec, as every descriptor of the server : a cgi or an upgrade does not get it.
+static FileDescriptor acceptSocket(FileDescriptor listenFd, struct sockaddr_in* addr)
+{
+  socklen_t len = sizeof(*addr);
+
+#if defined(__linux__)
+  return (accept4(listenFd, reinterpret_cast<sockaddr*>(addr), &len, SOCK_NONBLOCK | SOCK_CLOEXEC));
+#else
+  const FileDescriptor fd = accept(listenFd, reinterpret_cast<sockaddr*>(addr), &len);
+  if (fd >= 0)
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+  return (fd);
+#endif
+}
+
+// connections waiting in the accept queue reached the listen() backlog. (linux : TCP_INFO)
+static bool isAcceptQueueFull(FileDescriptor listenFd)
+{
+#if defined(__linux__)
+  struct tcp_info info;
+  socklen_t len = sizeof(info);
+
+  if (getsockopt(listenFd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0)
+    return (false);
+  // listening socket : unacked = queued connections, sacked = backlog
+  return (info.tcpi_unacked >= info.tcpi_sacked);
+#else
+  (void)listenFd;
+  return (false);
+#endif
+}
+
+// over max_connections : the pre-serialised 503, then close.
+static void rejectConnection(ServerManager* manager, FileDescriptor newSocket)
+{
+  const std::string& response = manager->getUnavailableResponse();
+  struct linger optLinger = {0, 0}; // no reset on close : the 503 reaches the client (see Server::openListenSocket)
+
+  setsockopt(newSocket, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
+  ssize_t ret = send(newSocket, response.data(), response.size(), MSG_DONTWAIT);
+  (void)ret;
+  close(newSocket);
+}
+
+// drain the accept queue : at most accept_budget connections per wakeup.
+// (level-triggered : the rest is accepted on the next wakeup, after the other events)
+// socket options come from the listening socket. (see Server::openListenSocket)
 void acceptHandler(struct Context* context)
 {
   if (DEBUG_MODE)
     printLog("accept handler called\n", PRINT_CYAN);
-  socklen_t len = sizeof(context->addr);
-  FileDescriptor newSocket;
+  const size_t budget = context->manager->getConfig().acceptBudget;
+  size_t accepted = 0;
 
-  if ((newSocket = accept(context->fd, reinterpret_cast<sockaddr*>(&context->addr), &len)) < 0)
+  while (accepted < budget)
   {
-    if (DEBUG_MODE)
-      printLog("error:" + getClientIP(&context->addr) + " : accept failed\n", PRINT_RED);
+    // context->addr stays the listening address. (the port picks the server timeouts)
+    struct sockaddr_in addr;
+    FileDescriptor newSocket = acceptSocket(context->fd, &addr);
+
+    if (newSocket < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED) // the peer gave up while queued
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+      {
+        if (context->acceptStat != NULL)
+          context->acceptStat->errors++;
+        if (DEBUG_MODE)
+          printLog("error:" + getClientIP(&context->addr) + " : accept failed : " + strerror(errno) + "\n", PRINT_RED);
+      }
+      break;
+    }
+    accepted++;
+    ConfigSnapshot& snapshot = getSnapshot(context);
+    Server& server = snapshot.getPortServer(context->addr.sin_port);
+    if (!context->manager->admit(server, LOAD_CONNECTIONS))
+    {
+      rejectConnection(context->manager, newSocket);
+      continue;
+    }
+    printLog("connect\t\t" + getClientIP(&addr) + "\n" , PRINT_GREEN);
+    struct Handoff handoff;
+    handoff.fd = newSocket;
+    handoff.addr = addr;
+    handoff.manager = context->manager;
+    handoff.snapshot = &snapshot;
+    handoff.server = &server;
+    snapshot.retain();
     if (THREAD_MODE)
-      delete (context);
-    return ;
+    {
+      if (!context->manager->getThreadPool().handOff(handoff))
+      {
+        printLog("error: " + getClientIP(&addr) + " : every worker is full, connection dropped\n", PRINT_RED);
+        context->manager->release(server, LOAD_CONNECTIONS);
+        ConfigSnapshot::release(&snapshot);
+        close(newSocket);
+      }
+      continue;
+    }
+    attachClient(handoff, context->threadBackend, context->reactor);
   }
-  else
+  if (context->acceptStat != NULL)
+  {
+    const bool budgetHit = (accepted == budget);
+    std::string name = "port " + ft_itos(ntohs(context->addr.sin_port));
+    if (context->reactor != NULL)
+      name += " reactor " + ft_itos(context->reactor->getId());
+    context->acceptStat->record(accepted, budgetHit, budgetHit && isAcceptQueueFull(context->fd));
+    context->acceptStat->report(name, context->manager->getConfig().eventStatInterval);
+  }
+}
+
+// register an accepted connection on backend. (the thread which owns backend serves it)
+void attachClient(const struct Handoff& handoff, EventBackend* backend, Reactor* reactor)
+{
+  struct Context* newContext = new struct Context(handoff.fd, handoff.addr, socketReceiveHandler, handoff.manager);
+  newContext->threadBackend = backend;
+  newContext->reactor = reactor;
+  newContext->snapshot = handoff.snapshot;
+  newContext->connectContexts = new std::vector<struct Context*>();
+  newContext->connectContexts->reserve(CONN_STAGES);
+  newContext->connectContexts->push_back(newContext);
+  struct Event event;
+  setEvent(&event, handoff.fd, EVENT_READ, EVENT_ADD | EVENT_CLEAR, 0, newContext);
+  newContext->manager->attachNewEvent(newContext, event);
+  newContext->loadServers[LOAD_CONNECTIONS] = handoff.server; // admitted by acceptHandler
+  if (ConnectionTimers::current() != NULL)
+    ConnectionTimers::current()->open(handoff.fd, newContext->connectContexts, &handoff.server->_timeouts);
+}
+
+// the configuration a context works with : the one of its connection, or of its listening socket.
+ConfigSnapshot& getSnapshot(const struct Context* context)
+{
+  if (context->connectContexts != NULL)
+    return (*context->connectContexts->front()->snapshot);
+  return (*context->snapshot);
+}
+
+static void releaseSnapshot(struct Context* context)
+{
+  struct Context* connection = context->connectContexts->front();
+
+  ConfigSnapshot::release(connection->snapshot);
+  connection->snapshot = NULL;
+}
+
+static bool isSameAddress(const struct sockaddr_in& a, const struct sockaddr_in& b)
+{
+  return (a.sin_port == b.sin_port && a.sin_addr.s_addr == b.sin_addr.s_addr);
+}
+
+static struct Context* openListener(FileDescriptor fd, const struct sockaddr_in& addr, ServerManager* manager, EventBackend* backend, Reactor* reactor)
+{
+  struct Event event;
+  struct Context* context = new struct Context(fd, addr, acceptHandler, manager);
+
+  context->threadBackend = backend;
+  context->reactor = reactor;
+  context->acceptStat = new AcceptStat();
+  setEvent(&event, context->fd, EVENT_READ, EVENT_ADD, 0, context);
+  if (backend->attach(event) < 0 || backend->flush() < 0)
   {
-    // set socket option
-    if (fcntl(newSocket, F_SETFL, O_NONBLOCK) < 0)
+    closeListener(context);
+    printLog("error: server: event attachServerEvent failed\n", PRINT_RED);
+    throw (std::runtime_error("Event attachServerEvent failed\n"));
+  }
+  return (context);
+}
+
+void closeListener(struct Context* context)
+{
+  context->threadBackend->detach(context->fd);
+  close(context->fd);
+  ConfigSnapshot::release(context->snapshot);
+  delete (context->acceptStat);
+  delete (context);
+}
+
+// stop : no new connection from here.
+void closeListeners(std::vector<struct Context*>& listeners)
+{
+  for (size_t i = 0; i < listeners.size(); ++i)
+    closeListener(listeners[i]);
+  listeners.clear();
+}
+
+// make the listening sockets of one event loop match the published configuration.
+// addresses it dropped are closed, new ones opened. the others keep their socket and accept queue
+// and only move to the new snapshot.
+// reactor : SO_REUSEPORT sockets of that reactor. (NULL : main thread)
+// mustOpen : a socket which cannot be opened stops the server. (otherwise it is only logged)
+void syncListeners(std::vector<struct Context*>& listeners, ServerManager* manager, EventBackend* backend, Reactor* reactor, bool mustOpen)
+{
+  ConfigSnapshot* snapshot = manager->acquireSnapshot();
+  std::vector<Server*> servers = snapshot->getListenServers();
+  std::vector<struct Context*> kept;
+
+  for (size_t i = 0; i < listeners.size(); ++i)
+  {
+    struct Context* context = listeners[i];
+    if (snapshot->findListenServer(context->addr) == NULL)
     {
-      throw (std::runtime_error("fcntl non block failed\n"));
+      printLog("listen closed\t" + getClientIP(&context->addr) + ":" + ft_itos(ntohs(context->addr.sin_port)) + "\n", PRINT_CYAN);
+      closeListener(context);
+      continue;
     }
-    struct linger optLinger = {1, 0};
-    if (setsockopt(newSocket, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger)) < 0 )
+    if (context->snapshot != snapshot)
     {
-      throw (std::runtime_error("Socket opt failed\n"));
+      snapshot->retain();
+      ConfigSnapshot::release(context->snapshot);
+      context->snapshot = snapshot;
+    }
+    kept.push_back(context);
+  }
+  listeners.swap(kept);
+  for (size_t i = 0; i < servers.size(); ++i)
+  {
+    bool isOpen = false;
+    for (size_t j = 0; j < listeners.size() && !isOpen; ++j)
+      isOpen = isSameAddress(listeners[j]->addr, servers[i]->_socketAddr);
+    if (isOpen)
+      continue;
+    try
+    {
+      listeners.push_back(openListener(servers[i]->openListenSocket(reactor != NULL), servers[i]->_socketAddr, manager, backend, reactor));
+    }
+    catch (std::exception& e)
+    {
+      if (mustOpen)
+      {
+        ConfigSnapshot::release(snapshot);
+        throw ;
+      }
+      printLog("error: listen " + getClientIP(&servers[i]->_socketAddr) + ":" + ft_itos(servers[i]->_serverPort) + " : " + e.what(), PRINT_RED);
+      continue;
+    }
+    snapshot->retain();
+    listeners.back()->snapshot = snapshot;
+    if (!mustOpen)
+      printLog("listen opened\t" + getClientIP(&servers[i]->_socketAddr) + ":" + ft_itos(servers[i]->_serverPort) + "\n", PRINT_CYAN);
+  }
+  ConfigSnapshot::release(snapshot);
+}
+
+// binary upgrade, once every event loop took its sockets : the previous process had more of them per
+// address. (its reactors had more SO_REUSEPORT sockets per port) connections are queued on those, and
+// the kernel goes on queueing new ones there : this event loop accepts from them too, as long as their
+// address is in the configuration. (closing them would reset those connections)
+void adoptListeners(std::vector<struct Context*>& listeners, ServerManager* manager, EventBackend* backend, Reactor* reactor)
+{
+  ConfigSnapshot* snapshot = manager->acquireSnapshot();
+  struct sockaddr_in addr;
+  FileDescriptor fd;
+
+  while ((fd = Server::takeLeftoverSocket(&addr)) >= 0)
+  {
+    if (snapshot->findListenServer(addr) == NULL) // gone from the configuration
+    {
+      close(fd);
+      continue;
+    }
+    listeners.push_back(openListener(fd, addr, manager, backend, reactor));
+    snapshot->retain();
+    listeners.back()->snapshot = snapshot;
+    printLog("listen adopted\t" + getClientIP(&addr) + ":" + ft_itos(ntohs(addr.sin_port)) + "\n", PRINT_CYAN);
+  }
+  ConfigSnapshot::release(snapshot);
+}
+
+// closing a connection frees all of its contexts.
+// events of those contexts left in the same batch are dropped. (udata = NULL)
+static void dropClosedEvents(struct Context* closed, struct Event* batchRest, int batchRestCount)
+{
+  for (int i = 0; i < batchRestCount; ++i)
+  {
+    struct Context* data = static_cast<struct Context*>(batchRest[i].udata);
+
+    if (data == NULL)
+      continue;
+    if (data == closed || (closed->connectContexts != NULL && \
+        std::find(closed->connectContexts->begin(), closed->connectContexts->end(), data) != closed->connectContexts->end()))
+    {
+      batchRest[i].udata = NULL;
+    }
+  }
+}
+
+void handleEvents(struct Event* events, int eventCount)
+{
+  for (int i = 0; i < eventCount; ++i)
+  {
+    if (events[i].udata == NULL) // connection closed by an earlier event of this batch
+      continue;
+    if (events[i].filter == EVENT_READ \
+        || events[i].filter == EVENT_WRITE \
+        || events[i].filter == EVENT_PROC)
+    {
+      handleEvent(&events[i], &events[i + 1], eventCount - i - 1);
     }
-    printLog("connect\t\t" + getClientIP(&context->addr) + "\n" , PRINT_GREEN);
-
-    struct Context* newContext = new struct Context(newSocket, context->addr, socketReceiveHandler, context->manager);
-    newContext->fd = newSocket;
-    newContext->threadKQ = context->threadKQ;
-    newContext->connectContexts = new std::vector<struct Context*>();
-    newContext->connectContexts->push_back(newContext);
-    newContext->pipeFD[0] = context->pipeFD[0];
-    newContext->pipeFD[1] = context->pipeFD[1];
-    struct kevent event;
-    EV_SET(&event, newSocket, EVFILT_READ, EV_ADD, 0, 0, newContext);
-    context->manager->attachNewEvent(context, event);
-    if (THREAD_MODE)
-      delete (context);
   }
 }
 
-void handleEvent(struct kevent* event)
+void handleEvent(struct Event* event, struct Event* batchRest, int batchRestCount)
 {
   struct Context* eventData = static_cast<struct Context*>(event->udata);
   try
   {
-    if (event->filter != EVFILT_PROC && (event->flags & EV_EOF || event->fflags & EV_EOF))
+    if (event->filter != EVENT_PROC && (event->flags & EVENT_EOF))
     {
       struct stat st;
       if (fstat(event->ident, &st) != FAILED && S_ISFIFO(st.st_mode))
       {
-        if (event->filter == EVFILT_WRITE)
+        if (event->filter == EVENT_WRITE)
           close (eventData->pipeFD[1]);
         std::cout << "OK?\n";
         return ;
       }
       printLog("Client closed connection : " + getClientIP(&eventData->addr) + "\n", PRINT_YELLOW);
-      shutdown(eventData->fd, SHUT_RDWR);
-      close(eventData->fd);
-      clearContexts(eventData);
-      eventData->req = NULL;
-      delete (eventData);
+      dropClosedEvents(eventData, batchRest, batchRestCount);
+      closeConnection(eventData);
     }
-    else if (event->flags & EV_ERROR)
+    else if (event->flags & EVENT_ERROR)
     {
       printLog("EV ERROR case\n", PRINT_YELLOW);
-      shutdown(eventData->fd, SHUT_RDWR);
-      close(eventData->fd);
-      if (eventData->req != NULL)
-        delete (eventData->req);
-      eventData->req = NULL;
-      if (eventData->res != NULL)
-        delete (eventData->res);
-      eventData->res = NULL;
-      delete (eventData);
+      dropClosedEvents(eventData, batchRest, batchRestCount);
+      closeConnection(eventData);
     }
     else
     {
@@ -224,39 +529,158 @@ void handleEvent(struct kevent* event)
   }
 }
 
-// nonblocking write.
-void writeFileHandle(struct Context* context)
+// the socket is read again : a paused read, or one which stopped before EAGAIN. (see socketReceiveHandler)
+// enabling it again reports what is left, as no new edge would.
+void resumeRead(struct Context* connection)
+{
+  if (connection->readPaused || connection->readLeft)
+  {
+    struct Event event;
+    setEvent(&event, connection->fd, EVENT_READ, EVENT_ENABLE, 0, connection);
+    connection->manager->attachNewEvent(connection, event);
+    connection->readPaused = false;
+    connection->readLeft = false;
+  }
+}
+
+// the body read so far goes to its sink, as much as it takes now. returns true once all of it is written.
+// (a write error (ENOSPC, EIO) drops it and marks the body failed : see sendServerError)
+bool writeBody(struct Context* context)
 {
   HTTPRequest& req = *context->req;
+  std::string& pending = *req.body;
+  size_t written = 0;
+  ssize_t writeSize;
 
-  ssize_t writeSize = 0;
-  if ((writeSize = write(context->fd, &req.body->c_str()[context->totalIOSize], req.body->size() - context->totalIOSize)) < 0)
+  while (written < pending.size() && !req.bodyFailed)
   {
-    printLog("error\t\t" + getClientIP(&context->addr) + "\t: write failed\n", PRINT_RED);
+    if ((writeSize = write(req.bodyFd, pending.data() + written, pending.size() - written)) < 0)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      printLog("error\t\t" + getClientIP(&context->addr) + "\t: write failed\n", PRINT_RED);
+      req.bodyFailed = true;
+    }
+    else
+      written += writeSize;
+  }
+  if (req.bodyFailed)
+    pending.clear();
+  else
+    pending.erase(0, written);
+  return (pending.empty());
+}
+
+// the file at path is added at the end of the file at target.
+static bool appendFile(const std::string& path, const std::string& target)
+{
+  BufferSlice buffer(DEFAULT_OUTPUT_BUFFER_SIZE);
+  const FileDescriptor from = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  const FileDescriptor to = open(target.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0777);
+  ssize_t readSize = -1;
+
+  while (from >= 0 && to >= 0 && (readSize = read(from, buffer.data(), buffer.room())) > 0)
+  {
+    if (write(to, buffer.data(), readSize) != readSize)
+    {
+      readSize = -1;
+      break;
+    }
+  }
+  if (from >= 0)
+    close(from);
+  if (to >= 0)
+    close(to);
+  return (readSize == 0);
+}
+
+// the body is complete and written : its temporary file becomes the target (PUT, or POST to an
+// empty file), or is added at its end (POST). returns false when it could not. (see openBodySink)
+bool commitBody(struct Context* context)
+{
+  HTTPRequest& req = *context->req;
+  struct stat targetStat;
+
+  if (req.bodyFailed) // (the temporary file is unlinked with the request)
+    return (false);
+  if (req.bodyPath.empty())
+    return (true);
+  close(req.bodyFd);
+  req.bodyFd = -1;
+  if (req.method == POST && stat(req.bodyTarget.c_str(), &targetStat) == 0 && targetStat.st_size > 0)
+    return (appendFile(req.bodyPath, req.bodyTarget)); // (the temporary file is unlinked with the request)
+  if (rename(req.bodyPath.c_str(), req.bodyTarget.c_str()) == FAILED)
+    return (false);
+  req.bodyPath.clear();
+  return (true);
+}
+
+// the body read so far goes on to its sink as it arrives. a sink which takes no more now is waited
+// for : the socket is not read meanwhile (see writeFileHandle). no sink : the body stays in memory.
+void streamBody(struct Context* context)
+{
+  struct Context* connection = context->connectContexts->front();
+  HTTPRequest& req = *connection->req;
+
+  if (req.bodyFailed) // answered already
+    return ;
+  if (req.bodyFd < 0 || writeBody(connection))
+  {
+    if (req.bodyFailed)
+      sendServerError(connection);
+    return ;
   }
-  context->totalIOSize += writeSize; // get total write size
-  if (context->totalIOSize >= static_cast<ssize_t>(req.body->size())) // If write finished
+  struct Event event;
+  setEvent(&event, connection->fd, EVENT_READ, EVENT_DISABLE, 0, connection);
+  connection->manager->attachNewEvent(connection, event);
+  connection->readPaused = true;
+  struct Context* newContext = getStage(connection, STAGE_AUX, writeFileHandle);
+  newContext->fd = req.bodyFd;
+  setEvent(&event, req.bodyFd, EVENT_WRITE, EVENT_ADD, 0, newContext);
+  connection->manager->attachNewEvent(newContext, event);
+}
+
+// the sink of the body takes more : what was read goes on to it. then the socket is read again,
+// or, the body being complete, the cgi starts or the response is sent. (see streamBody)
+void writeFileHandle(struct Context* context)
+{
+  if (context->req == NULL || context->req->bodyFd != context->fd) // the request is over (same batch)
+    return ;
+  if (!writeBody(context))
+    return ;
+  struct Event ev;
+  setEvent(&ev, context->fd, EVENT_WRITE, EVENT_DELETE, 0, NULL);
+  context->manager->attachNewEvent(context, ev);
+  if (context->req->bodyFailed)
+    sendServerError(context);
+  else if (context->req->status != END)
+    resumeRead(context->connectContexts->front());
+  else if (context->cgi != NULL)
+    CGIStart(context);
+  else
   {
-    delete (req.body);
-    req.body = NULL;
+    if (!commitBody(context))
+      context->res->setStatus(ST_INTERNAL_SERVER_ERROR, "Server Error");
+    context->res->sendToClient(context->connectContexts->front());
   }
 }
 
 void writePipeHandler(struct Context* context)
 {
-  if (write(context->pipeFD[1], context->ioBuffer, context->totalIOSize) < 0)
+  if (context->ioBuffer.empty()) // already written
+    return ;
+  if (write(context->pipeFD[1], context->ioBuffer.data(), context->ioBuffer.size()) < 0)
   {
     printLog("error\t\t" + getClientIP(&context->addr) + "\t: write failed\n", PRINT_RED);
   }
   else
   {
-    delete (context->ioBuffer);
-    context->ioBuffer = NULL;
-    struct kevent ev;
-    EV_SET(&ev, context->pipeFD[1], EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+    context->ioBuffer.clear();
+    struct Event ev;
+    setEvent(&ev, context->pipeFD[1], EVENT_WRITE, EVENT_DELETE, 0, NULL);
     context->manager->attachNewEvent(context, ev);
     context->res->addHeader(HTTPResponseHeader::CONTENT_LENGTH(FdGetFileSize(context->res->getFd())));
-    context->res->sendToClient(context);
+    context->res->sendToClient(context->connectContexts->front());
   }
 }
 
@@ -337,81 +761,319 @@ long FdGetFileSize(int fd)
     return 0;
   struct stat stat_buf;
   int rc = fstat(fd, &stat_buf);
+  if (rc == 0 && S_ISFIFO(stat_buf.st_mode))
+  {
+    // st_size of pipe is 0 on linux. ask the bytes waiting in the pipe.
+    int pending = 0;
+    return (ioctl(fd, FIONREAD, &pending) == 0) ? pending : -1;
+  }
   return rc == 0 ? stat_buf.st_size : -1;
 }
 
-void clearContexts(struct Context* context)
+// the context of stage on the connection of context, ready to run handler.
+// allocated by the first request which needs it, then reused by the next ones : a connection
+// holds CONN_STAGES contexts at most. it borrows the request, the response and the cgi of the connection.
+struct Context* getStage(struct Context* context, int stage, void (*handler)(struct Context*))
 {
-  // 내부에서 본인 제외 모두 삭제.
-  std::set<HTTPRequest*> reqSets;
-  std::set<HTTPResponse*> resSets;
-  std::set<CGI*> cgiSets;
+  struct Context* connection = context->connectContexts->front();
+  std::vector<struct Context*>& stages = *connection->connectContexts;
 
-  for (
-          std::vector<struct Context*>::iterator it = context->connectContexts->begin();
-          it != context->connectContexts->end();
-          ++it
-          )
+  while (stages.size() < CONN_STAGES)
   {
-    struct Context* data = *it;
+    struct Context* newContext = new struct Context(connection->fd, connection->addr, NULL, connection->manager);
+    newContext->threadBackend = connection->threadBackend;
+    newContext->connectContexts = connection->connectContexts;
+    stages.push_back(newContext);
+  }
+  struct Context* stageContext = stages[stage];
+  stageContext->fd = connection->fd;
+  stageContext->handler = handler;
+  stageContext->req = connection->req;
+  stageContext->res = connection->res;
+  stageContext->cgi = connection->cgi;
+  if (stage != STAGE_SEND) // (send : the responses before may still be waiting, see socketSendHandler)
+    stageContext->ioBuffer.clear();
+  stageContext->totalIOSize = 0;
+  stageContext->pipeFD[0] = connection->pipeFD[0];
+  stageContext->pipeFD[1] = connection->pipeFD[1];
+  return (stageContext);
+}
 
-    if (data == context)
-    {
-      if (data->req)
-      {
-        reqSets.insert(data->req);
-      }
-      if (data->res)
-      {
-        resSets.insert(data->res);
-      }
-      if (data->cgi)
-      {
-        cgiSets.insert(data->cgi);
-      }
-      continue;
-    }
-    if (data->req)
-    {
-      reqSets.insert(data->req);
-    }
-    if (data->res)
-    {
-      resSets.insert(data->res);
-    }
-    if (data->cgi)
-    {
-      cgiSets.insert(data->cgi);
-    }
-    if (data->ioBuffer != NULL)
-    {
-      delete (data->ioBuffer);
-      data->ioBuffer = NULL;
-    }
-    if (data != context)
+void setState(struct Context* context, int state)
+{
+  context->connectContexts->front()->state = state;
+}
+
+// free the request, the response and the cgi of the connection. (their fds leave the event loop)
+static void releaseRequest(struct Context* connection)
+{
+  std::vector<struct Context*>& stages = *connection->connectContexts;
+
+  for (size_t i = 1; i < stages.size(); ++i)
+  {
+    stages[i]->req = NULL;
+    stages[i]->res = NULL;
+    stages[i]->cgi = NULL;
+    if (i != STAGE_SEND) // (responses done may wait there for the next one, see socketSendHandler)
+      stages[i]->ioBuffer.clear();
+    stages[i]->pipeFD[0] = -1;
+    stages[i]->pipeFD[1] = -1;
+  }
+  if (connection->cgi != NULL)
+  {
+    CGI* cgi = connection->cgi;
+    if (cgi->pid > 0) // closed before its cgi is done (client gone, shutdown)
     {
-      free (data);
-      data = NULL;
+      struct Event event;
+      setEvent(&event, cgi->pid, EVENT_PROC, EVENT_DELETE, 0, NULL);
+      connection->manager->attachNewEvent(connection, event);
+      kill(cgi->pid, SIGKILL);
+      waitpid(cgi->pid, NULL, 0);
     }
+    // fds closed by the destructor
+    connection->manager->detachEvents(connection, cgi->readFD);
+    delete (cgi);
+  }
+  if (connection->res != NULL)
+  {
+    connection->manager->detachEvents(connection, connection->res->_readFD);
+    delete (connection->res);
   }
-  for (std::set<HTTPResponse*>::iterator it = resSets.begin(); it != resSets.end(); ++it)
+  if (connection->req != NULL) // (the file of its body is closed with it)
+    connection->manager->detachEvents(connection, connection->req->bodyFd);
+  delete (connection->req);
+  if (connection->pipeline.empty()) // (the requests queued are in it too)
+    connection->arena.reset();
+  connection->cgi = NULL;
+  connection->res = NULL;
+  connection->req = NULL;
+  connection->pipeFD[0] = -1;
+  connection->pipeFD[1] = -1;
+}
+
+// pipelining : the first request queued becomes the one served, as if it was just read.
+// (an incomplete one is read on from the socket)
+static void serveNextRequest(struct Context* connection)
+{
+  HTTPRequest* request = connection->pipeline.front();
+
+  connection->pipeline.erase(connection->pipeline.begin());
+  connection->req = request;
+  if (request->status == END || request->status == ERROR)
+    request->dispatched = true;
+  else
+    resumeRead(connection);
+  armTimer(connection, TIMEOUT_HEADER);
+  connection->manager->getRequestProcessor().processRequest(connection);
+}
+
+// the response is sent : the connection waits for its next request with the same contexts,
+// or serves the next one it read already.
+void completeRequest(struct Context* context)
+{
+  struct Context* connection = context->connectContexts->front();
+
+  releaseRequest(connection);
+  connection->state = CONN_READ_HEADER;
+  if (connection->pipeline.empty() && !connection->readBuffer.empty()) // (more were sent than were queued)
+    connection->manager->getRequestParser().queueRequests(connection);
+  if (!connection->pipeline.empty())
   {
-    delete (*it);
+    serveNextRequest(connection);
+    return ;
   }
-  for (std::set<HTTPRequest*>::iterator it = reqSets.begin(); it != reqSets.end(); ++it)
+  if (connection->readBuffer.empty())
+    connection->readBuffer.clear();
+  resumeRead(connection);
+}
+
+// the request after the one being answered is read already. (its response may follow right away)
+bool isNextRequestRead(struct Context* context)
+{
+  struct Context* connection = context->connectContexts->front();
+
+  return (!connection->pipeline.empty() && connection->pipeline.front()->status == END);
+}
+
+// the connection is closed once the response is sent : the requests read after it are dropped.
+void cancelPipeline(struct Context* context)
+{
+  struct Context* connection = context->connectContexts->front();
+
+  for (size_t i = 0; i < connection->pipeline.size(); ++i)
+    delete (connection->pipeline[i]);
+  connection->pipeline.clear();
+  connection->readBuffer.clear();
+}
+
+// the connection is closed : every context but the first one is freed with the request.
+void clearContexts(struct Context* context)
+{
+  struct Context* connection = context->connectContexts->front();
+  std::vector<struct Context*>& stages = *connection->connectContexts;
+
+  cancelPipeline(connection);
+  releaseRequest(connection);
+  for (size_t i = 1; i < stages.size(); ++i)
+    delete (stages[i]);
+  stages.resize(1);
+}
+
+// close the socket and free every context of the connection.
+void closeConnection(struct Context* context)
+{
+  struct Context* connection = context->connectContexts->front();
+
+  if (ConnectionTimers::current() != NULL)
+    ConnectionTimers::current()->close(connection->fd);
+  for (int kind = 0; kind < LOAD_KINDS; ++kind)
+    releaseLoad(connection, kind);
+  releaseSnapshot(connection);
+  connection->manager->detachEvents(connection, connection->fd);
+  shutdown(connection->fd, SHUT_RDWR);
+  close(connection->fd);
+  clearContexts(connection);
+  delete (connection);
+}
+
+// context : the first context of the connection. (no job of the connection is out)
+void connectionTimeoutHandler(struct Context* context, int kind)
+{
+  const char* const KINDS[] = {"", "header", "body", "keepalive", "send", "cgi"};
+
+  printLog("timeout\t\t" + getClientIP(&context->addr) + "\t" + KINDS[kind] + "\n", PRINT_YELLOW);
+  if ((kind == TIMEOUT_HEADER || kind == TIMEOUT_BODY) && context->req != NULL)
   {
-    delete (*it);
+    // same as a bad request : the response closes the connection.
+    HTTPResponse* response = new HTTPResponse(ST_REQUEST_TIMEOUT, "request timeout", getSnapshot(context).getServerName(context->addr.sin_port));
+    Server& server = getSnapshot(context).getMatchedServer(*context->req);
+
+    context->res = response;
+    response->addHeader(HTTPResponseHeader::CONTENT_LENGTH(0));
+    response->setFd(server.getErrorPageFd(ST_REQUEST_TIMEOUT));
+    if (response->getFd() > 0)
+      response->addHeader(HTTPResponseHeader::CONTENT_LENGTH(FdGetFileSize(response->getFd())));
+    response->sendToClient(context);
+    return ;
   }
-  for (std::set<CGI*>::iterator it = cgiSets.begin(); it != cgiSets.end(); ++it)
+  if (kind == TIMEOUT_CGI)
   {
-    if (context->cgi != NULL)
+    // CGIChildHandler answers 504 once the process is gone.
+    for (size_t i = 0; i < context->connectContexts->size(); ++i)
     {
-      struct kevent event;
-      EV_SET(&event, context->cgi->pid, EVFILT_PROC, EV_DELETE, 0, 0, NULL);
-      context->manager->attachNewEvent(context, event);
+      CGI* cgi = (*context->connectContexts)[i]->cgi;
+      if (cgi != NULL && cgi->pid > 0)
+      {
+        cgi->timedOut = true;
+        kill(cgi->pid, SIGKILL);
+        return ;
+      }
     }
-    delete (*it);
   }
-  context->connectContexts->clear();
-  context->connectContexts->push_back(context);
+  closeConnection(context);
+}
+
+void armTimer(struct Context* context, int kind, int fromKind)
+{
+  if (ConnectionTimers::current() != NULL)
+    ConnectionTimers::current()->arm(context->fd, kind, fromKind);
+}
+
+void setTimerTimeouts(struct Context* context, const Timeouts* timeouts)
+{
+  if (ConnectionTimers::current() != NULL)
+    ConnectionTimers::current()->setTimeouts(context->fd, timeouts);
+}
+
+// admission control : the load slots a connection holds are kept by its first context.
+// (one slot of each kind per connection at most, released when done or on close)
+bool acquireLoad(struct Context* context, Server& server, int kind)
+{
+  struct Context* connection = context->connectContexts->front();
+
+  if (connection->loadServers[kind] != NULL)
+    return (true);
+  if (!context->manager->admit(server, kind))
+    return (false);
+  connection->loadServers[kind] = &server;
+  return (true);
+}
+
+void releaseLoad(struct Context* context, int kind)
+{
+  struct Context* connection = context->connectContexts->front();
+
+  if (connection->loadServers[kind] == NULL)
+    return ;
+  context->manager->release(*connection->loadServers[kind], kind);
+  connection->loadServers[kind] = NULL;
+}
+
+// over max_requests or max_cgi. (no error page : shed the load cheaply)
+void sendServiceUnavailable(struct Context* context)
+{
+  HTTPResponse* response = new HTTPResponse(ST_SERVICE_UNAVAILABLE, "service unavailable", getSnapshot(context).getServerName(context->addr.sin_port));
+
+  context->res = response;
+  response->setFd(-1);
+  response->addHeader("Retry-After", ft_itos(context->manager->getConfig().retryAfter));
+  response->addHeader(HTTPResponseHeader::CONTENT_LENGTH(0));
+  response->sendToClient(context);
+}
+
+// the body has nowhere to go : its file cannot be opened or written. the answer to the request (or
+// the one waiting for the body) is 500, and the connection is closed after it with the rest of the body.
+void sendServerError(struct Context* context)
+{
+  struct Context* connection = context->connectContexts->front();
+  HTTPResponse* response = connection->res;
+
+  if (response == NULL)
+  {
+    response = new HTTPResponse(ST_INTERNAL_SERVER_ERROR, "Server Error", getSnapshot(connection).getServerName(connection->addr.sin_port));
+    connection->res = response;
+    response->setFd(-1);
+    response->addHeader(HTTPResponseHeader::CONTENT_LENGTH(0));
+  }
+  else
+    response->setStatus(ST_INTERNAL_SERVER_ERROR, "Server Error");
+  response->sendToClient(connection);
+}
+
+void openWakeFd(FileDescriptor wakeFd[2])
+{
+#if defined(__linux__)
+  wakeFd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wakeFd[0] < 0)
+    throw (std::runtime_error("eventfd() failed\n"));
+  wakeFd[1] = wakeFd[0];
+#else
+  if (pipe(wakeFd) < 0)
+    throw (std::runtime_error("pipe() failed\n"));
+  fcntl(wakeFd[0], F_SETFL, O_NONBLOCK);
+  fcntl(wakeFd[1], F_SETFL, O_NONBLOCK);
+  fcntl(wakeFd[0], F_SETFD, FD_CLOEXEC);
+  fcntl(wakeFd[1], F_SETFD, FD_CLOEXEC);
+#endif
+}
+
+void closeWakeFd(FileDescriptor wakeFd[2])
+{
+  close(wakeFd[0]);
+  if (wakeFd[1] != wakeFd[0])
+    close(wakeFd[1]);
+}
+
+void sendWakeUp(FileDescriptor wakeFd)
+{
+  const uint64_t one = 1;
+  ssize_t ret = write(wakeFd, &one, sizeof(one)); // full pipe / counter : the thread is awake anyway
+  (void)ret;
+}
+
+void clearWakeUp(FileDescriptor wakeFd)
+{
+  uint64_t buf[16];
+  while (read(wakeFd, buf, sizeof(buf)) > 0)
+    ;
 }
@@ -1,10 +1,16 @@
 #include <unistd.h>
+#include <cstdlib>
 #include "Session.hpp"
+#include <pthread.h>
+
+// worker threads share the servers. (worker_threads) one lock for every storage.
+static pthread_mutex_t g_sessionMutex = PTHREAD_MUTEX_INITIALIZER;
 
 WS::Time::Time()
 {
   time_t curTime = time(NULL);          // get current time info
-  struct tm *pLocal = gmtime(&curTime); // convert to struct for easy use
+  struct tm tmBuf;
+  struct tm *pLocal = gmtime_r(&curTime, &tmBuf); // convert to struct for easy use
   _sec = pLocal->tm_sec;
   _min = pLocal->tm_min;
   _hour = pLocal->tm_hour;
@@ -27,7 +33,8 @@ WS::Time::Time(struct tm *pLocal)
 bool WS::Time::isPast()
 {
   time_t curTime = time(NULL);          // get current time info
-  struct tm *pLocal = gmtime(&curTime); // convert to struct for easy use
+  struct tm tmBuf;
+  struct tm *pLocal = gmtime_r(&curTime, &tmBuf); // convert to struct for easy use
 
   if (_year != pLocal->tm_year)
     return (_year < pLocal->tm_year);
@@ -60,8 +67,12 @@ Session::~Session()
 // travers map, and delete expired session.
 void Session::clearExpiredID()
 {
+  pthread_mutex_lock(&g_sessionMutex);
   if (_storage.empty())
+  {
+    pthread_mutex_unlock(&g_sessionMutex);
     return;
+  }
 
   std::map<std::string, WS::Time>::iterator itr = _storage.begin();
   while (itr != _storage.end())
@@ -71,19 +82,31 @@ void Session::clearExpiredID()
     else
       ++itr;
   }
+  pthread_mutex_unlock(&g_sessionMutex);
 }
 
 // validate given id
 bool Session::isValid_ID(const std::string &clientID)
 {
-  if (Session::find(clientID) != _storage.end())
-    return (true);
-  return (false);
+  pthread_mutex_lock(&g_sessionMutex);
+  const bool found = (Session::find(clientID) != _storage.end());
+  pthread_mutex_unlock(&g_sessionMutex);
+  return (found);
 }
 
 void Session::add(const std::string &id, const WS::Time &expire_time)
 {
+  pthread_mutex_lock(&g_sessionMutex);
   _storage[id] = expire_time;
+  pthread_mutex_unlock(&g_sessionMutex);
+}
+
+// copy the sessions of other. (configuration reload : the new server keeps the old one's clients)
+void Session::assign(const Session &other)
+{
+  pthread_mutex_lock(&g_sessionMutex);
+  _storage = other._storage;
+  pthread_mutex_unlock(&g_sessionMutex);
 }
 
 std::map<std::string, WS::Time>::iterator Session::find(const std::string &id)
@@ -0,0 +1,249 @@
+#include "Slab.hpp"
+#include "ServerManager.hpp"
+#include <sys/mman.h>
+#include <new>
+#include <stdint.h>
+#include <sstream>
+
+static SlabPool* g_pools[SLAB_MAX_POOLS];
+static size_t g_poolCount = 0;
+static bool g_hugePages = false;
+static __thread SlabCache* t_caches[SLAB_MAX_POOLS];
+
+SlabPool g_contextSlab("connection", sizeof(struct Context));
+SlabPool g_requestSlab("request", sizeof(HTTPRequest));
+SlabPool g_responseSlab("response", sizeof(HTTPResponse));
+
+// bytes of memory aligned on bytes. (a huge page is only used for an aligned range)
+static void* mapAligned(size_t bytes)
+{
+  char* area = static_cast<char*>(mmap(NULL, bytes * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0));
+
+  if (area == MAP_FAILED)
+    return (MAP_FAILED);
+  const size_t head = (bytes - reinterpret_cast<uintptr_t>(area) % bytes) % bytes;
+  if (head > 0)
+    munmap(area, head);
+  munmap(area + head + bytes, bytes - head);
+  return (area + head);
+}
+
+// constructed before main() : no thread runs yet.
+SlabPool::SlabPool(const char* name, size_t objectSize) :
+  NAME(name),
+  OBJECT_SIZE((objectSize + SLAB_ALIGN - 1) & ~static_cast<size_t>(SLAB_ALIGN - 1)),
+  _id(g_poolCount),
+  _free(NULL),
+  _freeCount(0),
+  _slabs(0),
+  _slabBytes(0),
+  _caches(NULL),
+  _retiredAllocs(0),
+  _retiredFrees(0),
+  _objects(0),
+  _outHighWater(0)
+{
+  if (g_poolCount == SLAB_MAX_POOLS)
+    throw (std::runtime_error("too many slab pools\n"));
+  pthread_mutex_init(&_mutex, NULL);
+  g_pools[g_poolCount++] = this;
+}
+
+void* SlabPool::allocate(size_t size)
+{
+  if (size > OBJECT_SIZE) // derived class
+    return (::operator new(size));
+  SlabCache* cache = threadCache();
+  if (cache->head == NULL)
+    refill(cache);
+  void* object = cache->head;
+  cache->head = *static_cast<void**>(object);
+  cache->count--;
+  __atomic_store_n(&cache->allocs, cache->allocs + 1, __ATOMIC_RELAXED);
+  return (object);
+}
+
+// to the cache of the calling thread, whichever allocated it.
+void SlabPool::deallocate(void* object, size_t size)
+{
+  if (object == NULL)
+    return ;
+  if (size > OBJECT_SIZE)
+  {
+    ::operator delete(object);
+    return ;
+  }
+  SlabCache* cache = threadCache();
+  *static_cast<void**>(object) = cache->head;
+  cache->head = object;
+  cache->count++;
+  __atomic_store_n(&cache->frees, cache->frees + 1, __ATOMIC_RELAXED);
+  if (cache->count >= 2 * SLAB_CACHE_BATCH)
+    spill(cache, SLAB_CACHE_BATCH);
+}
+
+SlabCache* SlabPool::threadCache()
+{
+  SlabCache* cache = t_caches[_id];
+
+  if (cache != NULL)
+    return (cache);
+  cache = new SlabCache();
+  cache->head = NULL;
+  cache->count = 0;
+  cache->allocs = 0;
+  cache->frees = 0;
+  pthread_mutex_lock(&_mutex);
+  cache->next = _caches;
+  _caches = cache;
+  pthread_mutex_unlock(&_mutex);
+  t_caches[_id] = cache;
+  return (cache);
+}
+
+// an empty cache takes a batch from the pool, which carves a new slab when it has none.
+void SlabPool::refill(SlabCache* cache)
+{
+  pthread_mutex_lock(&_mutex);
+  if (_free == NULL)
+  {
+    try
+    {
+      carve();
+    }
+    catch (std::bad_alloc&)
+    {
+      pthread_mutex_unlock(&_mutex);
+      throw ;
+    }
+  }
+  for (size_t i = 0; i < SLAB_CACHE_BATCH && _free != NULL; ++i)
+  {
+    void* object = _free;
+    _free = *static_cast<void**>(object);
+    _freeCount--;
+    *static_cast<void**>(object) = cache->head;
+    cache->head = object;
+    cache->count++;
+  }
+  if (_objects - _freeCount > _outHighWater)
+    _outHighWater = _objects - _freeCount;
+  pthread_mutex_unlock(&_mutex);
+}
+
+// a full cache gives count objects back to the pool.
+void SlabPool::spill(SlabCache* cache, size_t count)
+{
+  pthread_mutex_lock(&_mutex);
+  for (size_t i = 0; i < count && cache->head != NULL; ++i)
+  {
+    void* object = cache->head;
+    cache->head = *static_cast<void**>(object);
+    cache->count--;
+    *static_cast<void**>(object) = _free;
+    _free = object;
+    _freeCount++;
+  }
+  pthread_mutex_unlock(&_mutex);
+}
+
+// with the mutex. slab_hugepages : a huge page (hugetlbfs), else one the kernel may merge. (THP)
+void SlabPool::carve()
+{
+  const size_t bytes = g_hugePages ? SLAB_HUGE_BYTES : SLAB_BYTES;
+  void* slab = MAP_FAILED;
+
+#if defined(MAP_HUGETLB)
+  if (g_hugePages)
+    slab = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON | MAP_HUGETLB, -1, 0);
+#endif
+  if (slab == MAP_FAILED)
+  {
+    slab = mapAligned(bytes);
+    if (slab == MAP_FAILED)
+      throw (std::bad_alloc());
+#if defined(MADV_HUGEPAGE)
+    if (g_hugePages)
+      madvise(slab, bytes, MADV_HUGEPAGE);
+#endif
+  }
+  char* object = static_cast<char*>(slab);
+  for (size_t i = 0; i < bytes / OBJECT_SIZE; ++i, object += OBJECT_SIZE)
+  {
+    *reinterpret_cast<void**>(object) = _free;
+    _free = object;
+    _freeCount++;
+    _objects++;
+  }
+  _slabs++;
+  _slabBytes += bytes;
+}
+
+// with the mutex. objects in use, by every thread.
+unsigned long SlabPool::countLive()
+{
+  unsigned long live = _retiredAllocs - _retiredFrees;
+
+  // one thread may free what another allocated : only the sum counts.
+  for (SlabCache* cache = _caches; cache != NULL; cache = cache->next)
+    live += __atomic_load_n(&cache->allocs, __ATOMIC_RELAXED) - __atomic_load_n(&cache->frees, __ATOMIC_RELAXED);
+  return (live);
+}
+
+void SlabPool::report()
+{
+  pthread_mutex_lock(&_mutex);
+  if (_slabs == 0)
+  {
+    pthread_mutex_unlock(&_mutex);
+    return ;
+  }
+  const unsigned long live = countLive();
+  std::stringstream ss;
+  ss << "slab\t\t" << NAME
+     << "\tlive " << live
+     << "\tcached " << (_objects - _freeCount - live)
+     << "\thigh-water " << _outHighWater
+     << "\tslabs " << _slabs
+     << " (" << (_slabBytes / 1024) << " KB, " << _objects << " objects of " << OBJECT_SIZE << " bytes)\n";
+  pthread_mutex_unlock(&_mutex);
+  printLog(ss.str(), PRINT_CYAN);
+}
+
+void SlabPool::useHugePages(bool on)
+{
+  g_hugePages = on;
+}
+
+void SlabPool::releaseThreadCaches()
+{
+  for (size_t i = 0; i < g_poolCount; ++i)
+  {
+    SlabPool& pool = *g_pools[i];
+    SlabCache* cache = t_caches[i];
+    if (cache == NULL)
+      continue;
+    pool.spill(cache, cache->count);
+    pthread_mutex_lock(&pool._mutex);
+    for (SlabCache** link = &pool._caches; *link != NULL; link = &(*link)->next)
+    {
+      if (*link == cache)
+      {
+        *link = cache->next;
+        break ;
+      }
+    }
+    pool._retiredAllocs += cache->allocs;
+    pool._retiredFrees += cache->frees;
+    pthread_mutex_unlock(&pool._mutex);
+    delete (cache);
+    t_caches[i] = NULL;
+  }
+}
+
+// pools which never carved a slab are not printed. (SLAB_ALLOCATOR (0) : none)
+void SlabPool::reportAll()
+{
+  for (size_t i = 0; i < g_poolCount; ++i)
+    g_pools[i]->report();
+}
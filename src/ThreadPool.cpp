@@ -1,23 +1,46 @@
 #include "ThreadPool.hpp"
 #include "ServerManager.hpp"
 
-static void* jobHandler(void *_threadPool)
+// take the connections the main thread accepted for this worker.
+static void takeHandoffs(ThreadPool::Worker& worker)
 {
-  ThreadPool& tp = *reinterpret_cast<ThreadPool*>(_threadPool);
-  FileDescriptor kq = kqueue();
-  // observe server kq
-  struct kevent event;
-  EV_SET(&event, tp._serverKQ, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, NULL);
-  if (kevent(kq, &event, 1, NULL, 0, NULL) < 0)
-    std::cout << "ERROR ON " << kq << '\n';
+  struct Handoff handoff;
 
+  while (worker.ring.pop(&handoff))
+    attachClient(handoff, worker.backend, NULL);
+}
+
+static void* jobHandler(void *_worker)
+{
+  ThreadPool::Worker& worker = *reinterpret_cast<ThreadPool::Worker*>(_worker);
+  ThreadPool& tp = *worker.pool;
+  EventBackend* backend = worker.backend;
+  const uintptr_t wakeFd = static_cast<uintptr_t>(worker.wakeFd[0]);
+  std::vector<struct Event> events(tp._eventBatchSize);
+  EventStat eventStat;
+  ConnectionTimers timers;
+
+  timers.bind(backend);
   while (true)
   {
-    // check Connection event
-    struct kevent* newEvent = NULL;
-
-    // 서버 시작. 새 이벤트(Req)가 발생할 때 까지 무한루프. (감지하는 kevent)
-    int newEventCount = kevent(kq, NULL, 0, &event, 1, NULL);
+    takeHandoffs(worker);
+    if (tp.isStop() && timers.drain(tp._stopDeadline))
+    {
+      SlabPool::releaseThreadCaches();
+      BufferPool::releaseThreadCache();
+      return (NULL);
+    }
+    // announce the wait, then look at the ring once more :
+    // a handoff pushed in between either is seen here or sends a wake up.
+    __atomic_store_n(&worker.idle, 1, __ATOMIC_SEQ_CST);
+    if (!worker.ring.empty())
+    {
+      __atomic_store_n(&worker.idle, 0, __ATOMIC_SEQ_CST);
+      continue;
+    }
+    // 서버 시작. 새 이벤트(Req)가 발생할 때 까지 무한루프. (감지하는 event backend)
+    int newEventCount = backend->wait(&events[0], static_cast<int>(events.size()), -1);
+    __atomic_store_n(&worker.idle, 0, __ATOMIC_SEQ_CST);
 
     if (newEventCount == -1)
     { // nothing happen
@@ -28,95 +51,116 @@ static void* jobHandler(void *_threadPool)
     { // time limit expired -> never happen
       continue;
     }
-    else if (event.ident == static_cast<uintptr_t>(tp._serverKQ))
+    eventStat.record(newEventCount, events.size());
+    eventStat.report("worker", tp._eventStatInterval);
+    for (int i = 0; i < newEventCount; ++i)
     {
-      pthread_mutex_lock(tp.getMutex());
-      if (!tp._eventQueue.empty())
+      // new connections (or stop) : the ring is read at the top of the loop
+      if (events[i].ident == wakeFd && events[i].udata == &worker)
       {
-        newEvent = tp._eventQueue.front();
-        tp._eventQueue.pop();
-        struct Context* context = reinterpret_cast<struct Context*>(newEvent->udata);
-        struct Context* newContext = new struct Context();
-        *newContext = *context;
-        newContext->threadKQ = kq;
-        pthread_mutex_unlock(tp.getMutex());
-        acceptHandler(newContext);
+        clearWakeUp(worker.wakeFd[0]);
         continue;
       }
-      else if (tp._eventQueue.empty() && tp.isStop())
+      if (events[i].udata == NULL) // connection closed by an earlier event of this batch
+        continue;
+      if (events[i].filter != EVENT_READ && events[i].filter != EVENT_WRITE && events[i].filter != EVENT_PROC)
+        continue;
+      try
       {
-        pthread_mutex_unlock(tp.getMutex());
-        return (NULL);
+        handleEvent(&events[i], &events[i + 1], newEventCount - i - 1);
       }
-      else
+      catch (std::exception& e)
       {
-        pthread_mutex_unlock(tp.getMutex());
-        continue;
+        printLog(e.what(), PRINT_RED);
       }
-      pthread_mutex_unlock(tp.getMutex());
-    }
-    else if (event.filter == EVFILT_READ || event.filter == EVFILT_WRITE || event.filter == EVFILT_PROC)
-    {
-      newEvent = &event;
-    }
-    else
-    {
-      continue;
-    }
-    try
-    {
-      handleEvent(newEvent);
-    }
-    catch (std::exception& e)
-    {
-      printLog(e.what(), PRINT_RED);
     }
+    timers.advance();
   }
 }
 
 ThreadPool::ThreadPool(size_t threadNumber):
   NUM_THREADS(threadNumber),
-  _stopAll(false)
+  _stopAll(false),
+  _stopDeadline(0),
+  _nextWorker(0),
+  _eventBatchSize(DEFAULT_EVENT_BATCH_SIZE),
+  _eventStatInterval(DEFAULT_EVENT_STAT_INTERVAL),
+  _handoffs(0),
+  _dropped(0)
 {
-  pthread_mutex_init(&_jobQueueMutex, NULL);
-  _workerThreads.reserve(NUM_THREADS);
+  _workers.reserve(NUM_THREADS);
 }
 
 ThreadPool::~ThreadPool()
 {
-  _stopAll = true;
-  if (!THREAD_MODE)
-    return ;
-  for (size_t i = 0; i < NUM_THREADS; ++i)
-  {
-    pthread_join(_workerThreads[i], NULL);
-  }
+  stop(time(NULL));
 }
 
-pthread_mutex_t* ThreadPool::getMutex()
+// main thread only. the workers close their connections as they finish, the others at deadline,
+// then return. blocks until every worker is joined.
+void ThreadPool::stop(time_t deadline)
 {
-  return (&_jobQueueMutex);
+  _stopDeadline = deadline;
+  __atomic_store_n(&_stopAll, true, __ATOMIC_SEQ_CST);
+  for (size_t i = 0; i < _workers.size(); ++i)
+    sendWakeUp(_workers[i]->wakeFd[1]);
+  for (size_t i = 0; i < _workers.size(); ++i)
+  {
+    pthread_join(_workers[i]->thread, NULL);
+    closeWakeFd(_workers[i]->wakeFd);
+    delete (_workers[i]->backend);
+    delete (_workers[i]);
+  }
+  _workers.clear();
 }
 
 bool ThreadPool::isStop() const
 {
-  return (_stopAll);
+  return (__atomic_load_n(&_stopAll, __ATOMIC_SEQ_CST));
 }
 
-void ThreadPool::attachNewEvent(struct kevent* event)
+// main thread only. round robin, skipping workers whose ring is full.
+// returns false when every ring is full. (the caller closes the connection)
+bool ThreadPool::handOff(const struct Handoff& handoff)
 {
-  pthread_mutex_lock(getMutex());
-  _eventQueue.push(event);
-  pthread_mutex_unlock(getMutex());
+  for (size_t tried = 0; tried < _workers.size(); ++tried)
+  {
+    Worker& worker = *_workers[_nextWorker];
+    _nextWorker = (_nextWorker + 1) % _workers.size();
+    if (!worker.ring.push(handoff))
+      continue;
+    _handoffs++;
+    // pairs with the idle store + ring check of the worker. (no wake up while it is busy)
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&worker.idle, 0, __ATOMIC_SEQ_CST) == 1)
+    {
+      worker.wakeups++;
+      sendWakeUp(worker.wakeFd[1]);
+    }
+    return (true);
+  }
+  _dropped++;
+  return (false);
 }
 
 void ThreadPool::createPool()
 {
   for (size_t i = 0; i < NUM_THREADS; ++i)
   {
-    pthread_t newThread;
+    Worker* worker = new Worker();
+    struct Event event;
 
-    pthread_create(&newThread, NULL, jobHandler, this);
-    _workerThreads.push_back(newThread);
+    worker->pool = this;
+    worker->id = i;
+    worker->idle = 0;
+    worker->wakeups = 0;
+    worker->backend = EventBackend::create(_backendName);
+    openWakeFd(worker->wakeFd);
+    setEvent(&event, worker->wakeFd[0], EVENT_READ, EVENT_ADD, 0, worker);
+    if (worker->backend->attach(event) < 0 || worker->backend->flush() < 0)
+      throw (std::runtime_error("Event attach wake up fd failed\n"));
+    _workers.push_back(worker);
+    if (pthread_create(&worker->thread, NULL, jobHandler, worker) != 0)
+      throw (std::runtime_error("Create worker thread failed\n"));
   }
 }
@@ -0,0 +1,147 @@
+#include "TimingWheel.hpp"
+#include <time.h>
+
+static long getMonotonicMs()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static void initHead(TimerNode* head)
+{
+  head->prev = head;
+  head->next = head;
+}
+
+static void removeNode(TimerNode* node)
+{
+  node->prev->next = node->next;
+  node->next->prev = node->prev;
+  node->prev = NULL;
+  node->next = NULL;
+}
+
+static void pushBack(TimerNode* head, TimerNode* node)
+{
+  node->prev = head->prev;
+  node->next = head;
+  head->prev->next = node;
+  head->prev = node;
+}
+
+// move every node of from to the (empty) list to.
+static void takeAll(TimerNode* from, TimerNode* to)
+{
+  initHead(to);
+  if (from->next == from)
+    return ;
+  to->next = from->next;
+  to->prev = from->prev;
+  to->next->prev = to;
+  to->prev->next = to;
+  initHead(from);
+}
+
+TimingWheel::TimingWheel(Handler handler) :
+  _current(0),
+  _startMs(getMonotonicMs()),
+  _count(0),
+  _handler(handler)
+{
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; ++level)
+  {
+    for (int slot = 0; slot < TIMER_WHEEL_SLOTS; ++slot)
+      initHead(&_slots[level][slot]);
+  }
+}
+
+unsigned long TimingWheel::getTick() const
+{
+  return (static_cast<unsigned long>(getMonotonicMs() - _startMs) / TIMER_TICK_MS);
+}
+
+bool TimingWheel::isScheduled(const TimerNode* node)
+{
+  return (node->next != NULL);
+}
+
+size_t TimingWheel::size() const
+{
+  return (_count);
+}
+
+// level i holds the timers due within 64^(i+1) ticks, slot = the level's digit of the expire tick.
+void TimingWheel::insert(TimerNode* node)
+{
+  unsigned long delta;
+  int level = 0;
+
+  if (node->expire <= _current)
+    node->expire = _current + 1;
+  delta = node->expire - _current;
+  while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1UL << (TIMER_WHEEL_BITS * (level + 1))))
+    level++;
+  if (level == TIMER_WHEEL_LEVELS - 1 && delta >= (1UL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)))
+    node->expire = _current + (1UL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+  const unsigned long slot = (node->expire >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+  pushBack(&_slots[level][slot], node);
+}
+
+void TimingWheel::schedule(TimerNode* node, int kind, long timeoutMs)
+{
+  if (isScheduled(node))
+    removeNode(node);
+  else
+    _count++;
+  node->kind = kind;
+  node->expire = getTick() + (timeoutMs + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+  insert(node);
+}
+
+void TimingWheel::cancel(TimerNode* node)
+{
+  if (!isScheduled(node))
+    return ;
+  removeNode(node);
+  _count--;
+}
+
+// spread the current slot of level over the levels below.
+void TimingWheel::cascade(int level)
+{
+  const unsigned long slot = (_current >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+  TimerNode list;
+
+  takeAll(&_slots[level][slot], &list);
+  while (list.next != &list)
+  {
+    TimerNode* node = list.next;
+    removeNode(node);
+    insert(node);
+  }
+  if (slot == 0 && level + 1 < TIMER_WHEEL_LEVELS)
+    cascade(level + 1);
+}
+
+void TimingWheel::advance()
+{
+  const unsigned long now = getTick();
+  TimerNode expired;
+
+  while (_current < now)
+  {
+    _current++;
+    if ((_current & (TIMER_WHEEL_SLOTS - 1)) == 0)
+      cascade(1);
+    takeAll(&_slots[0][_current & (TIMER_WHEEL_SLOTS - 1)], &expired);
+    while (expired.next != &expired)
+    {
+      TimerNode* node = expired.next;
+      removeNode(node);
+      _count--;
+      _handler(node);
+    }
+  }
+}
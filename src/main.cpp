@@ -12,7 +12,7 @@ int main(int argc, char *argv[])
   {
     try
     {
-      ServerManager sv(argv[1]);
+      ServerManager sv(argv[1], argv[0]);
       sv.run();
     }
     catch (std::exception& e)